@@ -0,0 +1,265 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/23
+ */
+#include <benchmark/benchmark.h>
+
+#include <et.hpp>
+#include <et/TemplateNode.hpp>
+#include <et/Template.hpp>
+#include <et/Escape.hpp>
+
+using namespace std;
+using namespace et;
+
+namespace
+{
+    /**
+     * @brief 构造合成模板
+     * @param units 重复单元的数量
+     *
+     * 每个单元包含文本、表达式、条件、循环等全部节点类型，并带有控制节点独占一行的情况以触发Prettify。
+     */
+    string MakeSyntheticTemplate(size_t units)
+    {
+        static const char kUnit[] =
+            "<div class=\"item\">\n"
+            "  {% if i %% 2 == 0 %}\n"
+            "  <span>{% i %}</span>\n"
+            "  {% elseif i %% 3 == 0 %}\n"
+            "  <b>{% tostring(i) .. '!' %}</b>\n"
+            "  {% else %}\n"
+            "  <i>{% name %}</i>\n"
+            "  {% end %}\n"
+            "  <ul>\n"
+            "  {% for _, v in ipairs(list) %}\n"
+            "    <li>{% v %}</li>\n"
+            "  {% end %}\n"
+            "  </ul>\n"
+            "  {% n = 0 %}\n"
+            "  {% while n < 3 %}{% n %}{% n = n + 1 %}{% end %}\n"
+            "</div>\n";
+
+        string ret;
+        ret.reserve((sizeof(kUnit) - 1) * units + 64);
+        for (size_t i = 0; i < units; ++i)
+        {
+            ret.append("{% i = ");
+            ret.append(to_string(i));
+            ret.append(" %}");
+            ret.append(kUnit);
+        }
+        return ret;
+    }
+
+    /**
+     * @brief 准备一个带有渲染环境的虚拟机
+     */
+    lua_State* NewBenchState()
+    {
+        lua_State* L = luaL_newstate();
+        luaL_openlibs(L);
+        RegisterLibrary(L);
+
+        luaL_dostring(L, "name = 'et' list = { 1, 2, 3, 4, 5 }");
+        return L;
+    }
+
+    unique_ptr<TemplateBlockNode> ParseAndBuild(const string& source, bool prettify=true)
+    {
+        TextReader reader(source.c_str(), source.length(), "bench");
+        TemplateParser parser;
+        parser.SetPrettifyEnable(prettify);
+        parser.Run(reader);
+        return BuildRootNode(parser);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////// TemplateParser
+
+static void BM_TemplateParserRun(benchmark::State& state)
+{
+    string source = MakeSyntheticTemplate(static_cast<size_t>(state.range(0)));
+    bool prettify = state.range(1) != 0;
+
+    for (auto _ : state)
+    {
+        TextReader reader(source.c_str(), source.length(), "bench");
+        TemplateParser parser;
+        parser.SetPrettifyEnable(prettify);
+        parser.Run(reader);
+        benchmark::DoNotOptimize(parser.GetTokenCount());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * source.length()));
+}
+// Prettify是Run的最后一步且未单独暴露，以开关前后的差值衡量其开销
+BENCHMARK(BM_TemplateParserRun)->ArgNames({ "units", "prettify" })->Ranges({ { 1, 1024 }, { 0, 1 } });
+
+//////////////////////////////////////////////////////////////////////////////// BuildRootNode
+
+static void BM_BuildRootNode(benchmark::State& state)
+{
+    string source = MakeSyntheticTemplate(static_cast<size_t>(state.range(0)));
+
+    // BuildRootNode会移走Token中的内容，因此每轮都需要重新解析
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        TextReader reader(source.c_str(), source.length(), "bench");
+        TemplateParser parser;
+        parser.Run(reader);
+        state.ResumeTiming();
+
+        auto root = BuildRootNode(parser);
+        benchmark::DoNotOptimize(root.get());
+
+        state.PauseTiming();
+        root.reset();
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_BuildRootNode)->ArgName("units")->Range(1, 1024);
+
+//////////////////////////////////////////////////////////////////////////////// TemplateNode::Render
+
+static void BenchRenderNode(benchmark::State& state, const char* source)
+{
+    lua_State* L = NewBenchState();
+    auto root = ParseAndBuild(source);
+
+    string out;
+    for (auto _ : state)
+    {
+        out.clear();
+        root->Render(out, L, 0);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * out.length()));
+
+    lua_close(L);
+}
+BENCHMARK_CAPTURE(BenchRenderNode, Text, "<div class=\"item\"><span>hello world</span></div>");
+BENCHMARK_CAPTURE(BenchRenderNode, Expression, "{% name %}");
+BENCHMARK_CAPTURE(BenchRenderNode, If, "{% if name %}yes{% end %}");
+BENCHMARK_CAPTURE(BenchRenderNode, IfElse, "{% if not name %}yes{% else %}no{% end %}");
+BENCHMARK_CAPTURE(BenchRenderNode, While, "{% n = 0 %}{% while n < 10 %}{% n = n + 1 %}{% end %}");
+BENCHMARK_CAPTURE(BenchRenderNode, For, "{% for _, v in ipairs(list) %}{% v %}{% end %}");
+BENCHMARK_CAPTURE(BenchRenderNode, ForRange, "{% for i in et.range(1, 100) %}x{% end %}");
+
+static void BM_RenderSynthetic(benchmark::State& state)
+{
+    lua_State* L = NewBenchState();
+    auto root = ParseAndBuild(MakeSyntheticTemplate(static_cast<size_t>(state.range(0))));
+
+    string out;
+    for (auto _ : state)
+    {
+        out.clear();
+        root->Render(out, L, 0);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * out.length()));
+
+    lua_close(L);
+}
+BENCHMARK(BM_RenderSynthetic)->ArgName("units")->Range(1, 256);
+
+static void BM_TryRenderSynthetic(benchmark::State& state)
+{
+    lua_State* L = NewBenchState();
+    auto source = MakeSyntheticTemplate(static_cast<size_t>(state.range(0)));
+    Template tpl(source.c_str(), source.length(), "bench");
+
+    string out;
+    RenderError error;
+    for (auto _ : state)
+    {
+        if (tpl.TryRender(out, L, 0, error) != RenderErrorCodes::Ok)
+        {
+            state.SkipWithError(error.Message.c_str());
+            break;
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * out.length()));
+
+    tpl.ReleaseCompiled(L);
+    lua_close(L);
+}
+BENCHMARK(BM_TryRenderSynthetic)->ArgName("units")->Range(1, 256);
+
+//////////////////////////////////////////////////////////////////////////////// Escape
+
+/**
+ * @brief 测量转义吞吐
+ * @param density 每多少个字节出现一个需要转义的字符，0表示不出现
+ */
+static void BM_AppendEscaped(benchmark::State& state)
+{
+    auto density = static_cast<size_t>(state.range(0));
+
+    string input(64 * 1024, 'x');
+    if (density != 0)
+    {
+        for (size_t i = density - 1; i < input.length(); i += density)
+            input[i] = '<';
+    }
+
+    string out;
+    for (auto _ : state)
+    {
+        out.clear();
+        AppendEscaped(out, input.c_str(), input.length(), EscapeModes::Html);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.length()));
+}
+BENCHMARK(BM_AppendEscaped)->ArgName("density")->Arg(0)->Arg(64)->Arg(8);
+
+//////////////////////////////////////////////////////////////////////////////// Exported functions
+
+/**
+ * @brief 测量导出函数的调用开销
+ * @param setup 在全局环境中准备参数的代码
+ * @param call 被测量的调用，以函数形式给出
+ */
+static void BenchExport(benchmark::State& state, const char* setup, const char* call)
+{
+    lua_State* L = NewBenchState();
+    if (luaL_dostring(L, setup) != LUA_OK || luaL_loadstring(L, call) != LUA_OK || lua_pcall(L, 0, 1, 0) != LUA_OK)
+    {
+        state.SkipWithError(lua_tostring(L, -1));
+        lua_close(L);
+        return;
+    }
+
+    int func = lua_gettop(L);
+    for (auto _ : state)
+    {
+        lua_pushvalue(L, func);
+        if (lua_pcall(L, 0, 0, 0) != LUA_OK)
+        {
+            state.SkipWithError(lua_tostring(L, -1));
+            break;
+        }
+    }
+
+    lua_close(L);
+}
+BENCHMARK_CAPTURE(BenchExport, DumpStringShort, "s = 'hello\\nworld'",
+    "return function() et.dump_string(s) end");
+BENCHMARK_CAPTURE(BenchExport, DumpStringLong, "s = string.rep('hello\\tworld\\n', 1024)",
+    "return function() et.dump_string(s) end");
+BENCHMARK_CAPTURE(BenchExport, DumpValueArray, "v = {} for i = 1, 256 do v[i] = i end",
+    "return function() et.dump_value(v) end");
+BENCHMARK_CAPTURE(BenchExport, DumpValueTable, "v = { a = 1, b = 'x', c = { d = true, e = { 1, 2, 3 } } }",
+    "return function() et.dump_value(v) end");
+BENCHMARK_CAPTURE(BenchExport, Range, "",
+    "return function() for _ in et.range(1, 1000) do end end");
+BENCHMARK_CAPTURE(BenchExport, IsArraySmall, "v = { 1, 2, 3, 4 }",
+    "return function() et.is_array(v) end");
+BENCHMARK_CAPTURE(BenchExport, IsArrayLarge, "v = {} for i = 1, 4096 do v[i] = i end",
+    "return function() et.is_array(v) end");
+
+BENCHMARK_MAIN();
@@ -5,14 +5,206 @@
  */
 #include <et.hpp>
 #include <et/Base.hpp>
+#include <et/RenderProfiler.hpp>
+#include <et/Template.hpp>
+#include <et/TemplateCache.hpp>
+#include <et/TemplateAnalyzer.hpp>
+#include <et/TemplatePack.hpp>
 
+#include <cstdio>
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
-#include <iterator>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 
 using namespace std;
 
+// 输出先写入同一目录下的临时文件，渲染成功后再替换目标文件，失败时不会留下不完整的输出
+static string GetTempOutputPath(const char* path)
+{
+#ifdef _WIN32
+    return et::Format("%s.%d.tmp", path, ::_getpid());
+#else
+    return et::Format("%s.%d.tmp", path, static_cast<int>(::getpid()));
+#endif
+}
+
+// 目标已存在但不是普通文件（管道、设备、符号链接等）时不能被替换，只能直接写入
+static bool IsReplaceableOutput(const char* path)
+{
+#ifdef _WIN32
+    struct _stat st;
+    if (::_stat(path, &st) != 0)
+        return errno == ENOENT;
+    return (st.st_mode & _S_IFMT) == _S_IFREG;
+#else
+    struct stat st;
+    if (::lstat(path, &st) != 0)
+        return errno == ENOENT;
+    return S_ISREG(st.st_mode);
+#endif
+}
+
+static int OpenOutputFile(const char* path)
+{
+#ifdef _WIN32
+    return ::_open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+}
+
+static int OpenTempOutputFile(const char* tempPath, const char* path)
+{
+    int fd = OpenOutputFile(tempPath);
+#ifndef _WIN32
+    // 替换后保留目标文件的所有者和权限，没有权限修改所有者时忽略
+    struct stat st;
+    if (fd >= 0 && ::stat(path, &st) == 0)
+    {
+        ET_UNUSED(::fchown(fd, st.st_uid, st.st_gid));
+        ET_UNUSED(::fchmod(fd, st.st_mode & 07777));
+    }
+#else
+    ET_UNUSED(path);
+#endif
+    return fd;
+}
+
+static void CloseOutputFile(int fd)
+{
+#ifdef _WIN32
+    ::_close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+static bool CommitOutputFile(const char* tempPath, const char* path)
+{
+#ifdef _WIN32
+    // rename不能覆盖已有的文件，MoveFileEx可以在替换失败时保留原文件
+    if (::MoveFileExA(tempPath, path, MOVEFILE_REPLACE_EXISTING))
+        return true;
+#else
+    if (::rename(tempPath, path) == 0)
+        return true;
+#endif
+    ::remove(tempPath);
+    return false;
+}
+
+static int BuildPack(lua_State* L, const char* dir, const char* output)
+{
+    try
+    {
+        vector<string> names;
+        et::ListFiles(names, dir);
+
+        // extends/include按照相对于目录的名称查找
+        string root(dir);
+        if (!root.empty() && root.back() != '/' && root.back() != '\\')
+            root.push_back('/');
+        et::TemplateCache::GetInstance().SetSearchPaths({ root });
+
+        et::TemplatePackBuilder builder(L);
+        for (const auto& name : names)
+        {
+            et::MappedFile input((root + name).c_str());
+            builder.Add(name, input.GetData(), input.GetSize());
+        }
+
+        string pack;
+        builder.Save(pack);
+
+        fstream f(output, ios::out | ios::binary);
+        if (!f || !f.write(pack.data(), pack.size()))
+        {
+            cerr << "Write output file \"" << output << "\" error" << endl;
+            return -3;
+        }
+        cerr << "Packed " << builder.GetCount() << " templates, " << pack.size() << " bytes" << endl;
+    }
+    catch (const std::exception& ex)
+    {
+        cerr << ex.what() << endl;
+        return -4;
+    }
+    return 0;
+}
+
+static int PrintDependencies(lua_State* L, const et::Template& tpl)
+{
+    try
+    {
+        et::TemplateAnalyzer analyzer(L);
+        analyzer.Analyze(tpl.GetRoot());
+
+        for (const auto& name : analyzer.GetDependencies())
+            cout << name << endl;
+        if (analyzer.HasDynamicInclude())
+            cerr << "Warning: templates included by dynamic names are not analyzed" << endl;
+    }
+    catch (const std::exception& ex)
+    {
+        cerr << ex.what() << endl;
+        return -4;
+    }
+    return 0;
+}
+
+static int CheckTemplates(const vector<const char*>& inputs)
+{
+    try
+    {
+        // 目录展开为其下的所有文件
+        vector<string> paths;
+        for (auto input : inputs)
+        {
+            vector<string> names;
+            try
+            {
+                et::ListFiles(names, input);
+            }
+            catch (const et::IOException&)
+            {
+                paths.emplace_back(input);
+                continue;
+            }
+
+            string root(input);
+            if (!root.empty() && root.back() != '/' && root.back() != '\\')
+                root.push_back('/');
+            for (const auto& name : names)
+                paths.emplace_back(root + name);
+        }
+
+        et::CheckStatistics stats;
+        et::CheckTemplateFiles(stats, paths);
+
+        for (const auto& error : stats.Errors)
+            cerr << error << endl;
+        cerr << "Checked " << stats.Count << " templates, " << stats.Errors.size() << " failed, " <<
+            stats.CheckTime / 1000000 << " ms" << endl;
+        return stats.Errors.empty() ? 0 : -4;
+    }
+    catch (const std::exception& ex)
+    {
+        cerr << ex.what() << endl;
+        return -4;
+    }
+}
+
 int main(int argc, const char* argv[])
 {
     lua_State* L = nullptr;
@@ -21,6 +213,12 @@ int main(int argc, const char* argv[])
     int paramIndex = INT_MAX;
     const char* path = nullptr;
     const char* output = nullptr;
+    bool profile = false;
+    const char* foldedOutput = nullptr;
+    const char* packOutput = nullptr;
+    bool deps = false;
+    bool check = false;
+    vector<const char*> checkInputs;
 
     for (int i = 1, state = 0; i < argc; ++i)
     {
@@ -31,6 +229,39 @@ int main(int argc, const char* argv[])
             paramIndex = i + 1;
             break;
         }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            profile = true;
+            continue;
+        }
+        else if (strcmp(argv[i], "--deps") == 0)
+        {
+            deps = true;
+            continue;
+        }
+        else if (strcmp(argv[i], "--check") == 0)
+        {
+            // 其后直到下一个以'-'开头的参数（选项或"--"）都是被检查的文件或目录
+            check = true;
+            while (i + 1 < argc && argv[i + 1][0] != '-')
+                checkInputs.push_back(argv[++i]);
+            continue;
+        }
+        else if (strcmp(argv[i], "--pack") == 0)
+        {
+            if (++i >= argc)
+                goto ShowUsage;
+            packOutput = argv[i];
+            continue;
+        }
+        else if (strcmp(argv[i], "--profile-folded") == 0)
+        {
+            if (++i >= argc)
+                goto ShowUsage;
+            profile = true;
+            foldedOutput = argv[i];
+            continue;
+        }
 
         switch (state)
         {
@@ -56,6 +287,13 @@ int main(int argc, const char* argv[])
         }
     }
 
+    if (packOutput && (path == nullptr || output != nullptr))
+        goto ShowUsage;
+    if (deps && (packOutput || profile || output != nullptr))
+        goto ShowUsage;
+    if (check && (checkInputs.empty() || deps || packOutput || profile || path != nullptr))
+        goto ShowUsage;
+
     L = luaL_newstate();
     if (!L)
     {
@@ -82,37 +320,107 @@ int main(int argc, const char* argv[])
         }
     }
 
+    if (packOutput)
+    {
+        int ret = BuildPack(L, path, packOutput);
+        lua_close(L);
+        return ret;
+    }
+
+    if (check)
+    {
+        int ret = CheckTemplates(checkInputs);
+        lua_close(L);
+        return ret;
+    }
+
     try
     {
-        string builder;
+        et::RenderProfiler profiler;
+        et::RenderOptions options;
+        if (profile)
+            options.Profiler = &profiler;
 
-        // if no input file, read from stdin
+        // if no input file, read from stdin (mapped when redirected from a regular file)
+        shared_ptr<et::Template> tpl;
         if (path == nullptr)
         {
-            cin >> std::noskipws;
-
-            istream_iterator<char> it(cin);
-            istream_iterator<char> end;
-            string input(it, end);
-
-            builder.reserve(input.length());
-            et::RenderString(builder, L, input.c_str(), "stdin");
+            et::MappedFile input(fileno(stdin), "stdin");
+            tpl = make_shared<et::Template>(input.GetData(), input.GetSize(), "stdin");
         }
         else
-            et::RenderFile(builder, L, path);
+            tpl = et::LoadTemplateFile(path);
 
-        // write to file or stdout
-        if (output == nullptr)
-            cout << builder;
-        else
+        if (deps)
+            return PrintDependencies(L, *tpl);
+
+        // write to file or stdout, literal text is written by reference through writev
+        int fd = fileno(stdout);
+        string tempOutput;
+        if (output != nullptr)
         {
-            fstream f(output, ios::out);
-            if (!f)
+            fd = -1;
+            if (IsReplaceableOutput(output))
+            {
+                tempOutput = GetTempOutputPath(output);
+                fd = OpenTempOutputFile(tempOutput.c_str(), output);
+                if (fd < 0)
+                    tempOutput.clear();  // 例如目录不可写，退回到直接写入
+            }
+            if (fd < 0)
+                fd = OpenOutputFile(output);
+            if (fd < 0)
             {
                 cerr << "Open output file \"" << output << "\" error" << endl;
                 return -3;
             }
-            f << builder;
+        }
+
+        try
+        {
+            et::VectoredWriter writer(fd);
+            tpl->Render(writer, L, 0, &options);
+        }
+        catch (...)
+        {
+            if (output != nullptr)
+            {
+                CloseOutputFile(fd);
+                if (!tempOutput.empty())
+                    ::remove(tempOutput.c_str());
+            }
+            throw;
+        }
+        if (output != nullptr)
+        {
+            CloseOutputFile(fd);
+            if (!tempOutput.empty() && !CommitOutputFile(tempOutput.c_str(), output))
+            {
+                cerr << "Write output file \"" << output << "\" error" << endl;
+                return -3;
+            }
+        }
+
+        // print profile result
+        if (profile)
+        {
+            string report;
+            profiler.DumpReport(report);
+            cerr << report;
+
+            if (foldedOutput)
+            {
+                report.clear();
+                profiler.DumpFoldedStacks(report);
+
+                fstream f(foldedOutput, ios::out);
+                if (!f)
+                {
+                    cerr << "Open output file \"" << foldedOutput << "\" error" << endl;
+                    return -3;
+                }
+                f << report;
+            }
         }
     }
     catch (const std::exception& ex)
@@ -125,8 +433,20 @@ int main(int argc, const char* argv[])
 ShowUsage:
     cerr << "A simple text template renderer." << endl;
     cerr << "Usage: " << et::GetFileName(argv[0]) << " [<input> [<output>]] [-- <expr...>]" << endl;
+    cerr << "       " << et::GetFileName(argv[0]) << " --deps [<input>] [-- <expr...>]" << endl;
+    cerr << "       " << et::GetFileName(argv[0]) << " --pack <output> <dir> [-- <expr...>]" << endl;
+    cerr << "       " << et::GetFileName(argv[0]) << " --check <input...> [-- <expr...>]" << endl;
     cerr << "Options:" << endl;
     cerr << "  --stdin, -i     Input from stdin" << endl;
+    cerr << "  --profile       Print per-node render profile to stderr" << endl;
+    cerr << "  --profile-folded <file>" << endl;
+    cerr << "                  Also write folded stacks for flamegraph tools" << endl;
+    cerr << "  --pack <output> Compile all templates under <dir> into a template pack" << endl;
+    cerr << "  --deps          Print global names read by the template instead of rendering" << endl;
+    cerr << "  --check <input...>" << endl;
+    cerr << "                  Parse and compile templates (files or directories) in parallel without" << endl;
+    cerr << "                  executing them, print errors and exit with nonzero status on failure;" << endl;
+    cerr << "                  inputs end at the next argument starting with '-'" << endl;
     cerr << "  --help, -h      Show this help" << endl;
     return -1;
 }
@@ -6,7 +6,7 @@
 #pragma once
 #include <string>
 
-#include <lua.hpp>
+#include "et/RenderContext.hpp"
 
 namespace et
 {
@@ -17,8 +17,10 @@ namespace et
      * @param input 输入串
      * @param sourceName 源名称
      * @param env 环境Index
+     * @param options 渲染选项，当超出限制时抛出RenderException
      */
-    void RenderString(std::string& out, lua_State* L, const char* input, const char* sourceName="Unknown", int env=0);
+    void RenderString(std::string& out, lua_State* L, const char* input, const char* sourceName="Unknown", int env=0,
+        const RenderOptions* options=nullptr);
 
     /**
      * @brief 从文件渲染
@@ -26,9 +28,29 @@ namespace et
      * @param L 虚拟机环境
      * @param path 输入文件路径
      * @param env 环境Index
-     * @return 渲染结果
+     * @param options 渲染选项，当超出限制时抛出RenderException
      */
-    void RenderFile(std::string& out, lua_State* L, const char* path, int env=0);
+    void RenderFile(std::string& out, lua_State* L, const char* path, int env=0, const RenderOptions* options=nullptr);
+
+    /**
+     * @brief 将模板文本编译为Lua函数
+     * @param L 虚拟机环境
+     * @param input 输入串
+     * @param sourceName 源名称
+     *
+     * 成功后在栈顶压入编译产物，原型为function([env: table]) -> string。
+     * 编译产物中不存在C调用边界，可以在协程中执行，表达式允许yield。
+     */
+    void CompileString(lua_State* L, const char* input, const char* sourceName="Unknown");
+
+    /**
+     * @brief 将模板文件编译为Lua函数
+     * @param L 虚拟机环境
+     * @param path 输入文件路径
+     *
+     * 参见CompileString。
+     */
+    void CompileFile(lua_State* L, const char* path);
 
     /**
      * @brief 向Lua注册库
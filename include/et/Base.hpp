@@ -28,6 +28,14 @@
 #define ET_THROW(exception, format, ...) \
     throw exception(__FILE__, __LINE__, __FUNCTION__, format, ##__VA_ARGS__)
 
+/**
+ * @brief 抛出带有源位置的异常
+ *
+ * 位置和信息分别保存，直到调用what()时才拼接为"源:行:列: 信息"的形式，列号为0时省略。
+ */
+#define ET_THROW_AT(exception, source, line, column, message) \
+    throw exception(__FILE__, __LINE__, __FUNCTION__, et::SourceLocation((source), (line), (column)), (message))
+
 #define ET_DEFINE_EXCEPTION(name) \
     class name : \
         public et::Exception \
@@ -36,6 +44,11 @@
         template <typename... Args> \
         name(const char* file, int line, const char* func, const char* format, Args... args) \
             : Exception(file, line, func, format, args...) {} \
+        name(const char* file, int line, const char* func, const et::SourceLocation& location, \
+            std::string message) \
+            : Exception(file, line, func, location, std::move(message)) {} \
+    public: \
+        const char* GetKind()const noexcept override { return #name; } \
     }
 
 #define ET_UNUSED(x) static_cast<void>(x)
@@ -98,15 +111,106 @@ namespace et
      */
     void ReadFile(std::string& out, const char* path);
 
+    /**
+     * @brief 列出目录下的文件
+     * @exception IOException 无法打开目录时抛出
+     * @param[out] out 输出，为相对于dir的路径，以'/'分隔并按字典序排列
+     * @param dir 目录
+     *
+     * 递归进入子目录，跳过以'.'开头的文件和目录。
+     */
+    void ListFiles(std::vector<std::string>& out, const char* dir);
+
+    /**
+     * @brief 文件映射
+     *
+     * 以只读方式将整个文件映射到内存，可以直接从映射中解析而不需要复制到字符串。
+     * 对于管道、终端等无法映射的文件，以及不支持mmap的平台，退化为以大块read()读入内部缓冲区。
+     * 数据不以'\0'结尾。
+     */
+    class MappedFile
+    {
+    public:
+        /**
+         * @brief 回退时每次读取的块大小
+         */
+        static const size_t kReadBlockSize = 64 * 1024;
+
+    public:
+        /**
+         * @brief 映射文件
+         * @exception IOException 打开或读取失败时抛出
+         * @param path 文件路径
+         */
+        explicit MappedFile(const char* path);
+
+        /**
+         * @brief 映射已经打开的文件描述符（例如标准输入）
+         * @exception IOException 读取失败时抛出
+         * @param fd 文件描述符，不会被关闭
+         * @param name 用于错误信息的名称
+         */
+        MappedFile(int fd, const char* name);
+
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+    public:
+        /**
+         * @brief 获取数据
+         */
+        const char* GetData()const noexcept { return m_pMapped ? m_pMapped : m_stBuffer.data(); }
+
+        /**
+         * @brief 获取数据长度
+         */
+        size_t GetSize()const noexcept { return m_pMapped ? m_ullMappedSize : m_stBuffer.size(); }
+
+        /**
+         * @brief 是否通过mmap映射
+         */
+        bool IsMapped()const noexcept { return m_pMapped != nullptr; }
+
+    private:
+        void Load(int fd, const char* name);
+
+    private:
+        const char* m_pMapped = nullptr;
+        size_t m_ullMappedSize = 0;
+        std::string m_stBuffer;
+    };
+
+    /**
+     * @brief 源位置
+     */
+    struct SourceLocation
+    {
+        const char* Source = nullptr;
+        uint32_t Line = 0;
+        uint32_t Column = 0;  // 0表示未知
+
+        SourceLocation(const char* source, uint32_t line, uint32_t column=0)noexcept
+            : Source(source), Line(line), Column(column) {}
+    };
+
     /**
      * @brief 异常基类
+     *
+     * 除了抛出处的代码位置外，异常可以携带出错的源位置（参见ET_THROW_AT）。此时构造异常只保存源名称和信息，
+     * 完整的描述在首次调用what()时才拼接，大量构造而很少读取描述的场景（例如批量校验模板）不必承担格式化的开销。
+     * 异常的拷贝共享同一份数据。
      */
     class Exception :
         public std::exception
     {
+        struct Detail;
+
     public:
         Exception()noexcept = default;
         Exception(const char* file, int line, const char* func, const char* format, ...) ET_C_FORMAT_DECL(5, 6);
+        Exception(const char* file, int line, const char* func, const SourceLocation& location, std::string message);
         Exception(const Exception& rhs)noexcept;
         Exception(Exception&& rhs)noexcept;
 
@@ -119,6 +223,34 @@ namespace et
         const char* GetFunc()const noexcept { return m_pszFunc; }
         const char* GetDescription()const noexcept;
 
+        /**
+         * @brief 获取异常的类别，即异常的类名
+         */
+        virtual const char* GetKind()const noexcept { return "Exception"; }
+
+        /**
+         * @brief 获取出错的源名称
+         * @return 没有源位置时返回空串
+         */
+        const char* GetSource()const noexcept;
+
+        /**
+         * @brief 获取出错的源行号
+         * @return 没有源位置时返回0
+         */
+        uint32_t GetSourceLine()const noexcept;
+
+        /**
+         * @brief 获取出错的源列号
+         * @return 没有源位置或者列号未知时返回0
+         */
+        uint32_t GetSourceColumn()const noexcept;
+
+        /**
+         * @brief 获取不含源位置的错误信息
+         */
+        const char* GetErrorMessage()const noexcept;
+
     public:  // for std::exception
         const char* what()const noexcept override;
 
@@ -126,7 +258,7 @@ namespace et
         const char* m_pszFile = nullptr;
         int m_iLine = 0;
         const char* m_pszFunc = nullptr;
-        std::shared_ptr<std::string> m_pDescription;
+        std::shared_ptr<Detail> m_pDetail;
     };
 
     ET_DEFINE_EXCEPTION(InvalidCallException);
@@ -0,0 +1,62 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/27
+ */
+#pragma once
+#include "Base.hpp"
+
+namespace et
+{
+    /**
+     * @brief 转义模式
+     */
+    enum class EscapeModes
+    {
+        None,  // 原样输出
+        Html,  // & < > " '，其中'转义为&#39;
+        Xml,  // & < > " '，其中'转义为&apos;
+        Json,  // JSON字符串内容，转义" \和控制字符，不含两侧的引号
+        Sql,  // SQL字符串字面量内容，'转义为''，不含两侧的引号
+    };
+
+    /**
+     * @brief 解析转义模式名称
+     * @param name 名称，即"none"、"html"、"xml"、"json"、"sql"之一
+     * @param[out] mode 转义模式
+     * @return 是否成功
+     */
+    bool ParseEscapeMode(const char* name, EscapeModes& mode)noexcept;
+
+    /**
+     * @brief 获取转义模式名称
+     */
+    const char* GetEscapeModeName(EscapeModes mode)noexcept;
+
+    /**
+     * @brief 转义并追加到输出
+     * @param[out] out 输出
+     * @param data 数据
+     * @param length 长度
+     * @param mode 转义模式
+     *
+     * 以SIMD（SSE2）每次扫描16个字节寻找需要转义的字符，之间不需要转义的部分整段复制。
+     * 不足16字节的剩余部分以及不支持SSE2的平台上按字节查256项的表扫描。
+     */
+    void AppendEscaped(std::string& out, const char* data, size_t length, EscapeModes mode);
+
+    /**
+     * @brief 获取默认转义模式
+     *
+     * 没有通过autoescape语句声明转义模式的模板使用默认转义模式，默认为EscapeModes::None。
+     */
+    EscapeModes GetDefaultEscapeMode()noexcept;
+
+    /**
+     * @brief 设置默认转义模式
+     * @param mode 转义模式
+     *
+     * 转义模式在构建语法树时确定，只影响此后解析的模板，已经缓存的模板需要清空缓存后才会生效。
+     */
+    void SetDefaultEscapeMode(EscapeModes mode)noexcept;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/26
+ */
+#pragma once
+#include "Base.hpp"
+
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+
+namespace et
+{
+    /**
+     * @brief 片段缓存
+     *
+     * 保存cache语句块的渲染结果，以求值得到的键为索引，键在所有模板之间共享。
+     * 缓存按照最近最少使用的顺序淘汰，总大小（键与内容的字节数之和）不超过容量，单条记录可以设置过期时间。
+     * 所有方法都是线程安全的。
+     */
+    class FragmentCache
+    {
+    public:
+        /**
+         * @brief 默认容量（字节）
+         */
+        static const size_t kDefaultCapacity = 16 * 1024 * 1024;
+
+        /**
+         * @brief 获取全局实例
+         */
+        static FragmentCache& GetInstance()noexcept;
+
+    public:
+        FragmentCache(size_t capacity=kDefaultCapacity);
+
+        FragmentCache(const FragmentCache&) = delete;
+        FragmentCache& operator=(const FragmentCache&) = delete;
+
+    public:
+        /**
+         * @brief 获取容量
+         */
+        size_t GetCapacity()const;
+
+        /**
+         * @brief 设置容量
+         * @param capacity 容量（字节），0表示禁用缓存
+         *
+         * 超出新容量的记录会被立即淘汰。
+         */
+        void SetCapacity(size_t capacity);
+
+        /**
+         * @brief 获取已经使用的大小（字节）
+         */
+        size_t GetSize()const;
+
+        /**
+         * @brief 获取记录数量
+         */
+        size_t GetCount()const;
+
+        /**
+         * @brief 获取命中次数
+         */
+        uint64_t GetHitCount()const;
+
+        /**
+         * @brief 获取未命中次数
+         */
+        uint64_t GetMissCount()const;
+
+        /**
+         * @brief 查找记录
+         * @param key 键
+         * @return 内容，若不存在或已过期返回nullptr
+         */
+        std::shared_ptr<const std::string> Get(const std::string& key);
+
+        /**
+         * @brief 放入记录
+         * @param key 键
+         * @param value 内容
+         * @param ttl 有效时间（毫秒），0表示不过期
+         *
+         * 若记录大小超过容量则不会被放入。
+         */
+        void Put(const std::string& key, std::string value, uint32_t ttl=0);
+
+        /**
+         * @brief 清空缓存
+         */
+        void Clear();
+
+    private:
+        struct Entry
+        {
+            std::string Key;
+            std::shared_ptr<const std::string> Value;
+            bool HasDeadline = false;
+            std::chrono::steady_clock::time_point Deadline;
+        };
+
+        using EntryList = std::list<Entry>;
+
+        void Remove(EntryList::iterator it)noexcept;
+        void Shrink(size_t capacity)noexcept;
+
+    private:
+        mutable std::mutex m_stLock;
+        size_t m_ullCapacity = 0;
+        size_t m_ullSize = 0;
+        uint64_t m_ullHitCount = 0;
+        uint64_t m_ullMissCount = 0;
+
+        EntryList m_stEntries;  // 表头为最近使用的记录
+        std::unordered_map<std::string, EntryList::iterator> m_stIndex;
+    };
+}
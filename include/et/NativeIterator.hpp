@@ -0,0 +1,40 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/29
+ */
+#pragma once
+#include "Base.hpp"
+
+#include <lua.hpp>
+
+namespace et
+{
+    /**
+     * @brief 可以被原生执行的迭代器类型
+     */
+    enum class NativeIteratorTypes
+    {
+        None,  // 一般的迭代器
+        Range,  // et.range，浮点版本
+        IntegerRange,  // et.range，整数版本
+        IPairs,  // ipairs
+        Pairs,  // pairs或next
+    };
+
+    /**
+     * @brief 构造一个区间迭代器（et.range）
+     *
+     * 原型为`et.range(from: number, to: number, [step: number=1]) -> iter: func, nil, init: number`。
+     */
+    int LuaRange(lua_State* L)noexcept;
+
+    /**
+     * @brief 识别迭代函数
+     * @param L Lua状态机
+     * @param idx 迭代函数（泛型for的第一个值）所在的位置
+     *
+     * 通过比较C函数指针识别，只会识别当前进程中链接的Lua标准库和et.range产生的迭代函数。
+     */
+    NativeIteratorTypes GetNativeIteratorType(lua_State* L, int idx)noexcept;
+}
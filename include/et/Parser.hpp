@@ -14,8 +14,8 @@
 #define ET_PARSE_ERROR(format, ...) \
     do { \
         assert(GetReader()); \
-        ET_THROW(ParseErrorException, "%s:%u:%u: " format, GetReader()->GetSourceName(), GetReader()->GetLine(), \
-            GetReader()->GetColumn(), ##__VA_ARGS__); \
+        ET_THROW_AT(ParseErrorException, GetReader()->GetSourceName(), GetReader()->GetLine(), \
+            GetReader()->GetColumn(), et::Format(format, ##__VA_ARGS__)); \
     } while (false)
 
 namespace et
@@ -151,6 +151,18 @@ namespace et
          */
         bool Back()noexcept;
 
+        /**
+         * @brief 跳转到定位信息所指示的位置
+         * @param anchor 定位信息，须由同一缓冲区（或者该位置之前内容相同的缓冲区）产生
+         */
+        void Seek(const Anchor& anchor)noexcept
+        {
+            assert(anchor.Position <= m_ullBufferLength);
+            m_uPosition = anchor.Position;
+            m_uLine = anchor.Line;
+            m_uColumn = anchor.Column;
+        }
+
     private:
         const char* m_pszBuffer = nullptr;
         size_t m_ullBufferLength = 0;
@@ -0,0 +1,330 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/21
+ */
+#pragma once
+#include "Base.hpp"
+#include "Escape.hpp"
+
+#include <chrono>
+
+#include <lua.hpp>
+
+namespace et
+{
+    class RenderProfiler;
+    class RenderObserverBase;
+    class VectoredWriter;
+
+    /**
+     * @brief 渲染选项
+     */
+    struct RenderOptions
+    {
+        /**
+         * @brief 最多允许执行的Lua指令数
+         *
+         * 0表示不限制。
+         * 指令数以ExecutionGuard::kHookInterval为粒度进行统计。
+         */
+        uint64_t MaxInstructions = 0;
+
+        /**
+         * @brief 超时时间（毫秒）
+         *
+         * 0表示不限制。
+         */
+        uint32_t Timeout = 0;
+
+        /**
+         * @brief 最大输出字节数
+         *
+         * 0表示不限制。
+         * 当输出即将超出限制时立即中止渲染，而不是在渲染完成后再检查。
+         */
+        size_t MaxOutputSize = 0;
+
+        /**
+         * @brief 性能分析器
+         *
+         * nullptr表示不进行统计，参见RenderProfiler。
+         */
+        RenderProfiler* Profiler = nullptr;
+
+        /**
+         * @brief 本次渲染的观察者
+         *
+         * 在全局观察者之外额外通知，nullptr表示不设置，参见RenderObserverBase。
+         */
+        RenderObserverBase* Observer = nullptr;
+    };
+
+    /**
+     * @brief 渲染上下文
+     *
+     * 在一次渲染中传递给各个节点，节点的所有输出都经由上下文写入，并在此检查渲染选项中的限制。
+     */
+    class RenderContext
+    {
+    public:
+        /**
+         * @brief 构造渲染上下文
+         * @param builder 输出字符串，渲染结果追加在其后
+         * @param options 渲染选项
+         */
+        RenderContext(std::string& builder, const RenderOptions* options=nullptr)noexcept;
+
+        /**
+         * @brief 构造输出到VectoredWriter的渲染上下文
+         * @param writer 输出
+         * @param options 渲染选项
+         *
+         * 此时GetOutput不可用，调用方需要通过IsVectored判断。
+         */
+        RenderContext(VectoredWriter& writer, const RenderOptions* options=nullptr)noexcept;
+
+        RenderContext(const RenderContext&) = delete;
+        RenderContext& operator=(const RenderContext&) = delete;
+
+    public:
+        /**
+         * @brief 获取渲染选项
+         * @return 若不存在返回nullptr
+         */
+        const RenderOptions* GetOptions()const noexcept { return m_pOptions; }
+
+        /**
+         * @brief 获取性能分析器
+         * @return 若不存在返回nullptr
+         */
+        RenderProfiler* GetProfiler()const noexcept { return m_pProfiler; }
+
+        /**
+         * @brief 获取已经输出的字节数
+         */
+        size_t GetOutputSize()const noexcept { return m_ullOutputSize; }
+
+        /**
+         * @brief 是否输出到VectoredWriter
+         */
+        bool IsVectored()const noexcept { return m_pWriter != nullptr; }
+
+        /**
+         * @brief 获取已经输出的内容
+         * @param offset 偏移，不超过GetOutputSize
+         * @return 从偏移处开始的数据，长度为GetOutputSize() - offset，在下次输出前有效
+         */
+        const char* GetOutput(size_t offset)const noexcept
+        {
+            assert(!m_pWriter);
+            assert(offset <= m_ullOutputSize);
+            return m_pBuilder->data() + m_ullBaseSize + offset;
+        }
+
+        /**
+         * @brief 获取当前的include嵌套深度
+         */
+        uint32_t GetIncludeDepth()const noexcept { return m_uIncludeDepth; }
+
+        /**
+         * @brief 设置include嵌套深度
+         */
+        void SetIncludeDepth(uint32_t depth)noexcept { m_uIncludeDepth = depth; }
+
+        /**
+         * @brief 获取节点代码块缓存的栈索引
+         * @return 0表示不缓存
+         *
+         * 缓存是一张以节点地址为键的表，由Template在渲染期间置于栈上，节点据此在一次渲染中只加载一次代码块。
+         */
+        int GetChunkCache()const noexcept { return m_iChunkCache; }
+
+        /**
+         * @brief 设置节点代码块缓存的栈索引
+         */
+        void SetChunkCache(int idx)noexcept { m_iChunkCache = idx; }
+
+        /**
+         * @brief 在渲染结束前保持对象存活
+         * @param object 对象
+         *
+         * 输出到VectoredWriter时，引用片段在写出前必须有效，被引用的模板需要由上下文持有。
+         * 缓存节点代码块时同样需要持有，以免被释放的节点的地址在同一次渲染中被复用。
+         */
+        void KeepAlive(std::shared_ptr<const void> object)
+        {
+            if (m_pWriter || m_iChunkCache != 0)
+                m_stKeepAlive.emplace_back(std::move(object));
+        }
+
+        /**
+         * @brief 输出内容
+         * @exception RenderException 超出输出限制时抛出
+         * @param data 数据
+         * @param length 长度
+         */
+        void Write(const char* data, size_t length)
+        {
+            if (length > m_ullMaxOutputSize - m_ullOutputSize)
+                ThrowOutputLimitExceeded();
+
+            if (m_pWriter)
+                WriteToWriter(data, length, false);
+            else
+                m_pBuilder->append(data, length);
+            m_ullOutputSize += length;
+        }
+
+        void Write(const std::string& data)
+        {
+            Write(data.c_str(), data.length());
+        }
+
+        /**
+         * @brief 输出生命期长于本次渲染的内容
+         * @exception RenderException 超出输出限制时抛出
+         * @param data 数据，例如模板中的文本
+         * @param length 长度
+         *
+         * 输出到VectoredWriter时只记录引用而不复制。
+         */
+        void WriteReference(const char* data, size_t length)
+        {
+            if (length > m_ullMaxOutputSize - m_ullOutputSize)
+                ThrowOutputLimitExceeded();
+
+            if (m_pWriter)
+                WriteToWriter(data, length, true);
+            else
+                m_pBuilder->append(data, length);
+            m_ullOutputSize += length;
+        }
+
+        /**
+         * @brief 转义并输出内容
+         * @exception RenderException 超出输出限制时抛出
+         * @param data 数据
+         * @param length 长度
+         * @param mode 转义模式
+         */
+        void WriteEscaped(const char* data, size_t length, EscapeModes mode);
+
+    private:
+        [[noreturn]] void ThrowOutputLimitExceeded()const;
+        void WriteToWriter(const char* data, size_t length, bool reference);
+
+    private:
+        std::string* m_pBuilder = nullptr;
+        VectoredWriter* m_pWriter = nullptr;
+        size_t m_ullBaseSize = 0;  // 构造时输出中已有的内容长度
+        const RenderOptions* m_pOptions = nullptr;
+        RenderProfiler* m_pProfiler = nullptr;
+
+        size_t m_ullOutputSize = 0;
+        size_t m_ullMaxOutputSize = static_cast<size_t>(-1);
+        uint32_t m_uIncludeDepth = 0;
+        int m_iChunkCache = 0;
+
+        std::vector<std::shared_ptr<const void>> m_stKeepAlive;
+
+        // 临时变量
+        std::string m_stEscapeBuffer;
+    };
+
+    /**
+     * @brief 执行守卫
+     *
+     * 在生命期内通过lua_sethook安装计数钩子，当指令数或耗时超出RenderOptions的限制时在Lua中抛出错误。
+     * 节点会将这一错误转换为带有源和行号的LuaRuntimeException，调用方可以通过IsTriggered判断是否由守卫中止。
+     *
+     * 守卫可以嵌套，内层守卫在检查自身限制的同时也会检查外层守卫的限制。
+     * 析构时恢复之前安装的钩子。
+     */
+    class ExecutionGuard
+    {
+    public:
+        /**
+         * @brief 钩子触发间隔（指令数）
+         */
+        static const int kHookInterval = 1000;
+
+    public:
+        /**
+         * @brief 构造守卫
+         * @exception std::bad_alloc 首次在虚拟机上安装守卫时内存不足
+         * @param L 虚拟机环境
+         * @param options 选项，若为nullptr或者不含限制则不安装钩子
+         *
+         * 构造和析构都不会抛出Lua错误，守卫可以存活在Lua错误无法跳过的位置（例如lua_pcall的两侧）。
+         */
+        ExecutionGuard(lua_State* L, const RenderOptions* options);
+        ~ExecutionGuard();
+
+        ExecutionGuard(const ExecutionGuard&) = delete;
+        ExecutionGuard& operator=(const ExecutionGuard&) = delete;
+
+    public:
+        /**
+         * @brief 是否已经触发了限制
+         */
+        bool IsTriggered()const noexcept { return m_pszReason != nullptr; }
+
+        /**
+         * @brief 获取触发原因
+         */
+        const char* GetReason()const noexcept { return m_pszReason ? m_pszReason : ""; }
+
+        /**
+         * @brief 获取已经执行的指令数
+         *
+         * 只在限制了指令数时统计，粒度与钩子的触发间隔相同。
+         */
+        uint64_t GetExecutedInstructions()const noexcept { return m_ullExecutedInstructions; }
+
+    private:
+        static void Hook(lua_State* L, lua_Debug* ar);
+
+        bool Step(int count)noexcept;
+
+    private:
+        lua_State* m_pState = nullptr;
+        bool m_bInstalled = false;
+
+        // 被覆盖的钩子
+        ExecutionGuard* m_pPrevGuard = nullptr;
+        lua_Hook m_pPrevHook = nullptr;
+        int m_iPrevHookMask = 0;
+        int m_iPrevHookCount = 0;
+
+        // 限制
+        int m_iHookCount = kHookInterval;
+        uint64_t m_ullMaxInstructions = 0;
+        uint64_t m_ullExecutedInstructions = 0;
+        bool m_bHasDeadline = false;
+        std::chrono::steady_clock::time_point m_stDeadline;
+
+        const char* m_pszReason = nullptr;
+    };
+
+    /**
+     * @brief 节点代码块缓存的作用域
+     *
+     * 若上下文中尚无缓存，则在构造时于栈顶创建缓存表（参见RenderContext::GetChunkCache），析构时连同其上的内容一并移除。
+     * 已有缓存或者L为nullptr时不做任何事，被include的模板因此与外层共享同一个缓存。
+     */
+    class ChunkCacheScope
+    {
+    public:
+        ChunkCacheScope(RenderContext& context, lua_State* L);
+        ~ChunkCacheScope();
+
+        ChunkCacheScope(const ChunkCacheScope&) = delete;
+        ChunkCacheScope& operator=(const ChunkCacheScope&) = delete;
+
+    private:
+        RenderContext& m_stContext;
+        lua_State* m_pState = nullptr;
+        bool m_bOwner = false;
+    };
+}
@@ -0,0 +1,81 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/24
+ */
+#pragma once
+#include "Base.hpp"
+
+namespace et
+{
+    /**
+     * @brief 单次渲染的统计数据
+     */
+    struct RenderStatistics
+    {
+        const char* SourceName = nullptr;
+        bool Succeeded = false;
+        bool CacheHit = false;  // 模板是否已经渲染过（即本次渲染没有解析开销）
+        uint64_t ParseTime = 0;  // 纳秒，CacheHit时为0
+        uint64_t RenderTime = 0;  // 纳秒
+        size_t OutputSize = 0;
+        int64_t MemoryDelta = 0;  // 渲染前后Lua内存占用的变化（字节）
+    };
+
+    /**
+     * @brief 单次编译的统计数据
+     */
+    struct CompileStatistics
+    {
+        const char* SourceName = nullptr;
+        bool Succeeded = false;
+        uint64_t CompileTime = 0;  // 纳秒，包含解析和生成代码
+    };
+
+    /**
+     * @brief 渲染观察者基类
+     *
+     * 用于向监控系统导出渲染指标。
+     * 观察者可以全局安装（SetRenderObserver），也可以通过RenderOptions::Observer为单次渲染指定，两者同时存在时都会被通知。
+     * 未安装任何观察者时不进行计时和内存统计。
+     *
+     * 全局观察者可能被多个线程同时调用，实现需要自行保证线程安全。
+     */
+    class RenderObserverBase
+    {
+    public:
+        virtual ~RenderObserverBase() = default;
+
+    public:
+        /**
+         * @brief 渲染结束（包括失败）时调用
+         * @param stats 统计数据
+         */
+        virtual void OnRender(const RenderStatistics& stats)noexcept = 0;
+
+        /**
+         * @brief 编译结束（包括失败）时调用
+         * @param stats 统计数据
+         */
+        virtual void OnCompile(const CompileStatistics& stats)noexcept;
+    };
+
+    /**
+     * @brief 获取全局观察者
+     * @return 若未安装返回nullptr
+     */
+    RenderObserverBase* GetRenderObserver()noexcept;
+
+    /**
+     * @brief 安装全局观察者
+     * @param observer 观察者，nullptr表示卸载，调用方需保证其生命期
+     */
+    void SetRenderObserver(RenderObserverBase* observer)noexcept;
+
+    /**
+     * @brief 获取当前时间（纳秒）
+     *
+     * 仅用于计算时间间隔。
+     */
+    uint64_t GetMonotonicTime()noexcept;
+}
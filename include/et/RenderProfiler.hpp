@@ -0,0 +1,113 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/23
+ */
+#pragma once
+#include "RenderContext.hpp"
+
+#include <map>
+
+namespace et
+{
+    /**
+     * @brief 渲染性能分析器
+     *
+     * 以节点的源和行号为键，统计节点的调用次数、包含子节点的耗时、不含子节点的耗时以及输出字节数。
+     * 分析器通过RenderOptions::Profiler传入，未设置时节点不做任何统计。
+     *
+     * 只有带源和行号的节点（表达式和控制节点）会被统计，文本节点的耗时计入其父节点。
+     * 编译为Lua函数的模板（参见TemplateCompiler）不经过节点渲染，不会被统计。
+     * 分析器不是线程安全的，同一时刻只能用于一个渲染过程（允许嵌套）。
+     */
+    class RenderProfiler
+    {
+    public:
+        /**
+         * @brief 统计项
+         */
+        struct Entry
+        {
+            std::string Source;
+            uint32_t Line = 0;
+            uint64_t Calls = 0;
+            uint64_t InclusiveTime = 0;  // 纳秒
+            uint64_t ExclusiveTime = 0;  // 纳秒
+            uint64_t Bytes = 0;  // 包含子节点的输出字节数
+        };
+
+        /**
+         * @brief 统计作用域
+         *
+         * 在节点的Render中构造，析构时（包括异常退出）提交统计。
+         */
+        class Scope
+        {
+        public:
+            Scope(RenderContext& context, const char* source, uint32_t line)noexcept;
+            ~Scope();
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            RenderContext& m_stContext;
+            RenderProfiler* m_pProfiler = nullptr;
+        };
+
+    public:
+        RenderProfiler() = default;
+
+        RenderProfiler(const RenderProfiler&) = delete;
+        RenderProfiler& operator=(const RenderProfiler&) = delete;
+
+    public:
+        /**
+         * @brief 清空统计数据
+         *
+         * 同时丢弃未结束的帧（例如被中止的渲染遗留的），不应在渲染期间调用。
+         */
+        void Reset()noexcept;
+
+        /**
+         * @brief 获取统计项
+         * @return 按不含子节点的耗时降序排列
+         */
+        std::vector<Entry> GetEntries()const;
+
+        /**
+         * @brief 输出统计表
+         * @param[out] out 输出，追加在其后
+         */
+        void DumpReport(std::string& out)const;
+
+        /**
+         * @brief 输出折叠栈
+         * @param[out] out 输出，追加在其后
+         *
+         * 每行形如"source:line;source:line 耗时"，耗时为不含子节点的微秒数，可以直接交给flamegraph.pl等工具。
+         */
+        void DumpFoldedStacks(std::string& out)const;
+
+    private:
+        void Enter(const char* source, uint32_t line, size_t outputSize)noexcept;
+        void Leave(size_t outputSize)noexcept;
+
+    private:
+        struct Frame
+        {
+            const char* Source;
+            uint32_t Line;
+            std::chrono::steady_clock::time_point Start;
+            size_t OutputStart;
+            uint64_t ChildTime;
+        };
+
+        std::vector<Frame> m_vecStack;
+        size_t m_ullDroppedFrames = 0;  // 因内存不足未能入栈的帧
+
+        std::map<std::pair<std::string, uint32_t>, Entry> m_stEntries;
+        std::map<std::string, uint64_t> m_stFoldedStacks;
+        std::string m_stTmpKey;
+    };
+}
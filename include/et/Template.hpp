@@ -0,0 +1,258 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/22
+ */
+#pragma once
+#include "TemplateNode.hpp"
+#include "RenderObserver.hpp"
+#include "VectoredWriter.hpp"
+
+#include <atomic>
+#include <list>
+
+namespace et
+{
+    /**
+     * @brief 渲染错误码
+     */
+    enum class RenderErrorCodes
+    {
+        Ok = 0,
+        CompileError,  // 模板无法编译为Lua函数
+        RuntimeError,  // 执行中的Lua错误
+        LimitExceeded,  // 超出渲染选项中的限制
+        OutOfMemory,
+    };
+
+    /**
+     * @brief 渲染错误
+     */
+    struct RenderError
+    {
+        RenderErrorCodes Code = RenderErrorCodes::Ok;
+        std::string Source;  // 出错节点的源名称，无法确定时为空
+        uint32_t Line = 0;  // 出错节点的行号，无法确定时为0
+        std::string Message;  // 完整的错误信息
+    };
+
+    /**
+     * @brief 编译后的模板
+     *
+     * 持有解析得到的语法树，可以反复渲染而不需要重新解析。
+     *
+     * 模板会记录历次输出大小的指数平滑值，渲染前据此预留输出缓冲区，避免循环展开后输出反复重新分配。
+     * 渲染过程不修改语法树，可以在多个线程中使用不同的虚拟机同时渲染同一个模板。
+     *
+     * 存在观察者时，渲染结束后会通知观察者（参见RenderObserverBase），首次渲染会一并报告解析耗时。
+     */
+    class Template
+    {
+    public:
+        /**
+         * @brief 计算平滑后的输出大小
+         * @param estimate 之前的估计值
+         * @param actual 本次的实际大小
+         * @return 新的估计值
+         */
+        static size_t SmoothOutputSize(size_t estimate, size_t actual)noexcept
+        {
+            // 平滑系数取1/4，首次直接采用实际值
+            if (estimate == 0)
+                return actual;
+            if (actual >= estimate)
+                return estimate + (actual - estimate) / 4;
+            return estimate - (estimate - actual) / 4;
+        }
+
+    public:
+        /**
+         * @brief 解析并构造模板
+         * @exception ParseErrorException 解析失败时抛出
+         * @param input 输入串
+         * @param length 输入长度
+         * @param sourceName 源名称
+         * @param path 模板的路径或在TemplateCache中的名称，以相对名称继承的模板优先在其所在目录中查找，
+         *             nullptr时使用源名称
+         */
+        Template(const char* input, size_t length, const char* sourceName="Unknown", const char* path=nullptr);
+
+        /**
+         * @brief 从解析器的结果构造模板
+         * @exception ParseErrorException 语法树构造失败时抛出
+         * @param parser 已完成解析的解析器，Token的内容会被取走
+         * @param sourceSize 源文本大小
+         * @param sourceName 源名称
+         *
+         * 用于增量解析（参见TemplateParser::Update），解析的耗时不计入GetParseTime。
+         */
+        Template(TemplateParser& parser, size_t sourceSize, const char* sourceName="Unknown");
+
+        Template(const Template&) = delete;
+        Template& operator=(const Template&) = delete;
+
+    public:
+        /**
+         * @brief 获取源名称
+         */
+        const std::string& GetSourceName()const noexcept { return m_stSourceName; }
+
+        /**
+         * @brief 获取源文本大小
+         */
+        size_t GetSourceSize()const noexcept { return m_ullSourceSize; }
+
+        /**
+         * @brief 获取语法树
+         */
+        const TemplateBlockNode& GetRoot()const noexcept { return *m_pRoot; }
+
+        /**
+         * @brief 获取预测的输出大小
+         */
+        size_t GetPredictedOutputSize()const noexcept;
+
+        /**
+         * @brief 获取解析耗时（纳秒）
+         *
+         * 包括展开继承的耗时，首次渲染时报告给观察者（参见RenderStatistics::ParseTime）。
+         */
+        uint64_t GetParseTime()const noexcept { return m_ullParseTime; }
+
+        /**
+         * @brief 渲染模板
+         * @exception RenderException 渲染错误或超出渲染选项中的限制时抛出
+         * @exception LuaRuntimeException Lua执行错误时抛出
+         * @param[out] out 输出，渲染前会被清空
+         * @param L 虚拟机环境
+         * @param env 环境Index，当0时不设置ENV
+         * @param options 渲染选项
+         *
+         * out在清空时不会释放已有的容量，调用方可以在多次渲染之间复用同一个缓冲区。
+         */
+        void Render(std::string& out, lua_State* L, int env=0, const RenderOptions* options=nullptr)const;
+
+        /**
+         * @brief 渲染模板到VectoredWriter
+         * @exception RenderException 渲染错误或超出渲染选项中的限制时抛出
+         * @exception LuaRuntimeException Lua执行错误时抛出
+         * @exception IOException 写出失败时抛出
+         * @param writer 输出，渲染完成后会被Flush
+         * @param L 虚拟机环境
+         * @param env 环境Index，当0时不设置ENV
+         * @param options 渲染选项
+         *
+         * 模板中的文本以引用方式输出，不发生复制。
+         */
+        void Render(VectoredWriter& writer, lua_State* L, int env=0, const RenderOptions* options=nullptr)const;
+
+        /**
+         * @brief 以单次保护调用渲染模板
+         * @param[out] out 输出，渲染前会被清空
+         * @param L 虚拟机环境
+         * @param env 环境Index，当0时不设置ENV
+         * @param[out] error 错误信息，成功时Code为Ok
+         * @param options 渲染选项，不支持Profiler
+         * @return 错误码
+         *
+         * 模板被编译为Lua函数（参见TemplateCompiler），整个模板在一次lua_pcall中执行，节点之间没有lua_pcall、
+         * C++异常和栈展开，错误以错误码返回，并给出最内层的模板帧的源和行号。
+         * 编译产物按模板缓存在虚拟机中，首次渲染有编译开销，参见ReleaseCompiled。
+         */
+        RenderErrorCodes TryRender(std::string& out, lua_State* L, int env, RenderError& error,
+            const RenderOptions* options=nullptr)const noexcept;
+
+        /**
+         * @brief 释放虚拟机中缓存的编译产物
+         * @param L 虚拟机环境
+         *
+         * 缓存只持有模板的弱引用，模板销毁后其编译产物在之后向同一虚拟机缓存新的编译产物时被清理，
+         * 因此不调用也不会无限增长；需要立即释放内存时可以调用。
+         */
+        void ReleaseCompiled(lua_State* L)const noexcept;
+
+        /**
+         * @brief 检查模板
+         * @exception LuaRuntimeException 代码块无法编译时抛出
+         * @param L 虚拟机环境，只用于编译代码块
+         *
+         * 以与渲染时相同的方式编译所有节点的代码块（包括不会被执行的分支），但不执行任何代码。
+         * 解析错误在构造模板时就已经抛出；被include的模板不会被检查。
+         */
+        void Check(lua_State* L)const;
+
+        /**
+         * @brief 将模板编译为Lua函数并压入栈顶
+         * @exception LuaRuntimeException 编译失败时抛出
+         * @param L 虚拟机环境
+         *
+         * 编译产物（参见TemplateCompiler）按模板缓存在虚拟机中，与TryRender共享，参见ReleaseCompiled。
+         */
+        void PushCompiled(lua_State* L)const;
+
+    private:
+        void Render(RenderContext& context, lua_State* L, int env)const;
+        void DoRender(RenderContext& context, lua_State* L, int env)const;
+        void Notify(const RenderOptions* options, const RenderStatistics& stats)const noexcept;
+
+    private:
+        uint64_t m_ullId = 0;  // 作为编译产物缓存的键，不会重复
+        std::string m_stSourceName;  // 节点引用了这一字符串，因此模板不可移动
+        size_t m_ullSourceSize = 0;
+        std::list<std::string> m_stBaseSourceNames;  // 被继承的模板的源名称，节点同样引用了这些字符串
+        std::unique_ptr<TemplateBlockNode> m_pRoot;
+        uint64_t m_ullParseTime = 0;
+        std::shared_ptr<void> m_pCompiledOwner;  // 虚拟机中的编译产物缓存持有其弱引用，用于判断模板是否已经销毁
+
+        mutable std::atomic<size_t> m_ullOutputSizeEstimate;
+        mutable std::atomic<bool> m_bRendered;
+    };
+
+    /**
+     * @brief 展开模板继承
+     * @exception ParseErrorException 继承关系有误或被继承的模板解析失败时抛出
+     * @exception IOException 被继承的模板无法读取时抛出
+     * @param root 语法树
+     * @param[out] sourceNames 被继承的模板的源名称，展开后的节点引用这些字符串，调用方需保证其与语法树同生命期
+     * @param path 模板的路径或在TemplateCache中的名称，nullptr时使用extends节点的源名称
+     * @return 展开后的语法树
+     *
+     * 若模板以extends声明继承，则通过TemplateCache按名称加载并解析被继承的模板（源文本会被缓存，
+     * 参见TemplateCache::LoadSource），以当前模板中的同名块替换之，如此逐级展开，最终得到一棵不含继承关系的语法树。
+     * 被继承的模板名称优先相对于引用它的模板所在的目录查找，找不到时再按TemplateCache的规则查找。
+     * 继承其他模板时，块以外的内容会被忽略。同一模板中出现同名的块时抛出ParseErrorException。
+     */
+    std::unique_ptr<TemplateBlockNode> ResolveExtends(std::unique_ptr<TemplateBlockNode>&& root,
+        std::list<std::string>& sourceNames, const char* path=nullptr);
+
+    /**
+     * @brief 检查统计
+     */
+    struct CheckStatistics
+    {
+        size_t Count = 0;  // 检查的模板数
+        std::vector<std::string> Errors;  // 未通过检查的模板的错误信息，与路径的顺序一致
+        size_t SourceSize = 0;  // 源文本大小（字节）
+        uint64_t CheckTime = 0;  // 检查耗时（纳秒），为墙上时间
+    };
+
+    /**
+     * @brief 并行检查模板文件
+     * @param[out] stats 统计
+     * @param paths 文件路径，同时作为源名称
+     * @param threads 线程数，0表示与CPU核心数相同
+     *
+     * 每个线程使用独立的虚拟机，依次解析、构造语法树并检查（参见Template::Check）模板，不执行任何代码。
+     * 单个模板的错误不会中断检查。extends引用的模板经由TemplateCache加载。
+     */
+    void CheckTemplateFiles(CheckStatistics& stats, const std::vector<std::string>& paths, unsigned threads=0);
+
+    /**
+     * @brief 从文件加载模板
+     * @exception IOException 读取失败时抛出
+     * @exception ParseErrorException 解析失败时抛出
+     * @param path 文件路径
+     * @return 模板，源名称为文件名
+     */
+    std::shared_ptr<Template> LoadTemplateFile(const char* path);
+}
@@ -0,0 +1,115 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/2/1
+ */
+#pragma once
+#include "TemplateNode.hpp"
+
+#include <set>
+#include <unordered_set>
+
+namespace et
+{
+    /**
+     * @brief 模板依赖分析器
+     *
+     * 在不执行模板的情况下列出模板从ENV中读取的全局名称，调用方可以据此只准备模板用到的数据。
+     *
+     * 表达式交给Lua的语法分析器编译，局部变量、函数参数、字段访问等由Lua自行区分，
+     * 分析器只检查函数原型中以常量为键读取_ENV的指令。此外：
+     *  - for语句的迭代变量和宏参数在其作用域内不视作依赖
+     *  - 模板中定义的宏不视作依赖
+     *  - 只赋值而不读取的名称不视作依赖
+     *  - 静态名称的include会一并分析被引用的模板，动态名称只分析名称表达式本身
+     *  - 以非常量为键访问_ENV（例如_ENV[name]）无法静态确定，不会被列出
+     */
+    class TemplateAnalyzer
+    {
+    public:
+        /**
+         * @brief 构造分析器
+         * @param L 虚拟机环境，用于编译表达式
+         */
+        explicit TemplateAnalyzer(lua_State* L);
+
+    public:
+        /**
+         * @brief 获取依赖的名称，按字典序排列
+         */
+        const std::set<std::string>& GetDependencies()const noexcept { return m_stDependencies; }
+
+        /**
+         * @brief 获取静态引用的模板名称，包括间接引用的模板
+         */
+        const std::set<std::string>& GetIncludes()const noexcept { return m_stIncludes; }
+
+        /**
+         * @brief 是否存在无法静态确定名称的include
+         */
+        bool HasDynamicInclude()const noexcept { return m_bDynamicInclude; }
+
+        /**
+         * @brief 分析语法树
+         * @exception LuaRuntimeException 表达式有语法错误时抛出
+         * @exception IOException 被引用的模板无法读取时抛出
+         * @exception ParseErrorException 被引用的模板解析失败时抛出
+         * @param root 根节点
+         *
+         * 可以多次调用，结果会被合并。
+         */
+        void Analyze(const TemplateNodeBase& root);
+
+    public:  // 供节点使用
+        /**
+         * @brief 分析表达式
+         * @exception LuaRuntimeException 语法错误时抛出
+         * @param source 源
+         * @param line 行号
+         * @param expr 表达式
+         * @param length 长度
+         * @param statement 是否允许作为语句
+         */
+        void AddExpression(const char* source, uint32_t line, const char* expr, size_t length, bool statement);
+
+        /**
+         * @brief 记录宏定义
+         * @param name 宏名称
+         */
+        void AddMacro(const std::string& name);
+
+        /**
+         * @brief 分析被引用的模板
+         * @param name 模板名称，为空表示名称需要在渲染时求值
+         */
+        void AddInclude(const std::string& name);
+
+        /**
+         * @brief 进入作用域
+         * @param names 作用域内由模板赋值的名称
+         */
+        void PushScope(const std::vector<std::string>& names);
+
+        /**
+         * @brief 离开作用域
+         */
+        void PopScope()noexcept;
+
+    private:
+        bool IsInScope(const std::string& name)const noexcept;
+
+    private:
+        lua_State* m_pState = nullptr;
+
+        std::set<std::string> m_stDependencies;
+        std::set<std::string> m_stIncludes;
+        std::unordered_set<std::string> m_stMacros;
+        std::vector<const std::vector<std::string>*> m_stScopes;
+        std::vector<std::string> m_stIncludeStack;
+        bool m_bDynamicInclude = false;
+
+        // 临时变量
+        std::string m_stTmpBuffer;
+        std::vector<std::string> m_stTmpNames;
+    };
+}
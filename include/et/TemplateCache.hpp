@@ -0,0 +1,161 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/25
+ */
+#pragma once
+#include "TemplatePack.hpp"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace et
+{
+    /**
+     * @brief 模板缓存
+     *
+     * 进程内共享的模板缓存，以模板名称为键，保存解析后的模板。
+     * include节点通过缓存加载被引用的模板，使得同一个模板在多次引用之间只解析一次。
+     *
+     * 模板名称优先在挂载的模板包中查找，其次按照搜索路径依次查找，未设置搜索路径或名称为绝对路径时直接作为文件路径使用。
+     * 缓存不会检查文件是否被修改，需要时可以调用Clear清空。
+     * 所有方法都是线程安全的。
+     */
+    class TemplateCache
+    {
+    public:
+        /**
+         * @brief 获取全局实例
+         */
+        static TemplateCache& GetInstance()noexcept;
+
+    public:
+        TemplateCache() = default;
+
+        TemplateCache(const TemplateCache&) = delete;
+        TemplateCache& operator=(const TemplateCache&) = delete;
+
+    public:
+        /**
+         * @brief 获取搜索路径
+         */
+        std::vector<std::string> GetSearchPaths()const;
+
+        /**
+         * @brief 设置搜索路径
+         * @param paths 目录列表
+         */
+        void SetSearchPaths(std::vector<std::string> paths);
+
+        /**
+         * @brief 挂载模板包
+         * @param pack 模板包，后挂载的包优先
+         *
+         * 包中的模板优先于已经缓存的同名模板，这些模板及其源文本（参见LoadSource）会被移出缓存。
+         */
+        void AddPack(std::shared_ptr<const TemplatePack> pack);
+
+        /**
+         * @brief 卸载所有模板包
+         *
+         * 已经从包中加载的模板仍然保留在缓存中。
+         */
+        void ClearPacks();
+
+        /**
+         * @brief 在挂载的模板包中查找
+         * @param name 模板名称
+         * @param[out] entry 找到的项，与返回的包同生命期
+         * @return 找到的包，未找到时返回nullptr
+         */
+        std::shared_ptr<const TemplatePack> FindPacked(const std::string& name, TemplatePack::Entry& entry)const;
+
+        /**
+         * @brief 获取缓存的模板数量
+         */
+        size_t GetSize()const;
+
+        /**
+         * @brief 按照搜索路径读取模板源文本
+         * @exception IOException 在所有搜索路径中都无法读取时抛出
+         * @param[out] out 输出
+         * @param name 模板名称
+         */
+        void ReadSource(std::string& out, const std::string& name)const;
+
+        /**
+         * @brief 加载模板源文本
+         * @exception IOException 在所有搜索路径中都无法读取时抛出
+         * @param name 模板名称
+         * @return 源文本
+         *
+         * 与ReadSource相同，但结果会被缓存，用于被继承的模板：继承关系展开后的语法树属于子模板，
+         * 无法与其他模板共享，因此缓存源文本，避免每次展开都重新读取文件。
+         */
+        std::shared_ptr<const std::string> LoadSource(const std::string& name);
+
+        /**
+         * @brief 加载模板
+         * @exception IOException 在所有搜索路径中都无法读取时抛出
+         * @exception ParseErrorException 解析失败时抛出
+         * @param name 模板名称，同时作为模板的源名称
+         * @return 模板
+         *
+         * 若缓存中不存在则从文件加载并放入缓存。
+         * 解析在锁外进行，多个线程同时加载同一模板时可能重复解析，但最终只保留一份。
+         */
+        std::shared_ptr<Template> Load(const std::string& name);
+
+        /**
+         * @brief 查找模板
+         * @param name 模板名称
+         * @return 若不在缓存中返回nullptr
+         */
+        std::shared_ptr<Template> Find(const std::string& name)const;
+
+        /**
+         * @brief 放入模板
+         * @param name 模板名称
+         * @param tpl 模板，覆盖已有的同名模板
+         */
+        void Put(const std::string& name, std::shared_ptr<Template> tpl);
+
+        /**
+         * @brief 清空缓存
+         *
+         * 同时清空缓存的源文本（参见LoadSource）。
+         */
+        void Clear();
+
+    private:
+        mutable std::mutex m_stLock;
+        std::vector<std::string> m_vecSearchPaths;
+        std::vector<std::shared_ptr<const TemplatePack>> m_vecPacks;
+        std::unordered_map<std::string, std::shared_ptr<Template>> m_stTemplates;
+        std::unordered_map<std::string, std::shared_ptr<const std::string>> m_stSources;
+    };
+
+    /**
+     * @brief 预加载统计
+     */
+    struct PreloadStatistics
+    {
+        std::vector<std::string> Names;  // 已在缓存中的模板名称（含此前已经缓存的），按字典序排列
+        std::vector<std::string> Errors;  // 加载失败的模板的错误信息
+        size_t SourceSize = 0;  // 本次解析的源文本大小（字节）
+        uint64_t ParseTime = 0;  // 解析耗时（纳秒），为墙上时间
+    };
+
+    /**
+     * @brief 预加载模板目录
+     * @exception IOException 无法打开目录时抛出
+     * @param[out] stats 统计
+     * @param dir 目录
+     * @param pattern 通配符，匹配相对于dir的路径，'*'匹配任意字符（包括'/'），'?'匹配单个字符
+     * @param threads 解析线程数，0表示与CPU核心数相同
+     *
+     * 在多个线程中并行解析目录下的模板并放入TemplateCache，模板名称为相对于dir的路径，
+     * 因此dir通常也应当被设置为搜索路径。单个模板的错误不会中断预加载，而是记录在统计中。
+     */
+    void PreloadTemplates(PreloadStatistics& stats, const char* dir, const char* pattern="*", unsigned threads=0);
+}
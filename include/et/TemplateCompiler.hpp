@@ -0,0 +1,245 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/20
+ */
+#pragma once
+#include "TemplateNode.hpp"
+
+namespace et
+{
+    /**
+     * @brief 模板编译器
+     *
+     * 将一棵模板语法树翻译为单个Lua函数，原型为function([env]) -> string。
+     *
+     * 与逐节点调用lua_pcall的渲染方式不同，编译产物完全运行在Lua虚拟机中，中间不存在C调用边界。
+     * 因此当编译产物在协程中执行时，表达式可以直接yield（例如等待异步I/O），恢复后继续渲染。
+     *
+     * 约定：
+     *  - 生成代码的行号与模板行号对齐，Lua报错信息中的"源:行号"可以直接定位到模板
+     *  - 以"__et_"开头的名称被编译器保留
+     *  - for语句的迭代变量与逐节点渲染一致，写入ENV并在循环结束后恢复
+     *  - include语句引用的模板同样被编译为Lua函数，按名称缓存在虚拟机中，被引用的模板直接向调用方的缓冲区输出
+     *  - macro语句被编译为写入ENV的Lua函数，宏体输出到独立的缓冲区并作为返回值
+     */
+    class TemplateCompiler
+    {
+    public:
+        /**
+         * @brief 清空虚拟机中缓存的被引用模板的编译产物
+         * @param L 虚拟机环境
+         */
+        static void ClearIncludeCache(lua_State* L);
+
+        /**
+         * @brief 获取安全字符串的片段数
+         * @param L 虚拟机环境
+         * @param idx 值的栈索引
+         * @return 片段数，不是安全字符串时返回-1
+         *
+         * 宏体中的表达式已经按照其所在位置的模式转义，宏的返回值是一个安全字符串（用户数据），输出时不再转义。
+         * 安全字符串与普通字符串或数字拼接得到由多个片段组成的安全字符串，其中来自普通值的片段仍需转义；
+         * tostring可以得到拼接后的普通字符串。
+         */
+        static int GetSafeStringSegmentCount(lua_State* L, int idx)noexcept;
+
+        /**
+         * @brief 获取安全字符串的片段
+         * @param L 虚拟机环境
+         * @param idx 安全字符串的栈索引
+         * @param index 片段索引，从0开始
+         * @param[out] length 片段长度
+         * @param[out] safe 片段是否不需要转义
+         * @return 片段内容，在安全字符串被回收前有效
+         */
+        static const char* GetSafeStringSegment(lua_State* L, int idx, int index, size_t& length, bool& safe)noexcept;
+
+        /**
+         * @brief 加载生成的代码
+         * @exception LuaRuntimeException 加载失败时抛出
+         * @param L 虚拟机环境
+         * @param code 由Compile生成的代码
+         * @param sourceName 源名称
+         *
+         * 成功后在栈顶压入编译产物。
+         */
+        static void Load(lua_State* L, const std::string& code, const char* sourceName);
+
+        /**
+         * @brief 加载预编译的字节码
+         * @exception LuaRuntimeException 加载失败时抛出
+         * @param L 虚拟机环境
+         * @param data 由Dump生成的字节码
+         * @param length 长度
+         * @param sourceName 源名称
+         *
+         * 成功后在栈顶压入编译产物。字节码不会被校验，只能加载可信的数据。
+         */
+        static void LoadBinary(lua_State* L, const char* data, size_t length, const char* sourceName);
+
+        /**
+         * @brief 将生成的代码转换为字节码
+         * @exception LuaRuntimeException 代码有误时抛出
+         * @param L 虚拟机环境
+         * @param code 由Compile生成的代码
+         * @param sourceName 源名称
+         * @param[out] out 字节码，保留调试信息
+         */
+        static void Dump(lua_State* L, const std::string& code, const char* sourceName, std::string& out);
+
+        /**
+         * @brief 按名称加载模板并编译
+         * @exception IOException 模板无法读取时抛出
+         * @exception ParseErrorException 解析失败时抛出
+         * @exception LuaRuntimeException 编译失败时抛出
+         * @param L 虚拟机环境
+         * @param name 模板名称
+         *
+         * 与include语句一致，优先使用挂载的模板包中的字节码，否则经由TemplateCache加载并编译。
+         * 成功后在栈顶压入编译产物。
+         */
+        static void LoadTemplate(lua_State* L, const std::string& name);
+
+        /**
+         * @brief 按名称编译模板并放入虚拟机中的缓存
+         * @exception IOException 模板无法读取时抛出
+         * @exception ParseErrorException 解析失败时抛出
+         * @exception LuaRuntimeException 编译失败时抛出
+         * @param L 虚拟机环境
+         * @param name 模板名称
+         *
+         * 参见LoadTemplate，此后include该模板时直接使用缓存的编译产物。
+         */
+        static void PreloadInclude(lua_State* L, const std::string& name);
+
+        /**
+         * @brief 创建输出缓冲区
+         * @param L 虚拟机环境
+         * @param chunkSize 块大小，0表示不分块
+         * @param maxSize 最大输出字节数（包括已经取走的内容），0表示不限制
+         *
+         * 在栈顶压入缓冲区，可以作为编译产物的第二个参数传入，此时编译产物向其输出且不返回结果。
+         * 若指定了块大小并在协程中执行，编译产物在缓冲区达到块大小后让出（片段缓存记录期间除外），
+         * 调用方通过TakeOutput取走内容后恢复协程即可继续渲染。
+         * 被include的模板直接向同一缓冲区输出，同样会让出；宏体输出到独立的缓冲区，宏的返回值作为一个整体输出。
+         */
+        static void NewOutputBuffer(lua_State* L, size_t chunkSize, size_t maxSize=0);
+
+        /**
+         * @brief 取走输出缓冲区中的内容
+         * @param L 虚拟机环境
+         * @param idx 缓冲区索引
+         *
+         * 在栈顶压入内容并清空缓冲区。
+         */
+        static void TakeOutput(lua_State* L, int idx);
+
+        /**
+         * @brief 在一次保护调用中执行编译产物
+         * @param L 虚拟机环境，栈顶为编译产物
+         * @param env ENV的栈索引，0表示不设置ENV
+         * @param msgh 错误处理函数的栈索引，参见lua_pcall
+         * @param[in,out] out 输出，内容追加在其后
+         * @param options 渲染选项，用于限制输出大小、指令数和时间，可以为nullptr
+         * @param[out] limited 是否因超出限制而中止，可以为nullptr
+         * @return lua_pcall的返回值
+         *
+         * 编译产物被弹出，失败时在栈顶压入错误对象（安装守卫时内存不足则为nil）。
+         * 整个模板（包括被include的模板）只经过这一次lua_pcall，执行期间不会发生C++异常。
+         * 创建输出缓冲区时内存不足会抛出Lua错误，调用方的栈帧中不应持有C++对象。
+         */
+        static int ProtectedCall(lua_State* L, int env, int msgh, std::string& out,
+            const RenderOptions* options=nullptr, bool* limited=nullptr)noexcept;
+
+    public:
+        /**
+         * @brief 构造编译器
+         * @param L 虚拟机环境，用于检查表达式语法
+         * @param sourceName 源名称
+         */
+        TemplateCompiler(lua_State* L, const char* sourceName);
+
+    public:
+        /**
+         * @brief 获取生成的代码
+         */
+        const std::string& GetCode()const noexcept { return m_stCode; }
+
+        /**
+         * @brief 编译语法树
+         * @exception LuaRuntimeException 编译失败时抛出
+         * @param root 根节点
+         *
+         * 编译成功后在栈顶压入编译产物。
+         */
+        void Compile(const TemplateNodeBase& root);
+
+    public:  // 供节点生成代码使用
+        /**
+         * @brief 对齐到指定行
+         * @param line 模板行号
+         */
+        void SyncLine(uint32_t line);
+
+        /**
+         * @brief 追加代码
+         * @param code 代码
+         */
+        void Append(const char* code);
+        void Append(const char* code, size_t length);
+
+        /**
+         * @brief 生成输出文本的代码
+         * @param text 文本
+         */
+        void EmitText(const std::string& text);
+
+        /**
+         * @brief 生成表达式节点的代码
+         * @param source 源
+         * @param line 行号
+         * @param expr 表达式
+         * @param escape 转义模式
+         *
+         * 与逐节点渲染一致，优先按照表达式处理，否则作为语句处理。
+         */
+        void EmitExpression(const char* source, uint32_t line, const char* expr, size_t length,
+            EscapeModes escape=EscapeModes::None);
+
+        /**
+         * @brief 生成语句头
+         * @exception LuaRuntimeException 语法错误时抛出
+         * @param source 源
+         * @param line 行号
+         * @param prefix 前缀，如"if "
+         * @param expr 表达式
+         * @param suffix 后缀，如" then"
+         * @param closer 用于检查语法的闭合代码，如" end"
+         */
+        void EmitHeader(const char* source, uint32_t line, const char* prefix, const char* expr, size_t length,
+            const char* suffix, const char* closer);
+
+        /**
+         * @brief 分配一个唯一的局部变量名
+         */
+        std::string AllocLocalName();
+
+    private:
+        static void LoadChunk(lua_State* L, const char* data, size_t length, const char* sourceName,
+            const char* mode);
+
+        bool TryCompile(const std::string& code);
+
+    private:
+        lua_State* m_pState = nullptr;
+        const char* m_pszSourceName = nullptr;
+
+        std::string m_stCode;
+        uint32_t m_uLine = 1;
+        uint32_t m_uLocalId = 0;
+
+        // 临时变量
+        std::string m_stTmpBuffer;
+    };
+}
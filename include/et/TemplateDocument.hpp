@@ -0,0 +1,78 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/31
+ */
+#pragma once
+#include "Template.hpp"
+
+namespace et
+{
+    /**
+     * @brief 可编辑的模板文档
+     *
+     * 持有模板的源文本，面向编辑器、预览等需要频繁修改模板的场景。
+     * 每次编辑后通过TemplateParser::Update只重新解析受影响的Token，解析失败后的下一次编辑会回退到完整解析。
+     * 模板对象在首次获取时构造，并缓存到下一次编辑。
+     */
+    class TemplateDocument
+    {
+    public:
+        /**
+         * @brief 构造文档
+         * @param text 源文本
+         * @param length 源文本长度
+         * @param sourceName 源名称
+         *
+         * 构造时不进行解析。
+         */
+        TemplateDocument(const char* text, size_t length, const char* sourceName="Unknown");
+
+        TemplateDocument(const TemplateDocument&) = delete;
+        TemplateDocument& operator=(const TemplateDocument&) = delete;
+
+    public:
+        /**
+         * @brief 获取源文本
+         */
+        const std::string& GetText()const noexcept { return m_stText; }
+
+        /**
+         * @brief 获取源名称
+         */
+        const std::string& GetSourceName()const noexcept { return m_stSourceName; }
+
+        /**
+         * @brief 获取上一次解析的Token数量
+         */
+        size_t GetLastParsedTokenCount()const noexcept { return m_stParser.GetLastParsedTokenCount(); }
+
+        /**
+         * @brief 编辑文档
+         * @exception InvalidArgumentException 编辑范围越界时抛出
+         * @exception ParseErrorException 解析失败时抛出，此时源文本已被修改
+         * @param start 起始位置
+         * @param removed 删除的长度
+         * @param text 插入的文本
+         * @param length 插入的长度
+         */
+        void Edit(size_t start, size_t removed, const char* text, size_t length);
+
+        /**
+         * @brief 获取模板
+         * @exception ParseErrorException 解析失败时抛出
+         */
+        std::shared_ptr<Template> GetTemplate();
+
+    private:
+        void Parse();
+
+    private:
+        std::string m_stText;
+        std::string m_stSourceName;
+        TextReader m_stReader;  // 解析器引用了读取器，构造语法树时仍会用到
+        TemplateParser m_stParser;
+        bool m_bParsed = false;
+        std::shared_ptr<Template> m_pTemplate;
+    };
+}
@@ -5,11 +5,15 @@
  */
 #pragma once
 #include "TemplateParser.hpp"
+#include "RenderContext.hpp"
 
-#include <lua.hpp>
+#include <mutex>
 
 namespace et
 {
+    class TemplateCompiler;
+    class TemplateAnalyzer;
+
     /**
      * @brief 模板渲染错误
      */
@@ -32,6 +36,11 @@ namespace et
         IfElse,
         For,
         While,
+        Include,
+        Extends,
+        NamedBlock,
+        Cache,
+        Macro,
     };
 
     /**
@@ -84,13 +93,48 @@ namespace et
          */
         virtual bool RemoveNode(size_t index)noexcept;
 
+        /**
+         * @brief 渲染节点
+         * @param context 渲染上下文
+         * @param L LUA环境
+         * @param env 环境Table索引，当0时不设置ENV
+         */
+        virtual void Render(RenderContext& context, lua_State* L, int env)const = 0;
+
         /**
          * @brief 渲染节点
          * @param builder 输出字符串
          * @param L LUA环境
          * @param env 环境Table索引，当0时不设置ENV
+         *
+         * 以不带限制的渲染上下文进行渲染。
+         */
+        void Render(std::string& builder, lua_State* L, int env)const;
+
+        /**
+         * @brief 编译节点
+         * @param compiler 编译器
+         *
+         * 将节点翻译为Lua代码，参见TemplateCompiler。
+         */
+        virtual void Compile(TemplateCompiler& compiler)const = 0;
+
+        /**
+         * @brief 分析依赖
+         * @param analyzer 分析器
+         *
+         * 参见TemplateAnalyzer，默认依次分析各子节点。
+         */
+        virtual void Analyze(TemplateAnalyzer& analyzer)const;
+
+        /**
+         * @brief 检查节点
+         * @exception LuaRuntimeException 代码块无法编译时抛出
+         * @param L LUA环境，只用于编译代码块
+         *
+         * 以与渲染时相同的方式编译节点的代码块但不执行，默认依次检查各子节点。
          */
-        virtual void Render(std::string& builder, lua_State* L, int env)const = 0;
+        virtual void Check(lua_State* L)const;
 
     protected:
         TemplateNodeBase* m_pParent = nullptr;
@@ -109,8 +153,10 @@ namespace et
         TemplateTextNode(std::string&& content);
 
     public:  // for TemplateNodeBase
+        using TemplateNodeBase::Render;
         TemplateNodeTypes GetType()const noexcept override;
-        void Render(std::string& builder, lua_State* L, int env)const override;
+        void Render(RenderContext& context, lua_State* L, int env)const override;
+        void Compile(TemplateCompiler& compiler)const override;
 
     private:
         std::string m_stContent;
@@ -133,13 +179,15 @@ namespace et
         TemplateBlockNode& operator=(TemplateBlockNode&& rhs)noexcept;
 
     public:  // for TemplateNodeBase
+        using TemplateNodeBase::Render;
         TemplateNodeTypes GetType()const noexcept override;
         size_t GetNodeCount()const noexcept override;
         TemplateNodeBase* GetNodeByIndex(size_t index)const noexcept override;
         size_t FindNode(TemplateNodeBase* node)const noexcept override;
         void AppendNode(std::unique_ptr<TemplateNodeBase>&& p)override;
         bool RemoveNode(size_t index)noexcept override;
-        void Render(std::string& builder, lua_State* L, int env)const override;
+        void Render(RenderContext& context, lua_State* L, int env)const override;
+        void Compile(TemplateCompiler& compiler)const override;
 
     private:
         std::vector<std::unique_ptr<TemplateNodeBase>> m_vecNodes;
@@ -155,16 +203,30 @@ namespace et
         public TemplateNodeBase
     {
     public:
-        TemplateExpressionNode(const char* source, uint32_t line, std::string&& expr);
+        TemplateExpressionNode(const char* source, uint32_t line, std::string&& expr,
+            EscapeModes escape=EscapeModes::None);
+
+    public:
+        /**
+         * @brief 获取转义模式
+         *
+         * 表达式输出的字符串和数字按照这一模式转义。
+         */
+        EscapeModes GetEscapeMode()const noexcept { return m_iEscapeMode; }
 
     public:  // for TemplateNodeBase
+        using TemplateNodeBase::Render;
         TemplateNodeTypes GetType()const noexcept override;
-        void Render(std::string& builder, lua_State* L, int env)const override;
+        void Render(RenderContext& context, lua_State* L, int env)const override;
+        void Compile(TemplateCompiler& compiler)const override;
+        void Analyze(TemplateAnalyzer& analyzer)const override;
+        void Check(lua_State* L)const override;
 
     private:
         const char* m_pszSource = nullptr;
         uint32_t m_uLine = 0;
         std::string m_stExpression;
+        EscapeModes m_iEscapeMode = EscapeModes::None;
     };
 
     /**
@@ -200,13 +262,17 @@ namespace et
         TemplateNodeBase* GetTrueBranchNodeByIndex(size_t idx)const noexcept;
 
     public:  // for TemplateNodeBase
+        using TemplateNodeBase::Render;
         TemplateNodeTypes GetType()const noexcept override;
         size_t GetNodeCount()const noexcept override;
         TemplateNodeBase* GetNodeByIndex(size_t index)const noexcept override;
         size_t FindNode(TemplateNodeBase* node)const noexcept override;
         void AppendNode(std::unique_ptr<TemplateNodeBase>&& p)override;
         bool RemoveNode(size_t index)noexcept override;
-        void Render(std::string& builder, lua_State* L, int env)const override;
+        void Render(RenderContext& context, lua_State* L, int env)const override;
+        void Compile(TemplateCompiler& compiler)const override;
+        void Analyze(TemplateAnalyzer& analyzer)const override;
+        void Check(lua_State* L)const override;
 
     protected:
         const char* m_pszSource = nullptr;
@@ -246,13 +312,17 @@ namespace et
         TemplateNodeBase* GetFalseBranchNodeByIndex(size_t idx)const noexcept;
 
     public:  // for TemplateNodeBase
+        using TemplateNodeBase::Render;
         TemplateNodeTypes GetType()const noexcept override;
         size_t GetNodeCount()const noexcept override;
         TemplateNodeBase* GetNodeByIndex(size_t index)const noexcept override;
         size_t FindNode(TemplateNodeBase* node)const noexcept override;
         void AppendNode(std::unique_ptr<TemplateNodeBase>&& p)override;
         bool RemoveNode(size_t index)noexcept override;
-        void Render(std::string& builder, lua_State* L, int env)const override;
+        void Render(RenderContext& context, lua_State* L, int env)const override;
+        void Compile(TemplateCompiler& compiler)const override;
+        void Analyze(TemplateAnalyzer& analyzer)const override;
+        void Check(lua_State* L)const override;
 
     private:
         std::vector<std::unique_ptr<TemplateNodeBase>> m_vecFalseBranchNodes;
@@ -273,13 +343,17 @@ namespace et
         TemplateWhileNode& operator=(TemplateWhileNode&& rhs)noexcept;
 
     public:  // for TemplateNodeBase
+        using TemplateNodeBase::Render;
         TemplateNodeTypes GetType()const noexcept override;
         size_t GetNodeCount()const noexcept override;
         TemplateNodeBase* GetNodeByIndex(size_t index)const noexcept override;
         size_t FindNode(TemplateNodeBase* node)const noexcept override;
         void AppendNode(std::unique_ptr<TemplateNodeBase>&& p)override;
         bool RemoveNode(size_t index)noexcept override;
-        void Render(std::string& builder, lua_State* L, int env)const override;
+        void Render(RenderContext& context, lua_State* L, int env)const override;
+        void Compile(TemplateCompiler& compiler)const override;
+        void Analyze(TemplateAnalyzer& analyzer)const override;
+        void Check(lua_State* L)const override;
 
     private:
         const char* m_pszSource = nullptr;
@@ -291,6 +365,8 @@ namespace et
 
     /**
      * @brief For节点
+     *
+     * 迭代器为et.range、ipairs或pairs时不调用迭代函数，直接在原生代码中循环。
      */
     class TemplateForNode :
         public TemplateNodeBase
@@ -304,13 +380,30 @@ namespace et
         TemplateForNode& operator=(TemplateForNode&& rhs)noexcept;
 
     public:  // for TemplateNodeBase
+        using TemplateNodeBase::Render;
         TemplateNodeTypes GetType()const noexcept override;
         size_t GetNodeCount()const noexcept override;
         TemplateNodeBase* GetNodeByIndex(size_t index)const noexcept override;
         size_t FindNode(TemplateNodeBase* node)const noexcept override;
         void AppendNode(std::unique_ptr<TemplateNodeBase>&& p)override;
         bool RemoveNode(size_t index)noexcept override;
-        void Render(std::string& builder, lua_State* L, int env)const override;
+        void Render(RenderContext& context, lua_State* L, int env)const override;
+        void Compile(TemplateCompiler& compiler)const override;
+        void Analyze(TemplateAnalyzer& analyzer)const override;
+        void Check(lua_State* L)const override;
+
+    private:
+        void AssignArgs(lua_State* L, int env, int count)const;
+        void RestoreArgs(lua_State* L, int env)const;
+        void RenderNodes(RenderContext& context, lua_State* L, int env)const;
+
+        // iter为迭代函数在栈上的位置，其后依次为状态和控制变量
+        // 原生路径无法继续时返回false，此时控制变量已经更新，由一般路径继续迭代
+        void RenderGeneric(RenderContext& context, lua_State* L, int env, int iter)const;
+        bool RenderRange(RenderContext& context, lua_State* L, int env, int iter)const;
+        bool RenderIntegerRange(RenderContext& context, lua_State* L, int env, int iter)const;
+        bool RenderIPairs(RenderContext& context, lua_State* L, int env, int iter)const;
+        bool RenderPairs(RenderContext& context, lua_State* L, int env, int iter)const;
 
     private:
         const char* m_pszSource = nullptr;
@@ -321,12 +414,195 @@ namespace et
         std::vector<std::unique_ptr<TemplateNodeBase>> m_vecNodes;
     };
 
+    /**
+     * @brief Include节点
+     *
+     * 渲染另一个模板，被引用的模板通过TemplateCache加载，在多次引用之间只解析一次。
+     * 模板名称是一个Lua表达式，当其为字符串字面量时在构造时即确定，不需要在渲染时求值。
+     * 被引用的模板与当前模板共享渲染上下文和环境。
+     */
+    class TemplateIncludeNode :
+        public TemplateNodeBase
+    {
+    public:
+        /**
+         * @brief 最大嵌套深度，用于阻止模板相互引用导致的无限递归
+         */
+        static const uint32_t kMaxIncludeDepth = 64;
+
+    public:
+        TemplateIncludeNode(const char* source, uint32_t line, std::string&& expr);
+
+    public:
+        /**
+         * @brief 获取静态的模板名称
+         * @return 若名称需要在渲染时求值则为空
+         */
+        const std::string& GetStaticName()const noexcept { return m_stStaticName; }
+
+    public:  // for TemplateNodeBase
+        using TemplateNodeBase::Render;
+        TemplateNodeTypes GetType()const noexcept override;
+        void Render(RenderContext& context, lua_State* L, int env)const override;
+        void Compile(TemplateCompiler& compiler)const override;
+        void Analyze(TemplateAnalyzer& analyzer)const override;
+        void Check(lua_State* L)const override;
+
+    private:
+        const char* m_pszSource = nullptr;
+        uint32_t m_uLine = 0;
+        std::string m_stExpression;
+        std::string m_stStaticName;
+    };
+
+    /**
+     * @brief Extends节点
+     *
+     * 声明当前模板继承自另一个模板，只能出现在模板的顶层。
+     * 继承关系在构造模板时展开（参见ResolveExtends），展开后语法树中不再含有这一节点。
+     */
+    class TemplateExtendsNode :
+        public TemplateNodeBase
+    {
+    public:
+        TemplateExtendsNode(const char* source, uint32_t line, std::string&& expr);
+
+    public:
+        const char* GetSource()const noexcept { return m_pszSource; }
+        uint32_t GetLine()const noexcept { return m_uLine; }
+
+        /**
+         * @brief 获取被继承的模板名称
+         */
+        const std::string& GetName()const noexcept { return m_stName; }
+
+    public:  // for TemplateNodeBase
+        using TemplateNodeBase::Render;
+        TemplateNodeTypes GetType()const noexcept override;
+        void Render(RenderContext& context, lua_State* L, int env)const override;
+        void Compile(TemplateCompiler& compiler)const override;
+
+    private:
+        const char* m_pszSource = nullptr;
+        uint32_t m_uLine = 0;
+        std::string m_stName;
+    };
+
+    /**
+     * @brief 命名块节点
+     *
+     * 定义一个可以被子模板覆盖的块，渲染时与块节点一致。
+     */
+    class TemplateNamedBlockNode :
+        public TemplateBlockNode
+    {
+    public:
+        TemplateNamedBlockNode(const char* source, uint32_t line, std::string&& name);
+
+    public:
+        const char* GetSource()const noexcept { return m_pszSource; }
+        uint32_t GetLine()const noexcept { return m_uLine; }
+
+        /**
+         * @brief 获取块名称
+         */
+        const std::string& GetName()const noexcept { return m_stName; }
+
+        /**
+         * @brief 以另一个块的内容替换当前块的内容
+         * @param rhs 另一个块，其内容被移走
+         */
+        void ReplaceContent(TemplateNamedBlockNode& rhs)noexcept;
+
+    public:  // for TemplateNodeBase
+        TemplateNodeTypes GetType()const noexcept override;
+
+    private:
+        const char* m_pszSource = nullptr;
+        uint32_t m_uLine = 0;
+        std::string m_stName;
+    };
+
+    /**
+     * @brief 片段缓存节点
+     *
+     * 以表达式的值为键，将块的渲染结果保存在FragmentCache中，命中时直接输出而不执行块内的节点。
+     * 表达式的第一个返回值为键（字符串或数字），第二个返回值为可选的有效时间（秒）。
+     */
+    class TemplateCacheNode :
+        public TemplateBlockNode
+    {
+    public:
+        TemplateCacheNode(const char* source, uint32_t line, std::string&& expr);
+
+    public:  // for TemplateNodeBase
+        using TemplateNodeBase::Render;
+        TemplateNodeTypes GetType()const noexcept override;
+        void Render(RenderContext& context, lua_State* L, int env)const override;
+        void Compile(TemplateCompiler& compiler)const override;
+        void Analyze(TemplateAnalyzer& analyzer)const override;
+        void Check(lua_State* L)const override;
+
+    private:
+        const char* m_pszSource = nullptr;
+        uint32_t m_uLine = 0;
+        std::string m_stExpression;
+    };
+
+    /**
+     * @brief 宏节点
+     *
+     * 定义一个可以在表达式中调用的宏，例如"{% macro card(title) %}...{% end %}"，之后通过"{% card('x') %}"调用。
+     * 宏体在定义时只编译一次为Lua函数（参见TemplateCompiler），以宏名称写入ENV，调用时返回宏体的渲染结果。
+     * 宏体内的节点总是以编译产物的方式执行，因而不计入RenderProfiler的统计。
+     */
+    class TemplateMacroNode :
+        public TemplateBlockNode
+    {
+    public:
+        TemplateMacroNode(const char* source, uint32_t line, std::string&& name, std::vector<std::string>&& args);
+
+    public:
+        const char* GetSource()const noexcept { return m_pszSource; }
+        uint32_t GetLine()const noexcept { return m_uLine; }
+
+        /**
+         * @brief 获取宏名称
+         */
+        const std::string& GetName()const noexcept { return m_stName; }
+
+        /**
+         * @brief 获取参数列表
+         */
+        const std::vector<std::string>& GetArgumentList()const noexcept { return m_stArgList; }
+
+    public:  // for TemplateNodeBase
+        using TemplateNodeBase::Render;
+        TemplateNodeTypes GetType()const noexcept override;
+        void Render(RenderContext& context, lua_State* L, int env)const override;
+        void Compile(TemplateCompiler& compiler)const override;
+        void Analyze(TemplateAnalyzer& analyzer)const override;
+        void Check(lua_State* L)const override;
+
+    private:
+        const char* m_pszSource = nullptr;
+        uint32_t m_uLine = 0;
+        std::string m_stName;
+        std::vector<std::string> m_stArgList;
+
+        void PrepareCode(lua_State* L)const;
+
+        // 逐节点渲染时使用的定义代码的字节码，首次渲染时生成
+        mutable std::once_flag m_stCodeFlag;
+        mutable std::string m_stCode;
+    };
+
     /**
      * @brief 构建语法树
      * @param parser 解析器
      * @return 构造结果
      *
-     * 操作完成后Parser内的Token会被清空。
+     * 操作完成后Parser内的Token会被清空。启用增量解析时Token保持不变，其内容被复制到语法树中。
      */
     std::unique_ptr<TemplateBlockNode> BuildRootNode(TemplateParser& parser);
 }
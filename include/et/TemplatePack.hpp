@@ -0,0 +1,136 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/30
+ */
+#pragma once
+#include "Template.hpp"
+
+#include <map>
+
+namespace et
+{
+    /**
+     * @brief 模板包
+     *
+     * 将一组模板打包为单个文件，加载时整体映射到内存（参见MappedFile），不需要逐个打开文件。
+     * 包中按名称排序的索引之后依次存放名称、模板源文本以及编译产物的Lua字节码：
+     *  - 编译产物直接从映射中加载字节码，既不解析模板也不编译Lua代码
+     *  - 逐节点渲染的模板仍需从映射中的源文本解析，但不发生文件I/O
+     *
+     * 字节码与Lua的版本和编译选项相关，且加载时不做校验，因此包只能在相同构建的程序之间使用，并且只应加载可信的包。
+     */
+    class TemplatePack
+    {
+    public:
+        /**
+         * @brief 文件格式版本
+         */
+        static const uint32_t kVersion = 1;
+
+        /**
+         * @brief 包中的一项
+         *
+         * 各指针指向映射的内存，与包同生命期。Name以'\0'结尾。
+         */
+        struct Entry
+        {
+            const char* Name = nullptr;
+            size_t NameLength = 0;
+            const char* Source = nullptr;
+            size_t SourceLength = 0;
+            const char* Code = nullptr;
+            size_t CodeLength = 0;
+        };
+
+    public:
+        /**
+         * @brief 打开模板包
+         * @exception IOException 读取失败或格式有误时抛出
+         * @param path 文件路径
+         */
+        explicit TemplatePack(const char* path);
+
+        TemplatePack(const TemplatePack&) = delete;
+        TemplatePack& operator=(const TemplatePack&) = delete;
+
+    public:
+        /**
+         * @brief 获取模板数量
+         */
+        size_t GetCount()const noexcept { return m_ullCount; }
+
+        /**
+         * @brief 获取指定项
+         * @param index 索引，按名称排序
+         */
+        Entry GetEntry(size_t index)const noexcept;
+
+        /**
+         * @brief 按名称查找
+         * @param name 模板名称
+         * @param[out] entry 找到的项
+         * @return 是否找到
+         */
+        bool Find(const std::string& name, Entry& entry)const noexcept;
+
+        /**
+         * @brief 从源文本解析模板
+         * @exception ParseErrorException 解析失败时抛出
+         * @param entry 项
+         */
+        std::shared_ptr<Template> LoadTemplate(const Entry& entry)const;
+
+    private:
+        MappedFile m_stFile;
+        size_t m_ullCount = 0;
+    };
+
+    /**
+     * @brief 模板包构造器
+     *
+     * 添加模板时即解析并编译，继承的模板通过TemplateCache按名称加载，调用方需要事先设置好搜索路径。
+     */
+    class TemplatePackBuilder
+    {
+    public:
+        /**
+         * @brief 构造
+         * @param L 虚拟机环境，用于编译模板
+         */
+        explicit TemplatePackBuilder(lua_State* L);
+
+    public:
+        /**
+         * @brief 获取已添加的模板数量
+         */
+        size_t GetCount()const noexcept { return m_stItems.size(); }
+
+        /**
+         * @brief 添加模板
+         * @exception InvalidArgumentException 名称重复时抛出
+         * @exception ParseErrorException 解析失败时抛出
+         * @exception LuaRuntimeException 编译失败时抛出
+         * @param name 模板名称，同时作为源名称
+         * @param source 源文本
+         * @param length 源文本长度
+         */
+        void Add(const std::string& name, const char* source, size_t length);
+
+        /**
+         * @brief 生成模板包
+         * @param[out] out 输出
+         */
+        void Save(std::string& out)const;
+
+    private:
+        struct Item
+        {
+            std::string Source;
+            std::string Code;
+        };
+
+        lua_State* m_pState = nullptr;
+        std::map<std::string, Item> m_stItems;
+    };
+}
@@ -36,6 +36,13 @@ namespace et
             ElseIf,
             For,
             While,
+            Include,
+            Extends,
+            NamedBlock,
+            Cache,
+            Macro,
+            RawExpression,
+            AutoEscape,
         };
 
         /**
@@ -83,6 +90,25 @@ namespace et
          */
         void SetPrettifyEnable(bool e)noexcept { m_bPrettify = e; }
 
+        /**
+         * @brief 检查是否启用增量解析
+         *
+         * 启用后解析器会额外保存修饰前的Token及其起始位置，此后可以通过Update在编辑后只重新解析受影响的部分。
+         */
+        bool IsIncrementalEnabled()const noexcept { return m_bIncremental; }
+
+        /**
+         * @brief 设置是否启用增量解析
+         *
+         * 需要在Run之前设置。
+         */
+        void SetIncrementalEnable(bool e)noexcept { m_bIncremental = e; }
+
+        /**
+         * @brief 获取上一次Run或Update重新解析的Token数量
+         */
+        size_t GetLastParsedTokenCount()const noexcept { return m_ullLastParsedTokenCount; }
+
         /**
          * @brief 获取最终解析的Token数量
          */
@@ -111,6 +137,30 @@ namespace et
          */
         void Run(TextReader& reader)override;
 
+        /**
+         * @brief 增量解析
+         * @exception InvalidCallException 未启用增量解析，或者此前的解析失败时抛出
+         * @exception ParseErrorException 解析失败时抛出，此后需要重新调用Run
+         * @param reader 编辑后的源
+         * @param start 编辑的起始位置
+         * @param removed 被删除的长度（相对于编辑前的源）
+         * @param inserted 插入的长度
+         *
+         * 从受影响的Token之前的边界开始重新解析，直到解析位置与编辑前的某个Token的起始位置重合，
+         * 此后的Token保持不变，只平移其位置、行号和列号。Token之间不存在解析状态，因此重合之后的结果与完整解析一致。
+         * 输出的Token同样原地替换，修饰只在替换范围前后相邻的语句和文本上重新进行，未受影响的Token不会被复制。
+         */
+        void Update(TextReader& reader, size_t start, size_t removed, size_t inserted);
+
+        /**
+         * @brief 从增量解析保存的Token重新生成全部输出
+         * @exception InvalidCallException 未启用增量解析，或者此前的解析失败时抛出
+         *
+         * 启用增量解析时构造语法树只复制输出的Token的内容（参见BuildRootNode），一般不需要调用，
+         * 修改修饰选项或者清空输出后可以通过这一方法重新生成。
+         */
+        void Refresh();
+
     private:
         void SkipBlank();
         bool TryAcceptIdentifierOrKeyword(std::string& out);
@@ -118,15 +168,31 @@ namespace et
         bool ParseOuter(Token& result);
         void ParseInner(Token& result);
 
-        void Prettify();
+        void Prettify(const std::vector<Token>& tokens, size_t begin, size_t end);
+        static void ApplyTrims(Token& token, uint8_t trims);
 
     private:
+        enum
+        {
+            kTrimLeft = 1,
+            kTrimRight = 2,
+        };
+
         bool m_bPrettify = true;
+        bool m_bIncremental = false;
+        size_t m_ullLastParsedTokenCount = 0;
 
         // 临时变量
         std::string m_stTmpBuffer;
 
         // 解析器输出
         std::vector<Token> m_stTokenList;
+        std::vector<uint8_t> m_stTokenTrims;  // 修饰时每个Token需要剔除的空白（kTrimLeft、kTrimRight）
+
+        // 增量解析状态：修饰前的Token及其起始位置，Token首尾相接覆盖整个源
+        bool m_bRawTokenValid = false;
+        std::vector<Token> m_stRawTokenList;
+        std::vector<TextReader::Anchor> m_stRawTokenBegins;
+        TextReader::Anchor m_stRawTokenEnd;
     };
 }
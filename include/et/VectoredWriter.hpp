@@ -0,0 +1,111 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/28
+ */
+#pragma once
+#include "Base.hpp"
+
+namespace et
+{
+    /**
+     * @brief 向量化输出
+     *
+     * 将输出记录为若干片段，批量通过writev写入文件描述符（文件、管道或者套接字）。
+     *
+     * 片段分为两类：
+     *  - 引用片段：直接引用调用方的内存（例如模板中的文本），不发生复制，调用方需保证其在Flush前有效
+     *  - 复制片段：复制到内部的暂存区（例如表达式的结果），暂存区写满时整体写出
+     *
+     * 对于以静态文本为主的页面，绝大部分字节只在内核中复制一次。
+     *
+     * 子类可以覆盖WriteSegments将片段输出到其他位置（例如Lua字符串）。
+     */
+    class VectoredWriter
+    {
+    public:
+        /**
+         * @brief 每批最多的片段数
+         */
+        static const size_t kMaxBatchSize = 256;
+
+        /**
+         * @brief 暂存区大小
+         */
+        static const size_t kArenaSize = 16 * 1024;
+
+    public:
+        /**
+         * @brief 构造输出
+         * @param fd 文件描述符，不会被关闭
+         */
+        explicit VectoredWriter(int fd);
+        virtual ~VectoredWriter() = default;
+
+        VectoredWriter(const VectoredWriter&) = delete;
+        VectoredWriter& operator=(const VectoredWriter&) = delete;
+
+    protected:
+        VectoredWriter();
+
+    public:
+        /**
+         * @brief 获取已经写入（含尚未写出）的字节数
+         */
+        uint64_t GetSize()const noexcept { return m_ullSize; }
+
+        /**
+         * @brief 输出一个复制片段
+         * @exception IOException 写出失败时抛出
+         * @param data 数据
+         * @param length 长度
+         *
+         * 超过暂存区一半大小的数据在写出已有片段后直接写出，不经过暂存区。
+         */
+        void Write(const char* data, size_t length);
+
+        /**
+         * @brief 输出一个引用片段
+         * @exception IOException 写出失败时抛出
+         * @param data 数据，在下次Flush前必须有效
+         * @param length 长度
+         */
+        void WriteReference(const char* data, size_t length);
+
+        /**
+         * @brief 写出所有片段
+         * @exception IOException 写出失败时抛出
+         */
+        void Flush();
+
+    protected:
+        struct Segment
+        {
+            const char* Data;
+            size_t Length;
+        };
+
+        /**
+         * @brief 写出一批片段
+         * @exception IOException 写出失败时抛出
+         * @param segments 片段
+         * @param count 片段数，不超过kMaxBatchSize
+         *
+         * 默认实现通过writev写入文件描述符，返回后片段不再有效。
+         */
+        virtual void WriteSegments(const Segment* segments, size_t count);
+
+    private:
+        void Append(const char* data, size_t length);
+
+    private:
+        int m_iFd = -1;
+        uint64_t m_ullSize = 0;
+
+        Segment m_stSegments[kMaxBatchSize];
+        size_t m_ullSegmentCount = 0;
+
+        std::unique_ptr<char[]> m_pArena;
+        size_t m_ullArenaUsed = 0;
+    };
+}
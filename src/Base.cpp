@@ -6,7 +6,21 @@
 #include <et/Base.hpp>
 
 #include <set>
+#include <mutex>
 #include <fstream>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#define ET_HAS_MMAP
+#endif
 
 using namespace std;
 using namespace et;
@@ -106,14 +120,27 @@ std::string et::FormatV(const char* format, std::va_list args)noexcept
 {
     string ret;
 
-    // 计算format后占用大小
+    // 先格式化到栈上的缓冲区，多数情况下一次即可完成，同时得到format后占用大小
+    char buffer[256];
     va_list ap;
     va_copy(ap, args);
-    const int l = vsnprintf(nullptr, 0, format, ap);
+    const int l = vsnprintf(buffer, sizeof(buffer), format, ap);
     va_end(ap);
 
     if (l < 0)
         return string();
+    if (static_cast<size_t>(l) < sizeof(buffer))
+    {
+        try
+        {
+            ret.assign(buffer, static_cast<size_t>(l));
+        }
+        catch (...)
+        {
+            ret.clear();
+        }
+        return ret;
+    }
 
     // 尝试分配足够大小
     try
@@ -182,26 +209,199 @@ void et::ReadFile(std::string& out, const char* path)
     if (!t.good())
         ET_THROW(IOException, "Seek to begin on file \"%s\" error", path);
 
-    out.assign((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
-    if (out.length() != (size_t)size)
+    out.resize(static_cast<size_t>(size));
+    t.read(&out[0], size);
+    if (t.gcount() != size)
         ET_THROW(IOException, "Read file \"%s\" error", path);
 }
 
+namespace
+{
+    void ListFilesRecursive(std::vector<std::string>& out, const std::string& dir, const std::string& prefix)
+    {
+        vector<string> names;
+
+#ifdef _WIN32
+        _finddata_t data;
+        auto handle = ::_findfirst((dir + "/*").c_str(), &data);
+        if (handle == -1)
+            ET_THROW(IOException, "Open directory \"%s\" error", dir.c_str());
+        do
+        {
+            if (data.name[0] != '.')
+                names.emplace_back(data.name);
+        } while (::_findnext(handle, &data) == 0);
+        ::_findclose(handle);
+#else
+        DIR* d = ::opendir(dir.c_str());
+        if (!d)
+            ET_THROW(IOException, "Open directory \"%s\" error", dir.c_str());
+        try
+        {
+            while (auto entry = ::readdir(d))
+            {
+                if (entry->d_name[0] != '.')
+                    names.emplace_back(entry->d_name);
+            }
+        }
+        catch (...)
+        {
+            ::closedir(d);
+            throw;
+        }
+        ::closedir(d);
+#endif
+
+        sort(names.begin(), names.end());
+        for (const auto& name : names)
+        {
+            string path = dir + "/" + name;
+
+            struct stat st;
+            if (::stat(path.c_str(), &st) != 0)
+                continue;
+            if ((st.st_mode & S_IFMT) == S_IFDIR)
+                ListFilesRecursive(out, path, prefix + name + "/");
+            else if ((st.st_mode & S_IFMT) == S_IFREG)
+                out.push_back(prefix + name);
+        }
+    }
+}
+
+void et::ListFiles(std::vector<std::string>& out, const char* dir)
+{
+    string root(dir);
+    while (root.length() > 1 && (root.back() == '/' || root.back() == '\\'))
+        root.pop_back();
+
+    out.clear();
+    ListFilesRecursive(out, root, string());
+}
+
+//////////////////////////////////////////////////////////////////////////////// MappedFile
+
+#ifdef _WIN32
+#define ET_OPEN_FILE(path) ::_open(path, _O_RDONLY | _O_BINARY)
+#define ET_CLOSE_FILE ::_close
+#define ET_READ_FILE(fd, buf, size) ::_read(fd, buf, static_cast<unsigned>(size))
+#else
+#define ET_OPEN_FILE(path) ::open(path, O_RDONLY | O_CLOEXEC)
+#define ET_CLOSE_FILE ::close
+#define ET_READ_FILE(fd, buf, size) ::read(fd, buf, size)
+#endif
+
+MappedFile::MappedFile(const char* path)
+{
+    int fd = ET_OPEN_FILE(path);
+    if (fd < 0)
+        ET_THROW(IOException, "Open file \"%s\" error", path);
+
+    try
+    {
+        Load(fd, path);
+    }
+    catch (...)
+    {
+        ET_CLOSE_FILE(fd);
+        throw;
+    }
+    ET_CLOSE_FILE(fd);  // 映射在文件关闭后仍然有效
+}
+
+MappedFile::MappedFile(int fd, const char* name)
+{
+    Load(fd, name);
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef ET_HAS_MMAP
+    if (m_pMapped)
+        ::munmap(const_cast<char*>(m_pMapped), m_ullMappedSize);
+#endif
+}
+
+void MappedFile::Load(int fd, const char* name)
+{
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+        ET_THROW(IOException, "Stat file \"%s\" error", name);
+
+#ifdef ET_HAS_MMAP
+    // 只映射非空的普通文件，其余情况（管道、终端等）读入缓冲区
+    if (S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        auto size = static_cast<size_t>(st.st_size);
+        void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            ::madvise(p, size, MADV_SEQUENTIAL);
+            m_pMapped = static_cast<const char*>(p);
+            m_ullMappedSize = size;
+            return;
+        }
+    }
+#endif
+
+    // 已知大小时一次分配到位
+    size_t used = 0;
+    if ((st.st_mode & S_IFMT) == S_IFREG && st.st_size > 0)
+        m_stBuffer.resize(static_cast<size_t>(st.st_size));
+
+    while (true)
+    {
+        if (m_stBuffer.size() - used < kReadBlockSize)
+            m_stBuffer.resize(used + kReadBlockSize);
+
+        auto ret = ET_READ_FILE(fd, &m_stBuffer[used], m_stBuffer.size() - used);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            ET_THROW(IOException, "Read file \"%s\" error", name);
+        }
+        if (ret == 0)
+            break;
+        used += static_cast<size_t>(ret);
+    }
+    m_stBuffer.resize(used);
+}
+
 //////////////////////////////////////////////////////////////////////////////// Exception
 
+struct Exception::Detail
+{
+    std::string Source;
+    uint32_t Line = 0;
+    uint32_t Column = 0;
+    std::string Message;
+
+    std::once_flag DescriptionFlag;
+    std::string Description;  // 带有源位置时，在首次调用what()时拼接
+};
+
 Exception::Exception(const char* file, int line, const char* func, const char* format, ...)
-    : m_pszFile(file), m_iLine(line), m_pszFunc(func)
+    : m_pszFile(file), m_iLine(line), m_pszFunc(func), m_pDetail(make_shared<Detail>())
 {
     va_list args;
     va_start(args, format);
-    auto description(FormatV(format, args));
+    m_pDetail->Message = FormatV(format, args);
     va_end(args);
+}
 
-    m_pDescription = make_shared<string>(std::move(description));
+Exception::Exception(const char* file, int line, const char* func, const SourceLocation& location,
+    std::string message)
+    : m_pszFile(file), m_iLine(line), m_pszFunc(func), m_pDetail(make_shared<Detail>())
+{
+    if (location.Source)
+        m_pDetail->Source = location.Source;
+    m_pDetail->Line = location.Line;
+    m_pDetail->Column = location.Column;
+    m_pDetail->Message = std::move(message);
 }
 
 Exception::Exception(const Exception& rhs)noexcept
-    : m_pszFile(rhs.m_pszFile), m_iLine(rhs.m_iLine), m_pszFunc(rhs.m_pszFunc), m_pDescription(rhs.m_pDescription)
+    : m_pszFile(rhs.m_pszFile), m_iLine(rhs.m_iLine), m_pszFunc(rhs.m_pszFunc), m_pDetail(rhs.m_pDetail)
 {
 }
 
@@ -210,7 +410,7 @@ Exception::Exception(Exception&& rhs)noexcept
     std::swap(m_pszFile, rhs.m_pszFile);
     std::swap(m_iLine, rhs.m_iLine);
     std::swap(m_pszFunc, rhs.m_pszFunc);
-    std::swap(m_pDescription, rhs.m_pDescription);
+    std::swap(m_pDetail, rhs.m_pDetail);
 }
 
 Exception& Exception::operator=(const Exception& rhs)noexcept
@@ -218,7 +418,7 @@ Exception& Exception::operator=(const Exception& rhs)noexcept
     m_pszFile = rhs.m_pszFile;
     m_iLine = rhs.m_iLine;
     m_pszFunc = rhs.m_pszFunc;
-    m_pDescription = rhs.m_pDescription;
+    m_pDetail = rhs.m_pDetail;
     return *this;
 }
 
@@ -227,18 +427,64 @@ Exception& Exception::operator=(Exception&& rhs)noexcept
     m_pszFile = rhs.m_pszFile;
     m_iLine = rhs.m_iLine;
     m_pszFunc = rhs.m_pszFunc;
-    m_pDescription = rhs.m_pDescription;
+    m_pDetail = rhs.m_pDetail;
 
     rhs.m_pszFile = nullptr;
     rhs.m_iLine = 0;
     rhs.m_pszFunc = nullptr;
-    rhs.m_pDescription = nullptr;
+    rhs.m_pDetail = nullptr;
     return *this;
 }
 
 const char* Exception::GetDescription()const noexcept
 {
-    return m_pDescription ? m_pDescription->c_str() : "";
+    if (!m_pDetail)
+        return "";
+    if (m_pDetail->Source.empty())
+        return m_pDetail->Message.c_str();
+
+    auto detail = m_pDetail.get();
+    try
+    {
+        std::call_once(detail->DescriptionFlag, [detail]() {
+            char location[32];
+            if (detail->Column != 0)
+                sprintf(location, ":%u:%u: ", detail->Line, detail->Column);
+            else
+                sprintf(location, ":%u: ", detail->Line);
+
+            string description;
+            description.reserve(detail->Source.length() + strlen(location) + detail->Message.length());
+            description.append(detail->Source);
+            description.append(location);
+            description.append(detail->Message);
+            detail->Description = std::move(description);
+        });
+    }
+    catch (...)  // 内存不足时退化为不带位置的信息
+    {
+    }
+    return detail->Description.empty() ? detail->Message.c_str() : detail->Description.c_str();
+}
+
+const char* Exception::GetSource()const noexcept
+{
+    return m_pDetail ? m_pDetail->Source.c_str() : "";
+}
+
+uint32_t Exception::GetSourceLine()const noexcept
+{
+    return m_pDetail ? m_pDetail->Line : 0;
+}
+
+uint32_t Exception::GetSourceColumn()const noexcept
+{
+    return m_pDetail ? m_pDetail->Column : 0;
+}
+
+const char* Exception::GetErrorMessage()const noexcept
+{
+    return m_pDetail ? m_pDetail->Message.c_str() : "";
 }
 
 const char* Exception::what()const noexcept
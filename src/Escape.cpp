@@ -0,0 +1,273 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/27
+ */
+#include <et/Escape.hpp>
+
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ET_ESCAPE_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace et;
+
+static std::atomic<int> s_iDefaultEscapeMode(static_cast<int>(EscapeModes::None));
+
+namespace
+{
+    const char kHexDigitTable[16] = {
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+    };
+
+    /**
+     * @brief 需要转义的字符集
+     *
+     * 至多5个字符，另可选择包含全部控制字符（0x00~0x1F）。
+     * SSE2逐个比较Chars，其余情况按字节查Special表。
+     */
+    struct CharSet
+    {
+        char Chars[5];
+        int Count;
+        bool Control;
+        bool Special[256];
+    };
+
+    CharSet MakeCharSet(const char* chars, int count, bool control)noexcept
+    {
+        assert(count <= 5);
+
+        CharSet set {};
+        set.Count = count;
+        set.Control = control;
+        for (int i = 0; i < count; ++i)
+        {
+            set.Chars[i] = chars[i];
+            set.Special[static_cast<uint8_t>(chars[i])] = true;
+        }
+        if (control)
+        {
+            for (int i = 0; i < 0x20; ++i)
+                set.Special[i] = true;
+        }
+        return set;
+    }
+
+    const CharSet& GetCharSet(EscapeModes mode)noexcept
+    {
+        static const CharSet kHtml = MakeCharSet("&<>\"'", 5, false);
+        static const CharSet kJson = MakeCharSet("\"\\", 2, true);
+        static const CharSet kSql = MakeCharSet("'", 1, false);
+
+        switch (mode)
+        {
+            case EscapeModes::Json:
+                return kJson;
+            case EscapeModes::Sql:
+                return kSql;
+            default:
+                return kHtml;
+        }
+    }
+
+    bool IsSpecial(const CharSet& set, char ch)noexcept
+    {
+        return set.Special[static_cast<uint8_t>(ch)];
+    }
+
+    /**
+     * @brief 寻找第一个需要转义的字符
+     * @return 位置，若不存在返回length
+     */
+    size_t FindSpecial(const CharSet& set, const char* data, size_t length)noexcept
+    {
+        size_t i = 0;
+
+#ifdef ET_ESCAPE_SSE2
+        __m128i chars[5];
+        for (int j = 0; j < set.Count; ++j)
+            chars[j] = _mm_set1_epi8(set.Chars[j]);
+        const __m128i controlMax = _mm_set1_epi8(0x1F);
+
+        for (; i + 16 <= length; i += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            __m128i hit = _mm_setzero_si128();
+            for (int j = 0; j < set.Count; ++j)
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, chars[j]));
+            if (set.Control)  // 无符号比较：min(x, 0x1F) == x即x <= 0x1F
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(block, controlMax), block));
+
+            int mask = _mm_movemask_epi8(hit);
+            if (mask != 0)
+            {
+#if defined(_MSC_VER) && !defined(__clang__)
+                unsigned long index = 0;
+                _BitScanForward(&index, static_cast<unsigned long>(mask));
+                return i + index;
+#else
+                return i + static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+#endif
+            }
+        }
+#endif
+
+        for (; i < length; ++i)
+        {
+            if (IsSpecial(set, data[i]))
+                return i;
+        }
+        return length;
+    }
+
+    void AppendEscapedChar(std::string& out, char ch, EscapeModes mode)
+    {
+        switch (mode)
+        {
+            case EscapeModes::Html:
+            case EscapeModes::Xml:
+                switch (ch)
+                {
+                    case '&':
+                        out.append("&amp;", 5);
+                        break;
+                    case '<':
+                        out.append("&lt;", 4);
+                        break;
+                    case '>':
+                        out.append("&gt;", 4);
+                        break;
+                    case '"':
+                        out.append("&quot;", 6);
+                        break;
+                    case '\'':
+                        if (mode == EscapeModes::Html)
+                            out.append("&#39;", 5);
+                        else
+                            out.append("&apos;", 6);
+                        break;
+                    default:
+                        assert(false);
+                        out.push_back(ch);
+                        break;
+                }
+                break;
+            case EscapeModes::Json:
+                switch (ch)
+                {
+                    case '"':
+                        out.append("\\\"", 2);
+                        break;
+                    case '\\':
+                        out.append("\\\\", 2);
+                        break;
+                    case '\b':
+                        out.append("\\b", 2);
+                        break;
+                    case '\f':
+                        out.append("\\f", 2);
+                        break;
+                    case '\n':
+                        out.append("\\n", 2);
+                        break;
+                    case '\r':
+                        out.append("\\r", 2);
+                        break;
+                    case '\t':
+                        out.append("\\t", 2);
+                        break;
+                    default:
+                        {
+                            char buf[6] = { '\\', 'u', '0', '0', '0', '0' };
+                            buf[4] = kHexDigitTable[(static_cast<uint8_t>(ch) >> 4) & 0x0F];
+                            buf[5] = kHexDigitTable[static_cast<uint8_t>(ch) & 0x0F];
+                            out.append(buf, sizeof(buf));
+                        }
+                        break;
+                }
+                break;
+            case EscapeModes::Sql:
+                assert(ch == '\'');
+                out.append("''", 2);
+                break;
+            default:
+                assert(false);
+                out.push_back(ch);
+                break;
+        }
+    }
+}
+
+bool et::ParseEscapeMode(const char* name, EscapeModes& mode)noexcept
+{
+    static const EscapeModes kModes[] = {
+        EscapeModes::None, EscapeModes::Html, EscapeModes::Xml, EscapeModes::Json, EscapeModes::Sql,
+    };
+
+    for (auto m : kModes)
+    {
+        if (strcmp(name, GetEscapeModeName(m)) == 0)
+        {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* et::GetEscapeModeName(EscapeModes mode)noexcept
+{
+    switch (mode)
+    {
+        case EscapeModes::None:
+            return "none";
+        case EscapeModes::Html:
+            return "html";
+        case EscapeModes::Xml:
+            return "xml";
+        case EscapeModes::Json:
+            return "json";
+        case EscapeModes::Sql:
+            return "sql";
+        default:
+            assert(false);
+            return "none";
+    }
+}
+
+void et::AppendEscaped(std::string& out, const char* data, size_t length, EscapeModes mode)
+{
+    if (mode == EscapeModes::None)
+    {
+        out.append(data, length);
+        return;
+    }
+
+    const CharSet& set = GetCharSet(mode);
+    while (length > 0)
+    {
+        // 整段复制不需要转义的部分
+        size_t safe = FindSpecial(set, data, length);
+        out.append(data, safe);
+        if (safe == length)
+            break;
+
+        AppendEscapedChar(out, data[safe], mode);
+        data += safe + 1;
+        length -= safe + 1;
+    }
+}
+
+EscapeModes et::GetDefaultEscapeMode()noexcept
+{
+    return static_cast<EscapeModes>(s_iDefaultEscapeMode.load(memory_order_relaxed));
+}
+
+void et::SetDefaultEscapeMode(EscapeModes mode)noexcept
+{
+    s_iDefaultEscapeMode.store(static_cast<int>(mode), memory_order_relaxed);
+}
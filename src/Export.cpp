@@ -5,60 +5,1208 @@
  */
 #include <et.hpp>
 #include <et/TemplateNode.hpp>
+#include <et/Template.hpp>
+#include <et/TemplateCompiler.hpp>
+#include <et/RenderProfiler.hpp>
+#include <et/RenderObserver.hpp>
+#include <et/TemplateCache.hpp>
+#include <et/TemplatePack.hpp>
+#include <et/TemplateDocument.hpp>
+#include <et/TemplateAnalyzer.hpp>
+#include <et/FragmentCache.hpp>
+#include <et/Escape.hpp>
+#include <et/VectoredWriter.hpp>
+#include <et/NativeIterator.hpp>
+
+#include <limits>
+#include <chrono>
 
 using namespace std;
 using namespace et;
 
 //////////////////////////////////////////////////////////////////////////////// Export for lua
 
+static const char kTemplateName[] = "et.Template";
+static const char kDocumentName[] = "et.Document";
+static const char kProfilerName[] = "et.Profiler";
+static const char kProfilerKey = 0;
+static const char kObserverKey = 0;
+static const size_t kDefaultChunkSize = 16 * 1024;
+
 static const char kHexDigitTable[16] = {
     '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
 };
 
-namespace
-{
-    static int LuaIsArray(lua_State* L)noexcept;
+namespace
+{
+    static int LuaIsArray(lua_State* L)noexcept;
+
+    /**
+     * @brief Lua侧持有的性能分析器
+     *
+     * 每个虚拟机至多一个，存放在注册表中，启用期间所有经由Lua发起的渲染都会被统计。
+     */
+    struct LuaProfiler
+    {
+        RenderProfiler Instance;
+        bool Enabled = false;
+    };
+
+    static LuaProfiler* GetLuaProfiler(lua_State* L)noexcept
+    {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &kProfilerKey);
+        auto profiler = static_cast<LuaProfiler*>(lua_touserdata(L, -1));
+        lua_pop(L, 1);
+        return profiler;
+    }
+
+    static RenderProfiler* GetActiveProfiler(lua_State* L)noexcept
+    {
+        auto profiler = GetLuaProfiler(L);
+        return (profiler && profiler->Enabled) ? &profiler->Instance : nullptr;
+    }
+
+    static int LuaProfilerGc(lua_State* L)noexcept
+    {
+        auto profiler = static_cast<LuaProfiler*>(luaL_checkudata(L, 1, kProfilerName));
+        profiler->~LuaProfiler();
+        return 0;
+    }
+
+    static int LuaProfileStart(lua_State* L)noexcept
+    {
+        auto profiler = GetLuaProfiler(L);
+        if (!profiler)
+        {
+            profiler = static_cast<LuaProfiler*>(lua_newuserdata(L, sizeof(LuaProfiler)));
+            new(profiler) LuaProfiler();
+
+            if (luaL_newmetatable(L, kProfilerName))
+            {
+                lua_pushcfunction(L, LuaProfilerGc);
+                lua_setfield(L, -2, "__gc");
+            }
+            lua_setmetatable(L, -2);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, &kProfilerKey);
+        }
+
+        profiler->Instance.Reset();
+        profiler->Enabled = true;
+        return 0;
+    }
+
+    static int LuaProfileStop(lua_State* L)noexcept
+    {
+        auto profiler = GetLuaProfiler(L);
+        if (profiler)
+            profiler->Enabled = false;
+        return 0;
+    }
+
+    static int LuaProfileReport(lua_State* L)noexcept  // [format: string] -> string
+    {
+        static const char* const kFormats[] = { "table", "folded", nullptr };
+        int format = luaL_checkoption(L, 1, "table", kFormats);
+
+        auto profiler = GetLuaProfiler(L);
+        string report;
+
+        try
+        {
+            if (format == 0)
+            {
+                if (profiler)
+                    profiler->Instance.DumpReport(report);
+                else
+                    RenderProfiler().DumpReport(report);
+            }
+            else if (profiler)
+                profiler->Instance.DumpFoldedStacks(report);
+        }
+        catch (const std::exception& ex)
+        {
+            luaL_error(L, "%s", ex.what());
+        }
+
+        lua_pushlstring(L, report.c_str(), report.length());
+        return 1;
+    }
+
+    /**
+     * @brief 解析并编译模板，完成后通知观察者
+     * @param localObserver 额外通知的观察者
+     * @param path 文件路径，用于查找以相对名称继承的模板（参见ResolveExtends）
+     */
+    static void CompileSource(lua_State* L, const char* input, size_t length, const char* sourceName,
+        RenderObserverBase* localObserver, const char* path=nullptr)
+    {
+        auto globalObserver = GetRenderObserver();
+        CompileStatistics stats;
+        stats.SourceName = sourceName;
+
+        auto start = (globalObserver || localObserver) ? GetMonotonicTime() : 0;
+        auto notify = [&]() {
+            if (!globalObserver && !localObserver)
+                return;
+
+            stats.CompileTime = GetMonotonicTime() - start;
+            if (globalObserver)
+                globalObserver->OnCompile(stats);
+            if (localObserver && localObserver != globalObserver)
+                localObserver->OnCompile(stats);
+        };
+
+        try
+        {
+            // 解析
+            TextReader reader(input, length, sourceName);
+            TemplateParser parser;
+            parser.Run(reader);
+
+            // 生成模板语法树
+            list<string> baseSourceNames;
+            auto root = ResolveExtends(BuildRootNode(parser), baseSourceNames, path);
+
+            // 编译
+            TemplateCompiler compiler(L, sourceName);
+            compiler.Compile(*root);
+        }
+        catch (...)
+        {
+            notify();
+            throw;
+        }
+
+        stats.Succeeded = true;
+        notify();
+    }
+
+    /**
+     * @brief 将观察者事件转发给Lua函数
+     *
+     * 由et.set_observer设置的函数存放在注册表中，原型为function(event: string, stats: table)。
+     * 观察者中的错误会被忽略，不影响渲染结果。
+     */
+    class LuaObserver :
+        public RenderObserverBase
+    {
+    public:
+        /**
+         * @brief 检查是否设置了Lua观察者
+         */
+        static bool IsInstalled(lua_State* L)noexcept
+        {
+            auto type = lua_rawgetp(L, LUA_REGISTRYINDEX, &kObserverKey);
+            lua_pop(L, 1);
+            return type != LUA_TNIL;
+        }
+
+    public:
+        LuaObserver(lua_State* L)
+            : m_pState(L) {}
+
+    public:
+        void OnRender(const RenderStatistics& stats)noexcept override
+        {
+            Call(LuaNotifyRender, &stats);
+        }
+
+        void OnCompile(const CompileStatistics& stats)noexcept override
+        {
+            Call(LuaNotifyCompile, &stats);
+        }
+
+    private:
+        static int LuaNotifyRender(lua_State* L)noexcept  // stats: lightuserdata
+        {
+            auto& stats = *static_cast<const RenderStatistics*>(lua_touserdata(L, 1));
+            lua_rawgetp(L, LUA_REGISTRYINDEX, &kObserverKey);
+            lua_pushstring(L, "render");
+            lua_createtable(L, 0, 7);
+            lua_pushstring(L, stats.SourceName);
+            lua_setfield(L, -2, "name");
+            lua_pushboolean(L, stats.Succeeded);
+            lua_setfield(L, -2, "ok");
+            lua_pushboolean(L, stats.CacheHit);
+            lua_setfield(L, -2, "cache_hit");
+            lua_pushnumber(L, stats.ParseTime / 1e9);
+            lua_setfield(L, -2, "parse_time");
+            lua_pushnumber(L, stats.RenderTime / 1e9);
+            lua_setfield(L, -2, "render_time");
+            lua_pushinteger(L, static_cast<lua_Integer>(stats.OutputSize));
+            lua_setfield(L, -2, "output_size");
+            lua_pushinteger(L, static_cast<lua_Integer>(stats.MemoryDelta));
+            lua_setfield(L, -2, "memory_delta");
+            lua_call(L, 2, 0);
+            return 0;
+        }
+
+        static int LuaNotifyCompile(lua_State* L)noexcept  // stats: lightuserdata
+        {
+            auto& stats = *static_cast<const CompileStatistics*>(lua_touserdata(L, 1));
+            lua_rawgetp(L, LUA_REGISTRYINDEX, &kObserverKey);
+            lua_pushstring(L, "compile");
+            lua_createtable(L, 0, 3);
+            lua_pushstring(L, stats.SourceName);
+            lua_setfield(L, -2, "name");
+            lua_pushboolean(L, stats.Succeeded);
+            lua_setfield(L, -2, "ok");
+            lua_pushnumber(L, stats.CompileTime / 1e9);
+            lua_setfield(L, -2, "compile_time");
+            lua_call(L, 2, 0);
+            return 0;
+        }
+
+        void Call(lua_CFunction func, const void* stats)noexcept
+        {
+            // 通知时栈上有C++对象，建表可能因内存不足抛出Lua错误，与调用观察者一同在保护调用中进行
+            if (!lua_checkstack(m_pState, 2))
+                return;
+            lua_pushcfunction(m_pState, func);
+            lua_pushlightuserdata(m_pState, const_cast<void*>(stats));
+            if (lua_pcall(m_pState, 1, 0, 0) != LUA_OK)
+                lua_pop(m_pState, 1);
+        }
+
+    private:
+        lua_State* m_pState = nullptr;
+    };
+
+    static int LuaSetObserver(lua_State* L)noexcept  // observer: function|nil
+    {
+        if (!lua_isnoneornil(L, 1))
+            luaL_checktype(L, 1, LUA_TFUNCTION);
+
+        lua_settop(L, 1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &kObserverKey);
+        return 0;
+    }
+
+    static int LuaSetSearchPath(lua_State* L)noexcept  // ...: string
+    {
+        int top = lua_gettop(L);
+        for (int i = 1; i <= top; ++i)
+            luaL_checkstring(L, i);
+
+        bool failed = false;
+        try
+        {
+            vector<string> paths;
+            for (int i = 1; i <= top; ++i)
+                paths.emplace_back(lua_tostring(L, i));
+            TemplateCache::GetInstance().SetSearchPaths(std::move(paths));
+        }
+        catch (...)
+        {
+            failed = true;
+        }
+
+        if (failed)
+            luaL_error(L, "Not enough memory");
+        return 0;
+    }
+
+    static int LuaClearCache(lua_State* L)noexcept
+    {
+        TemplateCache::GetInstance().Clear();
+        TemplateCompiler::ClearIncludeCache(L);
+        return 0;
+    }
+
+    static int LuaSetFragmentCacheCapacity(lua_State* L)noexcept  // capacity: integer
+    {
+        auto capacity = static_cast<size_t>(std::max<lua_Integer>(0, luaL_checkinteger(L, 1)));
+        FragmentCache::GetInstance().SetCapacity(capacity);
+        return 0;
+    }
+
+    static int LuaClearFragmentCache(lua_State* L)noexcept
+    {
+        ET_UNUSED(L);
+        FragmentCache::GetInstance().Clear();
+        return 0;
+    }
+
+    static EscapeModes CheckEscapeMode(lua_State* L, int idx)noexcept
+    {
+        EscapeModes mode = EscapeModes::None;
+        const char* name = luaL_checkstring(L, idx);
+        if (!ParseEscapeMode(name, mode))
+            luaL_argerror(L, idx, lua_pushfstring(L, "invalid escape mode '%s'", name));
+        return mode;
+    }
+
+    static int LuaSetEscapeMode(lua_State* L)noexcept  // mode: string
+    {
+        SetDefaultEscapeMode(CheckEscapeMode(L, 1));
+        return 0;
+    }
+
+    static int LuaEscape(lua_State* L)noexcept  // str: string, mode: string -> string
+    {
+        size_t length = 0;
+        const char* str = luaL_checklstring(L, 1, &length);
+        auto mode = CheckEscapeMode(L, 2);
+
+        // 局部对象须在抛出Lua错误前析构
+        bool outOfMemory = false;
+        {
+            string result;
+            try
+            {
+                AppendEscaped(result, str, length, mode);
+                lua_pushlstring(L, result.c_str(), result.length());
+            }
+            catch (...)
+            {
+                outOfMemory = true;
+            }
+        }
+
+        if (outOfMemory)
+            return luaL_error(L, "Not enough memory");
+        return 1;
+    }
+
+    static void ReadRenderOptions(lua_State* L, int idx, RenderOptions& options)
+    {
+        luaL_checktype(L, idx, LUA_TTABLE);
+
+        lua_getfield(L, idx, "max_instructions");
+        if (!lua_isnil(L, -1))
+            options.MaxInstructions = static_cast<uint64_t>(std::max<lua_Integer>(0, luaL_checkinteger(L, -1)));
+        lua_pop(L, 1);
+
+        lua_getfield(L, idx, "timeout");
+        if (!lua_isnil(L, -1))
+            options.Timeout = static_cast<uint32_t>(std::max<lua_Integer>(0, luaL_checkinteger(L, -1)));
+        lua_pop(L, 1);
+
+        lua_getfield(L, idx, "max_output_size");
+        if (!lua_isnil(L, -1))
+            options.MaxOutputSize = static_cast<size_t>(std::max<lua_Integer>(0, luaL_checkinteger(L, -1)));
+        lua_pop(L, 1);
+    }
+
+    /**
+     * @brief 输出到字符串列表的VectoredWriter
+     *
+     * 每批片段拼接为一个字符串。渲染期间栈上有C++对象，不能调用可能抛出Lua错误的API，
+     * 因此片段先保存在C++中，渲染结束后再转移到Lua表（参见LuaPushChunks）。
+     */
+    class ChunkWriter :
+        public VectoredWriter
+    {
+    public:
+        ChunkWriter(std::vector<std::string>& chunks)
+            : m_stChunks(chunks) {}
+
+    protected:
+        void WriteSegments(const Segment* segments, size_t count)override
+        {
+            size_t length = 0;
+            for (size_t i = 0; i < count; ++i)
+                length += segments[i].Length;
+
+            string chunk;
+            chunk.reserve(length);
+            for (size_t i = 0; i < count; ++i)
+                chunk.append(segments[i].Data, segments[i].Length);
+            m_stChunks.emplace_back(std::move(chunk));
+        }
+
+    private:
+        std::vector<std::string>& m_stChunks;
+    };
+
+    int LuaPushChunks(lua_State* L)noexcept  // chunks: lightuserdata -> table
+    {
+        auto chunks = static_cast<std::vector<std::string>*>(lua_touserdata(L, 1));
+
+        // 逐个转移并释放，C++和Lua中不会各保存一份完整的副本
+        lua_createtable(L, static_cast<int>(std::min<size_t>(chunks->size(), numeric_limits<int>::max())), 0);
+        for (size_t i = 0; i < chunks->size(); ++i)
+        {
+            auto& chunk = (*chunks)[i];
+            lua_pushlstring(L, chunk.data(), chunk.length());
+            lua_rawseti(L, -2, static_cast<lua_Integer>(i + 1));
+            std::string().swap(chunk);
+        }
+        return 1;
+    }
+
+    static bool ReadChunkedOutput(lua_State* L, int idx)
+    {
+        if (lua_isnoneornil(L, idx))
+            return false;
+
+        lua_getfield(L, idx, "output");
+        const char* mode = luaL_optstring(L, -1, "string");
+        bool chunked = (strcmp(mode, "chunks") == 0);
+        if (!chunked && strcmp(mode, "string") != 0)
+            luaL_error(L, "Invalid output mode '%s'", mode);
+        lua_pop(L, 1);
+        return chunked;
+    }
+
+    /**
+     * @brief 渲染为字符串表
+     *
+     * 成功后在栈顶压入表，可以直接交给table.concat或者socket:send。
+     */
+    static void RenderChunks(lua_State* L, const Template& tpl, int env, const RenderOptions* options)
+    {
+        vector<string> chunks;
+        {
+            ChunkWriter writer(chunks);
+            tpl.Render(writer, L, env, options);
+        }
+
+        // 建表可能因内存不足抛出Lua错误，在保护调用中进行
+        lua_pushcfunction(L, LuaPushChunks);
+        lua_pushlightuserdata(L, &chunks);
+        if (lua_pcall(L, 1, 1, 0) != LUA_OK)
+        {
+            lua_pop(L, 1);
+            throw bad_alloc();
+        }
+    }
+
+    static int LuaRenderString(lua_State* L)noexcept  // input: string, [sourceName: string], [env: table], [options: table]
+    {
+        const char* input = luaL_checkstring(L, 1);
+        const char* sourceName = "Unknown";
+        int envIndex = 0;
+        RenderOptions options;
+
+        int idx = 2;
+        if (lua_type(L, idx) == LUA_TSTRING)
+            sourceName = lua_tostring(L, idx++);
+        if (!lua_isnoneornil(L, idx))
+        {
+            luaL_checktype(L, idx, LUA_TTABLE);
+            envIndex = lua_absindex(L, idx);
+        }
+        bool chunked = false;
+        if (!lua_isnoneornil(L, ++idx))
+        {
+            ReadRenderOptions(L, idx, options);
+            chunked = ReadChunkedOutput(L, idx);
+        }
+        options.Profiler = GetActiveProfiler(L);
+
+        LuaObserver observer(L);
+        if (LuaObserver::IsInstalled(L))
+            options.Observer = &observer;
+
+        bool error = false;
+        string output;
+
+        // 处理异常
+        try
+        {
+            if (chunked)
+            {
+                Template tpl(input, strlen(input), sourceName);
+                RenderChunks(L, tpl, envIndex, &options);
+                return 1;
+            }
+            RenderString(output, L, input, sourceName, envIndex, &options);
+        }
+        catch (const std::exception& ex)
+        {
+            error = true;
+
+            try
+            {
+                output.clear();
+                output = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
+            }
+        }
+
+        if (error)
+        {
+            lua_pushnil(L);
+            lua_pushlstring(L, output.c_str(), output.length());
+            return 2;
+        }
+        else
+        {
+            lua_pushlstring(L, output.c_str(), output.length());
+            return 1;
+        }
+    }
+
+    static int LuaRenderFile(lua_State* L)noexcept  // path: string, [env: table], [options: table]
+    {
+        const char* path = luaL_checkstring(L, 1);
+        int envIndex = 0;
+        RenderOptions options;
+
+        if (!lua_isnoneornil(L, 2))
+        {
+            luaL_checktype(L, 2, LUA_TTABLE);
+            envIndex = lua_absindex(L, 2);
+        }
+        bool chunked = false;
+        if (!lua_isnoneornil(L, 3))
+        {
+            ReadRenderOptions(L, 3, options);
+            chunked = ReadChunkedOutput(L, 3);
+        }
+        options.Profiler = GetActiveProfiler(L);
+
+        LuaObserver observer(L);
+        if (LuaObserver::IsInstalled(L))
+            options.Observer = &observer;
+
+        bool error = false;
+        string output;
+
+        // 处理异常
+        try
+        {
+            if (chunked)
+            {
+                RenderChunks(L, *LoadTemplateFile(path), envIndex, &options);
+                return 1;
+            }
+            RenderFile(output, L, path, envIndex, &options);
+        }
+        catch (const std::exception& ex)
+        {
+            error = true;
+
+            try
+            {
+                output.clear();
+                output = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
+            }
+        }
+
+        if (error)
+        {
+            lua_pushnil(L);
+            lua_pushlstring(L, output.c_str(), output.length());
+            return 2;
+        }
+        else
+        {
+            lua_pushlstring(L, output.c_str(), output.length());
+            return 1;
+        }
+    }
+
+    static int LuaCompileString(lua_State* L)noexcept  // input: string, [sourceName: string]
+    {
+        size_t length = 0;
+        const char* input = luaL_checklstring(L, 1, &length);
+        const char* sourceName = luaL_optstring(L, 2, "Unknown");
+
+        LuaObserver observer(L);
+        bool observed = LuaObserver::IsInstalled(L);
+        string error;
+
+        // 处理异常
+        try
+        {
+            CompileSource(L, input, length, sourceName, observed ? &observer : nullptr);
+            return 1;
+        }
+        catch (const std::exception& ex)
+        {
+            try
+            {
+                error = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
+            }
+        }
+
+        lua_pushnil(L);
+        lua_pushlstring(L, error.c_str(), error.length());
+        return 2;
+    }
+
+    static int LuaCompileFile(lua_State* L)noexcept  // path: string
+    {
+        const char* path = luaL_checkstring(L, 1);
+
+        LuaObserver observer(L);
+        bool observed = LuaObserver::IsInstalled(L);
+        string error;
+
+        // 处理异常
+        try
+        {
+            MappedFile input(path);
+
+            string sourceName = GetFileName(path);
+            CompileSource(L, input.GetData(), input.GetSize(), sourceName.c_str(), observed ? &observer : nullptr,
+                path);
+            return 1;
+        }
+        catch (const std::exception& ex)
+        {
+            try
+            {
+                error = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
+            }
+        }
+
+        lua_pushnil(L);
+        lua_pushlstring(L, error.c_str(), error.length());
+        return 2;
+    }
+
+    /**
+     * @brief Lua侧持有的模板对象
+     */
+    struct LuaTemplate
+    {
+        std::shared_ptr<Template> Instance;
+        std::string Buffer;  // 在多次渲染之间复用的输出缓冲区
+        bool Rendering = false;  // 缓冲区是否正在使用，重入渲染时不能复用
+    };
+
+    static LuaTemplate* CheckTemplate(lua_State* L, int idx)
+    {
+        return static_cast<LuaTemplate*>(luaL_checkudata(L, idx, kTemplateName));
+    }
+
+    static int LuaTemplateGc(lua_State* L)noexcept
+    {
+        auto self = CheckTemplate(L, 1);
+        if (self->Instance)
+            self->Instance->ReleaseCompiled(L);
+        self->~LuaTemplate();
+        return 0;
+    }
+
+    static int LuaTemplateDependencies(lua_State* L)noexcept  // self -> names: table, includes: table
+    {
+        auto self = CheckTemplate(L, 1);
+
+        string error;
+
+        // 处理异常
+        try
+        {
+            TemplateAnalyzer analyzer(L);
+            analyzer.Analyze(self->Instance->GetRoot());
+
+            const auto& names = analyzer.GetDependencies();
+            lua_createtable(L, static_cast<int>(names.size()), 0);
+            lua_Integer index = 0;
+            for (const auto& name : names)
+            {
+                lua_pushlstring(L, name.c_str(), name.length());
+                lua_rawseti(L, -2, ++index);
+            }
+
+            const auto& includes = analyzer.GetIncludes();
+            lua_createtable(L, static_cast<int>(includes.size()), 1);
+            index = 0;
+            for (const auto& name : includes)
+            {
+                lua_pushlstring(L, name.c_str(), name.length());
+                lua_rawseti(L, -2, ++index);
+            }
+            lua_pushboolean(L, analyzer.HasDynamicInclude());
+            lua_setfield(L, -2, "dynamic");
+            return 2;
+        }
+        catch (const std::exception& ex)
+        {
+            try
+            {
+                error = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
+            }
+        }
+
+        lua_pushnil(L);
+        lua_pushlstring(L, error.c_str(), error.length());
+        return 2;
+    }
+
+    static int LuaTemplateRender(lua_State* L)noexcept  // self, [env: table], [options: table]
+    {
+        auto self = CheckTemplate(L, 1);
+        int envIndex = 0;
+        RenderOptions options;
+
+        if (!lua_isnoneornil(L, 2))
+        {
+            luaL_checktype(L, 2, LUA_TTABLE);
+            envIndex = lua_absindex(L, 2);
+        }
+        bool chunked = false;
+        bool protectedCall = false;
+        if (!lua_isnoneornil(L, 3))
+        {
+            ReadRenderOptions(L, 3, options);
+            chunked = ReadChunkedOutput(L, 3);
+
+            lua_getfield(L, 3, "protected");
+            protectedCall = lua_toboolean(L, -1) != 0;
+            lua_pop(L, 1);
+        }
+        options.Profiler = GetActiveProfiler(L);
+
+        LuaObserver observer(L);
+        if (LuaObserver::IsInstalled(L))
+            options.Observer = &observer;
+
+        string local;
+        string& output = self->Rendering ? local : self->Buffer;
+        string error;
+
+        // 整个模板在一次保护调用中执行，不经过C++异常
+        if (protectedCall && !chunked)
+        {
+            bool reentrant = self->Rendering;
+            self->Rendering = true;
+            RenderError renderError;
+            auto code = self->Instance->TryRender(output, L, envIndex, renderError, &options);
+            self->Rendering = reentrant;
+
+            if (code != RenderErrorCodes::Ok)
+            {
+                lua_pushnil(L);
+                lua_pushlstring(L, renderError.Message.c_str(), renderError.Message.length());
+                return 2;
+            }
+            lua_pushlstring(L, output.c_str(), output.length());
+            output.clear();  // 保留容量
+            return 1;
+        }
+
+        // 处理异常
+        try
+        {
+            if (chunked)
+            {
+                RenderChunks(L, *self->Instance, envIndex, &options);
+                return 1;
+            }
+
+            bool reentrant = self->Rendering;
+            self->Rendering = true;
+            try
+            {
+                self->Instance->Render(output, L, envIndex, &options);
+            }
+            catch (...)
+            {
+                self->Rendering = reentrant;
+                throw;
+            }
+            self->Rendering = reentrant;
+
+            lua_pushlstring(L, output.c_str(), output.length());
+            output.clear();  // 保留容量
+            return 1;
+        }
+        catch (const std::exception& ex)
+        {
+            try
+            {
+                output.clear();
+                error = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
+            }
+        }
+
+        lua_pushnil(L);
+        lua_pushlstring(L, error.c_str(), error.length());
+        return 2;
+    }
+
+    enum RenderIterStates
+    {
+        RenderIterReady,
+        RenderIterRunning,
+        RenderIterDone,
+    };
+
+    /**
+     * @brief 按剩余的额度执行一次恢复
+     *
+     * 钩子只对协程生效且不能跨越让出，因此每次恢复都安装新的守卫，并从剩余额度中扣除本次的消耗。
+     * 剩余额度以整数形式保存在迭代器的上值中，-1表示不限制。
+     * 让出时钩子计数中未满一个间隔的指令无法得知，按一个完整的间隔扣除，宁可多算也不能让死循环逃过限制。
+     */
+    static int ResumeRenderIter(lua_State* L, lua_State* co, int args, int instructionsIndex, int timeIndex,
+        const char*& reason)noexcept
+    {
+        auto remainingInstructions = lua_tointeger(L, instructionsIndex);
+        auto remainingTime = lua_tointeger(L, timeIndex);  // ns
+        if (remainingInstructions == 0)
+        {
+            reason = "Instruction limit exceeded";
+            return LUA_ERRRUN;
+        }
+        if (remainingTime == 0)
+        {
+            reason = "Render timeout";
+            return LUA_ERRRUN;
+        }
+
+        RenderOptions options;
+        if (remainingInstructions > 0)
+            options.MaxInstructions = static_cast<uint64_t>(remainingInstructions);
+        if (remainingTime > 0)
+        {
+            options.Timeout = static_cast<uint32_t>(std::min<lua_Integer>((remainingTime + 999999) / 1000000,
+                numeric_limits<uint32_t>::max()));
+        }
+
+        int ret;
+        uint64_t executed = 0;
+        auto start = chrono::steady_clock::now();
+        try
+        {
+            ExecutionGuard guard(co, &options);
+            ret = lua_resume(co, L, args);
+            executed = guard.GetExecutedInstructions();
+        }
+        catch (const std::bad_alloc&)
+        {
+            reason = "Not enough memory";
+            return LUA_ERRMEM;
+        }
+
+        if (remainingInstructions > 0)
+        {
+            auto used = static_cast<lua_Integer>(executed);
+            if (ret == LUA_YIELD)
+                used += std::min<lua_Integer>(ExecutionGuard::kHookInterval, remainingInstructions - used);
+            lua_pushinteger(L, std::max<lua_Integer>(0, remainingInstructions - used));
+            lua_replace(L, instructionsIndex);
+        }
+        if (remainingTime > 0)
+        {
+            auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+            lua_pushinteger(L, std::max<lua_Integer>(0, remainingTime - static_cast<lua_Integer>(elapsed)));
+            lua_replace(L, timeIndex);
+        }
+        return ret;
+    }
+
+    // upvalues: thread, buffer, state: integer, instructions: integer, time: integer -> string|nil
+    static int LuaRenderIterNext(lua_State* L)noexcept
+    {
+        auto co = lua_tothread(L, lua_upvalueindex(1));
+        auto state = lua_tointeger(L, lua_upvalueindex(3));
+        if (state == RenderIterDone)
+            return 0;
+
+        // 首次恢复时协程栈上为编译产物及其参数
+        int args = (state == RenderIterReady) ? lua_gettop(co) - 1 : 0;
+        lua_pushinteger(L, RenderIterRunning);
+        lua_replace(L, lua_upvalueindex(3));
+
+        const char* reason = nullptr;
+        int ret = ResumeRenderIter(L, co, args, lua_upvalueindex(4), lua_upvalueindex(5), reason);
+        if (ret == LUA_YIELD)
+        {
+            lua_settop(co, 0);
+            TemplateCompiler::TakeOutput(L, lua_upvalueindex(2));
+            return 1;
+        }
+
+        lua_pushinteger(L, RenderIterDone);
+        lua_replace(L, lua_upvalueindex(3));
+        if (reason)
+            return luaL_error(L, "%s", reason);
+        if (ret != LUA_OK)
+        {
+            lua_xmove(co, L, 1);
+            return lua_error(L);
+        }
+
+        // 剩余的内容
+        TemplateCompiler::TakeOutput(L, lua_upvalueindex(2));
+        if (lua_rawlen(L, -1) == 0)
+            return 0;
+        return 1;
+    }
+
+    // tpl: string|template, [env: table], [options: integer|table]
+    static int LuaRenderIter(lua_State* L)noexcept
+    {
+        int envIndex = 0;
+        if (!lua_isnoneornil(L, 2))
+        {
+            luaL_checktype(L, 2, LUA_TTABLE);
+            envIndex = lua_absindex(L, 2);
+        }
+
+        // 第三个参数可以是块大小，也可以是包含chunk_size的渲染选项
+        RenderOptions options;
+        auto chunkSize = static_cast<lua_Integer>(kDefaultChunkSize);
+        if (lua_type(L, 3) == LUA_TTABLE)
+        {
+            ReadRenderOptions(L, 3, options);
+
+            lua_getfield(L, 3, "chunk_size");
+            if (!lua_isnil(L, -1))
+                chunkSize = luaL_checkinteger(L, -1);
+            lua_pop(L, 1);
+        }
+        else
+            chunkSize = luaL_optinteger(L, 3, chunkSize);
+        chunkSize = std::max<lua_Integer>(1, chunkSize);
+
+        LuaTemplate* self = nullptr;
+        size_t length = 0;
+        const char* input = nullptr;
+        if (lua_type(L, 1) == LUA_TSTRING)
+            input = lua_tolstring(L, 1, &length);
+        else
+            self = CheckTemplate(L, 1);
+
+        LuaObserver observer(L);
+        bool observed = LuaObserver::IsInstalled(L);
+        string error;
+
+        // 编译为函数，在协程中执行，模板对象复用已经缓存的编译产物
+        try
+        {
+            if (self)
+                self->Instance->PushCompiled(L);
+            else
+                CompileSource(L, input, length, "Unknown", observed ? &observer : nullptr);
+        }
+        catch (const std::exception& ex)
+        {
+            try
+            {
+                error = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
+            }
+
+            lua_pushnil(L);
+            lua_pushlstring(L, error.c_str(), error.length());
+            return 2;
+        }
+
+        int func = lua_gettop(L);
+        auto co = lua_newthread(L);  // func thread
+        lua_pushvalue(L, func);
+        if (envIndex != 0)
+            lua_pushvalue(L, envIndex);
+        else
+            lua_pushnil(L);
+        TemplateCompiler::NewOutputBuffer(L, static_cast<size_t>(chunkSize), options.MaxOutputSize);
+        lua_pushvalue(L, -1);  // func thread func env buffer buffer
+        lua_insert(L, func + 2);  // func thread buffer func env buffer
+        lua_xmove(L, co, 3);  // func thread buffer
+
+        lua_pushinteger(L, RenderIterReady);
+        lua_pushinteger(L, options.MaxInstructions != 0 ?
+            static_cast<lua_Integer>(std::min<uint64_t>(options.MaxInstructions, numeric_limits<lua_Integer>::max())) :
+            -1);
+        lua_pushinteger(L, options.Timeout != 0 ? static_cast<lua_Integer>(options.Timeout) * 1000000 : -1);
+        lua_pushcclosure(L, LuaRenderIterNext, 5);
+        return 1;
+    }
 
-    static int LuaRenderString(lua_State* L)noexcept  // input: string, [sourceName: string], [env: table]
+    static void PushTemplate(lua_State* L, std::shared_ptr<Template>&& tpl)noexcept
     {
-        const char* input = luaL_checkstring(L, 1);
-        const char* sourceName = "Unknown";
-        int envIndex = 0;
+        static const luaL_Reg kMethods[] = {
+            { "render", LuaTemplateRender },
+            { "dependencies", LuaTemplateDependencies },
+            { nullptr, nullptr },
+        };
+
+        auto self = static_cast<LuaTemplate*>(lua_newuserdata(L, sizeof(LuaTemplate)));
+        new(self) LuaTemplate();
+        self->Instance = std::move(tpl);
+
+        if (luaL_newmetatable(L, kTemplateName))
+        {
+            lua_pushcfunction(L, LuaTemplateGc);
+            lua_setfield(L, -2, "__gc");
+            luaL_newlib(L, kMethods);
+            lua_setfield(L, -2, "__index");
+        }
+        lua_setmetatable(L, -2);
+    }
+
+    static int LuaLoadString(lua_State* L)noexcept  // input: string, [sourceName: string]
+    {
+        size_t length = 0;
+        const char* input = luaL_checklstring(L, 1, &length);
+        const char* sourceName = luaL_optstring(L, 2, "Unknown");
+
+        string error;
 
-        if (lua_gettop(L) > 1)
+        // 处理异常
+        try
+        {
+            PushTemplate(L, make_shared<Template>(input, length, sourceName));
+            return 1;
+        }
+        catch (const std::exception& ex)
         {
-            if (lua_type(L, 2) == LUA_TSTRING)
+            try
             {
-                sourceName = luaL_checkstring(L, 2);
-                if (lua_gettop(L) > 2)
-                {
-                    luaL_checktype(L, 3, LUA_TTABLE);
-                    envIndex = lua_absindex(L, 3);
-                }
+                error = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
             }
+        }
+
+        lua_pushnil(L);
+        lua_pushlstring(L, error.c_str(), error.length());
+        return 2;
+    }
+
+    static int LuaCheck(lua_State* L)noexcept  // input: string|template, [sourceName: string] -> true
+    {
+        LuaTemplate* self = nullptr;
+        size_t length = 0;
+        const char* input = nullptr;
+        if (lua_type(L, 1) == LUA_TSTRING)
+            input = lua_tolstring(L, 1, &length);
+        else
+            self = CheckTemplate(L, 1);
+        const char* sourceName = luaL_optstring(L, 2, "Unknown");
+
+        string error;
+
+        // 处理异常
+        try
+        {
+            if (self)
+                self->Instance->Check(L);
             else
             {
-                luaL_checktype(L, 2, LUA_TTABLE);
-                envIndex = lua_absindex(L, 2);
+                Template tpl(input, length, sourceName);
+                tpl.Check(L);
+            }
+            lua_pushboolean(L, 1);
+            return 1;
+        }
+        catch (const std::exception& ex)
+        {
+            try
+            {
+                error = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
             }
         }
 
-        bool error = false;
-        string output;
+        lua_pushnil(L);
+        lua_pushlstring(L, error.c_str(), error.length());
+        return 2;
+    }
+
+    static TemplateDocument* CheckDocument(lua_State* L, int idx)
+    {
+        return *static_cast<TemplateDocument**>(luaL_checkudata(L, idx, kDocumentName));
+    }
+
+    static int LuaDocumentGc(lua_State* L)noexcept
+    {
+        auto self = static_cast<TemplateDocument**>(luaL_checkudata(L, 1, kDocumentName));
+        delete *self;
+        *self = nullptr;
+        return 0;
+    }
+
+    static int LuaDocumentEdit(lua_State* L)noexcept  // self, pos: integer, removed: integer, [text: string]
+    {
+        auto self = CheckDocument(L, 1);
+        auto pos = luaL_checkinteger(L, 2);
+        auto removed = luaL_checkinteger(L, 3);
+        size_t length = 0;
+        const char* text = luaL_optlstring(L, 4, "", &length);
+
+        auto textLength = static_cast<lua_Integer>(self->GetText().length());
+        luaL_argcheck(L, pos >= 1 && pos <= textLength + 1, 2, "position out of range");
+        luaL_argcheck(L, removed >= 0 && removed <= textLength + 1 - pos, 3, "length out of range");
+
+        string error;
 
         // 处理异常
         try
         {
-            RenderString(output, L, input, sourceName, envIndex);
+            self->Edit(static_cast<size_t>(pos - 1), static_cast<size_t>(removed), text, length);
+            lua_pushboolean(L, 1);
+            return 1;
         }
         catch (const std::exception& ex)
         {
-            error = true;
+            try
+            {
+                error = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
+            }
+        }
+
+        lua_pushnil(L);
+        lua_pushlstring(L, error.c_str(), error.length());
+        return 2;
+    }
 
+    static int LuaDocumentText(lua_State* L)noexcept  // self -> string
+    {
+        auto self = CheckDocument(L, 1);
+        lua_pushlstring(L, self->GetText().c_str(), self->GetText().length());
+        return 1;
+    }
+
+    static int LuaDocumentTemplate(lua_State* L)noexcept  // self -> template
+    {
+        auto self = CheckDocument(L, 1);
+
+        string error;
+
+        // 处理异常
+        try
+        {
+            PushTemplate(L, self->GetTemplate());
+            return 1;
+        }
+        catch (const std::exception& ex)
+        {
             try
             {
-                output.clear();
-                output = ex.what();
+                error = ex.what();
             }
             catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
             {
@@ -66,46 +1214,162 @@ namespace
             }
         }
 
-        if (error)
+        lua_pushnil(L);
+        lua_pushlstring(L, error.c_str(), error.length());
+        return 2;
+    }
+
+    static int LuaDocument(lua_State* L)noexcept  // text: string, [sourceName: string] -> document
+    {
+        static const luaL_Reg kMethods[] = {
+            { "edit", LuaDocumentEdit },
+            { "text", LuaDocumentText },
+            { "template", LuaDocumentTemplate },
+            { nullptr, nullptr },
+        };
+
+        size_t length = 0;
+        const char* text = luaL_checklstring(L, 1, &length);
+        const char* sourceName = luaL_optstring(L, 2, "Unknown");
+
+        auto self = static_cast<TemplateDocument**>(lua_newuserdata(L, sizeof(TemplateDocument*)));
+        *self = nullptr;
+        if (luaL_newmetatable(L, kDocumentName))
         {
-            lua_pushnil(L);
-            lua_pushlstring(L, output.c_str(), output.length());
-            return 2;
+            lua_pushcfunction(L, LuaDocumentGc);
+            lua_setfield(L, -2, "__gc");
+            luaL_newlib(L, kMethods);
+            lua_setfield(L, -2, "__index");
         }
-        else
+        lua_setmetatable(L, -2);
+
+        bool failed = false;
         {
-            lua_pushlstring(L, output.c_str(), output.length());
+            try
+            {
+                *self = new TemplateDocument(text, length, sourceName);
+            }
+            catch (const std::exception&)  // 基本就是bad_alloc了
+            {
+                failed = true;
+            }
+        }
+        if (failed)
+            return luaL_error(L, "not enough memory");
+        return 1;
+    }
+
+    static int LuaLoadFile(lua_State* L)noexcept  // path: string
+    {
+        const char* path = luaL_checkstring(L, 1);
+
+        string error;
+
+        // 处理异常
+        try
+        {
+            PushTemplate(L, LoadTemplateFile(path));
             return 1;
         }
+        catch (const std::exception& ex)
+        {
+            try
+            {
+                error = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
+            }
+        }
+
+        lua_pushnil(L);
+        lua_pushlstring(L, error.c_str(), error.length());
+        return 2;
     }
 
-    static int LuaRenderFile(lua_State* L)noexcept  // path: string, [env: table]
+    static int LuaLoadPack(lua_State* L)noexcept  // path: string -> count: integer
     {
         const char* path = luaL_checkstring(L, 1);
-        int envIndex = 0;
 
-        if (lua_gettop(L) > 1)
+        string error;
+
+        // 处理异常
+        try
+        {
+            auto pack = make_shared<TemplatePack>(path);
+            auto count = pack->GetCount();
+            TemplateCache::GetInstance().AddPack(std::move(pack));
+            TemplateCompiler::ClearIncludeCache(L);  // 包中的模板优先于已经编译的同名模板，缓存的模板对象在AddPack中移除
+
+            lua_pushinteger(L, static_cast<lua_Integer>(count));
+            return 1;
+        }
+        catch (const std::exception& ex)
         {
-            luaL_checktype(L, 2, LUA_TTABLE);
-            envIndex = lua_absindex(L, 2);
+            try
+            {
+                error = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
+            }
         }
 
-        bool error = false;
-        string output;
+        lua_pushnil(L);
+        lua_pushlstring(L, error.c_str(), error.length());
+        return 2;
+    }
+
+    static int LuaCompileTemplate(lua_State* L)noexcept  // name: string -> func
+    {
+        size_t length = 0;
+        const char* name = luaL_checklstring(L, 1, &length);
+
+        string error;
 
         // 处理异常
         try
         {
-            RenderFile(output, L, path, envIndex);
+            TemplateCompiler::LoadTemplate(L, string(name, length));
+            return 1;
         }
         catch (const std::exception& ex)
         {
-            error = true;
+            try
+            {
+                error = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
+            }
+        }
+
+        lua_pushnil(L);
+        lua_pushlstring(L, error.c_str(), error.length());
+        return 2;
+    }
+
+    static int LuaLoadTemplate(lua_State* L)noexcept  // name: string -> template
+    {
+        size_t length = 0;
+        const char* name = luaL_checklstring(L, 1, &length);
+
+        string error;
 
+        // 处理异常
+        try
+        {
+            PushTemplate(L, TemplateCache::GetInstance().Load(string(name, length)));
+            return 1;
+        }
+        catch (const std::exception& ex)
+        {
             try
             {
-                output.clear();
-                output = ex.what();
+                error = ex.what();
             }
             catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
             {
@@ -113,17 +1377,87 @@ namespace
             }
         }
 
-        if (error)
+        lua_pushnil(L);
+        lua_pushlstring(L, error.c_str(), error.length());
+        return 2;
+    }
+
+    static int64_t GetLuaMemory(lua_State* L)noexcept
+    {
+        // 以KB为单位的计数超过2GB时乘以1024会溢出int
+        return static_cast<int64_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+    }
+
+    static int LuaPreload(lua_State* L)noexcept  // dir: string, [pattern: string], [threads: integer] -> table
+    {
+        const char* dir = luaL_checkstring(L, 1);
+        const char* pattern = luaL_optstring(L, 2, "*");
+        auto threads = static_cast<unsigned>(std::max<lua_Integer>(0, luaL_optinteger(L, 3, 0)));
+
+        PreloadStatistics stats;
+        string error;
+        uint64_t compileTime = 0;
+        auto memoryBefore = GetLuaMemory(L);
+
+        // 处理异常
+        try
+        {
+            PreloadTemplates(stats, dir, pattern, threads);
+
+            // 虚拟机只能在当前线程中使用，编译依次进行
+            auto start = GetMonotonicTime();
+            for (const auto& name : stats.Names)
+            {
+                try
+                {
+                    TemplateCompiler::PreloadInclude(L, name);
+                }
+                catch (const std::exception& ex)
+                {
+                    stats.Errors.emplace_back(ex.what());
+                }
+            }
+            compileTime = GetMonotonicTime() - start;
+        }
+        catch (const std::exception& ex)
         {
+            try
+            {
+                error = ex.what();
+            }
+            catch (const std::exception& ex)  // 基本就是bad_alloc了，也尝试恢复下
+            {
+                luaL_error(L, "%s", ex.what());
+            }
+
             lua_pushnil(L);
-            lua_pushlstring(L, output.c_str(), output.length());
+            lua_pushlstring(L, error.c_str(), error.length());
             return 2;
         }
-        else
+
+        auto memoryAfter = GetLuaMemory(L);
+
+        lua_createtable(L, 0, 7);
+        lua_pushinteger(L, static_cast<lua_Integer>(stats.Names.size()));
+        lua_setfield(L, -2, "count");
+        lua_pushinteger(L, static_cast<lua_Integer>(stats.Errors.size()));
+        lua_setfield(L, -2, "failed");
+        lua_createtable(L, static_cast<int>(stats.Errors.size()), 0);
+        for (size_t i = 0; i < stats.Errors.size(); ++i)
         {
-            lua_pushlstring(L, output.c_str(), output.length());
-            return 1;
+            lua_pushlstring(L, stats.Errors[i].c_str(), stats.Errors[i].length());
+            lua_rawseti(L, -2, static_cast<lua_Integer>(i + 1));
         }
+        lua_setfield(L, -2, "errors");
+        lua_pushinteger(L, static_cast<lua_Integer>(stats.SourceSize));
+        lua_setfield(L, -2, "source_size");
+        lua_pushnumber(L, stats.ParseTime / 1000000000.);
+        lua_setfield(L, -2, "parse_time");
+        lua_pushnumber(L, compileTime / 1000000000.);
+        lua_setfield(L, -2, "compile_time");
+        lua_pushinteger(L, static_cast<lua_Integer>(memoryAfter - memoryBefore));
+        lua_setfield(L, -2, "memory_delta");
+        return 1;
     }
 
     static int LuaDumpString(lua_State* L)noexcept  // raw: string
@@ -345,70 +1679,6 @@ namespace
         }
     }
 
-    static int LuaRangeClosure(lua_State* L)noexcept  // state: any, lastvalue: number
-    {
-        double last = luaL_checknumber(L, 2);
-        double to = lua_tonumber(L, lua_upvalueindex(1));
-        double step = lua_tonumber(L, lua_upvalueindex(2));
-
-        double next = last + step;
-        if ((step > 0 && next <= to) || (step < 0 && next >= to) || step == 0)
-            lua_pushnumber(L, next);
-        else
-            lua_pushnil(L);
-        return 1;
-    }
-
-    static int LuaRangeClosureInteger(lua_State* L)noexcept  // state: any, lastvalue: integer
-    {
-        lua_Integer last = luaL_checkinteger(L, 2);
-        lua_Integer to = lua_tointeger(L, lua_upvalueindex(1));
-        lua_Integer step = lua_tointeger(L, lua_upvalueindex(2));
-
-        lua_Integer next = last + step;
-        if ((step > 0 && next <= to) || (step < 0 && next >= to) || step == 0)
-            lua_pushinteger(L, next);
-        else
-            lua_pushnil(L);
-        return 1;
-    }
-
-    static int LuaRange(lua_State* L)noexcept  // from: number, to: number, [step: number=1]
-    {
-        // see: http://lua-users.org/wiki/RangeIterator
-        if (lua_isinteger(L, 1) && lua_isinteger(L, 2) && !(lua_gettop(L) > 2 && !lua_isinteger(L, 3)))
-        {
-            // 纯整数迭代版本
-            lua_Integer from = lua_tointeger(L, 1);
-            lua_Integer to = lua_tointeger(L, 2);
-            lua_Integer step = 1;
-            if (lua_gettop(L) > 2)
-                step = lua_tointeger(L, 3);
-
-            lua_pushinteger(L, to);  // upvalue 1
-            lua_pushinteger(L, step);  // upvalue 2
-            lua_pushcclosure(L, LuaRangeClosureInteger, 2);
-            lua_pushnil(L);
-            lua_pushinteger(L, from - step);
-            return 3;
-        }
-        else
-        {
-            double from = luaL_checknumber(L, 1);
-            double to = luaL_checknumber(L, 2);
-            double step = 1;
-            if (lua_gettop(L) > 2)
-                step = luaL_checknumber(L, 3);
-
-            lua_pushnumber(L, to);  // upvalue 1
-            lua_pushnumber(L, step);  // upvalue 2
-            lua_pushcclosure(L, LuaRangeClosure, 2);
-            lua_pushnil(L);
-            lua_pushnumber(L, from - step);
-            return 3;
-        }
-    }
-
     static int LuaIsArray(lua_State* L)noexcept  // any
     {
         if (lua_gettop(L) == 0 || lua_type(L, 1) != LUA_TTABLE)
@@ -450,10 +1720,31 @@ extern "C" int ET_EXPORT_API luaopen_et(lua_State* L)
     static const luaL_Reg kEntry[] = {
         { "render_string", LuaRenderString },
         { "render_file", LuaRenderFile },
+        { "compile_string", LuaCompileString },
+        { "compile_file", LuaCompileFile },
+        { "load_string", LuaLoadString },
+        { "load_file", LuaLoadFile },
         { "dump_string", LuaDumpString },
         { "dump_value", LuaDumpValue },
         { "range", LuaRange },
         { "is_array", LuaIsArray },
+        { "profile_start", LuaProfileStart },
+        { "profile_stop", LuaProfileStop },
+        { "profile_report", LuaProfileReport },
+        { "set_observer", LuaSetObserver },
+        { "set_search_path", LuaSetSearchPath },
+        { "clear_cache", LuaClearCache },
+        { "set_fragment_cache_capacity", LuaSetFragmentCacheCapacity },
+        { "clear_fragment_cache", LuaClearFragmentCache },
+        { "set_escape_mode", LuaSetEscapeMode },
+        { "escape", LuaEscape },
+        { "render_iter", LuaRenderIter },
+        { "load_pack", LuaLoadPack },
+        { "compile_template", LuaCompileTemplate },
+        { "load_template", LuaLoadTemplate },
+        { "preload", LuaPreload },
+        { "document", LuaDocument },
+        { "check", LuaCheck },
         { nullptr, nullptr },
     };
 
@@ -463,52 +1754,31 @@ extern "C" int ET_EXPORT_API luaopen_et(lua_State* L)
 
 //////////////////////////////////////////////////////////////////////////////// Api
 
-void et::RenderString(std::string& out, lua_State* L, const char* input, const char* sourceName, int env)
+void et::RenderString(std::string& out, lua_State* L, const char* input, const char* sourceName, int env,
+    const RenderOptions* options)
+{
+    Template tpl(input, strlen(input), sourceName);
+    tpl.Render(out, L, env, options);
+}
+
+void et::RenderFile(std::string& out, lua_State* L, const char* path, int env, const RenderOptions* options)
 {
-    size_t length = strlen(input);
-    out.clear();
-    out.reserve(length);
-
-    // 解析
-    TextReader reader(input, length, sourceName);
-    TemplateParser parser;
-    parser.Run(reader);
-
-    // 生成模板语法树
-    auto root = BuildRootNode(parser);
-
-    // 渲染
-#ifndef NDEBUG
-    int top = lua_gettop(L);
-#endif
-    root->Render(out, L, env);
-    assert(top == lua_gettop(L));
+    auto tpl = LoadTemplateFile(path);
+    tpl->Render(out, L, env, options);
 }
 
-void et::RenderFile(std::string& out, lua_State* L, const char* path, int env)
+void et::CompileString(lua_State* L, const char* input, const char* sourceName)
 {
-    out.clear();
+    CompileSource(L, input, strlen(input), sourceName, nullptr);
+}
 
+void et::CompileFile(lua_State* L, const char* path)
+{
     // 读取文件
-    string input;
-    ReadFile(input, path);
-    out.reserve(input.size());
+    MappedFile input(path);
 
-    // 解析
     string sourceName = GetFileName(path);
-    TextReader reader(input.c_str(), input.length(), sourceName.c_str());
-    TemplateParser parser;
-    parser.Run(reader);
-
-    // 生成模板语法树
-    auto root = BuildRootNode(parser);
-
-    // 渲染
-#ifndef NDEBUG
-    int top = lua_gettop(L);
-#endif
-    root->Render(out, L, env);
-    assert(top == lua_gettop(L));
+    CompileSource(L, input.GetData(), input.GetSize(), sourceName.c_str(), nullptr, path);
 }
 
 void et::RegisterLibrary(lua_State* L, const char* name)
@@ -0,0 +1,141 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/26
+ */
+#include <et/FragmentCache.hpp>
+
+using namespace std;
+using namespace et;
+
+//////////////////////////////////////////////////////////////////////////////// FragmentCache
+
+FragmentCache& FragmentCache::GetInstance()noexcept
+{
+    static FragmentCache s_stInstance;
+    return s_stInstance;
+}
+
+FragmentCache::FragmentCache(size_t capacity)
+    : m_ullCapacity(capacity)
+{
+}
+
+size_t FragmentCache::GetCapacity()const
+{
+    lock_guard<mutex> guard(m_stLock);
+    return m_ullCapacity;
+}
+
+void FragmentCache::SetCapacity(size_t capacity)
+{
+    lock_guard<mutex> guard(m_stLock);
+    m_ullCapacity = capacity;
+    Shrink(capacity);
+}
+
+size_t FragmentCache::GetSize()const
+{
+    lock_guard<mutex> guard(m_stLock);
+    return m_ullSize;
+}
+
+size_t FragmentCache::GetCount()const
+{
+    lock_guard<mutex> guard(m_stLock);
+    return m_stIndex.size();
+}
+
+uint64_t FragmentCache::GetHitCount()const
+{
+    lock_guard<mutex> guard(m_stLock);
+    return m_ullHitCount;
+}
+
+uint64_t FragmentCache::GetMissCount()const
+{
+    lock_guard<mutex> guard(m_stLock);
+    return m_ullMissCount;
+}
+
+std::shared_ptr<const std::string> FragmentCache::Get(const std::string& key)
+{
+    lock_guard<mutex> guard(m_stLock);
+
+    auto it = m_stIndex.find(key);
+    if (it == m_stIndex.end())
+    {
+        ++m_ullMissCount;
+        return nullptr;
+    }
+
+    auto entry = it->second;
+    if (entry->HasDeadline && chrono::steady_clock::now() >= entry->Deadline)
+    {
+        Remove(entry);
+        ++m_ullMissCount;
+        return nullptr;
+    }
+
+    // 移动到表头
+    m_stEntries.splice(m_stEntries.begin(), m_stEntries, entry);
+    ++m_ullHitCount;
+    return entry->Value;
+}
+
+void FragmentCache::Put(const std::string& key, std::string value, uint32_t ttl)
+{
+    size_t size = key.length() + value.length();
+
+    Entry entry;
+    entry.Key = key;
+    entry.Value = make_shared<const string>(std::move(value));
+    if (ttl != 0)
+    {
+        entry.HasDeadline = true;
+        entry.Deadline = chrono::steady_clock::now() + chrono::milliseconds(ttl);
+    }
+
+    lock_guard<mutex> guard(m_stLock);
+
+    auto it = m_stIndex.find(key);
+    if (it != m_stIndex.end())
+        Remove(it->second);
+
+    if (size > m_ullCapacity)
+        return;
+    Shrink(m_ullCapacity - size);
+
+    m_stEntries.emplace_front(std::move(entry));
+    try
+    {
+        m_stIndex.emplace(key, m_stEntries.begin());
+    }
+    catch (...)
+    {
+        m_stEntries.pop_front();
+        throw;
+    }
+    m_ullSize += size;
+}
+
+void FragmentCache::Clear()
+{
+    lock_guard<mutex> guard(m_stLock);
+    m_stIndex.clear();
+    m_stEntries.clear();
+    m_ullSize = 0;
+}
+
+void FragmentCache::Remove(EntryList::iterator it)noexcept
+{
+    m_ullSize -= it->Key.length() + it->Value->length();
+    m_stIndex.erase(it->Key);
+    m_stEntries.erase(it);
+}
+
+void FragmentCache::Shrink(size_t capacity)noexcept
+{
+    while (m_ullSize > capacity && !m_stEntries.empty())
+        Remove(--m_stEntries.end());
+}
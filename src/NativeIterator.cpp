@@ -0,0 +1,135 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/29
+ */
+#include <et/NativeIterator.hpp>
+
+#include <mutex>
+
+using namespace std;
+using namespace et;
+
+namespace
+{
+    int LuaRangeClosure(lua_State* L)noexcept  // state: any, lastvalue: number
+    {
+        double last = luaL_checknumber(L, 2);
+        double to = lua_tonumber(L, lua_upvalueindex(1));
+        double step = lua_tonumber(L, lua_upvalueindex(2));
+
+        double next = last + step;
+        if ((step > 0 && next <= to) || (step < 0 && next >= to) || step == 0)
+            lua_pushnumber(L, next);
+        else
+            lua_pushnil(L);
+        return 1;
+    }
+
+    int LuaRangeClosureInteger(lua_State* L)noexcept  // state: any, lastvalue: integer
+    {
+        lua_Integer last = luaL_checkinteger(L, 2);
+        lua_Integer to = lua_tointeger(L, lua_upvalueindex(1));
+        lua_Integer step = lua_tointeger(L, lua_upvalueindex(2));
+
+        lua_Integer next = last + step;
+        if ((step > 0 && next <= to) || (step < 0 && next >= to) || step == 0)
+            lua_pushinteger(L, next);
+        else
+            lua_pushnil(L);
+        return 1;
+    }
+
+    /**
+     * @brief 标准库中的迭代函数
+     *
+     * ipairs的迭代函数没有导出，因此在一个临时的状态机中取得。
+     */
+    struct BaseLibIterators
+    {
+        lua_CFunction IPairs = nullptr;
+        lua_CFunction Next = nullptr;
+    };
+
+    const BaseLibIterators& GetBaseLibIterators()noexcept
+    {
+        static once_flag s_stFlag;
+        static BaseLibIterators s_stIterators;
+
+        call_once(s_stFlag, []() {
+            lua_State* L = luaL_newstate();
+            if (!L)
+                return;
+
+            luaL_requiref(L, "_G", luaopen_base, 1);
+            lua_pop(L, 1);
+
+            lua_getglobal(L, "next");
+            s_stIterators.Next = lua_tocfunction(L, -1);
+            lua_pop(L, 1);
+
+            lua_getglobal(L, "ipairs");
+            lua_newtable(L);
+            if (lua_pcall(L, 1, 1, 0) == LUA_OK)
+                s_stIterators.IPairs = lua_tocfunction(L, -1);
+
+            lua_close(L);
+        });
+        return s_stIterators;
+    }
+}
+
+int et::LuaRange(lua_State* L)noexcept
+{
+    // see: http://lua-users.org/wiki/RangeIterator
+    if (lua_isinteger(L, 1) && lua_isinteger(L, 2) && !(lua_gettop(L) > 2 && !lua_isinteger(L, 3)))
+    {
+        // 纯整数迭代版本
+        lua_Integer from = lua_tointeger(L, 1);
+        lua_Integer to = lua_tointeger(L, 2);
+        lua_Integer step = 1;
+        if (lua_gettop(L) > 2)
+            step = lua_tointeger(L, 3);
+
+        lua_pushinteger(L, to);  // upvalue 1
+        lua_pushinteger(L, step);  // upvalue 2
+        lua_pushcclosure(L, LuaRangeClosureInteger, 2);
+        lua_pushnil(L);
+        lua_pushinteger(L, from - step);
+        return 3;
+    }
+    else
+    {
+        double from = luaL_checknumber(L, 1);
+        double to = luaL_checknumber(L, 2);
+        double step = 1;
+        if (lua_gettop(L) > 2)
+            step = luaL_checknumber(L, 3);
+
+        lua_pushnumber(L, to);  // upvalue 1
+        lua_pushnumber(L, step);  // upvalue 2
+        lua_pushcclosure(L, LuaRangeClosure, 2);
+        lua_pushnil(L);
+        lua_pushnumber(L, from - step);
+        return 3;
+    }
+}
+
+NativeIteratorTypes et::GetNativeIteratorType(lua_State* L, int idx)noexcept
+{
+    lua_CFunction func = lua_tocfunction(L, idx);
+    if (!func)
+        return NativeIteratorTypes::None;
+
+    if (func == LuaRangeClosureInteger)
+        return NativeIteratorTypes::IntegerRange;
+    if (func == LuaRangeClosure)
+        return NativeIteratorTypes::Range;
+
+    const BaseLibIterators& iterators = GetBaseLibIterators();
+    if (func == iterators.IPairs)
+        return NativeIteratorTypes::IPairs;
+    if (func == iterators.Next)
+        return NativeIteratorTypes::Pairs;
+    return NativeIteratorTypes::None;
+}
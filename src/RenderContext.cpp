@@ -0,0 +1,219 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/21
+ */
+#include <et/RenderContext.hpp>
+#include <et/TemplateNode.hpp>
+#include <et/VectoredWriter.hpp>
+
+using namespace std;
+using namespace et;
+
+static const char kGuardKey = 0;
+
+//////////////////////////////////////////////////////////////////////////////// ChunkCacheScope
+
+ChunkCacheScope::ChunkCacheScope(RenderContext& context, lua_State* L)
+    : m_stContext(context), m_pState(L)
+{
+    if (L && context.GetChunkCache() == 0)
+    {
+        lua_newtable(L);
+        context.SetChunkCache(lua_gettop(L));
+        m_bOwner = true;
+    }
+}
+
+ChunkCacheScope::~ChunkCacheScope()
+{
+    if (m_bOwner)
+    {
+        // 异常时节点可能在栈上留下了内容，一并移除
+        assert(lua_gettop(m_pState) >= m_stContext.GetChunkCache());
+        lua_settop(m_pState, m_stContext.GetChunkCache() - 1);
+        m_stContext.SetChunkCache(0);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////// ExecutionGuard
+
+namespace
+{
+    int LuaReserveGuardSlot(lua_State* L)noexcept
+    {
+        lua_pushboolean(L, 0);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &kGuardKey);
+        return 0;
+    }
+}
+
+ExecutionGuard::ExecutionGuard(lua_State* L, const RenderOptions* options)
+    : m_pState(L)
+{
+    if (!options || (options->MaxInstructions == 0 && options->Timeout == 0))
+        return;
+
+    m_ullMaxInstructions = options->MaxInstructions;
+    if (m_ullMaxInstructions != 0 && m_ullMaxInstructions < static_cast<uint64_t>(kHookInterval))
+        m_iHookCount = static_cast<int>(m_ullMaxInstructions);
+
+    if (options->Timeout != 0)
+    {
+        m_bHasDeadline = true;
+        m_stDeadline = chrono::steady_clock::now() + chrono::milliseconds(options->Timeout);
+    }
+
+    // 记录外层守卫
+    // 注册表中的槽位首次使用时在保护调用中创建，此后只覆盖已有的值，安装和卸载都不会分配内存或者抛出Lua错误
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &kGuardKey) == LUA_TNIL)
+    {
+        lua_pop(L, 1);
+        if (!lua_checkstack(L, 1))
+            throw bad_alloc();
+        lua_pushcfunction(L, LuaReserveGuardSlot);
+        if (lua_pcall(L, 0, 0, 0) != LUA_OK)
+        {
+            lua_pop(L, 1);
+            throw bad_alloc();
+        }
+        lua_pushboolean(L, 0);
+    }
+    m_pPrevGuard = static_cast<ExecutionGuard*>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+
+    m_pPrevHook = lua_gethook(L);
+    m_iPrevHookMask = lua_gethookmask(L);
+    m_iPrevHookCount = lua_gethookcount(L);
+
+    // 外层守卫的间隔可能更小
+    if (m_pPrevGuard && m_pPrevHook == Hook)
+        m_iHookCount = std::min(m_iHookCount, m_iPrevHookCount);
+
+    lua_pushlightuserdata(L, this);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &kGuardKey);
+    lua_sethook(L, Hook, LUA_MASKCOUNT, m_iHookCount);
+    m_bInstalled = true;
+}
+
+ExecutionGuard::~ExecutionGuard()
+{
+    if (!m_bInstalled)
+        return;
+
+    if (m_pPrevGuard)
+        lua_pushlightuserdata(m_pState, m_pPrevGuard);
+    else
+        lua_pushboolean(m_pState, 0);  // 保留槽位
+    lua_rawsetp(m_pState, LUA_REGISTRYINDEX, &kGuardKey);
+
+    lua_sethook(m_pState, m_pPrevHook, m_iPrevHookMask, m_iPrevHookCount);
+}
+
+void ExecutionGuard::Hook(lua_State* L, lua_Debug* ar)
+{
+    ET_UNUSED(ar);
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &kGuardKey);
+    auto guard = static_cast<ExecutionGuard*>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+
+    // 检查所有嵌套的守卫
+    int count = lua_gethookcount(L);
+    for (auto p = guard; p; p = p->m_pPrevGuard)
+    {
+        if (!p->Step(count))
+        {
+            // 错误可能被表达式中的pcall吞掉，此后每条指令都触发钩子，确保尽快中止渲染
+            if (count != 1)
+                lua_sethook(L, Hook, LUA_MASKCOUNT, 1);
+            luaL_error(L, "%s", p->GetReason());
+        }
+    }
+}
+
+bool ExecutionGuard::Step(int count)noexcept
+{
+    if (IsTriggered())
+        return false;
+
+    if (m_ullMaxInstructions != 0)
+    {
+        m_ullExecutedInstructions += static_cast<uint64_t>(count);
+        if (m_ullExecutedInstructions >= m_ullMaxInstructions)
+        {
+            m_pszReason = "Instruction limit exceeded";
+            return false;
+        }
+    }
+
+    if (m_bHasDeadline && chrono::steady_clock::now() >= m_stDeadline)
+    {
+        m_pszReason = "Render timeout";
+        return false;
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////// RenderContext
+
+RenderContext::RenderContext(std::string& builder, const RenderOptions* options)noexcept
+    : m_pBuilder(&builder), m_ullBaseSize(builder.length()), m_pOptions(options)
+{
+    if (options && options->MaxOutputSize != 0)
+        m_ullMaxOutputSize = options->MaxOutputSize;
+    if (options)
+        m_pProfiler = options->Profiler;
+}
+
+RenderContext::RenderContext(VectoredWriter& writer, const RenderOptions* options)noexcept
+    : m_pWriter(&writer), m_pOptions(options)
+{
+    if (options && options->MaxOutputSize != 0)
+        m_ullMaxOutputSize = options->MaxOutputSize;
+    if (options)
+        m_pProfiler = options->Profiler;
+}
+
+void RenderContext::WriteEscaped(const char* data, size_t length, EscapeModes mode)
+{
+    if (mode == EscapeModes::None)
+    {
+        Write(data, length);
+        return;
+    }
+
+    if (m_pWriter)
+    {
+        m_stEscapeBuffer.clear();
+        AppendEscaped(m_stEscapeBuffer, data, length, mode);
+        Write(m_stEscapeBuffer);
+        return;
+    }
+
+    // 转义后的长度事先未知，先写入再检查限制
+    size_t size = m_pBuilder->size();
+    AppendEscaped(*m_pBuilder, data, length, mode);
+
+    size_t written = m_pBuilder->size() - size;
+    if (written > m_ullMaxOutputSize - m_ullOutputSize)
+    {
+        m_pBuilder->resize(size);
+        ThrowOutputLimitExceeded();
+    }
+    m_ullOutputSize += written;
+}
+
+void RenderContext::WriteToWriter(const char* data, size_t length, bool reference)
+{
+    assert(m_pWriter);
+    if (reference)
+        m_pWriter->WriteReference(data, length);
+    else
+        m_pWriter->Write(data, length);
+}
+
+void RenderContext::ThrowOutputLimitExceeded()const
+{
+    ET_THROW(RenderException, "Output size limit exceeded (%zu bytes)", m_ullMaxOutputSize);
+}
@@ -0,0 +1,39 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/24
+ */
+#include <et/RenderObserver.hpp>
+
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+using namespace et;
+
+static std::atomic<RenderObserverBase*> s_pGlobalObserver(nullptr);
+
+//////////////////////////////////////////////////////////////////////////////// RenderObserverBase
+
+void RenderObserverBase::OnCompile(const CompileStatistics& stats)noexcept
+{
+    ET_UNUSED(stats);
+}
+
+//////////////////////////////////////////////////////////////////////////////// Global observer
+
+RenderObserverBase* et::GetRenderObserver()noexcept
+{
+    return s_pGlobalObserver.load(memory_order_acquire);
+}
+
+void et::SetRenderObserver(RenderObserverBase* observer)noexcept
+{
+    s_pGlobalObserver.store(observer, memory_order_release);
+}
+
+uint64_t et::GetMonotonicTime()noexcept
+{
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count());
+}
@@ -0,0 +1,135 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/23
+ */
+#include <et/RenderProfiler.hpp>
+
+#include <algorithm>
+
+using namespace std;
+using namespace et;
+
+//////////////////////////////////////////////////////////////////////////////// RenderProfiler::Scope
+
+RenderProfiler::Scope::Scope(RenderContext& context, const char* source, uint32_t line)noexcept
+    : m_stContext(context), m_pProfiler(context.GetProfiler())
+{
+    if (m_pProfiler)
+        m_pProfiler->Enter(source, line, context.GetOutputSize());
+}
+
+RenderProfiler::Scope::~Scope()
+{
+    if (m_pProfiler)
+        m_pProfiler->Leave(m_stContext.GetOutputSize());
+}
+
+//////////////////////////////////////////////////////////////////////////////// RenderProfiler
+
+void RenderProfiler::Reset()noexcept
+{
+    m_vecStack.clear();
+    m_ullDroppedFrames = 0;
+    m_stEntries.clear();
+    m_stFoldedStacks.clear();
+}
+
+std::vector<RenderProfiler::Entry> RenderProfiler::GetEntries()const
+{
+    vector<Entry> ret;
+    ret.reserve(m_stEntries.size());
+    for (const auto& it : m_stEntries)
+        ret.push_back(it.second);
+
+    stable_sort(ret.begin(), ret.end(), [](const Entry& lhs, const Entry& rhs) {
+        return lhs.ExclusiveTime > rhs.ExclusiveTime;
+    });
+    return ret;
+}
+
+void RenderProfiler::DumpReport(std::string& out)const
+{
+    auto entries = GetEntries();
+
+    out.append(Format("%-32s %10s %12s %12s %12s\n", "Location", "Calls", "Incl(ms)", "Excl(ms)", "Bytes"));
+    for (const auto& entry : entries)
+    {
+        string location = Format("%s:%u", entry.Source.c_str(), entry.Line);
+        out.append(Format("%-32s %10llu %12.3f %12.3f %12llu\n", location.c_str(),
+            static_cast<unsigned long long>(entry.Calls), entry.InclusiveTime / 1000000.0,
+            entry.ExclusiveTime / 1000000.0, static_cast<unsigned long long>(entry.Bytes)));
+    }
+}
+
+void RenderProfiler::DumpFoldedStacks(std::string& out)const
+{
+    for (const auto& it : m_stFoldedStacks)
+    {
+        out.append(it.first);
+        out.push_back(' ');
+        out.append(to_string(it.second / 1000));
+        out.push_back('\n');
+    }
+}
+
+void RenderProfiler::Enter(const char* source, uint32_t line, size_t outputSize)noexcept
+{
+    try
+    {
+        Frame frame = { source, line, chrono::steady_clock::now(), outputSize, 0 };
+        m_vecStack.push_back(frame);
+    }
+    catch (...)
+    {
+        ++m_ullDroppedFrames;
+    }
+}
+
+void RenderProfiler::Leave(size_t outputSize)noexcept
+{
+    if (m_ullDroppedFrames > 0)
+    {
+        --m_ullDroppedFrames;
+        return;
+    }
+
+    assert(!m_vecStack.empty());
+    const Frame& frame = m_vecStack.back();
+    auto inclusive = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now() - frame.Start).count());
+    auto exclusive = inclusive >= frame.ChildTime ? inclusive - frame.ChildTime : 0;
+
+    try
+    {
+        auto& entry = m_stEntries[make_pair(string(frame.Source), frame.Line)];
+        if (entry.Calls == 0)
+        {
+            entry.Source = frame.Source;
+            entry.Line = frame.Line;
+        }
+        ++entry.Calls;
+        entry.InclusiveTime += inclusive;
+        entry.ExclusiveTime += exclusive;
+        entry.Bytes += outputSize - frame.OutputStart;
+
+        // 折叠栈以自底向上的帧序列为键
+        m_stTmpKey.clear();
+        for (const auto& f : m_vecStack)
+        {
+            if (!m_stTmpKey.empty())
+                m_stTmpKey.push_back(';');
+            m_stTmpKey.append(f.Source);
+            m_stTmpKey.push_back(':');
+            m_stTmpKey.append(to_string(f.Line));
+        }
+        m_stFoldedStacks[m_stTmpKey] += exclusive;
+    }
+    catch (...)  // 内存不足时丢弃这一样本
+    {
+    }
+
+    m_vecStack.pop_back();
+    if (!m_vecStack.empty())
+        m_vecStack.back().ChildTime += inclusive;
+}
@@ -0,0 +1,727 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/22
+ */
+#include <et/Template.hpp>
+#include <et/TemplateCache.hpp>
+#include <et/TemplateCompiler.hpp>
+
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+using namespace et;
+
+namespace
+{
+    /**
+     * @brief 继承层级的上限，用于检测循环继承
+     */
+    static const size_t kMaxExtendsDepth = 64;
+
+    /**
+     * @brief 虚拟机中编译产物缓存的键
+     */
+    static const char kCompiledCacheKey = 0;
+    static const char kCompiledEntryName[] = "et.CompiledTemplate";
+
+    /**
+     * @brief 缓存中的项数达到这一数量后才开始清理
+     */
+    static const size_t kMinCompiledSweepThreshold = 64;
+
+    /**
+     * @brief 编译产物缓存
+     *
+     * 以用户数据的形式存放在注册表中，缓存表（模板ID -> CompiledEntry）为其uservalue。
+     */
+    struct CompiledCache
+    {
+        size_t Count;
+        size_t SweepThreshold;
+    };
+
+    /**
+     * @brief 缓存中的一项
+     *
+     * 编译产物为其uservalue。模板析构时不知道使用过哪些虚拟机，因此只持有模板的弱引用，
+     * 模板销毁后的项在插入新项时被清理。
+     */
+    struct CompiledEntry
+    {
+        std::weak_ptr<void> Owner;
+    };
+
+    int LuaCompiledEntryGc(lua_State* L)noexcept
+    {
+        auto entry = static_cast<CompiledEntry*>(luaL_checkudata(L, 1, kCompiledEntryName));
+        entry->~CompiledEntry();
+        return 0;
+    }
+
+    /**
+     * @brief 获取编译产物缓存，并将缓存表压入栈顶
+     * @param create 不存在时是否创建
+     */
+    CompiledCache* PushCompiledCache(lua_State* L, bool create)
+    {
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, &kCompiledCacheKey) != LUA_TUSERDATA)
+        {
+            lua_pop(L, 1);
+            if (!create)
+                return nullptr;
+
+            auto cache = static_cast<CompiledCache*>(lua_newuserdata(L, sizeof(CompiledCache)));
+            cache->Count = 0;
+            cache->SweepThreshold = kMinCompiledSweepThreshold;
+            lua_newtable(L);
+            lua_setuservalue(L, -2);
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, &kCompiledCacheKey);
+        }
+
+        auto cache = static_cast<CompiledCache*>(lua_touserdata(L, -1));
+        lua_getuservalue(L, -1);
+        lua_remove(L, -2);
+        return cache;
+    }
+
+    /**
+     * @brief 移除模板已经销毁的项
+     * @param idx 缓存表的栈索引
+     *
+     * 清理后的阈值为剩余项数的两倍，插入的均摊开销为常数。
+     */
+    void SweepCompiledCache(lua_State* L, int idx, CompiledCache* cache)
+    {
+        idx = lua_absindex(L, idx);
+
+        size_t count = 0;
+        lua_pushnil(L);
+        while (lua_next(L, idx))
+        {
+            auto entry = static_cast<CompiledEntry*>(lua_touserdata(L, -1));
+            lua_pop(L, 1);
+
+            // 遍历时可以将已有的项置为nil
+            if (entry && entry->Owner.expired())
+            {
+                lua_pushvalue(L, -1);
+                lua_pushnil(L);
+                lua_rawset(L, idx);
+            }
+            else
+                ++count;
+        }
+
+        cache->Count = count;
+        cache->SweepThreshold = std::max(kMinCompiledSweepThreshold, count * 2);
+    }
+
+    std::atomic<uint64_t> s_ullNextTemplateId(0);
+
+    int64_t GetLuaMemory(lua_State* L)noexcept
+    {
+        return static_cast<int64_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+    }
+
+    void AssignNoThrow(std::string& out, const char* str)noexcept
+    {
+        try
+        {
+            out.assign(str);
+        }
+        catch (...)
+        {
+        }
+    }
+
+    int LuaProtectedErrorHandler(lua_State* L)noexcept  // upvalue: error; msg -> msg
+    {
+        auto error = static_cast<RenderError*>(lua_touserdata(L, lua_upvalueindex(1)));
+
+        // 查找最内层的模板帧，编译产物的源名称以"="开头，行号与模板对齐
+        lua_Debug ar;
+        for (int level = 1; lua_getstack(L, level, &ar); ++level)
+        {
+            if (!lua_getinfo(L, "Sl", &ar) || ar.currentline <= 0 || ar.source[0] != '=')
+                continue;
+            AssignNoThrow(error->Source, ar.source + 1);
+            error->Line = static_cast<uint32_t>(ar.currentline);
+            break;
+        }
+
+        if (!lua_isstring(L, 1))
+            lua_pushfstring(L, "(error object is a %s value)", luaL_typename(L, 1));
+        return 1;
+    }
+
+    /**
+     * @brief TryRender在保护调用中使用的参数
+     */
+    struct ProtectedRenderArgs
+    {
+        const Template* Self;
+        std::string* Out;
+        RenderError* Error;
+        const RenderOptions* Options;
+    };
+
+    /**
+     * @brief 在保护调用中编译并执行模板
+     *
+     * 所有可能抛出Lua错误的调用都在这里进行，TryRender本身只调用不会抛出的API。
+     */
+    int LuaProtectedRender(lua_State* L)noexcept  // args: lightuserdata, env: table|nil
+    {
+        auto args = static_cast<ProtectedRenderArgs*>(lua_touserdata(L, 1));
+        auto& error = *args->Error;
+        int env = lua_isnil(L, 2) ? 0 : 2;
+
+        lua_pushlightuserdata(L, &error);
+        lua_pushcclosure(L, LuaProtectedErrorHandler, 1);
+        int msgh = lua_gettop(L);
+
+        // 只有首次渲染需要编译，异常不会出现在之后的渲染中
+        try
+        {
+            args->Out->reserve(args->Self->GetPredictedOutputSize());
+            args->Self->PushCompiled(L);
+        }
+        catch (const std::bad_alloc&)
+        {
+            error.Code = RenderErrorCodes::OutOfMemory;
+            return 0;
+        }
+        catch (const std::exception& ex)
+        {
+            error.Code = RenderErrorCodes::CompileError;
+            AssignNoThrow(error.Source, args->Self->GetSourceName().c_str());
+            AssignNoThrow(error.Message, ex.what());
+            return 0;
+        }
+
+        // 守卫由ProtectedCall在创建输出缓冲区之后安装，这里不持有任何C++对象
+        bool limited = false;
+        int ret = TemplateCompiler::ProtectedCall(L, env, msgh, *args->Out, args->Options, &limited);
+        if (ret != LUA_OK)
+        {
+            if (ret == LUA_ERRMEM)
+                error.Code = RenderErrorCodes::OutOfMemory;
+            else if (limited)
+                error.Code = RenderErrorCodes::LimitExceeded;
+            else
+                error.Code = RenderErrorCodes::RuntimeError;
+
+            auto message = lua_tostring(L, -1);
+            if (message)
+                AssignNoThrow(error.Message, message);
+        }
+        return 0;
+    }
+
+    void CollectNamedBlocks(TemplateNodeBase* node, std::vector<TemplateNamedBlockNode*>& out)
+    {
+        if (node->GetType() == TemplateNodeTypes::NamedBlock)
+            out.push_back(static_cast<TemplateNamedBlockNode*>(node));
+
+        if (node->GetType() == TemplateNodeTypes::IfElse)
+        {
+            auto ifElse = static_cast<TemplateIfElseNode*>(node);
+            for (size_t i = 0; i < ifElse->GetTrueBranchNodeCount(); ++i)
+                CollectNamedBlocks(ifElse->GetTrueBranchNodeByIndex(i), out);
+        }
+        for (size_t i = 0; i < node->GetNodeCount(); ++i)
+            CollectNamedBlocks(node->GetNodeByIndex(i), out);
+    }
+
+    std::shared_ptr<const std::string> LoadBaseSource(const std::string& referrer, const std::string& name,
+        std::string& resolved)
+    {
+        auto& cache = TemplateCache::GetInstance();
+
+        // 相对名称优先在引用者所在的目录中查找
+        auto pos = referrer.find_last_of("/\\");
+        if (pos != string::npos && !name.empty() && name[0] != '/' && name[0] != '\\')
+        {
+            resolved.assign(referrer, 0, pos + 1);
+            resolved.append(name);
+            try
+            {
+                return cache.LoadSource(resolved);
+            }
+            catch (const IOException&)
+            {
+            }
+        }
+
+        resolved = name;
+        return cache.LoadSource(name);
+    }
+
+    void CheckDuplicatedBlocks(const std::vector<TemplateNamedBlockNode*>& blocks)
+    {
+        unordered_map<string, TemplateNamedBlockNode*> defined;
+        for (auto block : blocks)
+        {
+            if (!defined.emplace(block->GetName(), block).second)
+            {
+                ET_THROW_AT(ParseErrorException, block->GetSource(), block->GetLine(), 0,
+                    Format("Duplicated block \"%s\"", block->GetName().c_str()));
+            }
+        }
+    }
+
+    const TemplateExtendsNode* FindExtends(const TemplateBlockNode& root)
+    {
+        const TemplateExtendsNode* ret = nullptr;
+        for (size_t i = 0; i < root.GetNodeCount(); ++i)
+        {
+            auto node = root.GetNodeByIndex(i);
+            if (node->GetType() != TemplateNodeTypes::Extends)
+                continue;
+
+            auto extends = static_cast<const TemplateExtendsNode*>(node);
+            if (ret)
+            {
+                ET_THROW_AT(ParseErrorException, extends->GetSource(), extends->GetLine(), 0,
+                    "Duplicated extends");
+            }
+            ret = extends;
+        }
+        return ret;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////// Template
+
+Template::Template(const char* input, size_t length, const char* sourceName, const char* path)
+    : m_ullId(++s_ullNextTemplateId), m_stSourceName(sourceName), m_ullSourceSize(length),
+    m_pCompiledOwner(make_shared<char>()), m_ullOutputSizeEstimate(0), m_bRendered(false)
+{
+    // 观察者可能只在渲染时通过选项传入，因此总是计时，两次读取时钟相对于解析可以忽略
+    uint64_t start = GetMonotonicTime();
+
+    // 解析
+    TextReader reader(input, length, m_stSourceName.c_str());
+    TemplateParser parser;
+    parser.Run(reader);
+
+    // 生成模板语法树
+    m_pRoot = ResolveExtends(BuildRootNode(parser), m_stBaseSourceNames, path);
+
+    m_ullParseTime = GetMonotonicTime() - start;
+}
+
+Template::Template(TemplateParser& parser, size_t sourceSize, const char* sourceName)
+    : m_ullId(++s_ullNextTemplateId), m_stSourceName(sourceName), m_ullSourceSize(sourceSize),
+    m_pCompiledOwner(make_shared<char>()), m_ullOutputSizeEstimate(0), m_bRendered(false)
+{
+    uint64_t start = GetMonotonicTime();
+
+    // 节点引用Token中的源名称，改为引用模板持有的字符串
+    for (size_t i = 0; i < parser.GetTokenCount(); ++i)
+        parser.GetTokenByIndex(i).Anchor.SourceName = m_stSourceName.c_str();
+
+    m_pRoot = ResolveExtends(BuildRootNode(parser), m_stBaseSourceNames);
+
+    m_ullParseTime = GetMonotonicTime() - start;
+}
+
+size_t Template::GetPredictedOutputSize()const noexcept
+{
+    size_t estimate = m_ullOutputSizeEstimate.load(memory_order_relaxed);
+    if (estimate == 0)
+        return m_ullSourceSize;
+
+    // 多预留1/8，避免输出略有增长时再次分配
+    return estimate + estimate / 8;
+}
+
+void Template::Render(std::string& out, lua_State* L, int env, const RenderOptions* options)const
+{
+    out.clear();
+    out.reserve(GetPredictedOutputSize());
+
+    RenderContext context(out, options);
+    Render(context, L, env);
+}
+
+void Template::Render(VectoredWriter& writer, lua_State* L, int env, const RenderOptions* options)const
+{
+    RenderContext context(writer, options);
+    Render(context, L, env);
+    writer.Flush();
+}
+
+void Template::Render(RenderContext& context, lua_State* L, int env)const
+{
+    auto options = context.GetOptions();
+
+    // 首次渲染需要报告解析开销，之后视作命中
+    bool rendered = m_bRendered.load(memory_order_relaxed);
+    if (!rendered)
+        m_bRendered.store(true, memory_order_relaxed);
+
+    if (!GetRenderObserver() && !(options && options->Observer))
+    {
+        DoRender(context, L, env);
+        return;
+    }
+
+    RenderStatistics stats;
+    stats.SourceName = m_stSourceName.c_str();
+    stats.CacheHit = rendered;
+    stats.ParseTime = rendered ? 0 : m_ullParseTime;
+
+    auto memory = GetLuaMemory(L);
+    auto start = GetMonotonicTime();
+
+    auto notify = [&]() {
+        stats.RenderTime = GetMonotonicTime() - start;
+        stats.OutputSize = context.GetOutputSize();
+        stats.MemoryDelta = GetLuaMemory(L) - memory;
+        Notify(options, stats);
+    };
+
+    try
+    {
+        DoRender(context, L, env);
+    }
+    catch (...)
+    {
+        notify();
+        throw;
+    }
+
+    stats.Succeeded = true;
+    notify();
+}
+
+RenderErrorCodes Template::TryRender(std::string& out, lua_State* L, int env, RenderError& error,
+    const RenderOptions* options)const noexcept
+{
+    error.Code = RenderErrorCodes::Ok;
+    error.Source.clear();
+    error.Line = 0;
+    error.Message.clear();
+    out.clear();
+
+    bool rendered = m_bRendered.load(memory_order_relaxed);
+    if (!rendered)
+        m_bRendered.store(true, memory_order_relaxed);
+
+    bool observed = GetRenderObserver() || (options && options->Observer);
+    int64_t memory = observed ? GetLuaMemory(L) : 0;
+    uint64_t start = observed ? GetMonotonicTime() : 0;
+
+    int top = lua_gettop(L);
+    if (env != 0)
+        env = lua_absindex(L, env);
+
+    // 压入轻量C函数、轻量用户数据和已有的值都不会分配内存
+    ProtectedRenderArgs args = { this, &out, &error, options };
+    int ret = LUA_ERRMEM;
+    if (lua_checkstack(L, 3))
+    {
+        lua_pushcfunction(L, LuaProtectedRender);
+        lua_pushlightuserdata(L, &args);
+        if (env != 0)
+            lua_pushvalue(L, env);
+        else
+            lua_pushnil(L);
+        ret = lua_pcall(L, 2, 0, 0);
+    }
+
+    // 错误处理函数之外的失败，例如创建闭包时内存不足
+    if (ret != LUA_OK && error.Code == RenderErrorCodes::Ok)
+    {
+        error.Code = (ret == LUA_ERRMEM) ? RenderErrorCodes::OutOfMemory : RenderErrorCodes::RuntimeError;
+        if (lua_gettop(L) > top && lua_type(L, -1) == LUA_TSTRING)  // 转换其他类型可能分配内存
+            AssignNoThrow(error.Message, lua_tostring(L, -1));
+    }
+    lua_settop(L, top);
+
+    if (error.Code == RenderErrorCodes::OutOfMemory && error.Message.empty())
+        AssignNoThrow(error.Message, "Not enough memory");
+
+    if (error.Code == RenderErrorCodes::Ok)
+    {
+        size_t estimate = m_ullOutputSizeEstimate.load(memory_order_relaxed);
+        m_ullOutputSizeEstimate.store(SmoothOutputSize(estimate, out.length()), memory_order_relaxed);
+    }
+    else
+        out.clear();
+
+    if (observed)
+    {
+        RenderStatistics stats;
+        stats.SourceName = m_stSourceName.c_str();
+        stats.Succeeded = (error.Code == RenderErrorCodes::Ok);
+        stats.CacheHit = rendered;
+        stats.ParseTime = rendered ? 0 : m_ullParseTime;
+        stats.RenderTime = GetMonotonicTime() - start;
+        stats.OutputSize = out.length();
+        stats.MemoryDelta = GetLuaMemory(L) - memory;
+        Notify(options, stats);
+    }
+    return error.Code;
+}
+
+void Template::ReleaseCompiled(lua_State* L)const noexcept
+{
+    auto cache = PushCompiledCache(L, false);
+    if (!cache)
+        return;
+
+    // 置空已有的项不会分配内存
+    if (lua_rawgeti(L, -1, static_cast<lua_Integer>(m_ullId)) != LUA_TNIL)
+    {
+        lua_pushnil(L);
+        lua_rawseti(L, -3, static_cast<lua_Integer>(m_ullId));
+        --cache->Count;
+    }
+    lua_pop(L, 2);
+}
+
+void Template::DoRender(RenderContext& context, lua_State* L, int env)const
+{
+#ifndef NDEBUG
+    int top = lua_gettop(L);
+#endif
+    ExecutionGuard guard(L, context.GetOptions());
+    try
+    {
+        ChunkCacheScope cache(context, L);
+        m_pRoot->Render(context, L, env);
+    }
+    catch (const LuaRuntimeException& ex)
+    {
+        // 由守卫中止的渲染，错误信息中已经带有节点的源和行号
+        if (guard.IsTriggered())
+        {
+            ET_THROW_AT(RenderException, ex.GetSource(), ex.GetSourceLine(), ex.GetSourceColumn(),
+                ex.GetErrorMessage());
+        }
+        throw;
+    }
+    assert(top == lua_gettop(L));
+
+    // 更新估计值，并发渲染时偶尔丢失一次更新无关紧要
+    size_t estimate = m_ullOutputSizeEstimate.load(memory_order_relaxed);
+    m_ullOutputSizeEstimate.store(SmoothOutputSize(estimate, context.GetOutputSize()), memory_order_relaxed);
+}
+
+void Template::Check(lua_State* L)const
+{
+    m_pRoot->Check(L);
+}
+
+void Template::PushCompiled(lua_State* L)const
+{
+    auto cache = PushCompiledCache(L, true);  // cache
+    if (lua_rawgeti(L, -1, static_cast<lua_Integer>(m_ullId)) == LUA_TUSERDATA)  // cache entry
+    {
+        lua_getuservalue(L, -1);
+        lua_replace(L, -3);
+        lua_pop(L, 1);
+        return;
+    }
+    lua_pop(L, 1);
+
+    // 编译器在之后可能抛出Lua错误的调用之前析构
+    {
+        TemplateCompiler compiler(L, m_stSourceName.c_str());
+        compiler.Compile(*m_pRoot);  // cache func
+    }
+
+    if (cache->Count >= cache->SweepThreshold)
+        SweepCompiledCache(L, -2, cache);
+
+    auto entry = static_cast<CompiledEntry*>(lua_newuserdata(L, sizeof(CompiledEntry)));
+    new(entry) CompiledEntry();
+    entry->Owner = m_pCompiledOwner;
+    if (luaL_newmetatable(L, kCompiledEntryName))
+    {
+        lua_pushcfunction(L, LuaCompiledEntryGc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+    lua_pushvalue(L, -2);
+    lua_setuservalue(L, -2);  // cache func entry
+    lua_rawseti(L, -3, static_cast<lua_Integer>(m_ullId));
+    ++cache->Count;
+    lua_remove(L, -2);
+}
+
+void Template::Notify(const RenderOptions* options, const RenderStatistics& stats)const noexcept
+{
+    auto globalObserver = GetRenderObserver();
+    auto localObserver = options ? options->Observer : nullptr;
+
+    if (globalObserver)
+        globalObserver->OnRender(stats);
+    if (localObserver && localObserver != globalObserver)
+        localObserver->OnRender(stats);
+}
+
+//////////////////////////////////////////////////////////////////////////////// CheckTemplateFiles
+
+void et::CheckTemplateFiles(CheckStatistics& stats, const std::vector<std::string>& paths, unsigned threads)
+{
+    stats = CheckStatistics();
+    auto start = GetMonotonicTime();
+
+    mutex lock;
+    atomic<size_t> next(0);
+    vector<pair<size_t, string>> errors;
+    auto worker = [&]() {
+        // 只用于编译代码块，不需要加载标准库
+        unique_ptr<lua_State, void(*)(lua_State*)> L(luaL_newstate(), lua_close);
+        while (true)
+        {
+            size_t index = next++;
+            if (index >= paths.size())
+                break;
+
+            const auto& path = paths[index];
+            try
+            {
+                if (!L)
+                    throw bad_alloc();
+
+                MappedFile input(path.c_str());
+                Template tpl(input.GetData(), input.GetSize(), path.c_str());
+                tpl.Check(L.get());
+
+                lock_guard<mutex> guard(lock);
+                ++stats.Count;
+                stats.SourceSize += input.GetSize();
+            }
+            catch (const std::exception& ex)
+            {
+                lock_guard<mutex> guard(lock);
+                ++stats.Count;
+                errors.emplace_back(index, ex.what());
+            }
+        }
+    };
+
+    if (threads == 0)
+        threads = std::max(1u, thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<size_t>(threads, std::max<size_t>(1, paths.size())));
+
+    // 当前线程也参与检查，线程创建失败时由已有的线程完成剩余的工作
+    vector<thread> workers;
+    for (unsigned i = 1; i < threads; ++i)
+    {
+        try
+        {
+            workers.emplace_back(worker);
+        }
+        catch (...)
+        {
+            break;
+        }
+    }
+    worker();
+    for (auto& t : workers)
+        t.join();
+
+    sort(errors.begin(), errors.end());
+    stats.Errors.reserve(errors.size());
+    for (auto& error : errors)
+        stats.Errors.emplace_back(std::move(error.second));
+    stats.CheckTime = GetMonotonicTime() - start;
+}
+
+//////////////////////////////////////////////////////////////////////////////// ResolveExtends
+
+std::unique_ptr<TemplateBlockNode> et::ResolveExtends(std::unique_ptr<TemplateBlockNode>&& root,
+    std::list<std::string>& sourceNames, const char* path)
+{
+    unique_ptr<TemplateBlockNode> current = std::move(root);
+    string referrer(path ? path : "");  // 当前模板的路径，相对名称在其所在目录中查找
+    vector<unique_ptr<TemplateBlockNode>> children;  // 覆盖块所在的语法树，需要保持到替换完成
+    unordered_map<string, TemplateNamedBlockNode*> overrides;
+    vector<TemplateNamedBlockNode*> blocks;
+
+    for (size_t depth = 0; ; ++depth)
+    {
+        auto extends = FindExtends(*current);
+
+        // 收集当前模板的块，已经被子模板覆盖的块保持不变
+        blocks.clear();
+        CollectNamedBlocks(current.get(), blocks);
+        CheckDuplicatedBlocks(blocks);
+
+        if (!extends)
+        {
+            // 到达最顶层，替换被覆盖的块
+            // 替换会销毁原有的子节点，同时替换进来的内容中可能还含有被覆盖的块，因此每次替换后都重新收集
+            while (true)
+            {
+                bool replaced = false;
+                for (auto block : blocks)
+                {
+                    auto it = overrides.find(block->GetName());
+                    if (it == overrides.end())
+                        continue;
+
+                    auto source = it->second;
+                    overrides.erase(it);
+                    if (source != block)
+                    {
+                        block->ReplaceContent(*source);
+                        replaced = true;
+                        break;
+                    }
+                }
+
+                if (!replaced)
+                    break;
+                blocks.clear();
+                CollectNamedBlocks(current.get(), blocks);
+            }
+            return current;
+        }
+
+        if (depth >= kMaxExtendsDepth)
+        {
+            ET_THROW_AT(ParseErrorException, extends->GetSource(), extends->GetLine(), 0,
+                "Extends depth limit exceeded");
+        }
+
+        for (auto block : blocks)
+            overrides.emplace(block->GetName(), block);
+
+        // 读取并解析被继承的模板，源文本由TemplateCache缓存
+        if (depth == 0 && referrer.empty())
+            referrer = extends->GetSource();
+
+        string resolved;
+        auto input = LoadBaseSource(referrer, extends->GetName(), resolved);
+
+        sourceNames.push_back(resolved);
+        referrer = std::move(resolved);
+        TextReader reader(input->c_str(), input->length(), sourceNames.back().c_str());
+        TemplateParser parser;
+        parser.Run(reader);
+
+        children.emplace_back(std::move(current));
+        current = BuildRootNode(parser);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////// LoadTemplateFile
+
+std::shared_ptr<Template> et::LoadTemplateFile(const char* path)
+{
+    // 直接从映射中解析，语法树不引用源文本，构造完成后即可解除映射
+    MappedFile input(path);
+
+    string sourceName = GetFileName(path);
+    return make_shared<Template>(input.GetData(), input.GetSize(), sourceName.c_str(), path);
+}
@@ -0,0 +1,318 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/2/1
+ */
+#include <et/TemplateAnalyzer.hpp>
+#include <et/Template.hpp>
+#include <et/TemplateCache.hpp>
+
+using namespace std;
+using namespace et;
+
+namespace
+{
+    const char kEnvName[] = "_ENV";
+
+    // Lua 5.3的字节码格式（参见ldump.c），不依赖虚拟机的内部结构，宿主使用其他构建的Lua时同样适用
+    const char kBytecodeHeader[] = "\x1bLua\x53\x00\x19\x93\r\n\x1a\n";
+    const uint8_t kConstNil = 0;
+    const uint8_t kConstBoolean = 1;
+    const uint8_t kConstFloat = 3;
+    const uint8_t kConstInteger = 3 | (1 << 4);
+    const uint8_t kConstShortString = 4;
+    const uint8_t kConstLongString = 4 | (1 << 4);
+
+    // 指令格式（参见lopcodes.h）
+    const uint32_t kOpGetTabUp = 6;
+    const uint32_t kConstantBit = 1u << 8;
+
+    inline uint32_t GetOpCode(uint32_t ins)noexcept { return ins & 0x3Fu; }
+    inline uint32_t GetArgB(uint32_t ins)noexcept { return (ins >> 23) & 0x1FFu; }
+    inline uint32_t GetArgC(uint32_t ins)noexcept { return (ins >> 14) & 0x1FFu; }
+
+    /**
+     * @brief 字节码读取器
+     *
+     * 字节码由同一个虚拟机生成，格式不符时说明宿主Lua的版本或配置不受支持。
+     */
+    class BytecodeReader
+    {
+    public:
+        BytecodeReader(const std::string& data)
+            : m_pCurrent(data.data()), m_pEnd(data.data() + data.length()) {}
+
+    public:
+        void ReadHeader()
+        {
+            Expect(sizeof(kBytecodeHeader) - 1 <= Remaining() &&
+                memcmp(m_pCurrent, kBytecodeHeader, sizeof(kBytecodeHeader) - 1) == 0);
+            m_pCurrent += sizeof(kBytecodeHeader) - 1;
+
+            // 各类型的大小须与本机一致，之后按本机类型读取
+            Expect(ReadByte() == sizeof(int) && ReadByte() == sizeof(size_t) && ReadByte() == sizeof(uint32_t) &&
+                ReadByte() == sizeof(lua_Integer) && ReadByte() == sizeof(lua_Number));
+            Skip(sizeof(lua_Integer) + sizeof(lua_Number));
+            ReadByte();  // 主函数的上值数
+        }
+
+        /**
+         * @brief 读取函数原型，收集以常量为键读取_ENV的名称
+         */
+        void ReadFunction(std::vector<std::string>& out)
+        {
+            ReadString(nullptr);  // source
+            Skip(sizeof(int) * 2 + 3);  // linedefined, lastlinedefined, numparams, is_vararg, maxstacksize
+
+            // 代码
+            int count = ReadCount(sizeof(uint32_t));
+            vector<uint32_t> code(static_cast<size_t>(count));
+            Read(code.data(), code.size() * sizeof(uint32_t));
+
+            // 常量，只保留字符串
+            count = ReadCount(1);
+            vector<string> constants(static_cast<size_t>(count));
+            vector<bool> isString(static_cast<size_t>(count), false);
+            for (int i = 0; i < count; ++i)
+            {
+                switch (ReadByte())
+                {
+                    case kConstNil:
+                        break;
+                    case kConstBoolean:
+                        Skip(1);
+                        break;
+                    case kConstFloat:
+                        Skip(sizeof(lua_Number));
+                        break;
+                    case kConstInteger:
+                        Skip(sizeof(lua_Integer));
+                        break;
+                    case kConstShortString:
+                    case kConstLongString:
+                        ReadString(&constants[i]);
+                        isString[i] = true;
+                        break;
+                    default:
+                        Expect(false);
+                        break;
+                }
+            }
+
+            // 上值
+            int upvalues = ReadCount(2);
+            Skip(static_cast<size_t>(upvalues) * 2);
+
+            // 子函数
+            count = ReadCount(1);
+            for (int i = 0; i < count; ++i)
+                ReadFunction(out);
+
+            // 调试信息，其中包含上值的名称
+            count = ReadCount(sizeof(int));
+            Skip(static_cast<size_t>(count) * sizeof(int));
+            count = ReadCount(1);
+            for (int i = 0; i < count; ++i)
+            {
+                ReadString(nullptr);
+                Skip(sizeof(int) * 2);
+            }
+            count = ReadCount(1);
+            Expect(count == 0 || count == upvalues);
+            vector<string> upvalueNames(static_cast<size_t>(count));
+            for (int i = 0; i < count; ++i)
+                ReadString(&upvalueNames[i]);
+
+            // 全局变量的读取被编译为GETTABUP R(A) := UpValue[B][RK(C)]，其中B为名为_ENV的上值
+            for (auto ins : code)
+            {
+                if (GetOpCode(ins) != kOpGetTabUp)
+                    continue;
+
+                uint32_t b = GetArgB(ins);
+                uint32_t c = GetArgC(ins);
+                if ((c & kConstantBit) == 0 || b >= upvalueNames.size() || upvalueNames[b] != kEnvName)
+                    continue;
+
+                c &= ~kConstantBit;
+                if (c < constants.size() && isString[c])
+                    out.push_back(constants[c]);
+            }
+        }
+
+    private:
+        size_t Remaining()const noexcept { return static_cast<size_t>(m_pEnd - m_pCurrent); }
+
+        void Expect(bool condition)
+        {
+            if (!condition)
+                ET_THROW(LuaRuntimeException, "Unsupported Lua bytecode format");
+        }
+
+        void Read(void* out, size_t size)
+        {
+            Expect(size <= Remaining());
+            if (size != 0)
+                memcpy(out, m_pCurrent, size);
+            m_pCurrent += size;
+        }
+
+        void Skip(size_t size)
+        {
+            Expect(size <= Remaining());
+            m_pCurrent += size;
+        }
+
+        uint8_t ReadByte()
+        {
+            uint8_t ret = 0;
+            Read(&ret, sizeof(ret));
+            return ret;
+        }
+
+        int ReadCount(size_t elementSize)
+        {
+            int ret = 0;
+            Read(&ret, sizeof(ret));
+            Expect(ret >= 0 && static_cast<size_t>(ret) <= Remaining() / elementSize);
+            return ret;
+        }
+
+        void ReadString(std::string* out)
+        {
+            size_t size = ReadByte();
+            if (size == 0xFF)
+                Read(&size, sizeof(size));
+            if (size == 0)  // NULL
+                return;
+
+            Expect(size - 1 <= Remaining());
+            if (out)
+                out->assign(m_pCurrent, size - 1);
+            m_pCurrent += size - 1;
+        }
+
+    private:
+        const char* m_pCurrent = nullptr;
+        const char* m_pEnd = nullptr;
+    };
+}
+
+TemplateAnalyzer::TemplateAnalyzer(lua_State* L)
+    : m_pState(L)
+{
+    assert(L);
+}
+
+void TemplateAnalyzer::Analyze(const TemplateNodeBase& root)
+{
+    root.Analyze(*this);
+
+    // 宏可能在使用之后才定义，因此最后统一剔除
+    for (const auto& name : m_stMacros)
+        m_stDependencies.erase(name);
+}
+
+void TemplateAnalyzer::AddExpression(const char* source, uint32_t line, const char* expr, size_t length,
+    bool statement)
+{
+    // 与渲染时一致，先以表达式方式编译，失败后作为语句
+    m_stTmpBuffer.assign("return ");
+    m_stTmpBuffer.append(expr, length);
+    int ret = luaL_loadbufferx(m_pState, m_stTmpBuffer.c_str(), m_stTmpBuffer.length(), "=(expr)", "t");
+    if (ret != LUA_OK && statement)
+    {
+        lua_pop(m_pState, 1);
+        ret = luaL_loadbufferx(m_pState, expr, length, "=(expr)", "t");
+    }
+    if (ret != LUA_OK)
+    {
+        string error(lua_tostring(m_pState, -1));
+        lua_pop(m_pState, 1);
+        ET_THROW_AT(LuaRuntimeException, source, line, 0, std::move(error));
+    }
+
+    // 保留调试信息，其中有上值的名称
+    m_stTmpBuffer.clear();
+    ret = lua_dump(m_pState, [](lua_State*, const void* p, size_t sz, void* ud) -> int {
+        try
+        {
+            static_cast<string*>(ud)->append(static_cast<const char*>(p), sz);
+            return 0;
+        }
+        catch (...)
+        {
+            return 1;
+        }
+    }, &m_stTmpBuffer, 0);
+    lua_pop(m_pState, 1);
+    if (ret != 0)
+        throw bad_alloc();
+
+    m_stTmpNames.clear();
+    BytecodeReader reader(m_stTmpBuffer);
+    reader.ReadHeader();
+    reader.ReadFunction(m_stTmpNames);
+
+    for (auto& name : m_stTmpNames)
+    {
+        if (!IsInScope(name))
+            m_stDependencies.emplace(std::move(name));
+    }
+}
+
+void TemplateAnalyzer::AddMacro(const std::string& name)
+{
+    m_stMacros.insert(name);
+}
+
+void TemplateAnalyzer::AddInclude(const std::string& name)
+{
+    if (name.empty())
+    {
+        m_bDynamicInclude = true;
+        return;
+    }
+    m_stIncludes.insert(name);
+
+    // 被引用的模板在当前作用域中渲染，可能被多次引用，每次都需要在各自的作用域中分析
+    if (std::find(m_stIncludeStack.begin(), m_stIncludeStack.end(), name) != m_stIncludeStack.end() ||
+        m_stIncludeStack.size() >= TemplateIncludeNode::kMaxIncludeDepth)
+    {
+        return;
+    }
+
+    auto tpl = TemplateCache::GetInstance().Load(name);
+    m_stIncludeStack.push_back(name);
+    try
+    {
+        tpl->GetRoot().Analyze(*this);
+    }
+    catch (...)
+    {
+        m_stIncludeStack.pop_back();
+        throw;
+    }
+    m_stIncludeStack.pop_back();
+}
+
+void TemplateAnalyzer::PushScope(const std::vector<std::string>& names)
+{
+    m_stScopes.push_back(&names);
+}
+
+void TemplateAnalyzer::PopScope()noexcept
+{
+    assert(!m_stScopes.empty());
+    m_stScopes.pop_back();
+}
+
+bool TemplateAnalyzer::IsInScope(const std::string& name)const noexcept
+{
+    for (auto scope : m_stScopes)
+    {
+        if (std::find(scope->begin(), scope->end(), name) != scope->end())
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,302 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/25
+ */
+#include <et/TemplateCache.hpp>
+
+#include <thread>
+
+using namespace std;
+using namespace et;
+
+//////////////////////////////////////////////////////////////////////////////// TemplateCache
+
+TemplateCache& TemplateCache::GetInstance()noexcept
+{
+    static TemplateCache s_stInstance;
+    return s_stInstance;
+}
+
+std::vector<std::string> TemplateCache::GetSearchPaths()const
+{
+    lock_guard<mutex> guard(m_stLock);
+    return m_vecSearchPaths;
+}
+
+void TemplateCache::SetSearchPaths(std::vector<std::string> paths)
+{
+    lock_guard<mutex> guard(m_stLock);
+    m_vecSearchPaths = std::move(paths);
+}
+
+void TemplateCache::AddPack(std::shared_ptr<const TemplatePack> pack)
+{
+    assert(pack);
+
+    // 包中的模板优先，移除已经缓存的同名模板和源文本，在锁外释放
+    vector<shared_ptr<Template>> templates;
+    vector<shared_ptr<const string>> sources;
+    string name;
+
+    lock_guard<mutex> guard(m_stLock);
+    for (size_t i = 0; i < pack->GetCount(); ++i)
+    {
+        auto entry = pack->GetEntry(i);
+        name.assign(entry.Name, entry.NameLength);
+
+        auto it = m_stTemplates.find(name);
+        if (it != m_stTemplates.end())
+        {
+            templates.push_back(std::move(it->second));
+            m_stTemplates.erase(it);
+        }
+        auto jt = m_stSources.find(name);
+        if (jt != m_stSources.end())
+        {
+            sources.push_back(std::move(jt->second));
+            m_stSources.erase(jt);
+        }
+    }
+    m_vecPacks.push_back(std::move(pack));
+}
+
+void TemplateCache::ClearPacks()
+{
+    vector<shared_ptr<const TemplatePack>> packs;
+    {
+        lock_guard<mutex> guard(m_stLock);
+        packs.swap(m_vecPacks);
+    }
+}
+
+std::shared_ptr<const TemplatePack> TemplateCache::FindPacked(const std::string& name,
+    TemplatePack::Entry& entry)const
+{
+    lock_guard<mutex> guard(m_stLock);
+    for (auto it = m_vecPacks.rbegin(); it != m_vecPacks.rend(); ++it)
+    {
+        if ((*it)->Find(name, entry))
+            return *it;
+    }
+    return nullptr;
+}
+
+size_t TemplateCache::GetSize()const
+{
+    lock_guard<mutex> guard(m_stLock);
+    return m_stTemplates.size();
+}
+
+void TemplateCache::ReadSource(std::string& out, const std::string& name)const
+{
+    TemplatePack::Entry entry;
+    if (FindPacked(name, entry))
+    {
+        out.assign(entry.Source, entry.SourceLength);
+        return;
+    }
+
+    // 绝对路径不经过搜索路径
+    auto searchPaths = GetSearchPaths();
+    if (searchPaths.empty() || (!name.empty() && (name[0] == '/' || name[0] == '\\')))
+    {
+        ReadFile(out, name.c_str());
+        return;
+    }
+
+    string path;
+    for (const auto& dir : searchPaths)
+    {
+        path = dir;
+        if (!path.empty() && path.back() != '/' && path.back() != '\\')
+            path.push_back('/');
+        path.append(name);
+
+        try
+        {
+            ReadFile(out, path.c_str());
+            return;
+        }
+        catch (const IOException&)
+        {
+        }
+    }
+
+    ET_THROW(IOException, "Template \"%s\" not found in search paths", name.c_str());
+}
+
+std::shared_ptr<const std::string> TemplateCache::LoadSource(const std::string& name)
+{
+    {
+        lock_guard<mutex> guard(m_stLock);
+        auto it = m_stSources.find(name);
+        if (it != m_stSources.end())
+            return it->second;
+    }
+
+    // 读取在锁外进行，与Load相同
+    auto source = make_shared<string>();
+    ReadSource(*source, name);
+
+    lock_guard<mutex> guard(m_stLock);
+    auto ret = m_stSources.emplace(name, std::move(source));
+    return ret.first->second;
+}
+
+std::shared_ptr<Template> TemplateCache::Load(const std::string& name)
+{
+    auto tpl = Find(name);
+    if (tpl)
+        return tpl;
+
+    // 读取并解析，包中的模板直接从映射中解析
+    TemplatePack::Entry entry;
+    auto pack = FindPacked(name, entry);
+    if (pack)
+        tpl = pack->LoadTemplate(entry);
+    else
+    {
+        string input;
+        ReadSource(input, name);
+        tpl = make_shared<Template>(input.c_str(), input.length(), name.c_str());
+    }
+
+    lock_guard<mutex> guard(m_stLock);
+    auto ret = m_stTemplates.emplace(name, std::move(tpl));
+    return ret.first->second;
+}
+
+std::shared_ptr<Template> TemplateCache::Find(const std::string& name)const
+{
+    lock_guard<mutex> guard(m_stLock);
+    auto it = m_stTemplates.find(name);
+    return it == m_stTemplates.end() ? nullptr : it->second;
+}
+
+void TemplateCache::Put(const std::string& name, std::shared_ptr<Template> tpl)
+{
+    lock_guard<mutex> guard(m_stLock);
+    m_stTemplates[name] = std::move(tpl);
+}
+
+void TemplateCache::Clear()
+{
+    unordered_map<string, shared_ptr<Template>> templates;
+    unordered_map<string, shared_ptr<const string>> sources;
+    {
+        lock_guard<mutex> guard(m_stLock);
+        templates.swap(m_stTemplates);
+        sources.swap(m_stSources);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////// PreloadTemplates
+
+namespace
+{
+    bool MatchWildcard(const char* pattern, const char* str)noexcept
+    {
+        // 回溯到最近一个'*'的贪心匹配
+        const char* starPattern = nullptr;
+        const char* starStr = nullptr;
+        while (*str)
+        {
+            if (*pattern == '*')
+            {
+                starPattern = ++pattern;
+                starStr = str;
+            }
+            else if (*pattern == '?' || *pattern == *str)
+            {
+                ++pattern;
+                ++str;
+            }
+            else if (starPattern)
+            {
+                pattern = starPattern;
+                str = ++starStr;
+            }
+            else
+                return false;
+        }
+
+        while (*pattern == '*')
+            ++pattern;
+        return *pattern == '\0';
+    }
+}
+
+void et::PreloadTemplates(PreloadStatistics& stats, const char* dir, const char* pattern, unsigned threads)
+{
+    auto& cache = TemplateCache::GetInstance();
+
+    vector<string> names;
+    ListFiles(names, dir);
+    names.erase(remove_if(names.begin(), names.end(), [&](const string& name) {
+        return !MatchWildcard(pattern, name.c_str());
+    }), names.end());
+
+    string root(dir);
+    if (!root.empty() && root.back() != '/' && root.back() != '\\')
+        root.push_back('/');
+
+    stats = PreloadStatistics();
+    auto start = GetMonotonicTime();
+
+    mutex lock;
+    atomic<size_t> next(0);
+    auto worker = [&]() {
+        while (true)
+        {
+            size_t index = next++;
+            if (index >= names.size())
+                break;
+
+            const auto& name = names[index];
+            try
+            {
+                size_t size = 0;
+                if (!cache.Find(name))
+                {
+                    MappedFile input((root + name).c_str());
+                    size = input.GetSize();
+                    cache.Put(name, make_shared<Template>(input.GetData(), size, name.c_str()));
+                }
+
+                lock_guard<mutex> guard(lock);
+                stats.Names.push_back(name);
+                stats.SourceSize += size;
+            }
+            catch (const std::exception& ex)
+            {
+                lock_guard<mutex> guard(lock);
+                stats.Errors.emplace_back(ex.what());
+            }
+        }
+    };
+
+    if (threads == 0)
+        threads = std::max(1u, thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<size_t>(threads, std::max<size_t>(1, names.size())));
+
+    // 当前线程也参与解析，线程创建失败时由已有的线程完成剩余的工作
+    vector<thread> workers;
+    for (unsigned i = 1; i < threads; ++i)
+    {
+        try
+        {
+            workers.emplace_back(worker);
+        }
+        catch (...)
+        {
+            break;
+        }
+    }
+    worker();
+    for (auto& t : workers)
+        t.join();
+
+    stats.ParseTime = GetMonotonicTime() - start;
+    sort(stats.Names.begin(), stats.Names.end());
+}
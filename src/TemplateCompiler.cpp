@@ -0,0 +1,895 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/20
+ */
+#include <et/TemplateCompiler.hpp>
+#include <et/Template.hpp>
+#include <et/TemplateCache.hpp>
+#include <et/FragmentCache.hpp>
+
+using namespace std;
+using namespace et;
+
+static const char kOutputBufferName[] = "et.OutputBuffer";
+static const char kIncludeCacheKey = 0;
+static const char kSafeStringName[] = "et.SafeString";
+
+static const char kHexDigitTable[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+};
+
+// 编译产物的框架，全部置于第一行以保证行号对齐
+// __et_hint记录历次输出大小的平滑值，用于预留输出缓冲区
+// 被include时由调用方传入__et_parent和__et_depth，直接输出到调用方的缓冲区
+static const char kPrologue[] = "local __et_newbuf, __et_emit, __et_finish, __et_include, __et_cache_get, "
+    "__et_cache_put, __et_escape = ... local __et_hint = 0 "
+    "return function(__et_env, __et_parent, __et_depth) local _ENV = __et_env or _ENV "
+    "local __et_out = __et_parent or __et_newbuf(__et_hint) ";
+static const char kEpilogue[] = " if __et_parent then return end "
+    "local __et_result __et_result, __et_hint = __et_finish(__et_out, __et_hint) return __et_result end";
+
+namespace
+{
+    /**
+     * @brief 编译产物使用的输出缓冲区
+     */
+    struct OutputBuffer
+    {
+        std::string Data;
+        size_t ChunkSize = 0;  // 非0时，在协程中输出达到这一大小后让出
+        uint32_t Pinned = 0;  // 正在记录片段缓存的层数，此时内容不能被取走
+        size_t MaxSize = 0;  // 非0时，输出即将超出这一大小时中止
+        size_t Taken = 0;  // 已经被取走的内容的大小，计入输出大小
+        bool Overflowed = false;
+    };
+
+    bool CheckOutputSize(OutputBuffer* buffer, size_t before)noexcept
+    {
+        if (buffer->MaxSize == 0 || buffer->Taken + buffer->Data.length() <= buffer->MaxSize)
+            return true;
+
+        // 丢弃超出的部分，与逐节点渲染一致
+        buffer->Data.resize(before);
+        buffer->Overflowed = true;
+        return false;
+    }
+
+    OutputBuffer* CheckOutputBuffer(lua_State* L, int idx)
+    {
+        return static_cast<OutputBuffer*>(luaL_checkudata(L, idx, kOutputBufferName));
+    }
+
+    int LuaOutputBufferGc(lua_State* L)noexcept
+    {
+        auto buffer = CheckOutputBuffer(L, 1);
+        buffer->~OutputBuffer();
+        return 0;
+    }
+
+    OutputBuffer* PushOutputBuffer(lua_State* L)noexcept
+    {
+        auto buffer = static_cast<OutputBuffer*>(lua_newuserdata(L, sizeof(OutputBuffer)));
+        new(buffer) OutputBuffer();
+
+        if (luaL_newmetatable(L, kOutputBufferName))
+        {
+            lua_pushcfunction(L, LuaOutputBufferGc);
+            lua_setfield(L, -2, "__gc");
+        }
+        lua_setmetatable(L, -2);
+        return buffer;
+    }
+
+    int LuaNewOutputBuffer(lua_State* L)noexcept  // hint: integer -> buffer
+    {
+        auto hint = static_cast<size_t>(std::max<lua_Integer>(0, luaL_checkinteger(L, 1)));
+        auto buffer = PushOutputBuffer(L);
+
+        // 按照预测值预留空间，多预留1/8
+        try
+        {
+            buffer->Data.reserve(hint + hint / 8);
+        }
+        catch (...)
+        {
+        }
+        return 1;
+    }
+
+    int EmitValues(lua_State* L, OutputBuffer* buffer, int first, EscapeModes escape)noexcept
+    {
+        int top = lua_gettop(L);
+        bool outOfMemory = false;
+
+        for (int i = first; i <= top; ++i)
+        {
+            const char* str = nullptr;
+            size_t len = 0;
+            int segments = -1;
+
+            switch (lua_type(L, i))
+            {
+                case LUA_TNIL:
+                    continue;
+                case LUA_TBOOLEAN:
+                    str = lua_toboolean(L, i) ? "true" : "false";
+                    len = strlen(str);
+                    break;
+                case LUA_TNUMBER:
+                case LUA_TSTRING:
+                    str = lua_tolstring(L, i, &len);
+                    break;
+                case LUA_TUSERDATA:
+                    segments = TemplateCompiler::GetSafeStringSegmentCount(L, i);
+                    if (segments >= 0)
+                        break;
+                    // fallthrough
+                default:
+                    // luaL_error会附加调用者（即编译产物）的位置信息
+                    return luaL_error(L, "Unexpected expression return type %s", luaL_typename(L, i));
+            }
+
+            size_t before = buffer->Data.length();
+            try
+            {
+                if (lua_type(L, i) == LUA_TBOOLEAN)
+                    buffer->Data.append(str, len);
+                else if (segments >= 0)
+                {
+                    // 宏的返回值已经转义过，只转义拼接进来的普通值
+                    for (int j = 0; j < segments; ++j)
+                    {
+                        bool safe = false;
+                        str = TemplateCompiler::GetSafeStringSegment(L, i, j, len, safe);
+                        AppendEscaped(buffer->Data, str, len, safe ? EscapeModes::None : escape);
+                    }
+                }
+                else
+                    AppendEscaped(buffer->Data, str, len, escape);
+            }
+            catch (...)
+            {
+                outOfMemory = true;
+                break;
+            }
+            if (!CheckOutputSize(buffer, before))
+                break;
+        }
+
+        if (outOfMemory)
+            return luaL_error(L, "Not enough memory");
+        if (buffer->Overflowed)
+            return luaL_error(L, "Output size limit exceeded (%I bytes)", static_cast<lua_Integer>(buffer->MaxSize));
+
+        // 分块输出时，缓冲区达到块大小后让出，由调用方取走内容
+        if (buffer->ChunkSize != 0 && buffer->Pinned == 0 && buffer->Data.length() >= buffer->ChunkSize &&
+            lua_isyieldable(L))
+        {
+            return lua_yield(L, 0);
+        }
+        return 0;
+    }
+
+    int LuaEmit(lua_State* L)noexcept  // buffer, ...
+    {
+        return EmitValues(L, CheckOutputBuffer(L, 1), 2, EscapeModes::None);
+    }
+
+    int LuaEscape(lua_State* L)noexcept  // buffer, mode: integer, ...
+    {
+        auto buffer = CheckOutputBuffer(L, 1);
+        auto mode = luaL_checkinteger(L, 2);
+        luaL_argcheck(L, mode >= static_cast<lua_Integer>(EscapeModes::None) &&
+            mode <= static_cast<lua_Integer>(EscapeModes::Sql), 2, "invalid escape mode");
+        return EmitValues(L, buffer, 3, static_cast<EscapeModes>(mode));
+    }
+
+    int LuaSafeStringConcat(lua_State* L)noexcept;
+    int LuaSafeStringToString(lua_State* L)noexcept;
+
+    /**
+     * @brief 以栈顶的值构造安全字符串并替换之
+     *
+     * 栈顶为字符串时，整个字符串都是安全的（即宏的返回值）；
+     * 否则为片段表，依次存放各片段及其是否安全，拼接普通字符串后得到。
+     */
+    void PushSafeString(lua_State* L)
+    {
+        lua_newuserdata(L, 0);
+        if (luaL_newmetatable(L, kSafeStringName))
+        {
+            static const luaL_Reg kMethods[] = {
+                { "__tostring", LuaSafeStringToString },
+                { "__concat", LuaSafeStringConcat },
+                { nullptr, nullptr },
+            };
+            luaL_setfuncs(L, kMethods, 0);
+        }
+        lua_setmetatable(L, -2);
+        lua_insert(L, -2);
+        lua_setuservalue(L, -2);
+    }
+
+    void AppendSafeStringSegment(lua_State* L, int segments, int value, bool safe)
+    {
+        if (lua_rawlen(L, value) == 0)
+            return;
+
+        // 与上一个片段的安全性相同时合并
+        auto count = static_cast<lua_Integer>(lua_rawlen(L, segments));
+        lua_rawgeti(L, segments, count);
+        bool merge = count > 0 && (lua_toboolean(L, -1) != 0) == safe;
+        lua_pop(L, 1);
+        if (merge)
+        {
+            lua_rawgeti(L, segments, count - 1);
+            lua_pushvalue(L, value);
+            lua_concat(L, 2);
+            lua_rawseti(L, segments, count - 1);
+            return;
+        }
+
+        lua_pushvalue(L, value);
+        lua_rawseti(L, segments, count + 1);
+        lua_pushboolean(L, safe ? 1 : 0);
+        lua_rawseti(L, segments, count + 2);
+    }
+
+    void AppendSafeStringOperand(lua_State* L, int segments, int idx)
+    {
+        int count = TemplateCompiler::GetSafeStringSegmentCount(L, idx);
+        if (count >= 0)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                size_t length = 0;
+                bool safe = false;
+                auto str = TemplateCompiler::GetSafeStringSegment(L, idx, i, length, safe);
+                lua_pushlstring(L, str, length);
+                AppendSafeStringSegment(L, segments, lua_gettop(L), safe);
+                lua_pop(L, 1);
+            }
+            return;
+        }
+
+        // 普通的字符串和数字在输出时按照所在位置的模式转义
+        int type = lua_type(L, idx);
+        if (type != LUA_TSTRING && type != LUA_TNUMBER)
+            luaL_error(L, "attempt to concatenate a %s value", luaL_typename(L, idx));
+        lua_pushvalue(L, idx);
+        lua_tostring(L, -1);
+        AppendSafeStringSegment(L, segments, lua_gettop(L), false);
+        lua_pop(L, 1);
+    }
+
+    int LuaSafeStringConcat(lua_State* L)noexcept  // a, b -> safe string
+    {
+        lua_settop(L, 2);
+        lua_newtable(L);
+        AppendSafeStringOperand(L, 3, 1);
+        AppendSafeStringOperand(L, 3, 2);
+
+        // 只剩一个安全片段时不保留片段表
+        lua_rawgeti(L, 3, 2);
+        if (lua_rawlen(L, 3) == 2 && lua_toboolean(L, -1))
+            lua_rawgeti(L, 3, 1);
+        else
+            lua_pushvalue(L, 3);
+        PushSafeString(L);
+        return 1;
+    }
+
+    int LuaSafeStringToString(lua_State* L)noexcept  // self -> string
+    {
+        luaL_Buffer buffer;
+        luaL_buffinit(L, &buffer);
+        int count = TemplateCompiler::GetSafeStringSegmentCount(L, 1);
+        luaL_argcheck(L, count >= 0, 1, "safe string expected");
+        for (int i = 0; i < count; ++i)
+        {
+            size_t length = 0;
+            bool safe = false;
+            auto str = TemplateCompiler::GetSafeStringSegment(L, 1, i, length, safe);
+            luaL_addlstring(&buffer, str, length);
+        }
+        luaL_pushresult(&buffer);
+        return 1;
+    }
+
+    int LuaFinish(lua_State* L)noexcept  // buffer, hint: integer, safe: boolean|nil -> string, hint: integer
+    {
+        auto buffer = CheckOutputBuffer(L, 1);
+        auto hint = static_cast<size_t>(std::max<lua_Integer>(0, luaL_checkinteger(L, 2)));
+        bool safe = lua_toboolean(L, 3) != 0;
+
+        // 宏的返回值已经转义，作为安全字符串返回，输出时不再转义
+        lua_pushlstring(L, buffer->Data.c_str(), buffer->Data.length());
+        if (safe)
+            PushSafeString(L);
+        lua_pushinteger(L, static_cast<lua_Integer>(Template::SmoothOutputSize(hint, buffer->Data.length())));
+        return 2;
+    }
+
+    void PushIncludeCache(lua_State* L)
+    {
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, &kIncludeCacheKey) != LUA_TTABLE)
+        {
+            lua_pop(L, 1);
+            lua_newtable(L);
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, &kIncludeCacheKey);
+        }
+    }
+
+    int LuaInclude(lua_State* L)noexcept  // name: string, depth: integer|nil -> func
+    {
+        size_t length = 0;
+        const char* name = luaL_checklstring(L, 1, &length);
+
+        // 与逐节点渲染使用相同的上限，避免自引用的模板耗尽C栈
+        if (luaL_optinteger(L, 2, 0) >= static_cast<lua_Integer>(TemplateIncludeNode::kMaxIncludeDepth))
+            return luaL_error(L, "Include depth limit exceeded");
+        lua_settop(L, 1);
+
+        // 查找虚拟机中的缓存
+        PushIncludeCache(L);
+        int cache = lua_gettop(L);
+
+        lua_pushvalue(L, 1);
+        if (lua_rawget(L, cache) == LUA_TFUNCTION)
+            return 1;
+        lua_pop(L, 1);
+
+        // 从模板包或全局缓存加载，错误信息转移到Lua栈上之后再抛出，保证C++对象都已析构
+        bool failed = false;
+        {
+            string error;
+            try
+            {
+                TemplateCompiler::LoadTemplate(L, string(name, length));
+            }
+            catch (const std::exception& ex)
+            {
+                failed = true;
+                try
+                {
+                    error = ex.what();
+                }
+                catch (...)
+                {
+                }
+            }
+
+            // 附加调用者（即include语句）的位置信息
+            if (failed)
+            {
+                luaL_where(L, 1);
+                lua_pushlstring(L, error.c_str(), error.length());
+                lua_concat(L, 2);
+            }
+        }
+        if (failed)
+            return lua_error(L);
+
+        lua_pushvalue(L, 1);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, cache);
+        return 1;
+    }
+
+    void CheckCacheKey(lua_State* L, int idx)
+    {
+        int type = lua_type(L, idx);
+        if (type != LUA_TSTRING && type != LUA_TNUMBER)
+            luaL_error(L, "Cache key expected, but found %s", luaL_typename(L, idx));
+    }
+
+    uint32_t CheckCacheTtl(lua_State* L, int idx)
+    {
+        if (lua_isnoneornil(L, idx))
+            return 0;
+
+        int isNumber = 0;
+        auto seconds = lua_tonumberx(L, idx, &isNumber);
+        if (!isNumber)
+            luaL_error(L, "Cache ttl expected, but found %s", luaL_typename(L, idx));
+        if (!(seconds > 0))
+            luaL_error(L, "Cache ttl must be positive, but found %f", seconds);
+        return static_cast<uint32_t>(std::max(1., std::min(seconds * 1000., 4294967295.)));
+    }
+
+    int LuaCacheGet(lua_State* L)noexcept  // buffer, key: string|number, ttl: number|nil -> mark: integer|nil
+    {
+        auto buffer = CheckOutputBuffer(L, 1);
+        CheckCacheKey(L, 2);
+        CheckCacheTtl(L, 3);
+
+        size_t length = 0;
+        const char* key = lua_tolstring(L, 2, &length);
+
+        // 命中时输出缓存的内容
+        bool failed = false;
+        bool hit = false;
+        try
+        {
+            auto fragment = FragmentCache::GetInstance().Get(string(key, length));
+            if (fragment)
+            {
+                size_t before = buffer->Data.length();
+                buffer->Data.append(*fragment);
+                CheckOutputSize(buffer, before);
+                hit = true;
+            }
+        }
+        catch (...)
+        {
+            failed = true;
+        }
+
+        if (failed)
+            return luaL_error(L, "Not enough memory");
+        if (buffer->Overflowed)
+            return luaL_error(L, "Output size limit exceeded (%I bytes)", static_cast<lua_Integer>(buffer->MaxSize));
+        if (hit)
+            return 0;
+        ++buffer->Pinned;
+        lua_pushinteger(L, static_cast<lua_Integer>(buffer->Data.length()));
+        return 1;
+    }
+
+    int LuaCachePut(lua_State* L)noexcept  // buffer, key: string|number, ttl: number|nil, mark: integer
+    {
+        auto buffer = CheckOutputBuffer(L, 1);
+        CheckCacheKey(L, 2);
+        auto ttl = CheckCacheTtl(L, 3);
+        auto mark = static_cast<size_t>(luaL_checkinteger(L, 4));
+        luaL_argcheck(L, mark <= buffer->Data.length(), 4, "invalid mark");
+        if (buffer->Pinned > 0)
+            --buffer->Pinned;
+
+        size_t length = 0;
+        const char* key = lua_tolstring(L, 2, &length);
+
+        bool failed = false;
+        try
+        {
+            FragmentCache::GetInstance().Put(string(key, length), buffer->Data.substr(mark), ttl);
+        }
+        catch (...)
+        {
+            failed = true;
+        }
+
+        if (failed)
+            return luaL_error(L, "Not enough memory");
+        return 0;
+    }
+
+    void AppendQuoted(std::string& out, const char* raw, size_t length)
+    {
+        out.push_back('"');
+        for (size_t i = 0; i < length; ++i)
+        {
+            char ch = raw[i];
+            switch (ch)
+            {
+                case '\a': out.append("\\a"); break;
+                case '\b': out.append("\\b"); break;
+                case '\f': out.append("\\f"); break;
+                case '\n': out.append("\\n"); break;
+                case '\r': out.append("\\r"); break;
+                case '\t': out.append("\\t"); break;
+                case '\v': out.append("\\v"); break;
+                case '\\': out.append("\\\\"); break;
+                case '"': out.append("\\\""); break;
+                default:
+                    if ((ch >= 0 && ch < 0x20) || ch == 0x7F)  // 其余控制字符，UTF-8字节原样保留
+                    {
+                        int hex = static_cast<uint8_t>(ch);
+                        out.append("\\x");
+                        out.push_back(kHexDigitTable[(hex >> 4) & 0xF]);
+                        out.push_back(kHexDigitTable[hex & 0xF]);
+                    }
+                    else
+                        out.push_back(ch);
+                    break;
+            }
+        }
+        out.push_back('"');
+    }
+
+    bool IsBlank(const char* expr, size_t length)
+    {
+        for (size_t i = 0; i < length; ++i)
+        {
+            if (!(expr[i] > 0 && ::isspace(expr[i])))
+                return false;
+        }
+        return true;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////// TemplateCompiler
+
+void TemplateCompiler::ClearIncludeCache(lua_State* L)
+{
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &kIncludeCacheKey);
+}
+
+int TemplateCompiler::GetSafeStringSegmentCount(lua_State* L, int idx)noexcept
+{
+    if (!luaL_testudata(L, idx, kSafeStringName))
+        return -1;
+
+    lua_getuservalue(L, idx);
+    int count = lua_type(L, -1) == LUA_TSTRING ? 1 : static_cast<int>(lua_rawlen(L, -1) / 2);
+    lua_pop(L, 1);
+    return count;
+}
+
+const char* TemplateCompiler::GetSafeStringSegment(lua_State* L, int idx, int index, size_t& length,
+    bool& safe)noexcept
+{
+    // 片段被用户数据引用，弹出后指针仍然有效
+    const char* ret = nullptr;
+    if (lua_getuservalue(L, idx) == LUA_TSTRING)
+    {
+        ret = lua_tolstring(L, -1, &length);
+        safe = true;
+    }
+    else
+    {
+        lua_rawgeti(L, -1, index * 2 + 1);
+        ret = lua_tolstring(L, -1, &length);
+        lua_rawgeti(L, -2, index * 2 + 2);
+        safe = lua_toboolean(L, -1) != 0;
+        lua_pop(L, 2);
+    }
+    lua_pop(L, 1);
+    return ret;
+}
+
+void TemplateCompiler::Load(lua_State* L, const std::string& code, const char* sourceName)
+{
+    LoadChunk(L, code.c_str(), code.length(), sourceName, "t");
+}
+
+void TemplateCompiler::LoadBinary(lua_State* L, const char* data, size_t length, const char* sourceName)
+{
+    LoadChunk(L, data, length, sourceName, "b");
+}
+
+void TemplateCompiler::Dump(lua_State* L, const std::string& code, const char* sourceName, std::string& out)
+{
+    string chunkName("=");
+    chunkName.append(sourceName ? sourceName : "Unknown");
+
+    int ret = luaL_loadbufferx(L, code.c_str(), code.length(), chunkName.c_str(), "t");
+    if (ret == LUA_ERRMEM)
+    {
+        lua_pop(L, 1);
+        throw bad_alloc();
+    }
+    if (ret != LUA_OK)
+    {
+        string error(lua_tostring(L, -1));
+        lua_pop(L, 1);
+        ET_THROW(LuaRuntimeException, "%s", error.c_str());
+    }
+
+    // 保留调试信息，以便错误信息中仍然带有模板的行号
+    out.clear();
+    ret = lua_dump(L, [](lua_State*, const void* p, size_t sz, void* ud) -> int {
+        try
+        {
+            static_cast<string*>(ud)->append(static_cast<const char*>(p), sz);
+            return 0;
+        }
+        catch (...)
+        {
+            return 1;
+        }
+    }, &out, 0);
+    lua_pop(L, 1);
+    if (ret != 0)
+        throw bad_alloc();
+}
+
+void TemplateCompiler::LoadTemplate(lua_State* L, const std::string& name)
+{
+    // 模板包中有预编译的字节码时直接加载
+    TemplatePack::Entry entry;
+    auto pack = TemplateCache::GetInstance().FindPacked(name, entry);
+    if (pack && entry.CodeLength != 0)
+    {
+        LoadBinary(L, entry.Code, entry.CodeLength, entry.Name);
+        return;
+    }
+
+    auto tpl = TemplateCache::GetInstance().Load(name);
+    TemplateCompiler compiler(L, tpl->GetSourceName().c_str());
+    compiler.Compile(tpl->GetRoot());
+}
+
+void TemplateCompiler::PreloadInclude(lua_State* L, const std::string& name)
+{
+    LoadTemplate(L, name);
+
+    PushIncludeCache(L);
+    lua_pushlstring(L, name.c_str(), name.length());
+    lua_pushvalue(L, -3);
+    lua_rawset(L, -3);
+    lua_pop(L, 2);
+}
+
+void TemplateCompiler::LoadChunk(lua_State* L, const char* data, size_t length, const char* sourceName,
+    const char* mode)
+{
+    string chunkName("=");
+    chunkName.append(sourceName ? sourceName : "Unknown");
+
+    int ret = luaL_loadbufferx(L, data, length, chunkName.c_str(), mode);
+    if (ret == LUA_ERRMEM)
+    {
+        lua_pop(L, 1);
+        throw bad_alloc();  // 内存不足不是编译错误
+    }
+    if (ret != LUA_OK)
+    {
+        string error(lua_tostring(L, -1));
+        lua_pop(L, 1);
+        ET_THROW(LuaRuntimeException, "%s", error.c_str());
+    }
+
+    // 执行框架代码，得到最终的渲染函数
+    lua_pushcfunction(L, LuaNewOutputBuffer);
+    lua_pushcfunction(L, LuaEmit);
+    lua_pushcfunction(L, LuaFinish);
+    lua_pushcfunction(L, LuaInclude);
+    lua_pushcfunction(L, LuaCacheGet);
+    lua_pushcfunction(L, LuaCachePut);
+    lua_pushcfunction(L, LuaEscape);
+    ret = lua_pcall(L, 7, 1, 0);
+    if (ret == LUA_ERRMEM)
+    {
+        lua_pop(L, 1);
+        throw bad_alloc();
+    }
+    if (ret != LUA_OK)
+    {
+        string error(lua_tostring(L, -1));
+        lua_pop(L, 1);
+        ET_THROW(LuaRuntimeException, "%s", error.c_str());
+    }
+}
+
+void TemplateCompiler::NewOutputBuffer(lua_State* L, size_t chunkSize, size_t maxSize)
+{
+    auto buffer = PushOutputBuffer(L);
+    buffer->ChunkSize = chunkSize;
+    buffer->MaxSize = maxSize;
+}
+
+void TemplateCompiler::TakeOutput(lua_State* L, int idx)
+{
+    auto buffer = CheckOutputBuffer(L, idx);
+    lua_pushlstring(L, buffer->Data.c_str(), buffer->Data.length());
+    buffer->Taken += buffer->Data.length();
+    buffer->Data.clear();
+}
+
+int TemplateCompiler::ProtectedCall(lua_State* L, int env, int msgh, std::string& out, const RenderOptions* options,
+    bool* limited)noexcept
+{
+    assert(lua_isfunction(L, -1));
+
+    // 缓冲区在安装守卫之前创建，此时内存不足抛出的Lua错误不会跳过任何C++对象
+    if (env != 0)
+        lua_pushvalue(L, env);
+    else
+        lua_pushnil(L);
+    auto buffer = PushOutputBuffer(L);  // func env buffer
+    buffer->MaxSize = options ? options->MaxOutputSize : 0;
+    lua_pushvalue(L, -1);
+    lua_insert(L, -4);  // buffer func env buffer
+
+    // 守卫存活期间只有lua_pcall，不会有Lua错误跳出这一函数
+    int ret = LUA_ERRMEM;
+    bool triggered = false;
+    try
+    {
+        ExecutionGuard guard(L, options);
+
+        // 编译产物直接向调用方的字符串追加内容，不需要再复制一次结果
+        buffer->Data.swap(out);
+        ret = lua_pcall(L, 2, 0, msgh);
+        buffer->Data.swap(out);
+        triggered = guard.IsTriggered();
+    }
+    catch (const std::bad_alloc&)
+    {
+        lua_pop(L, 3);
+        lua_pushnil(L);  // buffer nil
+    }
+
+    if (limited)
+        *limited = triggered || buffer->Overflowed;
+    lua_remove(L, ret == LUA_OK ? -1 : -2);
+    return ret;
+}
+
+TemplateCompiler::TemplateCompiler(lua_State* L, const char* sourceName)
+    : m_pState(L), m_pszSourceName(sourceName)
+{
+    assert(L);
+}
+
+void TemplateCompiler::Compile(const TemplateNodeBase& root)
+{
+    m_stCode.clear();
+    m_uLine = 1;
+    m_uLocalId = 0;
+
+    Append(kPrologue, sizeof(kPrologue) - 1);
+    root.Compile(*this);
+    Append(kEpilogue, sizeof(kEpilogue) - 1);
+
+    Load(m_pState, m_stCode, m_pszSourceName);
+}
+
+void TemplateCompiler::SyncLine(uint32_t line)
+{
+    while (m_uLine < line)
+    {
+        m_stCode.push_back('\n');
+        ++m_uLine;
+    }
+}
+
+void TemplateCompiler::Append(const char* code)
+{
+    Append(code, strlen(code));
+}
+
+void TemplateCompiler::Append(const char* code, size_t length)
+{
+    // 与Lua词法分析器保持一致："\n"、"\r"、"\r\n"、"\n\r"均视作一个换行
+    for (size_t i = 0; i < length; ++i)
+    {
+        char ch = code[i];
+        if (ch == '\n' || ch == '\r')
+        {
+            ++m_uLine;
+            if (i + 1 < length && (code[i + 1] == '\n' || code[i + 1] == '\r') && code[i + 1] != ch)
+                ++i;
+        }
+    }
+    m_stCode.append(code, length);
+}
+
+void TemplateCompiler::EmitText(const std::string& text)
+{
+    if (text.empty())
+        return;
+
+    m_stCode.append("__et_emit(__et_out, ");
+    AppendQuoted(m_stCode, text.c_str(), text.length());
+    m_stCode.append(") ");
+}
+
+void TemplateCompiler::EmitExpression(const char* source, uint32_t line, const char* expr, size_t length,
+    EscapeModes escape)
+{
+    if (IsBlank(expr, length))
+        return;
+
+    // 先以表达式方式编译
+    // 若表达式以注释结尾，则需要换行后才能闭合括号
+    static const char* const kExpressionForms[][2] = {
+        { "", " ) " },
+        { "", "\n) " },
+        { "(function() return ", "\nend)()) " },
+    };
+
+    m_stTmpBuffer.assign("return ");
+    m_stTmpBuffer.append(expr, length);
+    if (TryCompile(m_stTmpBuffer))
+    {
+        // 需要转义时改为调用__et_escape(__et_out, mode, ...)
+        string emitter = (escape == EscapeModes::None) ? string("__et_emit(__et_out, ") :
+            Format("__et_escape(__et_out, %d, ", static_cast<int>(escape));
+
+        for (const auto& form : kExpressionForms)
+        {
+            m_stTmpBuffer.assign(emitter);
+            m_stTmpBuffer.append(form[0]);
+            m_stTmpBuffer.append(expr, length);
+            m_stTmpBuffer.append(form[1]);
+            if (TryCompile(m_stTmpBuffer))
+            {
+                Append(m_stTmpBuffer.c_str(), m_stTmpBuffer.length());
+                return;
+            }
+        }
+    }
+
+    // 编译失败，换成语句块模式
+    static const char* const kStatementForms[][2] = {
+        { "do ", " end " },
+        { "do ", "\nend " },
+    };
+
+    for (const auto& form : kStatementForms)
+    {
+        m_stTmpBuffer.assign(form[0]);
+        m_stTmpBuffer.append(expr, length);
+        m_stTmpBuffer.append(form[1]);
+        if (TryCompile(m_stTmpBuffer))
+        {
+            Append(m_stTmpBuffer.c_str(), m_stTmpBuffer.length());
+            return;
+        }
+    }
+
+    // 报告语句块模式下的错误
+    int ret = luaL_loadbufferx(m_pState, expr, length, "=(expr)", "t");
+    if (ret == LUA_ERRMEM)
+    {
+        lua_pop(m_pState, 1);
+        throw bad_alloc();
+    }
+    string error(ret != LUA_OK ? lua_tostring(m_pState, -1) : "Invalid expression");
+    lua_pop(m_pState, 1);
+    ET_THROW_AT(LuaRuntimeException, source, line, 0, std::move(error));
+}
+
+void TemplateCompiler::EmitHeader(const char* source, uint32_t line, const char* prefix, const char* expr,
+    size_t length, const char* suffix, const char* closer)
+{
+    static const char* const kSeparators[] = { " ", "\n" };
+
+    for (const auto& sep : kSeparators)
+    {
+        m_stTmpBuffer.assign(prefix);
+        m_stTmpBuffer.append(expr, length);
+        m_stTmpBuffer.append(sep);
+        m_stTmpBuffer.append(suffix);
+
+        size_t headerLength = m_stTmpBuffer.length();
+        m_stTmpBuffer.append(closer);
+        if (TryCompile(m_stTmpBuffer))
+        {
+            Append(m_stTmpBuffer.c_str(), headerLength);
+            return;
+        }
+    }
+
+    // 以表达式方式报告错误
+    m_stTmpBuffer.assign("return ");
+    m_stTmpBuffer.append(expr, length);
+    int ret = luaL_loadbufferx(m_pState, m_stTmpBuffer.c_str(), m_stTmpBuffer.length(), "=(expr)", "t");
+    if (ret == LUA_ERRMEM)
+    {
+        lua_pop(m_pState, 1);
+        throw bad_alloc();
+    }
+    string error(ret != LUA_OK ? lua_tostring(m_pState, -1) : "Invalid expression");
+    lua_pop(m_pState, 1);
+    ET_THROW_AT(LuaRuntimeException, source, line, 0, std::move(error));
+}
+
+std::string TemplateCompiler::AllocLocalName()
+{
+    return Format("__et_%u", m_uLocalId++);
+}
+
+bool TemplateCompiler::TryCompile(const std::string& code)
+{
+    int ret = luaL_loadbufferx(m_pState, code.c_str(), code.length(), "=(check)", "t");
+    lua_pop(m_pState, 1);
+    if (ret == LUA_ERRMEM)
+        throw bad_alloc();  // 否则会被当作语法错误，继续尝试其他形式
+    return ret == LUA_OK;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/31
+ */
+#include <et/TemplateDocument.hpp>
+
+using namespace std;
+using namespace et;
+
+TemplateDocument::TemplateDocument(const char* text, size_t length, const char* sourceName)
+    : m_stText(text, length), m_stSourceName(sourceName)
+{
+    m_stParser.SetIncrementalEnable(true);
+}
+
+void TemplateDocument::Edit(size_t start, size_t removed, const char* text, size_t length)
+{
+    if (start > m_stText.length() || removed > m_stText.length() - start)
+    {
+        ET_THROW(InvalidArgumentException, "Edit range out of bound, start %u, removed %u, length %u",
+            static_cast<unsigned>(start), static_cast<unsigned>(removed), static_cast<unsigned>(m_stText.length()));
+    }
+
+    m_stText.replace(start, removed, text, length);
+    m_pTemplate.reset();
+
+    if (!m_bParsed)
+    {
+        Parse();
+        return;
+    }
+
+    // 解析失败后解析器不再可用，下一次编辑时完整解析
+    m_bParsed = false;
+    m_stReader = TextReader(m_stText.c_str(), m_stText.length(), m_stSourceName.c_str());
+    m_stParser.Update(m_stReader, start, removed, length);
+    m_bParsed = true;
+}
+
+std::shared_ptr<Template> TemplateDocument::GetTemplate()
+{
+    if (!m_pTemplate)
+    {
+        if (!m_bParsed)
+            Parse();
+        m_pTemplate = make_shared<Template>(m_stParser, m_stText.length(), m_stSourceName.c_str());
+    }
+    return m_pTemplate;
+}
+
+void TemplateDocument::Parse()
+{
+    m_stReader = TextReader(m_stText.c_str(), m_stText.length(), m_stSourceName.c_str());
+    m_stParser.Run(m_stReader);
+    m_bParsed = true;
+}
@@ -4,6 +4,12 @@
  * @date 2018/1/7
  */
 #include <et/TemplateNode.hpp>
+#include <et/TemplateCompiler.hpp>
+#include <et/TemplateAnalyzer.hpp>
+#include <et/RenderProfiler.hpp>
+#include <et/TemplateCache.hpp>
+#include <et/FragmentCache.hpp>
+#include <et/NativeIterator.hpp>
 
 #include <stack>
 #include <cassert>
@@ -15,18 +21,122 @@ static const char kReturn[] = "return ";
 
 namespace
 {
-    string SafeAssignString(const char* raw)
+    /**
+     * @brief 尝试将表达式解析为简单的字符串字面量
+     *
+     * 只接受不含转义和换行的单行字符串，其余情况交给Lua求值。
+     */
+    bool TryParseStringLiteral(const char* expr, size_t length, string& out)
     {
+        while (length > 0 && expr[0] > 0 && ::isspace(expr[0]))
+        {
+            ++expr;
+            --length;
+        }
+        while (length > 0 && expr[length - 1] > 0 && ::isspace(expr[length - 1]))
+            --length;
+
+        if (length < 2 || (expr[0] != '"' && expr[0] != '\'') || expr[length - 1] != expr[0])
+            return false;
+
+        for (size_t i = 1; i + 1 < length; ++i)
+        {
+            char ch = expr[i];
+            if (ch == expr[0] || ch == '\\' || ch == '\n' || ch == '\r')
+                return false;
+        }
+
+        out.assign(expr + 1, length - 2);
+        return true;
+    }
+
+    const char kSharedEnvKey = 0;
+
+    /**
+     * @brief 从本次渲染的缓存中取出节点的代码块
+     * @return 是否命中，命中时压入代码块
+     */
+    bool PushCachedChunk(RenderContext& context, lua_State* L, const TemplateNodeBase* node)
+    {
+        int cache = context.GetChunkCache();
+        if (cache == 0)
+            return false;
+        if (lua_rawgetp(L, cache, node) == LUA_TFUNCTION)
+            return true;
+        lua_pop(L, 1);
+        return false;
+    }
+
+    /**
+     * @brief 为栈顶新加载的代码块设置ENV，并放入本次渲染的缓存
+     *
+     * 缓存中第一个代码块的_ENV上值被设置为env，此后的代码块通过lua_upvaluejoin共享同一个上值，
+     * 因此代码块被缓存后的每次执行都只是一次普通的调用。
+     * 一次渲染中所有节点的env都是同一个表（for语句的迭代变量写入其中，而不是替换它），共享是安全的。
+     * 表达式中对_ENV的赋值会改变共享的上值，作用于其后的所有节点，这与编译产物中_ENV为整个函数的局部变量一致。
+     */
+    void BindChunk(RenderContext& context, lua_State* L, int env, const TemplateNodeBase* node)
+    {
+        int cache = context.GetChunkCache();
+        if (env != 0)
+        {
+            if (cache != 0 && lua_rawgetp(L, cache, &kSharedEnvKey) == LUA_TFUNCTION)
+            {
+                lua_upvaluejoin(L, -2, 1, -1, 1);
+                lua_pop(L, 1);
+            }
+            else
+            {
+                if (cache != 0)
+                    lua_pop(L, 1);
+
+                lua_pushvalue(L, env);
+                if (!lua_setupvalue(L, -2, 1))
+                    lua_pop(L, 1);
+                else if (cache != 0)
+                {
+                    lua_pushvalue(L, -1);
+                    lua_rawsetp(L, cache, &kSharedEnvKey);
+                }
+            }
+        }
+
+        if (cache != 0)
+        {
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, cache, node);
+        }
+    }
+
+    /**
+     * @brief 弹出栈顶的错误信息
+     *
+     * 错误信息只复制这一次，随后直接移入异常，位置信息由异常在what()中拼接。
+     */
+    string PopErrorMessage(lua_State* L)
+    {
+        size_t length = 0;
+        const char* raw = lua_tolstring(L, -1, &length);
+
         string ret;
         try
         {
-            ret.assign(raw);
+            if (raw)
+                ret.assign(raw, length);
         }
         catch (...)
         {
         }
+        lua_pop(L, 1);
         return ret;
     }
+
+    void CheckChunk(lua_State* L, const std::string& code, const char* chunkName, const char* source, uint32_t line)
+    {
+        if (luaL_loadbufferx(L, code.c_str(), code.length(), chunkName, "t") != LUA_OK)
+            ET_THROW_AT(LuaRuntimeException, source, line, 0, PopErrorMessage(L));
+        lua_pop(L, 1);
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////// TemplateNodeBase
@@ -59,6 +169,25 @@ bool TemplateNodeBase::RemoveNode(size_t index)noexcept
     return false;
 }
 
+void TemplateNodeBase::Render(std::string& builder, lua_State* L, int env)const
+{
+    RenderContext context(builder);
+    ChunkCacheScope cache(context, L);
+    Render(context, L, env);
+}
+
+void TemplateNodeBase::Analyze(TemplateAnalyzer& analyzer)const
+{
+    for (size_t i = 0; i < GetNodeCount(); ++i)
+        GetNodeByIndex(i)->Analyze(analyzer);
+}
+
+void TemplateNodeBase::Check(lua_State* L)const
+{
+    for (size_t i = 0; i < GetNodeCount(); ++i)
+        GetNodeByIndex(i)->Check(L);
+}
+
 //////////////////////////////////////////////////////////////////////////////// TemplateTextNode
 
 TemplateTextNode::TemplateTextNode(std::string&& content)
@@ -71,11 +200,16 @@ TemplateNodeTypes TemplateTextNode::GetType()const noexcept
     return TemplateNodeTypes::Text;
 }
 
-void TemplateTextNode::Render(std::string& builder, lua_State* L, int env)const
+void TemplateTextNode::Render(RenderContext& context, lua_State* L, int env)const
 {
     ET_UNUSED(L);
     ET_UNUSED(env);
-    builder.append(m_stContent);
+    context.WriteReference(m_stContent.data(), m_stContent.length());
+}
+
+void TemplateTextNode::Compile(TemplateCompiler& compiler)const
+{
+    compiler.EmitText(m_stContent);
 }
 
 //////////////////////////////////////////////////////////////////////////////// TemplateBlockNode
@@ -133,16 +267,23 @@ bool TemplateBlockNode::RemoveNode(size_t index)noexcept
     return true;
 }
 
-void TemplateBlockNode::Render(std::string& builder, lua_State* L, int env)const
+void TemplateBlockNode::Render(RenderContext& context, lua_State* L, int env)const
+{
+    for (const auto& node : m_vecNodes)
+        node->Render(context, L, env);
+}
+
+void TemplateBlockNode::Compile(TemplateCompiler& compiler)const
 {
     for (const auto& node : m_vecNodes)
-        node->Render(builder, L, env);
+        node->Compile(compiler);
 }
 
 //////////////////////////////////////////////////////////////////////////////// TemplateExpressionNode
 
-TemplateExpressionNode::TemplateExpressionNode(const char* source, uint32_t line, std::string&& expr)
-    : m_pszSource(source), m_uLine(line)
+TemplateExpressionNode::TemplateExpressionNode(const char* source, uint32_t line, std::string&& expr,
+    EscapeModes escape)
+    : m_pszSource(source), m_uLine(line), m_iEscapeMode(escape)
 {
     // 加上一个return使得变成一个表达式
     m_stExpression = std::move(expr);
@@ -154,31 +295,29 @@ TemplateNodeTypes TemplateExpressionNode::GetType()const noexcept
     return TemplateNodeTypes::Expression;
 }
 
-void TemplateExpressionNode::Render(std::string& builder, lua_State* L, int env)const
+void TemplateExpressionNode::Render(RenderContext& context, lua_State* L, int env)const
 {
-    // 先以表达式方式编译
-    int ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(expr)", "t");
-    if (ret != LUA_OK)
-    {
-        // 编译失败，换成语句块模式
-        lua_pop(L, 1);
-        ret = luaL_loadbufferx(L, m_stExpression.c_str() + sizeof(kReturn) - 1,
-            m_stExpression.length() - sizeof(kReturn) + 1, "=(expr)", "t");
+    RenderProfiler::Scope profile(context, m_pszSource, m_uLine);
 
+    // 同一次渲染中代码块只加载一次，并绑定到共享的ENV上（参见BindChunk）
+    int ret = LUA_OK;
+    if (!PushCachedChunk(context, L, this))
+    {
+        // 先以表达式方式编译
+        ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(expr)", "t");
         if (ret != LUA_OK)
         {
-            string error = SafeAssignString(lua_tostring(L, -1));
+            // 编译失败，换成语句块模式
             lua_pop(L, 1);
-            ET_THROW(LuaRuntimeException, "%s:%u: %s", m_pszSource, m_uLine, error.c_str());
-        }
-    }
+            ret = luaL_loadbufferx(L, m_stExpression.c_str() + sizeof(kReturn) - 1,
+                m_stExpression.length() - sizeof(kReturn) + 1, "=(expr)", "t");
 
-    // 设置ENV
-    if (env != 0)
-    {
-        lua_pushvalue(L, env);
-        if (!lua_setupvalue(L, -2, 1))
-            lua_pop(L, 1);
+            if (ret != LUA_OK)
+            {
+                ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
+            }
+        }
+        BindChunk(context, L, env, this);
     }
 
     // 执行语句或者表达式
@@ -186,9 +325,7 @@ void TemplateExpressionNode::Render(std::string& builder, lua_State* L, int env)
     ret = lua_pcall(L, 0, LUA_MULTRET, 0);
     if (ret != LUA_OK)
     {
-        string error = SafeAssignString(lua_tostring(L, -1));
-        lua_pop(L, 1);
-        ET_THROW(LuaRuntimeException, "%s:%u: %s", m_pszSource, m_uLine, error.c_str());
+        ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
     }
 
     // 栈顶剩下需要打印输出的内容
@@ -207,15 +344,40 @@ void TemplateExpressionNode::Render(std::string& builder, lua_State* L, int env)
                 case LUA_TNIL:
                     break;
                 case LUA_TBOOLEAN:
-                    builder.append(lua_toboolean(L, idx) ? "true" : "false");
+                    if (lua_toboolean(L, idx))
+                        context.Write("true", 4);
+                    else
+                        context.Write("false", 5);
                     break;
                 case LUA_TNUMBER:
                 case LUA_TSTRING:
-                    builder.append(lua_tostring(L, idx));
+                    {
+                        size_t len = 0;
+                        const char* str = lua_tolstring(L, idx, &len);
+                        context.WriteEscaped(str, len, m_iEscapeMode);
+                    }
+                    break;
+                case LUA_TUSERDATA:
+                    {
+                        // 宏的返回值已经转义过，只转义拼接进来的普通值（参见TemplateCompiler::GetSafeStringSegmentCount）
+                        int segments = TemplateCompiler::GetSafeStringSegmentCount(L, idx);
+                        if (segments < 0)
+                        {
+                            ET_THROW_AT(RenderException, m_pszSource, m_uLine, 0,
+                                Format("Unexpected expression return type %s", luaL_typename(L, idx)));
+                        }
+                        for (int j = 0; j < segments; ++j)
+                        {
+                            size_t len = 0;
+                            bool safe = false;
+                            const char* str = TemplateCompiler::GetSafeStringSegment(L, idx, j, len, safe);
+                            context.WriteEscaped(str, len, safe ? EscapeModes::None : m_iEscapeMode);
+                        }
+                    }
                     break;
                 default:
-                    ET_THROW(RenderException, "%s:%u: Unexpected expression return type %s", m_pszSource, m_uLine,
-                        luaL_typename(L, idx));
+                    ET_THROW_AT(RenderException, m_pszSource, m_uLine, 0,
+                        Format("Unexpected expression return type %s", luaL_typename(L, idx)));
             }
         }
     }
@@ -230,6 +392,34 @@ void TemplateExpressionNode::Render(std::string& builder, lua_State* L, int env)
     lua_pop(L, count);
 }
 
+void TemplateExpressionNode::Compile(TemplateCompiler& compiler)const
+{
+    compiler.SyncLine(m_uLine);
+    compiler.EmitExpression(m_pszSource, m_uLine, m_stExpression.c_str() + sizeof(kReturn) - 1,
+        m_stExpression.length() - sizeof(kReturn) + 1, m_iEscapeMode);
+}
+
+void TemplateExpressionNode::Analyze(TemplateAnalyzer& analyzer)const
+{
+    analyzer.AddExpression(m_pszSource, m_uLine, m_stExpression.c_str() + sizeof(kReturn) - 1,
+        m_stExpression.length() - sizeof(kReturn) + 1, true);
+}
+
+void TemplateExpressionNode::Check(lua_State* L)const
+{
+    // 与渲染时一致，先以表达式方式编译，失败后作为语句
+    int ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(expr)", "t");
+    if (ret != LUA_OK)
+    {
+        lua_pop(L, 1);
+        ret = luaL_loadbufferx(L, m_stExpression.c_str() + sizeof(kReturn) - 1,
+            m_stExpression.length() - sizeof(kReturn) + 1, "=(expr)", "t");
+        if (ret != LUA_OK)
+            ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
+    }
+    lua_pop(L, 1);
+}
+
 //////////////////////////////////////////////////////////////////////////////// TemplateIfNode
 
 TemplateIfNode::TemplateIfNode(const char* source, uint32_t line, std::string&& expr)
@@ -307,31 +497,27 @@ bool TemplateIfNode::RemoveNode(size_t index)noexcept
     return true;
 }
 
-void TemplateIfNode::Render(std::string& builder, lua_State* L, int env)const
+void TemplateIfNode::Render(RenderContext& context, lua_State* L, int env)const
 {
-    int ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(if)", "t");
-    if (ret != LUA_OK)
-    {
-        string error = SafeAssignString(lua_tostring(L, -1));
-        lua_pop(L, 1);
-        ET_THROW(LuaRuntimeException, "%s:%u: %s", m_pszSource, m_uLine, error.c_str());
-    }
+    RenderProfiler::Scope profile(context, m_pszSource, m_uLine);
 
-    // 设置ENV
-    if (env != 0)
+    // 同一次渲染中代码块只加载一次，并绑定到共享的ENV上（参见BindChunk）
+    int ret = LUA_OK;
+    if (!PushCachedChunk(context, L, this))
     {
-        lua_pushvalue(L, env);
-        if (!lua_setupvalue(L, -2, 1))
-            lua_pop(L, 1);
+        ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(if)", "t");
+        if (ret != LUA_OK)
+        {
+            ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
+        }
+        BindChunk(context, L, env, this);
     }
 
     // 执行表达式
     ret = lua_pcall(L, 0, 1, 0);  // 只取第一个返回值
     if (ret != LUA_OK)
     {
-        string error = SafeAssignString(lua_tostring(L, -1));
-        lua_pop(L, 1);
-        ET_THROW(LuaRuntimeException, "%s:%u: %s", m_pszSource, m_uLine, error.c_str());
+        ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
     }
 
     // 检查结果
@@ -342,10 +528,39 @@ void TemplateIfNode::Render(std::string& builder, lua_State* L, int env)const
     if (result)
     {
         for (const auto& node : m_vecTrueBranchNodes)
-            node->Render(builder, L, env);
+            node->Render(context, L, env);
     }
 }
 
+void TemplateIfNode::Compile(TemplateCompiler& compiler)const
+{
+    compiler.SyncLine(m_uLine);
+    compiler.EmitHeader(m_pszSource, m_uLine, "if ", m_stExpression.c_str() + sizeof(kReturn) - 1,
+        m_stExpression.length() - sizeof(kReturn) + 1, "then ", " end");
+
+    for (const auto& node : m_vecTrueBranchNodes)
+        node->Compile(compiler);
+
+    compiler.Append(" end ");
+}
+
+void TemplateIfNode::Analyze(TemplateAnalyzer& analyzer)const
+{
+    analyzer.AddExpression(m_pszSource, m_uLine, m_stExpression.c_str() + sizeof(kReturn) - 1,
+        m_stExpression.length() - sizeof(kReturn) + 1, false);
+
+    for (const auto& node : m_vecTrueBranchNodes)
+        node->Analyze(analyzer);
+}
+
+void TemplateIfNode::Check(lua_State* L)const
+{
+    CheckChunk(L, m_stExpression, "=(if)", m_pszSource, m_uLine);
+
+    for (const auto& node : m_vecTrueBranchNodes)
+        node->Check(L);
+}
+
 //////////////////////////////////////////////////////////////////////////////// TemplateIfElseNode
 
 TemplateIfElseNode::TemplateIfElseNode(TemplateIfNode& origin)
@@ -416,31 +631,27 @@ bool TemplateIfElseNode::RemoveNode(size_t index)noexcept
     return true;
 }
 
-void TemplateIfElseNode::Render(std::string& builder, lua_State* L, int env)const
+void TemplateIfElseNode::Render(RenderContext& context, lua_State* L, int env)const
 {
-    int ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(if)", "t");
-    if (ret != LUA_OK)
-    {
-        string error = SafeAssignString(lua_tostring(L, -1));
-        lua_pop(L, 1);
-        ET_THROW(LuaRuntimeException, "%s:%u: %s", m_pszSource, m_uLine, error.c_str());
-    }
+    RenderProfiler::Scope profile(context, m_pszSource, m_uLine);
 
-    // 设置ENV
-    if (env != 0)
+    // 同一次渲染中代码块只加载一次，并绑定到共享的ENV上（参见BindChunk）
+    int ret = LUA_OK;
+    if (!PushCachedChunk(context, L, this))
     {
-        lua_pushvalue(L, env);
-        if (!lua_setupvalue(L, -2, 1))
-            lua_pop(L, 1);
+        ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(if)", "t");
+        if (ret != LUA_OK)
+        {
+            ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
+        }
+        BindChunk(context, L, env, this);
     }
 
     // 执行表达式
     ret = lua_pcall(L, 0, 1, 0);  // 只取第一个返回值
     if (ret != LUA_OK)
     {
-        string error = SafeAssignString(lua_tostring(L, -1));
-        lua_pop(L, 1);
-        ET_THROW(LuaRuntimeException, "%s:%u: %s", m_pszSource, m_uLine, error.c_str());
+        ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
     }
 
     // 检查结果
@@ -451,15 +662,48 @@ void TemplateIfElseNode::Render(std::string& builder, lua_State* L, int env)cons
     if (result)
     {
         for (const auto& node : m_vecTrueBranchNodes)
-            node->Render(builder, L, env);
+            node->Render(context, L, env);
     }
     else  // 否则执行FalseBranch
     {
         for (const auto& node : m_vecFalseBranchNodes)
-            node->Render(builder, L, env);
+            node->Render(context, L, env);
     }
 }
 
+void TemplateIfElseNode::Compile(TemplateCompiler& compiler)const
+{
+    compiler.SyncLine(m_uLine);
+    compiler.EmitHeader(m_pszSource, m_uLine, "if ", m_stExpression.c_str() + sizeof(kReturn) - 1,
+        m_stExpression.length() - sizeof(kReturn) + 1, "then ", " end");
+
+    for (const auto& node : m_vecTrueBranchNodes)
+        node->Compile(compiler);
+
+    compiler.Append(" else ");
+
+    for (const auto& node : m_vecFalseBranchNodes)
+        node->Compile(compiler);
+
+    compiler.Append(" end ");
+}
+
+void TemplateIfElseNode::Analyze(TemplateAnalyzer& analyzer)const
+{
+    TemplateIfNode::Analyze(analyzer);
+
+    for (const auto& node : m_vecFalseBranchNodes)
+        node->Analyze(analyzer);
+}
+
+void TemplateIfElseNode::Check(lua_State* L)const
+{
+    TemplateIfNode::Check(L);
+
+    for (const auto& node : m_vecFalseBranchNodes)
+        node->Check(L);
+}
+
 //////////////////////////////////////////////////////////////////////////////// TemplateWhileNode
 
 TemplateWhileNode::TemplateWhileNode(const char* source, uint32_t line, std::string&& expr)
@@ -527,22 +771,20 @@ bool TemplateWhileNode::RemoveNode(size_t index)noexcept
     return true;
 }
 
-void TemplateWhileNode::Render(std::string& builder, lua_State* L, int env)const
+void TemplateWhileNode::Render(RenderContext& context, lua_State* L, int env)const
 {
-    int ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(while)", "t");
-    if (ret != LUA_OK)
-    {
-        string error = SafeAssignString(lua_tostring(L, -1));
-        lua_pop(L, 1);
-        ET_THROW(LuaRuntimeException, "%s:%u: %s", m_pszSource, m_uLine, error.c_str());
-    }
+    RenderProfiler::Scope profile(context, m_pszSource, m_uLine);
 
-    // 设置ENV
-    if (env != 0)
+    // 同一次渲染中代码块只加载一次，并绑定到共享的ENV上（参见BindChunk）
+    int ret = LUA_OK;
+    if (!PushCachedChunk(context, L, this))
     {
-        lua_pushvalue(L, env);
-        if (!lua_setupvalue(L, -2, 1))
-            lua_pop(L, 1);
+        ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(while)", "t");
+        if (ret != LUA_OK)
+        {
+            ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
+        }
+        BindChunk(context, L, env, this);
     }
 
     // 此处，复制一份编译好的代码
@@ -559,9 +801,9 @@ void TemplateWhileNode::Render(std::string& builder, lua_State* L, int env)const
         ret = lua_pcall(L, 0, 1, 0);  // 只取第一个返回值
         if (ret != LUA_OK)
         {
-            string error = SafeAssignString(lua_tostring(L, -1));
-            lua_pop(L, 1);
-            ET_THROW(LuaRuntimeException, "%s:%u: %s", m_pszSource, m_uLine, error.c_str());
+            auto error = PopErrorMessage(L);
+            lua_pop(L, 1);  // 平衡堆栈，同时弹出编译好的函数体
+            ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, std::move(error));
         }
 
         // 检查结果
@@ -578,7 +820,7 @@ void TemplateWhileNode::Render(std::string& builder, lua_State* L, int env)const
             try
             {
                 for (const auto &node : m_vecNodes)
-                    node->Render(builder, L, env);
+                    node->Render(context, L, env);
             }
             catch (...)
             {
@@ -599,6 +841,35 @@ void TemplateWhileNode::Render(std::string& builder, lua_State* L, int env)const
 #endif
 }
 
+void TemplateWhileNode::Compile(TemplateCompiler& compiler)const
+{
+    compiler.SyncLine(m_uLine);
+    compiler.EmitHeader(m_pszSource, m_uLine, "while ", m_stExpression.c_str() + sizeof(kReturn) - 1,
+        m_stExpression.length() - sizeof(kReturn) + 1, "do ", " end");
+
+    for (const auto& node : m_vecNodes)
+        node->Compile(compiler);
+
+    compiler.Append(" end ");
+}
+
+void TemplateWhileNode::Analyze(TemplateAnalyzer& analyzer)const
+{
+    analyzer.AddExpression(m_pszSource, m_uLine, m_stExpression.c_str() + sizeof(kReturn) - 1,
+        m_stExpression.length() - sizeof(kReturn) + 1, false);
+
+    for (const auto& node : m_vecNodes)
+        node->Analyze(analyzer);
+}
+
+void TemplateWhileNode::Check(lua_State* L)const
+{
+    CheckChunk(L, m_stExpression, "=(while)", m_pszSource, m_uLine);
+
+    for (const auto& node : m_vecNodes)
+        node->Check(L);
+}
+
 //////////////////////////////////////////////////////////////////////////////// TemplateForNode
 
 TemplateForNode::TemplateForNode(const char* source, uint32_t line, std::string&& expr, std::vector<std::string>&& args)
@@ -669,8 +940,10 @@ bool TemplateForNode::RemoveNode(size_t index)noexcept
     return true;
 }
 
-void TemplateForNode::Render(std::string& builder, lua_State* L, int env)const
+void TemplateForNode::Render(RenderContext& context, lua_State* L, int env)const
 {
+    RenderProfiler::Scope profile(context, m_pszSource, m_uLine);
+
     // 获取栈顶
     int base = lua_gettop(L);
 
@@ -687,122 +960,79 @@ void TemplateForNode::Render(std::string& builder, lua_State* L, int env)const
     }
 
     // 编译语句
-    int ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(for)", "t");
-    if (ret != LUA_OK)
-    {
-        string error = SafeAssignString(lua_tostring(L, -1));
-        lua_settop(L, base);  // 平衡堆栈
-        ET_THROW(LuaRuntimeException, "%s:%u: %s", m_pszSource, m_uLine, error.c_str());
-    }
-
-    // 设置ENV
-    if (env != 0)
+    // 同一次渲染中代码块只加载一次，并绑定到共享的ENV上（参见BindChunk）
+    int ret = LUA_OK;
+    if (!PushCachedChunk(context, L, this))
     {
-        lua_pushvalue(L, env);
-        if (!lua_setupvalue(L, -2, 1))
-            lua_pop(L, 1);
+        ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(for)", "t");
+        if (ret != LUA_OK)
+        {
+            auto error = PopErrorMessage(L);
+            lua_settop(L, base);  // 平衡堆栈
+            ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, std::move(error));
+        }
+        BindChunk(context, L, env, this);
     }
 
     // 执行表达式
     ret = lua_pcall(L, 0, 3, 0);  // For迭代器首次执行后会返回三个值
     if (ret != LUA_OK)
     {
-        string error = SafeAssignString(lua_tostring(L, -1));
+        auto error = PopErrorMessage(L);
         lua_settop(L, base);  // 平衡堆栈
-        ET_THROW(LuaRuntimeException, "%s:%u: %s", m_pszSource, m_uLine, error.c_str());
+        ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, std::move(error));
     }
 
     // 此时堆栈为
     // arg1bak, arg2bak, ..., argnbak, f, s, var
-    // 调整堆栈到
-    // arg1bak, arg2bak, ..., argnbak, f, s, f, s, var
-    lua_pushvalue(L, -3);  // ...f, s, var, f
-    lua_pushvalue(L, -3);  // ...f, s, var, f, s
-    lua_pushvalue(L, -3);  // ...f, s, var, f, s, var
-    lua_remove(L, lua_absindex(L, -4));  // ...f, s, f, s, var
-
-    while (true)
+    int iter = lua_gettop(L) - 2;
+    try
     {
-        // 执行迭代器
-        ret = lua_pcall(L, 2, static_cast<int>(m_vecArgs.size()), 0);
-        if (ret != LUA_OK)
-        {
-            string error = SafeAssignString(lua_tostring(L, -1));
-            lua_settop(L, base);  // 平衡堆栈
-            ET_THROW(LuaRuntimeException, "%s:%u: %s", m_pszSource, m_uLine, error.c_str());
-        }
-
-        // 如果执行成功，此时堆栈为
-        // arg1bak, arg2bak, ..., argnbak, f, s, arg1, arg2, arg3...argn
-
-        // 检查是否终止
-        if (lua_type(L, -static_cast<int>(m_vecArgs.size())) == LUA_TNIL)
-            break;
-
-        // 依次保存结果，直到最后一个
-        if (env == 0)
-        {
-            for (size_t i = m_vecArgs.size() - 1; i > 0; --i)
-                lua_setglobal(L, m_vecArgs[i].c_str());
-        }
-        else
-        {
-            for (size_t i = m_vecArgs.size() - 1; i > 0; --i)
-                lua_setfield(L, env, m_vecArgs[i].c_str());
-        }
-
-        // 最后一个需要复制并赋值
-        lua_pushvalue(L, -1);
-        if (env == 0)
-            lua_setglobal(L, m_vecArgs[0].c_str());
-        else
-            lua_setfield(L, env, m_vecArgs[0].c_str());
-
-        // 此时堆栈为
-        // arg1bak, arg2bak, ..., argnbak, f, s, arg1
-        assert(lua_gettop(L) - base == m_vecArgs.size() + 3);
-
-        // 先执行下子节点
-        try
-        {
-            for (const auto &node : m_vecNodes)
-                node->Render(builder, L, env);
-        }
-        catch (...)
+        // 常见的迭代器不经过迭代函数，直接在原生代码中循环
+        bool done = false;
+        switch (GetNativeIteratorType(L, iter))
         {
-            assert(lua_gettop(L) - base == m_vecArgs.size() + 3);
-            lua_pop(L, 3);
-
-            // 依次恢复值
-            if (env == 0)
-            {
-                for (auto it = m_vecArgs.rbegin(); it != m_vecArgs.rend(); ++it)
-                    lua_setglobal(L, it->c_str());
-            }
-            else
-            {
-                for (auto it = m_vecArgs.rbegin(); it != m_vecArgs.rend(); ++it)
-                    lua_setfield(L, env, it->c_str());
-            }
-
-            assert(lua_gettop(L) == base);
-            throw;
+            case NativeIteratorTypes::Range:
+                done = RenderRange(context, L, env, iter);
+                break;
+            case NativeIteratorTypes::IntegerRange:
+                done = RenderIntegerRange(context, L, env, iter);
+                break;
+            case NativeIteratorTypes::IPairs:
+                done = RenderIPairs(context, L, env, iter);
+                break;
+            case NativeIteratorTypes::Pairs:
+                done = RenderPairs(context, L, env, iter);
+                break;
+            default:
+                break;
         }
 
-        // 调整堆栈到
-        // arg1bak, arg2bak, ..., argnbak, f, s, f, s, arg1
-        lua_pushvalue(L, -3);  // ...f, s, arg1, f
-        lua_pushvalue(L, -3);  // ...f, s, arg1, f, s
-        lua_pushvalue(L, -3);  // ...f, s, arg1, f, s, arg1
-        lua_remove(L, lua_absindex(L, -4));  // ...f, s, f, s, arg1
+        if (!done)
+            RenderGeneric(context, L, env, iter);
+    }
+    catch (...)
+    {
+        lua_settop(L, iter - 1);
+        RestoreArgs(L, env);
+        assert(lua_gettop(L) == base);
+        throw;
     }
 
-    // 恢复备份值，此时堆栈为
-    // arg1bak, arg2bak, ..., argnbak, f, s, arg1, arg2, arg3...argn
-    assert(lua_gettop(L) - base == m_vecArgs.size() * 2 + 2);
-    lua_pop(L, m_vecArgs.size() + 2);
+    lua_settop(L, iter - 1);
+    RestoreArgs(L, env);
+    assert(lua_gettop(L) == base);
+}
+
+void TemplateForNode::AssignArgs(lua_State* L, int env, int count)const
+{
+    // 栈顶的count个值对应各个迭代变量，多余的丢弃，不足的补nil
+    auto args = static_cast<int>(m_vecArgs.size());
+    if (count > args)
+        lua_pop(L, count - args);
+    for (; count < args; ++count)
+        lua_pushnil(L);
 
-    // 依次恢复值
     if (env == 0)
     {
         for (auto it = m_vecArgs.rbegin(); it != m_vecArgs.rend(); ++it)
@@ -813,45 +1043,679 @@ void TemplateForNode::Render(std::string& builder, lua_State* L, int env)const
         for (auto it = m_vecArgs.rbegin(); it != m_vecArgs.rend(); ++it)
             lua_setfield(L, env, it->c_str());
     }
-
-    assert(lua_gettop(L) == base);
 }
 
-//////////////////////////////////////////////////////////////////////////////// BuildRootNode
+void TemplateForNode::RestoreArgs(lua_State* L, int env)const
+{
+    AssignArgs(L, env, static_cast<int>(m_vecArgs.size()));
+}
 
-std::unique_ptr<TemplateBlockNode> et::BuildRootNode(TemplateParser& parser)
+void TemplateForNode::RenderNodes(RenderContext& context, lua_State* L, int env)const
 {
-    unique_ptr<TemplateBlockNode> root;
-    stack<TemplateNodeBase*> unclosed;
+    for (const auto& node : m_vecNodes)
+        node->Render(context, L, env);
+}
 
-    root.reset(new TemplateBlockNode());
-    for (size_t i = 0; i < parser.GetTokenCount(); ++i)
+void TemplateForNode::RenderGeneric(RenderContext& context, lua_State* L, int env, int iter)const
+{
+    auto args = static_cast<int>(m_vecArgs.size());
+    while (true)
     {
-        TemplateParser::Token& token = parser.GetTokenByIndex(i);
-        TemplateNodeBase* top = (unclosed.empty() ? nullptr : unclosed.top());
+        // 执行迭代器
+        lua_pushvalue(L, iter);
+        lua_pushvalue(L, iter + 1);
+        lua_pushvalue(L, iter + 2);
+        int ret = lua_pcall(L, 2, args, 0);
+        if (ret != LUA_OK)
+            ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
 
-        switch (token.Type)
-        {
-            case TemplateParser::TokenTypes::Literal:
-                {
-                    unique_ptr<TemplateTextNode> node;
-                    node.reset(new TemplateTextNode(std::move(token.Content)));
-                    top ? top->AppendNode(std::move(node)) : root->AppendNode(std::move(node));
-                }
-                break;
-            case TemplateParser::TokenTypes::Expression:
-                {
+        // 检查是否终止
+        if (lua_type(L, -args) == LUA_TNIL)
+            break;
+
+        // 第一个值作为下一次迭代的控制变量
+        lua_pushvalue(L, -args);
+        lua_replace(L, iter + 2);
+
+        AssignArgs(L, env, args);
+        RenderNodes(context, L, env);
+    }
+}
+
+bool TemplateForNode::RenderRange(RenderContext& context, lua_State* L, int env, int iter)const
+{
+    if (lua_type(L, iter + 2) != LUA_TNUMBER)
+        return false;
+
+    lua_getupvalue(L, iter, 1);
+    lua_getupvalue(L, iter, 2);
+    double to = lua_tonumber(L, -2);
+    double step = lua_tonumber(L, -1);
+    lua_pop(L, 2);
+
+    // 与LuaRangeClosure保持一致
+    double current = lua_tonumber(L, iter + 2);
+    while (true)
+    {
+        double next = current + step;
+        if (!((step > 0 && next <= to) || (step < 0 && next >= to) || step == 0))
+            break;
+        current = next;
+
+        lua_pushnumber(L, current);
+        AssignArgs(L, env, 1);
+        RenderNodes(context, L, env);
+    }
+    return true;
+}
+
+bool TemplateForNode::RenderIntegerRange(RenderContext& context, lua_State* L, int env, int iter)const
+{
+    if (!lua_isinteger(L, iter + 2))
+        return false;
+
+    lua_getupvalue(L, iter, 1);
+    lua_getupvalue(L, iter, 2);
+    lua_Integer to = lua_tointeger(L, -2);
+    lua_Integer step = lua_tointeger(L, -1);
+    lua_pop(L, 2);
+
+    // 与LuaRangeClosureInteger保持一致
+    lua_Integer current = lua_tointeger(L, iter + 2);
+    while (true)
+    {
+        auto next = static_cast<lua_Integer>(static_cast<lua_Unsigned>(current) + static_cast<lua_Unsigned>(step));
+        if (!((step > 0 && next <= to) || (step < 0 && next >= to) || step == 0))
+            break;
+        current = next;
+
+        lua_pushinteger(L, current);
+        AssignArgs(L, env, 1);
+        RenderNodes(context, L, env);
+    }
+    return true;
+}
+
+bool TemplateForNode::RenderIPairs(RenderContext& context, lua_State* L, int env, int iter)const
+{
+    if (lua_type(L, iter + 1) != LUA_TTABLE || !lua_isinteger(L, iter + 2))
+        return false;
+
+    lua_Integer index = lua_tointeger(L, iter + 2);
+    while (true)
+    {
+        // 带有元表时ipairs会经过__index，交给一般路径处理
+        if (lua_getmetatable(L, iter + 1))
+        {
+            lua_pop(L, 1);
+            lua_pushinteger(L, index);
+            lua_replace(L, iter + 2);
+            return false;
+        }
+
+        ++index;
+        if (lua_rawgeti(L, iter + 1, index) == LUA_TNIL)
+        {
+            lua_pop(L, 1);
+            return true;
+        }
+
+        lua_pushinteger(L, index);
+        lua_insert(L, -2);  // index, value
+        AssignArgs(L, env, 2);
+        RenderNodes(context, L, env);
+    }
+}
+
+bool TemplateForNode::RenderPairs(RenderContext& context, lua_State* L, int env, int iter)const
+{
+    if (lua_type(L, iter + 1) != LUA_TTABLE)
+        return false;
+
+    while (true)
+    {
+        // lua_next在键不存在时会抛出Lua错误，此时交给一般路径处理（在保护模式下调用next）
+        if (!lua_isnil(L, iter + 2))
+        {
+            lua_pushvalue(L, iter + 2);
+            bool present = lua_rawget(L, iter + 1) != LUA_TNIL;
+            lua_pop(L, 1);
+            if (!present)
+                return false;
+        }
+
+        lua_pushvalue(L, iter + 2);
+        if (lua_next(L, iter + 1) == 0)
+            return true;
+
+        // 此时堆栈为 ..., key, value
+        lua_pushvalue(L, -2);
+        lua_replace(L, iter + 2);
+
+        AssignArgs(L, env, 2);
+        RenderNodes(context, L, env);
+    }
+}
+
+void TemplateForNode::Compile(TemplateCompiler& compiler)const
+{
+    // 与Render保持一致，迭代变量写入ENV，并在循环结束后恢复：
+    // do local bak1, bak2 = a, b for v1, v2 in <expr> do a, b = v1, v2 <body> end a, b = bak1, bak2 end
+    string args, backups, values;
+    for (size_t i = 0; i < m_vecArgs.size(); ++i)
+    {
+        if (i != 0)
+        {
+            args.append(", ");
+            backups.append(", ");
+            values.append(", ");
+        }
+        args.append(m_vecArgs[i]);
+        backups.append(compiler.AllocLocalName());
+        values.append(compiler.AllocLocalName());
+    }
+
+    string prefix;
+    prefix.append("do local ").append(backups).append(" = ").append(args);
+    prefix.append(" for ").append(values).append(" in ");
+
+    string suffix;
+    suffix.append("do ").append(args).append(" = ").append(values).append(" ");
+
+    compiler.SyncLine(m_uLine);
+    compiler.EmitHeader(m_pszSource, m_uLine, prefix.c_str(), m_stExpression.c_str() + sizeof(kReturn) - 1,
+        m_stExpression.length() - sizeof(kReturn) + 1, suffix.c_str(), " end end");
+
+    for (const auto& node : m_vecNodes)
+        node->Compile(compiler);
+
+    string epilogue;
+    epilogue.append(" end ").append(args).append(" = ").append(backups).append(" end ");
+    compiler.Append(epilogue.c_str(), epilogue.length());
+}
+
+void TemplateForNode::Analyze(TemplateAnalyzer& analyzer)const
+{
+    analyzer.AddExpression(m_pszSource, m_uLine, m_stExpression.c_str() + sizeof(kReturn) - 1,
+        m_stExpression.length() - sizeof(kReturn) + 1, false);
+
+    // 迭代变量在循环体内由模板赋值
+    analyzer.PushScope(m_vecArgs);
+    for (const auto& node : m_vecNodes)
+        node->Analyze(analyzer);
+    analyzer.PopScope();
+}
+
+void TemplateForNode::Check(lua_State* L)const
+{
+    CheckChunk(L, m_stExpression, "=(for)", m_pszSource, m_uLine);
+
+    for (const auto& node : m_vecNodes)
+        node->Check(L);
+}
+
+//////////////////////////////////////////////////////////////////////////////// TemplateIncludeNode
+
+TemplateIncludeNode::TemplateIncludeNode(const char* source, uint32_t line, std::string&& expr)
+    : m_pszSource(source), m_uLine(line)
+{
+    if (!TryParseStringLiteral(expr.c_str(), expr.length(), m_stStaticName))
+        m_stStaticName.clear();
+
+    m_stExpression = std::move(expr);
+    m_stExpression.insert(0, kReturn);
+}
+
+TemplateNodeTypes TemplateIncludeNode::GetType()const noexcept
+{
+    return TemplateNodeTypes::Include;
+}
+
+void TemplateIncludeNode::Render(RenderContext& context, lua_State* L, int env)const
+{
+    RenderProfiler::Scope profile(context, m_pszSource, m_uLine);
+
+    if (context.GetIncludeDepth() >= kMaxIncludeDepth)
+        ET_THROW_AT(RenderException, m_pszSource, m_uLine, 0, "Include depth limit exceeded");
+
+    // 确定模板名称
+    string dynamicName;
+    if (m_stStaticName.empty())
+    {
+        // 同一次渲染中代码块只加载一次，并绑定到共享的ENV上（参见BindChunk）
+        int ret = LUA_OK;
+        if (!PushCachedChunk(context, L, this))
+        {
+            ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(include)", "t");
+            if (ret != LUA_OK)
+            {
+                ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
+            }
+            BindChunk(context, L, env, this);
+        }
+
+        ret = lua_pcall(L, 0, 1, 0);
+        if (ret != LUA_OK)
+        {
+            ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
+        }
+
+        if (lua_type(L, -1) != LUA_TSTRING)
+        {
+            const char* type = luaL_typename(L, -1);
+            lua_pop(L, 1);
+            ET_THROW_AT(RenderException, m_pszSource, m_uLine, 0, Format("Template name expected, but found %s", type));
+        }
+
+        size_t length = 0;
+        const char* name = lua_tolstring(L, -1, &length);
+        try
+        {
+            dynamicName.assign(name, length);
+        }
+        catch (...)
+        {
+            lua_pop(L, 1);
+            throw;
+        }
+        lua_pop(L, 1);
+    }
+
+    // 加载并渲染，持有引用以防渲染期间缓存被清空
+    auto tpl = TemplateCache::GetInstance().Load(m_stStaticName.empty() ? dynamicName : m_stStaticName);
+    context.KeepAlive(tpl);
+
+    auto depth = context.GetIncludeDepth();
+    context.SetIncludeDepth(depth + 1);
+    try
+    {
+        tpl->GetRoot().Render(context, L, env);
+    }
+    catch (...)
+    {
+        context.SetIncludeDepth(depth);
+        throw;
+    }
+    context.SetIncludeDepth(depth);
+}
+
+void TemplateIncludeNode::Compile(TemplateCompiler& compiler)const
+{
+    compiler.SyncLine(m_uLine);
+    compiler.EmitHeader(m_pszSource, m_uLine, "__et_include(", m_stExpression.c_str() + sizeof(kReturn) - 1,
+        m_stExpression.length() - sizeof(kReturn) + 1, ", __et_depth)(_ENV, __et_out, (__et_depth or 0) + 1) ", "");
+}
+
+void TemplateIncludeNode::Analyze(TemplateAnalyzer& analyzer)const
+{
+    if (m_stStaticName.empty())
+    {
+        analyzer.AddExpression(m_pszSource, m_uLine, m_stExpression.c_str() + sizeof(kReturn) - 1,
+            m_stExpression.length() - sizeof(kReturn) + 1, false);
+    }
+    analyzer.AddInclude(m_stStaticName);
+}
+
+void TemplateIncludeNode::Check(lua_State* L)const
+{
+    // 被引用的模板在渲染时才确定，不做检查
+    if (m_stStaticName.empty())
+        CheckChunk(L, m_stExpression, "=(include)", m_pszSource, m_uLine);
+}
+
+//////////////////////////////////////////////////////////////////////////////// TemplateExtendsNode
+
+TemplateExtendsNode::TemplateExtendsNode(const char* source, uint32_t line, std::string&& expr)
+    : m_pszSource(source), m_uLine(line)
+{
+    if (!TryParseStringLiteral(expr.c_str(), expr.length(), m_stName))
+        m_stName = std::move(expr);
+}
+
+TemplateNodeTypes TemplateExtendsNode::GetType()const noexcept
+{
+    return TemplateNodeTypes::Extends;
+}
+
+void TemplateExtendsNode::Render(RenderContext& context, lua_State* L, int env)const
+{
+    ET_UNUSED(context);
+    ET_UNUSED(L);
+    ET_UNUSED(env);
+    ET_THROW_AT(RenderException, m_pszSource, m_uLine, 0, "Unresolved extends");
+}
+
+void TemplateExtendsNode::Compile(TemplateCompiler& compiler)const
+{
+    ET_UNUSED(compiler);
+    ET_THROW_AT(RenderException, m_pszSource, m_uLine, 0, "Unresolved extends");
+}
+
+//////////////////////////////////////////////////////////////////////////////// TemplateNamedBlockNode
+
+TemplateNamedBlockNode::TemplateNamedBlockNode(const char* source, uint32_t line, std::string&& name)
+    : m_pszSource(source), m_uLine(line), m_stName(std::move(name))
+{
+}
+
+void TemplateNamedBlockNode::ReplaceContent(TemplateNamedBlockNode& rhs)noexcept
+{
+    TemplateBlockNode::operator=(std::move(rhs));
+    for (size_t i = 0; i < GetNodeCount(); ++i)
+        GetNodeByIndex(i)->SetParent(this);
+}
+
+TemplateNodeTypes TemplateNamedBlockNode::GetType()const noexcept
+{
+    return TemplateNodeTypes::NamedBlock;
+}
+
+//////////////////////////////////////////////////////////////////////////////// TemplateCacheNode
+
+TemplateCacheNode::TemplateCacheNode(const char* source, uint32_t line, std::string&& expr)
+    : m_pszSource(source), m_uLine(line)
+{
+    m_stExpression = std::move(expr);
+    m_stExpression.insert(0, kReturn);
+}
+
+TemplateNodeTypes TemplateCacheNode::GetType()const noexcept
+{
+    return TemplateNodeTypes::Cache;
+}
+
+void TemplateCacheNode::Render(RenderContext& context, lua_State* L, int env)const
+{
+    RenderProfiler::Scope profile(context, m_pszSource, m_uLine);
+
+    // 同一次渲染中代码块只加载一次，并绑定到共享的ENV上（参见BindChunk）
+    int ret = LUA_OK;
+    if (!PushCachedChunk(context, L, this))
+    {
+        ret = luaL_loadbufferx(L, m_stExpression.c_str(), m_stExpression.length(), "=(cache)", "t");
+        if (ret != LUA_OK)
+        {
+            ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
+        }
+        BindChunk(context, L, env, this);
+    }
+
+    // 执行表达式，取键和有效时间
+    ret = lua_pcall(L, 0, 2, 0);
+    if (ret != LUA_OK)
+    {
+        ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
+    }
+
+    int keyType = lua_type(L, -2);
+    if (keyType != LUA_TSTRING && keyType != LUA_TNUMBER)
+    {
+        const char* type = lua_typename(L, keyType);
+        lua_pop(L, 2);
+        ET_THROW_AT(RenderException, m_pszSource, m_uLine, 0, Format("Cache key expected, but found %s", type));
+    }
+
+    uint32_t ttl = 0;
+    if (!lua_isnil(L, -1))
+    {
+        int isNumber = 0;
+        auto seconds = lua_tonumberx(L, -1, &isNumber);
+        if (!isNumber)
+        {
+            const char* type = luaL_typename(L, -1);
+            lua_pop(L, 2);
+            ET_THROW_AT(RenderException, m_pszSource, m_uLine, 0, Format("Cache ttl expected, but found %s", type));
+        }
+
+        // 0表示不过期，只能由省略有效时间表示，非正数和NaN视作错误
+        if (!(seconds > 0))
+        {
+            lua_pop(L, 2);
+            ET_THROW_AT(RenderException, m_pszSource, m_uLine, 0, Format("Cache ttl must be positive, but found %f",
+                seconds));
+        }
+        ttl = static_cast<uint32_t>(std::max(1., std::min(seconds * 1000., 4294967295.)));
+    }
+
+    string key;
+    try
+    {
+        size_t length = 0;
+        const char* str = lua_tolstring(L, -2, &length);
+        key.assign(str, length);
+    }
+    catch (...)
+    {
+        lua_pop(L, 2);
+        throw;
+    }
+    lua_pop(L, 2);
+
+    // 命中时直接输出
+    auto& cache = FragmentCache::GetInstance();
+    auto fragment = cache.Get(key);
+    if (fragment)
+    {
+        context.Write(*fragment);
+        return;
+    }
+
+    if (!context.IsVectored())
+    {
+        size_t start = context.GetOutputSize();
+        TemplateBlockNode::Render(context, L, env);
+        cache.Put(key, string(context.GetOutput(start), context.GetOutputSize() - start), ttl);
+        return;
+    }
+
+    // 已经写出的内容无法取回，先渲染到单独的缓冲区
+    string fragmentOutput;
+    {
+        RenderContext fragmentContext(fragmentOutput, context.GetOptions());
+        fragmentContext.SetIncludeDepth(context.GetIncludeDepth());
+        TemplateBlockNode::Render(fragmentContext, L, env);
+    }
+    context.Write(fragmentOutput);
+    cache.Put(key, std::move(fragmentOutput), ttl);
+}
+
+void TemplateCacheNode::Compile(TemplateCompiler& compiler)const
+{
+    auto key = compiler.AllocLocalName();
+    auto ttl = compiler.AllocLocalName();
+    auto mark = compiler.AllocLocalName();
+
+    // do local key, ttl = <expr> local mark = __et_cache_get(__et_out, key, ttl) if mark then <body> __et_cache_put(...) end end
+    // 命中时__et_cache_get直接输出缓存的内容并返回nil，否则返回当前输出位置
+    string prefix = Format("do local %s, %s = ", key.c_str(), ttl.c_str());
+    string suffix = Format("local %s = __et_cache_get(__et_out, %s, %s) if %s then ", mark.c_str(), key.c_str(),
+        ttl.c_str(), mark.c_str());
+
+    compiler.SyncLine(m_uLine);
+    compiler.EmitHeader(m_pszSource, m_uLine, prefix.c_str(), m_stExpression.c_str() + sizeof(kReturn) - 1,
+        m_stExpression.length() - sizeof(kReturn) + 1, suffix.c_str(), " end end");
+
+    TemplateBlockNode::Compile(compiler);
+
+    compiler.Append(Format(" __et_cache_put(__et_out, %s, %s, %s) end end ", key.c_str(), ttl.c_str(),
+        mark.c_str()).c_str());
+}
+
+void TemplateCacheNode::Analyze(TemplateAnalyzer& analyzer)const
+{
+    analyzer.AddExpression(m_pszSource, m_uLine, m_stExpression.c_str() + sizeof(kReturn) - 1,
+        m_stExpression.length() - sizeof(kReturn) + 1, false);
+    TemplateBlockNode::Analyze(analyzer);
+}
+
+void TemplateCacheNode::Check(lua_State* L)const
+{
+    CheckChunk(L, m_stExpression, "=(cache)", m_pszSource, m_uLine);
+    TemplateBlockNode::Check(L);
+}
+
+//////////////////////////////////////////////////////////////////////////////// TemplateMacroNode
+
+TemplateMacroNode::TemplateMacroNode(const char* source, uint32_t line, std::string&& name,
+    std::vector<std::string>&& args)
+    : m_pszSource(source), m_uLine(line), m_stName(std::move(name)), m_stArgList(std::move(args))
+{
+}
+
+TemplateNodeTypes TemplateMacroNode::GetType()const noexcept
+{
+    return TemplateNodeTypes::Macro;
+}
+
+void TemplateMacroNode::Render(RenderContext& context, lua_State* L, int env)const
+{
+    // 宏定义本身就是一段完整的编译产物，执行后在ENV中留下宏函数
+    // 同一次渲染中只加载一次，ENV以参数传入，不需要绑定
+    if (!PushCachedChunk(context, L, this))
+    {
+        PrepareCode(L);
+        TemplateCompiler::LoadBinary(L, m_stCode.c_str(), m_stCode.length(), m_pszSource);
+        BindChunk(context, L, 0, this);
+    }
+
+    if (env != 0)
+        lua_pushvalue(L, env);
+    else
+        lua_pushnil(L);
+
+    int ret = lua_pcall(L, 1, 1, 0);
+    if (ret != LUA_OK)
+    {
+        ET_THROW_AT(LuaRuntimeException, m_pszSource, m_uLine, 0, PopErrorMessage(L));
+    }
+    lua_pop(L, 1);
+}
+
+void TemplateMacroNode::Compile(TemplateCompiler& compiler)const
+{
+    auto hint = compiler.AllocLocalName();
+    auto result = compiler.AllocLocalName();
+
+    // do local hint = 0 name = function(args) local __et_out = __et_newbuf(hint) <body> ... return result end end
+    // 宏体的__et_out遮盖了外层的缓冲区，宏体的输出作为返回值
+    string header = Format("do local %s = 0 %s = function(", hint.c_str(), m_stName.c_str());
+    for (size_t i = 0; i < m_stArgList.size(); ++i)
+    {
+        if (i != 0)
+            header.append(", ");
+        header.append(m_stArgList[i]);
+    }
+    header.append(Format(") local __et_out = __et_newbuf(%s) ", hint.c_str()));
+
+    compiler.SyncLine(m_uLine);
+    compiler.Append(header.c_str(), header.length());
+
+    TemplateBlockNode::Compile(compiler);
+
+    compiler.Append(Format(" local %s %s, %s = __et_finish(__et_out, %s, true) return %s end end ", result.c_str(),
+        result.c_str(), hint.c_str(), hint.c_str(), result.c_str()).c_str());
+}
+
+void TemplateMacroNode::Analyze(TemplateAnalyzer& analyzer)const
+{
+    analyzer.AddMacro(m_stName);
+
+    // 宏参数是宏体函数的局部变量
+    analyzer.PushScope(m_stArgList);
+    TemplateBlockNode::Analyze(analyzer);
+    analyzer.PopScope();
+}
+
+void TemplateMacroNode::Check(lua_State* L)const
+{
+    // 宏体以编译产物的形式执行，编译的同时检查了其中的所有节点
+    PrepareCode(L);
+}
+
+void TemplateMacroNode::PrepareCode(lua_State* L)const
+{
+    // 保存为字节码，之后的渲染加载时不需要再次解析
+    std::call_once(m_stCodeFlag, [&]() {
+        TemplateCompiler compiler(L, m_pszSource);
+        compiler.Compile(*this);
+        lua_pop(L, 1);
+        TemplateCompiler::Dump(L, compiler.GetCode(), m_pszSource, m_stCode);
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////////// BuildRootNode
+
+std::unique_ptr<TemplateBlockNode> et::BuildRootNode(TemplateParser& parser)
+{
+    unique_ptr<TemplateBlockNode> root;
+    stack<TemplateNodeBase*> unclosed;
+    EscapeModes escape = GetDefaultEscapeMode();
+
+    // 增量解析的输出在下一次构造时仍要使用，只复制其内容
+    bool keep = parser.IsIncrementalEnabled();
+    auto take = [keep](std::string& value) -> std::string {
+        if (keep)
+            return value;
+        return std::move(value);
+    };
+    auto takeArgs = [keep](std::vector<std::string>& args) -> std::vector<std::string> {
+        if (keep)
+            return args;
+        return std::move(args);
+    };
+
+    root.reset(new TemplateBlockNode());
+    for (size_t i = 0; i < parser.GetTokenCount(); ++i)
+    {
+        TemplateParser::Token& token = parser.GetTokenByIndex(i);
+        TemplateNodeBase* top = (unclosed.empty() ? nullptr : unclosed.top());
+
+        switch (token.Type)
+        {
+            case TemplateParser::TokenTypes::Literal:
+                {
+                    unique_ptr<TemplateTextNode> node;
+                    node.reset(new TemplateTextNode(take(token.Content)));
+                    top ? top->AppendNode(std::move(node)) : root->AppendNode(std::move(node));
+                }
+                break;
+            case TemplateParser::TokenTypes::Expression:
+                {
+                    unique_ptr<TemplateExpressionNode> node;
+                    node.reset(new TemplateExpressionNode(token.Anchor.SourceName, token.Anchor.Line,
+                        take(token.Content), escape));
+                    top ? top->AppendNode(std::move(node)) : root->AppendNode(std::move(node));
+                }
+                break;
+            case TemplateParser::TokenTypes::RawExpression:
+                {
                     unique_ptr<TemplateExpressionNode> node;
                     node.reset(new TemplateExpressionNode(token.Anchor.SourceName, token.Anchor.Line,
-                        std::move(token.Content)));
+                        take(token.Content), EscapeModes::None));
                     top ? top->AppendNode(std::move(node)) : root->AppendNode(std::move(node));
                 }
                 break;
+            case TemplateParser::TokenTypes::AutoEscape:
+                {
+                    string name;
+                    if (top)
+                    {
+                        ET_THROW_AT(ParseErrorException, token.Anchor.SourceName, token.Anchor.Line,
+                            token.Anchor.Column, "Unexpected autoescape");
+                    }
+                    if (!TryParseStringLiteral(token.Content.c_str(), token.Content.length(), name) ||
+                        !ParseEscapeMode(name.c_str(), escape))
+                    {
+                        ET_THROW_AT(ParseErrorException, token.Anchor.SourceName, token.Anchor.Line,
+                            token.Anchor.Column, "Escape mode expected after autoescape");
+                    }
+                }
+                break;
             case TemplateParser::TokenTypes::If:
                 {
                     unique_ptr<TemplateIfNode> node;
                     node.reset(new TemplateIfNode(token.Anchor.SourceName, token.Anchor.Line,
-                        std::move(token.Content)));
+                        take(token.Content)));
 
                     auto weak = node.get();
                     top ? top->AppendNode(std::move(node)) : root->AppendNode(std::move(node));
@@ -863,8 +1727,8 @@ std::unique_ptr<TemplateBlockNode> et::BuildRootNode(TemplateParser& parser)
             case TemplateParser::TokenTypes::Else:
                 if (!top || top->GetType() != TemplateNodeTypes::If)  // Else必须加插在If后面
                 {
-                    ET_THROW(ParseErrorException, "%s:%u:%u: Unexpected else branch", token.Anchor.SourceName,
-                        token.Anchor.Line, token.Anchor.Column);
+                    ET_THROW_AT(ParseErrorException, token.Anchor.SourceName, token.Anchor.Line,
+                        token.Anchor.Column, "Unexpected else branch");
                 }
                 else
                 {
@@ -891,8 +1755,8 @@ std::unique_ptr<TemplateBlockNode> et::BuildRootNode(TemplateParser& parser)
             case TemplateParser::TokenTypes::ElseIf:
                 if (!top || top->GetType() != TemplateNodeTypes::If)  // Else必须加插在If后面
                 {
-                    ET_THROW(ParseErrorException, "%s:%u:%u: Unexpected else branch", token.Anchor.SourceName,
-                        token.Anchor.Line, token.Anchor.Column);
+                    ET_THROW_AT(ParseErrorException, token.Anchor.SourceName, token.Anchor.Line,
+                        token.Anchor.Column, "Unexpected else branch");
                 }
                 else
                 {
@@ -915,7 +1779,7 @@ std::unique_ptr<TemplateBlockNode> et::BuildRootNode(TemplateParser& parser)
                     // 构造一个新的If节点
                     unique_ptr<TemplateIfNode> node;
                     node.reset(new TemplateIfNode(token.Anchor.SourceName, token.Anchor.Line,
-                        std::move(token.Content)));
+                        take(token.Content)));
 
                     auto weak = node.get();
                     weakClosedNode->AppendNode(std::move(node));
@@ -929,7 +1793,7 @@ std::unique_ptr<TemplateBlockNode> et::BuildRootNode(TemplateParser& parser)
                 {
                     unique_ptr<TemplateForNode> node;
                     node.reset(new TemplateForNode(token.Anchor.SourceName, token.Anchor.Line,
-                        std::move(token.Content), std::move(token.Args)));
+                        take(token.Content), takeArgs(token.Args)));
 
                     auto weak = node.get();
                     top ? top->AppendNode(std::move(node)) : root->AppendNode(std::move(node));
@@ -942,7 +1806,82 @@ std::unique_ptr<TemplateBlockNode> et::BuildRootNode(TemplateParser& parser)
                 {
                     unique_ptr<TemplateWhileNode> node;
                     node.reset(new TemplateWhileNode(token.Anchor.SourceName, token.Anchor.Line,
-                        std::move(token.Content)));
+                        take(token.Content)));
+
+                    auto weak = node.get();
+                    top ? top->AppendNode(std::move(node)) : root->AppendNode(std::move(node));
+
+                    // 加入未闭合队列
+                    unclosed.push(weak);
+                }
+                break;
+            case TemplateParser::TokenTypes::Include:
+                {
+                    unique_ptr<TemplateIncludeNode> node;
+                    node.reset(new TemplateIncludeNode(token.Anchor.SourceName, token.Anchor.Line,
+                        take(token.Content)));
+                    top ? top->AppendNode(std::move(node)) : root->AppendNode(std::move(node));
+                }
+                break;
+            case TemplateParser::TokenTypes::Extends:
+                {
+                    string name;
+                    if (top)
+                    {
+                        ET_THROW_AT(ParseErrorException, token.Anchor.SourceName, token.Anchor.Line,
+                            token.Anchor.Column, "Unexpected extends");
+                    }
+                    if (!TryParseStringLiteral(token.Content.c_str(), token.Content.length(), name))
+                    {
+                        ET_THROW_AT(ParseErrorException, token.Anchor.SourceName, token.Anchor.Line,
+                            token.Anchor.Column, "String literal expected after extends");
+                    }
+
+                    unique_ptr<TemplateExtendsNode> node;
+                    node.reset(new TemplateExtendsNode(token.Anchor.SourceName, token.Anchor.Line,
+                        take(token.Content)));
+                    root->AppendNode(std::move(node));
+                }
+                break;
+            case TemplateParser::TokenTypes::NamedBlock:
+                {
+                    assert(token.Args.size() == 1);
+
+                    unique_ptr<TemplateNamedBlockNode> node;
+                    node.reset(new TemplateNamedBlockNode(token.Anchor.SourceName, token.Anchor.Line,
+                        take(token.Args[0])));
+
+                    auto weak = node.get();
+                    top ? top->AppendNode(std::move(node)) : root->AppendNode(std::move(node));
+
+                    // 加入未闭合队列
+                    unclosed.push(weak);
+                }
+                break;
+            case TemplateParser::TokenTypes::Cache:
+                {
+                    unique_ptr<TemplateCacheNode> node;
+                    node.reset(new TemplateCacheNode(token.Anchor.SourceName, token.Anchor.Line,
+                        take(token.Content)));
+
+                    auto weak = node.get();
+                    top ? top->AppendNode(std::move(node)) : root->AppendNode(std::move(node));
+
+                    // 加入未闭合队列
+                    unclosed.push(weak);
+                }
+                break;
+            case TemplateParser::TokenTypes::Macro:
+                {
+                    assert(!token.Args.empty());
+
+                    auto args = takeArgs(token.Args);
+                    string name = std::move(args[0]);
+                    args.erase(args.begin());
+
+                    unique_ptr<TemplateMacroNode> node;
+                    node.reset(new TemplateMacroNode(token.Anchor.SourceName, token.Anchor.Line, std::move(name),
+                        std::move(args)));
 
                     auto weak = node.get();
                     top ? top->AppendNode(std::move(node)) : root->AppendNode(std::move(node));
@@ -954,8 +1893,8 @@ std::unique_ptr<TemplateBlockNode> et::BuildRootNode(TemplateParser& parser)
             case TemplateParser::TokenTypes::End:
                 if (!top)
                 {
-                    ET_THROW(ParseErrorException, "%s:%u:%u: Unexpected block end", token.Anchor.SourceName,
-                        token.Anchor.Line, token.Anchor.Column);
+                    ET_THROW_AT(ParseErrorException, token.Anchor.SourceName, token.Anchor.Line,
+                        token.Anchor.Column, "Unexpected block end");
                 }
                 unclosed.pop();
                 break;
@@ -967,10 +1906,11 @@ std::unique_ptr<TemplateBlockNode> et::BuildRootNode(TemplateParser& parser)
 
     if (!unclosed.empty())
     {
-        ET_THROW(ParseErrorException, "%s:%u:%u: Unclosed block", parser.GetReader()->GetSourceName(),
-            parser.GetReader()->GetLine(), parser.GetReader()->GetColumn());
+        ET_THROW_AT(ParseErrorException, parser.GetReader()->GetSourceName(), parser.GetReader()->GetLine(),
+            parser.GetReader()->GetColumn(), "Unclosed block");
     }
 
-    parser.Clear();
+    if (!keep)
+        parser.Clear();
     return root;
 }
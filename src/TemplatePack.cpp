@@ -0,0 +1,228 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/30
+ */
+#include <et/TemplatePack.hpp>
+#include <et/TemplateCompiler.hpp>
+
+using namespace std;
+using namespace et;
+
+namespace
+{
+    const char kMagic[4] = { 'E', 'T', 'P', 'K' };
+
+    // 所有字段均为本机字节序，与字节码一样不跨平台
+    struct PackHeader
+    {
+        char Magic[4];
+        uint32_t Version;
+        uint32_t LuaVersion;
+        uint32_t Count;
+    };
+
+    struct PackEntry
+    {
+        uint64_t NameOffset;
+        uint64_t NameLength;  // 不含结尾的'\0'
+        uint64_t SourceOffset;
+        uint64_t SourceLength;
+        uint64_t CodeOffset;
+        uint64_t CodeLength;
+    };
+
+    static_assert(sizeof(PackHeader) == 16, "Unexpected header size");
+    static_assert(sizeof(PackEntry) == 48, "Unexpected entry size");
+
+    PackEntry ReadPackEntry(const char* data, size_t index)noexcept
+    {
+        // 映射的地址对齐，但回退到read()时不一定，因此总是复制出来
+        PackEntry ret;
+        memcpy(&ret, data + sizeof(PackHeader) + index * sizeof(PackEntry), sizeof(PackEntry));
+        return ret;
+    }
+
+    bool IsValidRange(uint64_t offset, uint64_t length, size_t size)noexcept
+    {
+        return offset <= size && length <= size - offset;
+    }
+
+    int CompareName(const char* a, size_t aLength, const char* b, size_t bLength)noexcept
+    {
+        int ret = memcmp(a, b, std::min(aLength, bLength));
+        if (ret == 0 && aLength != bLength)
+            ret = aLength < bLength ? -1 : 1;
+        return ret;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////// TemplatePack
+
+TemplatePack::TemplatePack(const char* path)
+    : m_stFile(path)
+{
+    const char* data = m_stFile.GetData();
+    size_t size = m_stFile.GetSize();
+
+    PackHeader header;
+    if (size < sizeof(header))
+        ET_THROW(IOException, "Bad template pack \"%s\"", path);
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.Magic, kMagic, sizeof(kMagic)) != 0)
+        ET_THROW(IOException, "Bad template pack \"%s\"", path);
+    if (header.Version != kVersion || header.LuaVersion != LUA_VERSION_NUM)
+    {
+        ET_THROW(IOException, "Template pack \"%s\" version mismatch, version %u, lua %u", path, header.Version,
+            header.LuaVersion);
+    }
+    if (header.Count > (size - sizeof(header)) / sizeof(PackEntry))
+        ET_THROW(IOException, "Bad template pack \"%s\"", path);
+
+    // 只检查各项的范围以及索引的顺序（Find依赖于此进行二分查找），内容在使用时才会读取
+    PackEntry prev = {};
+    for (size_t i = 0; i < header.Count; ++i)
+    {
+        auto entry = ReadPackEntry(data, i);
+        if (entry.NameLength >= size || !IsValidRange(entry.NameOffset, entry.NameLength + 1, size) ||
+            data[entry.NameOffset + entry.NameLength] != '\0' ||
+            !IsValidRange(entry.SourceOffset, entry.SourceLength, size) ||
+            !IsValidRange(entry.CodeOffset, entry.CodeLength, size))
+        {
+            ET_THROW(IOException, "Bad template pack \"%s\", entry %u out of range", path,
+                static_cast<unsigned>(i));
+        }
+        if (i > 0 && CompareName(data + prev.NameOffset, static_cast<size_t>(prev.NameLength),
+            data + entry.NameOffset, static_cast<size_t>(entry.NameLength)) >= 0)
+        {
+            ET_THROW(IOException, "Bad template pack \"%s\", entry %u out of order", path,
+                static_cast<unsigned>(i));
+        }
+        prev = entry;
+    }
+    m_ullCount = header.Count;
+}
+
+TemplatePack::Entry TemplatePack::GetEntry(size_t index)const noexcept
+{
+    assert(index < m_ullCount);
+
+    const char* data = m_stFile.GetData();
+    auto entry = ReadPackEntry(data, index);
+
+    Entry ret;
+    ret.Name = data + entry.NameOffset;
+    ret.NameLength = static_cast<size_t>(entry.NameLength);
+    ret.Source = data + entry.SourceOffset;
+    ret.SourceLength = static_cast<size_t>(entry.SourceLength);
+    ret.Code = data + entry.CodeOffset;
+    ret.CodeLength = static_cast<size_t>(entry.CodeLength);
+    return ret;
+}
+
+bool TemplatePack::Find(const std::string& name, Entry& entry)const noexcept
+{
+    // 索引按名称排序，二分查找
+    size_t low = 0, high = m_ullCount;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        auto current = GetEntry(mid);
+
+        int ret = CompareName(current.Name, current.NameLength, name.c_str(), name.length());
+        if (ret == 0)
+        {
+            entry = current;
+            return true;
+        }
+        else if (ret < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return false;
+}
+
+std::shared_ptr<Template> TemplatePack::LoadTemplate(const Entry& entry)const
+{
+    return make_shared<Template>(entry.Source, entry.SourceLength, entry.Name);
+}
+
+//////////////////////////////////////////////////////////////////////////////// TemplatePackBuilder
+
+TemplatePackBuilder::TemplatePackBuilder(lua_State* L)
+    : m_pState(L)
+{
+    assert(L);
+}
+
+void TemplatePackBuilder::Add(const std::string& name, const char* source, size_t length)
+{
+    if (m_stItems.find(name) != m_stItems.end())
+        ET_THROW(InvalidArgumentException, "Duplicated template \"%s\"", name.c_str());
+
+    Item item;
+    item.Source.assign(source, length);
+
+    // 编译并转换为字节码，编译产物本身不需要
+    Template tpl(source, length, name.c_str());
+    TemplateCompiler compiler(m_pState, tpl.GetSourceName().c_str());
+    compiler.Compile(tpl.GetRoot());
+    lua_pop(m_pState, 1);
+    TemplateCompiler::Dump(m_pState, compiler.GetCode(), tpl.GetSourceName().c_str(), item.Code);
+
+    m_stItems.emplace(name, std::move(item));
+}
+
+void TemplatePackBuilder::Save(std::string& out)const
+{
+    PackHeader header;
+    memcpy(header.Magic, kMagic, sizeof(kMagic));
+    header.Version = TemplatePack::kVersion;
+    header.LuaVersion = LUA_VERSION_NUM;
+    header.Count = static_cast<uint32_t>(m_stItems.size());
+
+    // 计算各段的位置：索引、名称、源文本、字节码
+    vector<PackEntry> entries;
+    entries.reserve(m_stItems.size());
+
+    uint64_t offset = sizeof(PackHeader) + m_stItems.size() * sizeof(PackEntry);
+    for (const auto& it : m_stItems)
+    {
+        PackEntry entry;
+        entry.NameOffset = offset;
+        entry.NameLength = it.first.length();
+        offset += it.first.length() + 1;
+        entries.push_back(entry);
+    }
+    size_t index = 0;
+    for (const auto& it : m_stItems)
+    {
+        entries[index].SourceOffset = offset;
+        entries[index].SourceLength = it.second.Source.length();
+        offset += it.second.Source.length();
+        ++index;
+    }
+    index = 0;
+    for (const auto& it : m_stItems)
+    {
+        entries[index].CodeOffset = offset;
+        entries[index].CodeLength = it.second.Code.length();
+        offset += it.second.Code.length();
+        ++index;
+    }
+
+    out.clear();
+    out.reserve(static_cast<size_t>(offset));
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!entries.empty())
+        out.append(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(PackEntry));
+    for (const auto& it : m_stItems)
+        out.append(it.first.c_str(), it.first.length() + 1);
+    for (const auto& it : m_stItems)
+        out.append(it.second.Source);
+    for (const auto& it : m_stItems)
+        out.append(it.second.Code);
+    assert(out.length() == offset);
+}
@@ -15,6 +15,95 @@ namespace
         return (ch > 0 && ::isspace(ch));
     }
 
+    /**
+     * @brief 判断其后是否为一个操作数
+     *
+     * 非Lua关键字的语句名称同时可能是普通的变量名，例如"raw .. x"、"cache = {}"，
+     * 此时名称之后是运算符而不是操作数，整体应当作为表达式处理。
+     */
+    bool IsOperandFollowing(const char* p, const char* end)
+    {
+        while (p < end && IsSpace(*p))
+            ++p;
+        if (p >= end)
+            return false;
+
+        char next = (p + 1 < end) ? p[1] : '\0';
+        switch (*p)
+        {
+            case '.':  // ".5"是数字，其余为".."或字段访问
+                return next >= '0' && next <= '9';
+            case '-':  // "--"开始注释
+                return next != '-';
+            case '~':  // "~="
+                return next != '=';
+            case '[':  // "[["或"[="开始长字符串，其余为索引
+                return next == '[' || next == '=';
+            case ':':
+            case '=':
+            case '+':
+            case '*':
+            case '/':
+            case '%':
+            case '^':
+            case '<':
+            case '>':
+            case '&':
+            case '|':
+            case ',':
+            case ';':
+            case ')':
+            case ']':
+            case '}':
+                return false;
+            default:
+                break;
+        }
+
+        // "and"、"or"同样是运算符
+        const char* word = p;
+        while (p < end && (*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+            (*p >= '0' && *p <= '9')))
+        {
+            ++p;
+        }
+        size_t length = static_cast<size_t>(p - word);
+        return !((length == 3 && strncmp(word, "and", 3) == 0) || (length == 2 && strncmp(word, "or", 2) == 0));
+    }
+
+    bool IsStatement(const TemplateParser::Token& token)
+    {
+        return token.Type != TemplateParser::TokenTypes::Literal &&
+            token.Type != TemplateParser::TokenTypes::Expression &&
+            token.Type != TemplateParser::TokenTypes::RawExpression;
+    }
+
+    /**
+     * @brief 替换列表中的一段
+     *
+     * 相同数量的部分原地赋值，只有数量不同时才需要移动之后的元素。
+     */
+    template <typename T, typename Iterator>
+    void ReplaceRange(std::vector<T>& list, size_t first, size_t removed, Iterator begin, Iterator end)
+    {
+        auto inserted = static_cast<size_t>(std::distance(begin, end));
+        auto common = std::min(removed, inserted);
+        std::copy(begin, begin + common, list.begin() + first);
+        if (removed > common)
+            list.erase(list.begin() + first + common, list.begin() + first + removed);
+        else if (inserted > common)
+            list.insert(list.begin() + first + common, begin + common, end);
+    }
+
+    template <typename T>
+    void ResizeRange(std::vector<T>& list, size_t first, size_t removed, size_t inserted)
+    {
+        if (removed > inserted)
+            list.erase(list.begin() + first + inserted, list.begin() + first + removed);
+        else if (inserted > removed)
+            list.insert(list.begin() + first + removed, inserted - removed, T());
+    }
+
     bool IsStartingByNewLine(const std::string& text)
     {
         for (char ch : text)
@@ -104,6 +193,7 @@ TemplateParser::Token& TemplateParser::GetTokenByIndex(size_t index)noexcept
 void TemplateParser::Clear()noexcept
 {
     m_stTokenList.clear();
+    m_stTokenTrims.clear();
 }
 
 void TemplateParser::Run(TextReader& reader)
@@ -113,15 +203,199 @@ void TemplateParser::Run(TextReader& reader)
     Clear();
     m_stTokenList.reserve(16);
 
+    if (!m_bIncremental)
+    {
+        Token token;
+        while (ParseOuter(token))
+        {
+            assert(token.Type != TokenTypes::Eof);
+            m_stTokenList.emplace_back(std::move(token));
+        }
+        m_ullLastParsedTokenCount = m_stTokenList.size();
+
+        if (m_bPrettify)
+        {
+            m_stTokenTrims.assign(m_stTokenList.size(), 0);
+            Prettify(m_stTokenList, 0, m_stTokenList.size());
+            for (size_t i = 0; i < m_stTokenList.size(); ++i)
+                ApplyTrims(m_stTokenList[i], m_stTokenTrims[i]);
+            m_stTokenTrims.clear();
+        }
+        return;
+    }
+
+    m_bRawTokenValid = false;
+    m_stRawTokenList.clear();
+    m_stRawTokenBegins.clear();
+
     Token token;
+    auto begin = GetReader()->MakeAnchor();
     while (ParseOuter(token))
     {
         assert(token.Type != TokenTypes::Eof);
-        m_stTokenList.emplace_back(std::move(token));
+        m_stRawTokenList.emplace_back(std::move(token));
+        m_stRawTokenBegins.push_back(begin);
+        begin = GetReader()->MakeAnchor();
     }
+    m_stRawTokenEnd = begin;
+    m_ullLastParsedTokenCount = m_stRawTokenList.size();
+    m_bRawTokenValid = true;
+
+    Refresh();
+}
+
+void TemplateParser::Update(TextReader& reader, size_t start, size_t removed, size_t inserted)
+{
+    if (!m_bIncremental || !m_bRawTokenValid)
+        ET_THROW(InvalidCallException, "Incremental parsing is not available");
+    assert(start + inserted <= reader.GetLength());
+
+    m_bRawTokenValid = false;  // 成功之前状态都是无效的
+
+    // 从编辑位置所在的Token的前一个开始，前一个文本可能因为"{%"被破坏而延伸
+    auto it = upper_bound(m_stRawTokenBegins.begin(), m_stRawTokenBegins.end(), start,
+        [](size_t pos, const TextReader::Anchor& anchor) { return pos < anchor.Position; });
+    auto first = static_cast<size_t>(it - m_stRawTokenBegins.begin());
+    first = first >= 2 ? first - 2 : 0;
+
+    if (first < m_stRawTokenBegins.size())
+        reader.Seek(m_stRawTokenBegins[first]);
+    else
+        reader.Seek(TextReader().MakeAnchor());
+    ParserBase::Run(reader);
+
+    // 输出可能已被Clear，或者修饰选项有变化，此时需要完整地重新生成
+    bool outputValid = m_stTokenList.size() == m_stRawTokenList.size() &&
+        m_stTokenTrims.size() == (m_bPrettify ? m_stRawTokenList.size() : 0);
+
+    // 重新解析，直到与编辑前的Token边界重合
+    vector<Token> tokens;
+    vector<TextReader::Anchor> begins;
+    size_t sync = m_stRawTokenList.size();
+    Token token;
+    while (true)
+    {
+        auto begin = GetReader()->MakeAnchor();
+        if (begin.Position >= start + inserted)
+        {
+            auto oldPosition = begin.Position - inserted + removed;
+            auto found = lower_bound(m_stRawTokenBegins.begin() + first, m_stRawTokenBegins.end(), oldPosition,
+                [](const TextReader::Anchor& anchor, size_t pos) { return anchor.Position < pos; });
+            if (found != m_stRawTokenBegins.end() && found->Position == oldPosition)
+            {
+                sync = static_cast<size_t>(found - m_stRawTokenBegins.begin());
+
+                // 平移之后的Token，与重合点同一行的还需要调整列号
+                auto oldAnchor = *found;
+                auto shift = [&](TextReader::Anchor& anchor) {
+                    if (anchor.Line == oldAnchor.Line)
+                        anchor.Column = anchor.Column - oldAnchor.Column + begin.Column;
+                    anchor.Line = anchor.Line - oldAnchor.Line + begin.Line;
+                };
+                // 读取器同样移动到结尾，与完整解析后的状态一致
+                m_stRawTokenEnd.Position = m_stRawTokenEnd.Position - oldPosition + begin.Position;
+                m_stRawTokenEnd.SourceName = reader.GetSourceName();
+                shift(m_stRawTokenEnd);
+                reader.Seek(m_stRawTokenEnd);
+
+                for (size_t i = sync; i < m_stRawTokenList.size(); ++i)
+                {
+                    auto& anchor = m_stRawTokenBegins[i];
+                    anchor.Position = anchor.Position - oldPosition + begin.Position;
+                    shift(anchor);
+
+                    auto& tokenAnchor = m_stRawTokenList[i].Anchor;
+                    tokenAnchor.Position = tokenAnchor.Position - oldPosition + begin.Position;
+                    tokenAnchor.SourceName = anchor.SourceName = reader.GetSourceName();
+                    shift(tokenAnchor);
+
+                    // 输出的Token与保存的Token一一对应，同样平移
+                    if (outputValid)
+                        m_stTokenList[i].Anchor = tokenAnchor;
+                }
+                break;
+            }
+        }
+
+        if (!ParseOuter(token))
+        {
+            m_stRawTokenEnd = begin;
+            break;
+        }
+        assert(token.Type != TokenTypes::Eof);
+        tokens.emplace_back(std::move(token));
+        begins.push_back(begin);
+    }
+
+    // 替换受影响的Token
+    ReplaceRange(m_stRawTokenList, first, sync - first, make_move_iterator(tokens.begin()),
+        make_move_iterator(tokens.end()));
+    ReplaceRange(m_stRawTokenBegins, first, sync - first, begins.begin(), begins.end());
+    m_ullLastParsedTokenCount = tokens.size();
+    m_bRawTokenValid = true;
+
+    if (!outputValid)
+    {
+        Refresh();
+        return;
+    }
+
+    // 输出同样只替换受影响的部分，此后从保存的Token重新生成
+    ResizeRange(m_stTokenList, first, sync - first, tokens.size());
+    if (!m_bPrettify)
+    {
+        for (size_t i = first; i < first + tokens.size(); ++i)
+            m_stTokenList[i] = m_stRawTokenList[i];
+        return;
+    }
+    ResizeRange(m_stTokenTrims, first, sync - first, tokens.size());
+    fill(m_stTokenTrims.begin() + first, m_stTokenTrims.begin() + first + tokens.size(), 0);
+
+    // 状态机在非语句的Token之后总是回到初始状态，因此只需从替换范围之前的语句开始，到之后的第一个非语句为止重新修饰。
+    // 处理一个Token时会检查其后一个Token，因此开始的位置至少要在替换范围之前一个。
+    size_t count = m_stRawTokenList.size();
+    size_t begin = first > 0 ? first - 1 : 0;
+    while (begin > 0 && IsStatement(m_stRawTokenList[begin - 1]))
+        --begin;
+    size_t end = first + tokens.size();
+    while (end < count && IsStatement(m_stRawTokenList[end]))
+        ++end;
+    end = std::min(end + 1, count);
+
+    // 清除这一范围内的处理产生的标记：语句之前的文本剔除行尾，语句之后的文本剔除行首
+    size_t outputBegin = begin > 0 ? begin - 1 : 0;
+    size_t outputEnd = std::min(end + 1, count);
+    for (size_t i = outputBegin; i < outputEnd; ++i)
+    {
+        if (i + 1 >= begin && i + 1 < end)
+            m_stTokenTrims[i] &= ~kTrimRight;
+        if (i > begin)
+            m_stTokenTrims[i] &= ~kTrimLeft;
+    }
+    Prettify(m_stRawTokenList, begin, end);
+
+    for (size_t i = outputBegin; i < outputEnd; ++i)
+    {
+        m_stTokenList[i] = m_stRawTokenList[i];
+        ApplyTrims(m_stTokenList[i], m_stTokenTrims[i]);
+    }
+}
+
+void TemplateParser::Refresh()
+{
+    if (!m_bIncremental || !m_bRawTokenValid)
+        ET_THROW(InvalidCallException, "Incremental parsing is not available");
+
+    m_stTokenList = m_stRawTokenList;
+    m_stTokenTrims.clear();
 
     if (m_bPrettify)
-        Prettify();
+    {
+        m_stTokenTrims.resize(m_stTokenList.size(), 0);
+        Prettify(m_stRawTokenList, 0, m_stRawTokenList.size());
+        for (size_t i = 0; i < m_stTokenList.size(); ++i)
+            ApplyTrims(m_stTokenList[i], m_stTokenTrims[i]);
+    }
 }
 
 void TemplateParser::SkipBlank()
@@ -201,6 +475,11 @@ void TemplateParser::ParseInner(Token& result)
 
     if (TryAcceptIdentifierOrKeyword(m_stTmpBuffer))
     {
+        // 以下非Lua关键字的语句必须后跟空白和操作数，否则视作表达式（例如"cache[k]"、"raw .. x"）
+        auto reader = GetReader();
+        bool statement = IsSpace(c) && IsOperandFollowing(reader->GetBuffer() + reader->GetPosition(),
+            reader->GetBuffer() + reader->GetLength());
+
         if (m_stTmpBuffer == "end")
             result.Type = TokenTypes::End;
         else if (m_stTmpBuffer == "if")
@@ -246,6 +525,61 @@ void TemplateParser::ParseInner(Token& result)
         }
         else if (m_stTmpBuffer == "while")
             result.Type = TokenTypes::While;
+        else if (m_stTmpBuffer == "include" && statement)
+            result.Type = TokenTypes::Include;
+        else if (m_stTmpBuffer == "extends" && statement)
+            result.Type = TokenTypes::Extends;
+        else if (m_stTmpBuffer == "cache" && statement)
+            result.Type = TokenTypes::Cache;
+        else if (m_stTmpBuffer == "block" && statement)
+        {
+            result.Type = TokenTypes::NamedBlock;
+
+            // 块名称
+            SkipBlank();
+            if (!TryAcceptIdentifierOrKeyword(m_stTmpBuffer))
+                ET_PARSE_ERROR("Identifier expected, but found %s", PrintChar(c).c_str());
+            if (IsLuaKeyword(m_stTmpBuffer))
+                ET_PARSE_ERROR("Identifier expected, but found \"%s\"", m_stTmpBuffer.c_str());
+            result.Args.emplace_back(std::move(m_stTmpBuffer));
+        }
+        else if (m_stTmpBuffer == "raw" && statement)
+            result.Type = TokenTypes::RawExpression;
+        else if (m_stTmpBuffer == "autoescape" && statement)
+            result.Type = TokenTypes::AutoEscape;
+        else if (m_stTmpBuffer == "macro" && statement)
+        {
+            result.Type = TokenTypes::Macro;
+
+            // macro Name '(' [Name {',' Name}] ')'
+            // Args[0]为宏名称，其余为参数列表
+            SkipBlank();
+            if (!TryAcceptIdentifierOrKeyword(m_stTmpBuffer))
+                ET_PARSE_ERROR("Identifier expected, but found %s", PrintChar(c).c_str());
+            if (IsLuaKeyword(m_stTmpBuffer))
+                ET_PARSE_ERROR("Identifier expected, but found \"%s\"", m_stTmpBuffer.c_str());
+            result.Args.emplace_back(std::move(m_stTmpBuffer));
+
+            SkipBlank();
+            AcceptOne('(');
+            SkipBlank();
+            if (!TryAcceptOne(')'))
+            {
+                while (true)
+                {
+                    SkipBlank();
+                    if (!TryAcceptIdentifierOrKeyword(m_stTmpBuffer))
+                        ET_PARSE_ERROR("Identifier expected, but found %s", PrintChar(c).c_str());
+                    if (IsLuaKeyword(m_stTmpBuffer))
+                        ET_PARSE_ERROR("Identifier expected, but found \"%s\"", m_stTmpBuffer.c_str());
+                    result.Args.emplace_back(std::move(m_stTmpBuffer));
+                    SkipBlank();
+                    if (TryAcceptOne(')'))
+                        break;
+                    AcceptOne(',');
+                }
+            }
+        }
         else  // 不识别的节点，作为表达式传递给Lua
         {
             result.Type = TokenTypes::Expression;
@@ -271,8 +605,10 @@ void TemplateParser::ParseInner(Token& result)
                 // 去除末尾的空白
                 TrimEnd(result.Content);
 
+                // 除去Else、End、Block和Macro以外，后面必然有个Expression
                 bool shouldFollowingExpr = result.Type != TokenTypes::Expression && result.Type != TokenTypes::End &&
-                    result.Type != TokenTypes::Else; // 除去Else和End以外，后面必然有个Expression
+                    result.Type != TokenTypes::Else && result.Type != TokenTypes::NamedBlock &&
+                    result.Type != TokenTypes::Macro;
 
                 if (shouldFollowingExpr)
                 {
@@ -299,21 +635,25 @@ void TemplateParser::ParseInner(Token& result)
     ET_PARSE_ERROR("Unclosed expression node");
 }
 
-void TemplateParser::Prettify()
+void TemplateParser::Prettify(const std::vector<Token>& tokens, size_t begin, size_t end)
 {
+    // 判断只依赖修饰前的内容，需要剔除的空白先记录在m_stTokenTrims中，由ApplyTrims统一处理
+    assert(begin == 0 || !IsStatement(tokens[begin - 1]));
+    assert(end <= tokens.size() && m_stTokenTrims.size() == tokens.size());
+
     int state = 0;
     size_t left = static_cast<size_t>(-1);
 
-    for (size_t i = 0; i < m_stTokenList.size(); ++i)
+    for (size_t i = begin; i < end; ++i)
     {
-        const Token& current = m_stTokenList[i];
-        Token* prev = (i != 0 ? &m_stTokenList[i - 1] : nullptr);
-        Token* next = (i + 1 < m_stTokenList.size() ? &m_stTokenList[i + 1] : nullptr);
+        const Token& current = tokens[i];
+        const Token* prev = (i != 0 ? &tokens[i - 1] : nullptr);
+        const Token* next = (i + 1 < tokens.size() ? &tokens[i + 1] : nullptr);
 
         if (state == 0)
         {
             // 当前是语句，且上一个是文本
-            if (current.Type != TokenTypes::Literal && current.Type != TokenTypes::Expression)
+            if (IsStatement(current))
             {
                 if (!prev || (prev->Type == TokenTypes::Literal && IsEndingByNewLine(prev->Content)))
                 {
@@ -328,19 +668,29 @@ void TemplateParser::Prettify()
             {
                 size_t right = (next ? i + 1 : static_cast<size_t>(-1));
                 if (left != static_cast<size_t>(-1))
-                    TrimRightUntilNewLine(m_stTokenList[left].Content);
+                    m_stTokenTrims[left] |= kTrimRight;
                 if (right != static_cast<size_t>(-1))
-                    TrimLeftUntilNewLine(m_stTokenList[right].Content);
+                    m_stTokenTrims[right] |= kTrimLeft;
                 state = 0;
             }
-            else if (current.Type == TokenTypes::Literal || current.Type == TokenTypes::Expression)  // 有其他文本，不剔除
+            else if (!IsStatement(current))  // 有其他文本，不剔除
                 state = 0;
         }
     }
 
     if (state == 1)
     {
+        assert(end == tokens.size());
         if (left != static_cast<size_t>(-1))
-            TrimRightUntilNewLine(m_stTokenList[left].Content);
+            m_stTokenTrims[left] |= kTrimRight;
     }
 }
+
+void TemplateParser::ApplyTrims(Token& token, uint8_t trims)
+{
+    // 与逐个处理时的顺序一致，先剔除行首
+    if (trims & kTrimLeft)
+        TrimLeftUntilNewLine(token.Content);
+    if (trims & kTrimRight)
+        TrimRightUntilNewLine(token.Content);
+}
@@ -0,0 +1,165 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/28
+ */
+#include <et/VectoredWriter.hpp>
+
+#include <cerrno>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+using namespace std;
+using namespace et;
+
+#ifdef _WIN32
+namespace
+{
+    /**
+     * @brief 完整写出一段数据
+     */
+    void WriteAll(int fd, const char* data, size_t length)
+    {
+        while (length > 0)
+        {
+            auto ret = ::_write(fd, data, static_cast<unsigned>(std::min<size_t>(length, 0x7FFFFFFF)));
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                ET_THROW(IOException, "Write error, errno=%d", errno);
+            }
+
+            data += ret;
+            length -= static_cast<size_t>(ret);
+        }
+    }
+}
+#endif
+
+VectoredWriter::VectoredWriter(int fd)
+    : m_iFd(fd), m_pArena(new char[kArenaSize])
+{
+}
+
+VectoredWriter::VectoredWriter()
+    : m_pArena(new char[kArenaSize])
+{
+}
+
+void VectoredWriter::Write(const char* data, size_t length)
+{
+    if (length == 0)
+        return;
+
+    // 大块数据直接写出
+    if (length > kArenaSize / 2)
+    {
+        Flush();
+
+        Segment segment = { data, length };
+        WriteSegments(&segment, 1);
+        m_ullSize += length;
+        return;
+    }
+
+    // 写出会重置暂存区，因此需要在复制前确保片段数未满
+    if (length > kArenaSize - m_ullArenaUsed || m_ullSegmentCount >= kMaxBatchSize)
+        Flush();
+
+    char* dest = m_pArena.get() + m_ullArenaUsed;
+    memcpy(dest, data, length);
+    m_ullArenaUsed += length;
+
+    Append(dest, length);
+}
+
+void VectoredWriter::WriteReference(const char* data, size_t length)
+{
+    if (length == 0)
+        return;
+    Append(data, length);
+}
+
+void VectoredWriter::Flush()
+{
+    if (m_ullSegmentCount == 0)
+        return;
+
+    // 无论成功与否，片段都被丢弃
+    size_t count = m_ullSegmentCount;
+    m_ullSegmentCount = 0;
+    m_ullArenaUsed = 0;
+    WriteSegments(m_stSegments, count);
+}
+
+void VectoredWriter::WriteSegments(const Segment* segments, size_t count)
+{
+#ifdef _WIN32
+    for (size_t i = 0; i < count; ++i)
+        WriteAll(m_iFd, segments[i].Data, segments[i].Length);
+#else
+    iovec vec[kMaxBatchSize];
+    assert(count <= kMaxBatchSize);
+    for (size_t i = 0; i < count; ++i)
+    {
+        vec[i].iov_base = const_cast<char*>(segments[i].Data);
+        vec[i].iov_len = segments[i].Length;
+    }
+
+    // 处理部分写出
+    iovec* current = vec;
+    int remain = static_cast<int>(count);
+    while (remain > 0)
+    {
+        auto ret = ::writev(m_iFd, current, remain);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            ET_THROW(IOException, "Write error, errno=%d", errno);
+        }
+
+        auto written = static_cast<size_t>(ret);
+        while (remain > 0 && written >= current->iov_len)
+        {
+            written -= current->iov_len;
+            ++current;
+            --remain;
+        }
+        if (remain > 0)
+        {
+            current->iov_base = static_cast<char*>(current->iov_base) + written;
+            current->iov_len -= written;
+        }
+    }
+#endif
+}
+
+void VectoredWriter::Append(const char* data, size_t length)
+{
+    m_ullSize += length;
+
+    // 与上一片段相邻时合并
+    if (m_ullSegmentCount > 0)
+    {
+        Segment& last = m_stSegments[m_ullSegmentCount - 1];
+        if (last.Data + last.Length == data)
+        {
+            last.Length += length;
+            return;
+        }
+    }
+
+    if (m_ullSegmentCount >= kMaxBatchSize)
+        Flush();
+
+    m_stSegments[m_ullSegmentCount].Data = data;
+    m_stSegments[m_ullSegmentCount].Length = length;
+    ++m_ullSegmentCount;
+}
@@ -0,0 +1,90 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/27
+ */
+#include <gtest/gtest.h>
+
+#include <et.hpp>
+#include <et/Escape.hpp>
+#include <et/TemplateNode.hpp>
+
+using namespace std;
+using namespace et;
+
+static string Escape(const string& input, EscapeModes mode)
+{
+    string ret;
+    AppendEscaped(ret, input.c_str(), input.length(), mode);
+    return ret;
+}
+
+TEST(EscapeTest, AppendEscaped)
+{
+    EXPECT_EQ("<a href=\"x\">", Escape("<a href=\"x\">", EscapeModes::None));
+    EXPECT_EQ("&lt;a href=&quot;x&quot;&gt;&amp;&#39;", Escape("<a href=\"x\">&'", EscapeModes::Html));
+    EXPECT_EQ("&lt;&apos;&gt;", Escape("<'>", EscapeModes::Xml));
+    EXPECT_EQ("\\\"\\\\\\n\\u0001\xe4\xb8\xad", Escape("\"\\\n\x01\xe4\xb8\xad", EscapeModes::Json));
+    EXPECT_EQ("it''s", Escape("it's", EscapeModes::Sql));
+
+    // 跨越16字节边界以及不足16字节的尾部
+    string safe(37, 'x');
+    EXPECT_EQ(safe, Escape(safe, EscapeModes::Html));
+    EXPECT_EQ(string(16, 'x') + "&lt;" + string(20, 'x') + "&gt;",
+        Escape(string(16, 'x') + "<" + string(20, 'x') + ">", EscapeModes::Html));
+    EXPECT_EQ(string(31, '\x80') + "\\u001f", Escape(string(31, '\x80') + "\x1f", EscapeModes::Json));
+
+    EscapeModes mode = EscapeModes::None;
+    EXPECT_TRUE(ParseEscapeMode("json", mode));
+    EXPECT_EQ(EscapeModes::Json, mode);
+    EXPECT_FALSE(ParseEscapeMode("latex", mode));
+}
+
+TEST(EscapeTest, AutoEscape)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    static const char kSource[] = "{% autoescape \"html\" %}{% s %}{% raw s %}{% 1 %}{% true %}";
+    lua_pushstring(L, "<b>");
+    lua_setglobal(L, "s");
+
+    string result;
+    RenderString(result, L, kSource);
+    EXPECT_EQ("&lt;b&gt;<b>1true", result);
+
+    CompileString(L, kSource);
+    ASSERT_EQ(LUA_OK, lua_pcall(L, 0, 1, 0));
+    EXPECT_STREQ("&lt;b&gt;<b>1true", lua_tostring(L, -1));
+    lua_pop(L, 1);
+
+    // 输出限制同样作用于转义后的内容
+    RenderOptions options;
+    options.MaxOutputSize = 5;
+    EXPECT_THROW(RenderString(result, L, kSource, "test", 0, &options), RenderException);
+
+    // 宏的返回值不会被再次转义，与之拼接的普通值仍然转义
+    static const char kMacroSource[] = "{% autoescape \"html\" %}{% macro li(x) %}<li>{% x %}</li>{% end %}"
+        "{% li(s) %}{% li(s) .. '<br>' %}{% li(1) .. li(2) %}{% tostring(li(s)) %}";
+    static const char kMacroResult[] = "<li>&lt;b&gt;</li><li>&lt;b&gt;</li>&lt;br&gt;<li>1</li><li>2</li>"
+        "&lt;li&gt;&amp;lt;b&amp;gt;&lt;/li&gt;";
+    RenderString(result, L, kMacroSource);
+    EXPECT_EQ(kMacroResult, result);
+
+    CompileString(L, kMacroSource);
+    ASSERT_EQ(LUA_OK, lua_pcall(L, 0, 1, 0));
+    EXPECT_STREQ(kMacroResult, lua_tostring(L, -1));
+    lua_pop(L, 1);
+
+    // 以raw、autoescape为名的变量仍然可以用在表达式中
+    luaL_dostring(L, "raw = '<raw>' autoescape = 1");
+    RenderString(result, L, "{% autoescape \"html\" %}{% raw .. s %}{% raw %}{% autoescape + 1 %}");
+    EXPECT_EQ("&lt;raw&gt;&lt;b&gt;&lt;raw&gt;2", result);
+
+    EXPECT_THROW(RenderString(result, L, "{% autoescape \"latex\" %}"), ParseErrorException);
+    EXPECT_THROW(RenderString(result, L, "{% if true %}{% autoescape \"html\" %}{% end %}"), ParseErrorException);
+
+    EXPECT_EQ(0, lua_gettop(L));
+    lua_close(L);
+}
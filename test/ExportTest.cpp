@@ -0,0 +1,331 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/21
+ */
+#include <gtest/gtest.h>
+
+#include <et.hpp>
+#include <et/TemplateNode.hpp>
+
+using namespace std;
+using namespace et;
+
+TEST(ExportTest, RenderString)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    string result;
+    RenderString(result, L, "{% a = 1 %}{% while a < 4 %}{% a %}{% a = a + 1 %}{% end %}", "test");
+    EXPECT_EQ("123", result);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    lua_close(L);
+}
+
+TEST(ExportTest, ExecutionGuard)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    string result;
+    RenderOptions options;
+
+    options.MaxInstructions = 100000;
+    RenderString(result, L, "{% x = 0 %}{% while x < 100 %}{% x = x + 1 %}{% end %}", "test", 0, &options);
+
+    try
+    {
+        RenderString(result, L, "line1\n{% while true %}{% end %}", "test", 0, &options);
+        FAIL();
+    }
+    catch (const RenderException& ex)
+    {
+        EXPECT_EQ(0, strncmp("test:2:", ex.what(), 7));
+        EXPECT_NE(nullptr, strstr(ex.what(), "Instruction limit exceeded"));
+    }
+    EXPECT_EQ(0, lua_gettop(L));
+
+    options.MaxInstructions = 0;
+    options.Timeout = 10;
+    try
+    {
+        RenderString(result, L, "{% while true %}{% pcall(function() while true do end end) %}{% end %}", "test", 0,
+            &options);
+        FAIL();
+    }
+    catch (const RenderException& ex)
+    {
+        EXPECT_NE(nullptr, strstr(ex.what(), "Render timeout"));
+    }
+    EXPECT_EQ(0, lua_gettop(L));
+    EXPECT_EQ(nullptr, lua_gethook(L));
+
+    // 不受限制时，Lua错误依然是LuaRuntimeException
+    EXPECT_THROW(RenderString(result, L, "{% non_exists() %}", "test", 0, &options), LuaRuntimeException);
+
+    lua_close(L);
+}
+
+TEST(ExportTest, OutputLimit)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    string result;
+    RenderOptions options;
+    options.MaxOutputSize = 6;
+
+    RenderString(result, L, "abc{% 'def' %}", "test", 0, &options);
+    EXPECT_EQ("abcdef", result);
+
+    EXPECT_THROW(RenderString(result, L, "abc{% 'defg' %}", "test", 0, &options), RenderException);
+    EXPECT_THROW(RenderString(result, L, "abcdefg", "test", 0, &options), RenderException);
+    EXPECT_THROW(RenderString(result, L, "{% for i in ipairs({1, 2, 3, 4}) %}ab{% end %}", "test", 0, &options),
+        RenderException);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    lua_close(L);
+}
+
+TEST(ExportTest, ProfileReport)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+    RegisterLibrary(L);
+
+    const char* script = "et.profile_start() "
+        "assert(et.render_string('{% for i in et.range(1, 3) %}{% i %}{% end %}', 'test') == '123') "
+        "et.profile_stop() "
+        "local report = et.profile_report() "
+        "assert(report:find('test:1', 1, true)) "
+        "assert(et.profile_report('folded'):find('test:1;test:1 ', 1, true))";
+    EXPECT_EQ(LUA_OK, luaL_dostring(L, script)) << lua_tostring(L, -1);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    lua_close(L);
+}
+
+TEST(ExportTest, SetObserver)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+    RegisterLibrary(L);
+
+    const char* script = "local events = {} "
+        "et.set_observer(function(event, stats) events[#events + 1] = { event, stats } end) "
+        "local tpl = et.load_string('abc', 'test') "
+        "tpl:render() tpl:render() "
+        "et.compile_string('{% 1 %}', 'compiled') "
+        "et.set_observer(nil) "
+        "tpl:render() "
+        "assert(#events == 3) "
+        "assert(events[1][1] == 'render' and events[1][2].name == 'test' and events[1][2].ok) "
+        "assert(not events[1][2].cache_hit and events[2][2].cache_hit) "
+        "assert(events[1][2].parse_time > 0 and events[2][2].parse_time == 0) "
+        "assert(events[1][2].output_size == 3) "
+        "assert(events[3][1] == 'compile' and events[3][2].name == 'compiled')";
+    EXPECT_EQ(LUA_OK, luaL_dostring(L, script)) << lua_tostring(L, -1);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    lua_close(L);
+}
+
+TEST(ExportTest, NativeIterators)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+    RegisterLibrary(L);
+
+    // 原生路径与编译产物（总是调用迭代函数）的输出应当一致
+    const char* script = "local G = { __index = _G } "
+        "local function check(src, env, expected) "
+        "  env = setmetatable(env or {}, G) "
+        "  local ret = assert(et.render_string(src, 'test', env)) "
+        "  assert(ret == et.compile_string(src)(env), ret) "
+        "  if expected then assert(ret == expected, ret) end "
+        "end "
+        "check('{% for i in et.range(1, 5) %}{% i %},{% end %}', nil, '1,2,3,4,5,') "
+        "check('{% for i in et.range(5, 1, -2) %}{% i %},{% end %}', nil, '5,3,1,') "
+        "check('{% for i in et.range(0, 1, 0.25) %}{% i %},{% end %}', nil, '0.0,0.25,0.5,0.75,1.0,') "
+        "check('{% for i, j in et.range(1, 2) %}{% i %}{% tostring(j) %}{% end %}', nil, '1nil2nil') "
+        "check('{% for i, v in ipairs(list) %}{% i %}={% v %};{% end %}', { list = { 'a', 'b', 'c' } }, '1=a;2=b;3=c;') "
+        "check('{% for i in ipairs(list) %}{% i %}{% end %}', { list = { 1, 2, nil, 4 } }, '12') "
+        "check('{% for i, v in ipairs(list) %}{% v %}{% end %}', "
+        "  { list = setmetatable({}, { __index = function(t, k) if k <= 3 then return k * 10 end end }) }, '102030') "
+        "check('{% for i, v in ipairs(list) %}{% v %}{% mt = i == 1 and setmetatable(list, { __index = { [2] = \"x\" } }) %}{% end %}', "
+        "  { list = { 1 } }, '1x') "
+        "local t = { a = 1, b = 2, c = 3, 4, 5 } "
+        "local n, sum = 0, 0 "
+        "for k, v in pairs(t) do n = n + 1 sum = sum + v end "
+        "local env = setmetatable({ t = t, count = 0, total = 0 }, G) "
+        "et.render_string('{% for k, v in pairs(t) %}{% count = count + 1 total = total + v %}{% end %}', 'test', env) "
+        "assert(env.count == n and env.total == sum) "
+        "env = setmetatable({ t = { a = 1, b = 2, c = 3, d = 4 }, count = 0 }, G) "
+        "et.render_string('{% for k in pairs(t) %}{% t[k] = nil count = count + 1 %}{% end %}', 'test', env) "
+        "assert(env.count == 4 and next(env.t) == nil) "
+        "env = setmetatable({ i = 'outer' }, G) "
+        "assert(et.render_string('{% for i in et.range(1, 2) %}{% end %}{% i %}', 'test', env) == 'outer') "
+        "assert(not et.render_string('{% for i in et.range(1, 2) %}{% error(\"x\") %}{% end %}', 'test', env)) "
+        "assert(env.i == 'outer')";
+    EXPECT_EQ(LUA_OK, luaL_dostring(L, script)) << lua_tostring(L, -1);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    lua_close(L);
+}
+
+TEST(ExportTest, ChunkedOutput)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+    RegisterLibrary(L);
+
+    const char* script = "local src = '{% for i in et.range(1, 5000) %}<li>{% i %}</li>{% end %}' "
+        "local expected = et.render_string(src) "
+        "local chunks = et.render_string(src, nil, { output = 'chunks' }) "
+        "assert(type(chunks) == 'table' and #chunks > 1) "
+        "assert(table.concat(chunks) == expected) "
+        "local tpl = et.load_string(src) "
+        "assert(table.concat(tpl:render(nil, { output = 'chunks' })) == expected) "
+        "local ret, err = et.render_string('{% error(\"x\") %}', nil, { output = 'chunks' }) "
+        "assert(ret == nil and err:find('x', 1, true)) "
+        "assert(not pcall(et.render_string, src, nil, { output = 'file' }))";
+    EXPECT_EQ(LUA_OK, luaL_dostring(L, script)) << lua_tostring(L, -1);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    lua_close(L);
+}
+
+TEST(ExportTest, ProtectedRender)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+    RegisterLibrary(L);
+
+    const char* script = "local tpl = et.load_string('{% for _, v in ipairs(list) %}<{% v %}>{% end %}', 'p') "
+        "local env = setmetatable({ list = { 1, 2, 3 } }, { __index = _G }) "
+        "assert(tpl:render(env, { protected = true }) == tpl:render(env)) "
+        "assert(tpl:render(env, { protected = true }) == '<1><2><3>') "
+        "local bad = et.load_string('x\\n{% error(\"boom\") %}', 'bad') "
+        "local ret, err = bad:render(nil, { protected = true }) "
+        "assert(ret == nil and err:find('bad:2:', 1, true) and err:find('boom', 1, true)) "
+        "local loop = et.load_string('{% while true %}x{% end %}') "
+        "ret, err = loop:render(nil, { protected = true, max_output_size = 10 }) "
+        "assert(ret == nil and err:find('Output size limit exceeded', 1, true))";
+    EXPECT_EQ(LUA_OK, luaL_dostring(L, script)) << lua_tostring(L, -1);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    lua_close(L);
+}
+
+TEST(ExportTest, Check)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+    RegisterLibrary(L);
+
+    const char* script = "assert(et.check('{% if false %}{% x = 1 %}{% end %}') == true) "
+        "local ok, err = et.check('a\\n{% if false %}{% x = %}{% end %}', 'lint') "
+        "assert(ok == nil and err:find('lint:2:', 1, true)) "
+        "ok, err = et.check('{% if true %}') "
+        "assert(ok == nil and err:find('Unclosed block', 1, true)) "
+        "assert(et.check(et.load_string('{% y %}')) == true)";
+    EXPECT_EQ(LUA_OK, luaL_dostring(L, script)) << lua_tostring(L, -1);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    lua_close(L);
+}
+
+TEST(ExportTest, RenderIter)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+    RegisterLibrary(L);
+
+    const char* script = "local src = '{% for i in et.range(1, 2000) %}<li>{% i %}</li>{% end %}' "
+        "local expected = et.render_string(src) "
+        "local parts = {} "
+        "for chunk in et.render_iter(src, nil, 1024) do "
+        "  assert(#chunk >= 1024 or #parts * 1024 + #chunk >= #expected - 1024) "
+        "  parts[#parts + 1] = chunk "
+        "end "
+        "assert(#parts > 1 and table.concat(parts) == expected) "
+        "parts = {} "
+        "for chunk in et.render_iter(et.load_string('{% a %}-{% b %}'), { a = 1, b = 2 }) do parts[#parts + 1] = chunk end "
+        "assert(#parts == 1 and parts[1] == '1-2') "
+        "local cached = '{% for i in et.range(1, 100) %}{% cache \"iter:\" .. i %}<p>{% i %}</p>{% end %}{% end %}' "
+        "parts = {} "
+        "for chunk in et.render_iter(cached, nil, 8) do parts[#parts + 1] = chunk end "
+        "assert(table.concat(parts) == et.render_string(cached)) "
+        "for chunk in et.render_iter('') do error('unexpected chunk') end "
+        "local iter = et.render_iter('{% for i in et.range(1, 100) %}{% i %}{% end %}{% error(\"boom\") %}', nil, 8) "
+        "assert(#iter() >= 8) "
+        "local ok, err = pcall(function() for _ in iter do end end) "
+        "assert(not ok and err:find('boom', 1, true)) "
+        "assert(iter() == nil) "
+        "local ret, err2 = et.render_iter('{% for %}') "
+        "assert(ret == nil and type(err2) == 'string') "
+        "parts = {} "
+        "for chunk in et.render_iter(src, nil, { chunk_size = 1024, max_output_size = 1000000 }) do "
+        "  parts[#parts + 1] = chunk "
+        "end "
+        "assert(#parts > 1 and table.concat(parts) == expected) "
+        "iter = et.render_iter(src, nil, { chunk_size = 16, max_output_size = 100 }) "
+        "ok, err = pcall(function() for _ in iter do end end) "
+        "assert(not ok and err:find('Output size limit exceeded', 1, true)) "
+        "iter = et.render_iter(et.load_string('{% while true %}x{% end %}'), nil, { chunk_size = 1, max_instructions = 100000 }) "
+        "ok, err = pcall(function() for _ in iter do end end) "
+        "assert(not ok and err:find('Instruction limit exceeded', 1, true)) "
+        "assert(iter() == nil) "
+        "iter = et.render_iter('{% (function() while true do end end)() %}', nil, { timeout = 10 }) "
+        "ok, err = pcall(iter) "
+        "assert(not ok and err:find('Render timeout', 1, true)) "
+        "parts = {} "
+        "for chunk in et.render_iter('{% (function() for j = 1, 1e7 do end end)() %}{% 1 %}{% 2 %}', "
+        "  nil, 1) do parts[#parts + 1] = chunk end "
+        "assert(table.concat(parts) == '12')";
+    EXPECT_EQ(LUA_OK, luaL_dostring(L, script)) << lua_tostring(L, -1);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    lua_close(L);
+}
+
+TEST(ExportTest, Document)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+    RegisterLibrary(L);
+
+    const char* script = "local doc = et.document('<{% a %}>\\n{% if a %}\\nyes\\n{% end %}\\n', 'doc.tpl') "
+        "local tpl = doc:template() "
+        "assert(tpl:render({ a = 1 }) == '<1>\\nyes\\n') "
+        "assert(doc:edit(5, 1, 'b')) "
+        "assert(doc:text() == '<{% b %}>\\n{% if a %}\\nyes\\n{% end %}\\n') "
+        "assert(doc:template():render({ a = 1, b = 2 }) == '<2>\\nyes\\n') "
+        "assert(tpl:render({ a = 1 }) == '<1>\\nyes\\n') "
+        "assert(doc:edit(#doc:text() - 9, 9)) "
+        "local ret, err = doc:template() "
+        "assert(ret == nil and err:find('doc.tpl:5:1', 1, true)) "
+        "local ok, err2 = doc:edit(1, 0, '{% for %}') "
+        "assert(ok == nil and err2:find('doc.tpl', 1, true)) "
+        "assert(doc:edit(1, 9)) "
+        "assert(doc:edit(#doc:text() + 1, 0, '{% end %}')) "
+        "assert(doc:template():render({ a = 1, b = 3 }) == '<3>\\nyes\\n') "
+        "assert(not pcall(doc.edit, doc, 0, 0, 'x'))";
+    EXPECT_EQ(LUA_OK, luaL_dostring(L, script)) << lua_tostring(L, -1);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    lua_close(L);
+}
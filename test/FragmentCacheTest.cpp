@@ -0,0 +1,102 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/26
+ */
+#include <gtest/gtest.h>
+
+#include <et.hpp>
+#include <et/TemplateNode.hpp>
+#include <et/FragmentCache.hpp>
+
+#include <thread>
+
+using namespace std;
+using namespace et;
+
+TEST(FragmentCacheTest, LruAndTtl)
+{
+    FragmentCache cache(10);
+
+    cache.Put("a", "123");
+    cache.Put("b", "456");
+    EXPECT_EQ(8u, cache.GetSize());
+    ASSERT_NE(nullptr, cache.Get("a"));
+    EXPECT_EQ("123", *cache.Get("a"));
+
+    // b最久未使用，被淘汰
+    cache.Put("c", "789");
+    EXPECT_EQ(nullptr, cache.Get("b"));
+    EXPECT_NE(nullptr, cache.Get("a"));
+    EXPECT_NE(nullptr, cache.Get("c"));
+    EXPECT_EQ(2u, cache.GetCount());
+
+    // 超过容量的记录不会被放入
+    cache.Put("d", "0123456789");
+    EXPECT_EQ(nullptr, cache.Get("d"));
+
+    // 过期
+    cache.Put("e", "1", 1);
+    this_thread::sleep_for(chrono::milliseconds(5));
+    EXPECT_EQ(nullptr, cache.Get("e"));
+
+    cache.SetCapacity(4);
+    EXPECT_EQ(1u, cache.GetCount());
+    cache.Clear();
+    EXPECT_EQ(0u, cache.GetSize());
+}
+
+TEST(FragmentCacheTest, CacheNode)
+{
+    FragmentCache::GetInstance().Clear();
+
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    const char* source = "{% cache 'menu:' .. lang %}{% count = count + 1 %}{% lang %}{% end %}|{% count %}";
+
+    // 逐节点渲染
+    string result;
+    luaL_dostring(L, "count = 0 lang = 'en'");
+    RenderString(result, L, source, "test");
+    EXPECT_EQ("en|1", result);
+    RenderString(result, L, source, "test");
+    EXPECT_EQ("en|1", result);
+    luaL_dostring(L, "lang = 'zh'");
+    RenderString(result, L, source, "test");
+    EXPECT_EQ("zh|2", result);
+
+    // 编译产物与逐节点渲染共享缓存
+    CompileString(L, source, "test");
+    ASSERT_EQ(LUA_OK, lua_pcall(L, 0, 1, 0)) << lua_tostring(L, -1);
+    EXPECT_STREQ("zh|2", lua_tostring(L, -1));
+    lua_pop(L, 1);
+
+    luaL_dostring(L, "lang = 'fr'");
+    CompileString(L, source, "test");
+    ASSERT_EQ(LUA_OK, lua_pcall(L, 0, 1, 0)) << lua_tostring(L, -1);
+    EXPECT_STREQ("fr|3", lua_tostring(L, -1));
+    lua_pop(L, 1);
+
+    EXPECT_THROW(RenderString(result, L, "{% cache {} %}x{% end %}", "test"), RenderException);
+    EXPECT_THROW(RenderString(result, L, "{% cache 'k', 'ttl' %}x{% end %}", "test"), RenderException);
+
+    // 有效时间必须为正数，不过期需省略有效时间
+    for (auto ttl : { "0", "-1", "0/0" })
+    {
+        auto code = Format("{%% cache 'ttl', %s %%}x{%% end %%}", ttl);
+        EXPECT_THROW(RenderString(result, L, code.c_str(), "test"), RenderException);
+
+        CompileString(L, code.c_str(), "test");
+        ASSERT_NE(LUA_OK, lua_pcall(L, 0, 1, 0));
+        EXPECT_NE(nullptr, strstr(lua_tostring(L, -1), "Cache ttl must be positive"));
+        lua_pop(L, 1);
+    }
+    EXPECT_EQ(nullptr, FragmentCache::GetInstance().Get("ttl"));
+
+    EXPECT_EQ(0, lua_gettop(L));
+    lua_close(L);
+
+    FragmentCache::GetInstance().Clear();
+}
@@ -0,0 +1,68 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/27
+ */
+#include <gtest/gtest.h>
+
+#include <et/Base.hpp>
+
+#include <fstream>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace std;
+using namespace et;
+
+TEST(MappedFileTest, RegularFile)
+{
+    string path = ::testing::TempDir() + "/et_mapped.txt";
+    {
+        ofstream f(path, ios::binary);
+        f << "hello\nworld";
+    }
+
+    MappedFile file(path.c_str());
+    EXPECT_TRUE(file.IsMapped());
+    EXPECT_EQ("hello\nworld", string(file.GetData(), file.GetSize()));
+
+    // 空文件不映射
+    {
+        ofstream f(path, ios::binary | ios::trunc);
+    }
+    MappedFile empty(path.c_str());
+    EXPECT_FALSE(empty.IsMapped());
+    EXPECT_EQ(0u, empty.GetSize());
+
+    EXPECT_THROW(MappedFile("/et/non/exists"), IOException);
+}
+
+TEST(MappedFileTest, Pipe)
+{
+    int fds[2];
+    ASSERT_EQ(0, ::pipe(fds));
+
+    // 超过一个块的数据，验证分块读取
+    string content(MappedFile::kReadBlockSize * 2 + 100, 'x');
+    content.back() = 'y';
+
+    thread writer([&]() {
+        size_t written = 0;
+        while (written < content.size())
+        {
+            auto ret = ::write(fds[1], content.data() + written, content.size() - written);
+            if (ret <= 0)
+                break;
+            written += static_cast<size_t>(ret);
+        }
+        ::close(fds[1]);
+    });
+
+    MappedFile file(fds[0], "pipe");
+    writer.join();
+    ::close(fds[0]);
+
+    EXPECT_FALSE(file.IsMapped());
+    EXPECT_EQ(content, string(file.GetData(), file.GetSize()));
+}
@@ -0,0 +1,82 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/24
+ */
+#include <gtest/gtest.h>
+
+#include <et.hpp>
+#include <et/Template.hpp>
+
+using namespace std;
+using namespace et;
+
+namespace
+{
+    class TestObserver :
+        public RenderObserverBase
+    {
+    public:
+        void OnRender(const RenderStatistics& stats)noexcept override
+        {
+            Renders.push_back(stats);
+            Names.push_back(stats.SourceName);
+        }
+
+        void OnCompile(const CompileStatistics& stats)noexcept override
+        {
+            Compiles.push_back(stats);
+        }
+
+    public:
+        vector<RenderStatistics> Renders;
+        vector<string> Names;
+        vector<CompileStatistics> Compiles;
+    };
+}
+
+TEST(RenderObserverTest, Render)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    TestObserver observer;
+    RenderOptions options;
+    options.Observer = &observer;
+
+    string source = "{% for i in ipairs({1,2,3}) %}ab{% end %}";
+    Template tpl(source.c_str(), source.length(), "test");
+
+    string out;
+    tpl.Render(out, L, 0, &options);
+    tpl.Render(out, L, 0, &options);
+    EXPECT_THROW(RenderString(out, L, "{% error('x') %}", "fail", 0, &options), LuaRuntimeException);
+
+    ASSERT_EQ(3u, observer.Renders.size());
+    EXPECT_EQ("test", observer.Names[0]);
+    EXPECT_TRUE(observer.Renders[0].Succeeded);
+    EXPECT_FALSE(observer.Renders[0].CacheHit);
+    EXPECT_EQ(tpl.GetParseTime(), observer.Renders[0].ParseTime);
+    EXPECT_LT(0u, observer.Renders[0].ParseTime);  // 只通过选项传入的观察者同样得到解析耗时
+    EXPECT_EQ(6u, observer.Renders[0].OutputSize);
+    EXPECT_TRUE(observer.Renders[1].CacheHit);
+    EXPECT_EQ(0u, observer.Renders[1].ParseTime);
+    EXPECT_EQ("fail", observer.Names[2]);
+    EXPECT_FALSE(observer.Renders[2].Succeeded);
+
+    // 全局观察者
+    SetRenderObserver(&observer);
+    tpl.Render(out, L);
+    CompileString(L, "{% 1 %}", "compiled");
+    lua_pop(L, 1);
+    SetRenderObserver(nullptr);
+    tpl.Render(out, L);
+
+    EXPECT_EQ(4u, observer.Renders.size());
+    ASSERT_EQ(1u, observer.Compiles.size());
+    EXPECT_TRUE(observer.Compiles[0].Succeeded);
+
+    EXPECT_EQ(0, lua_gettop(L));
+    lua_close(L);
+}
@@ -0,0 +1,67 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/23
+ */
+#include <gtest/gtest.h>
+
+#include <et/Template.hpp>
+#include <et/RenderProfiler.hpp>
+
+using namespace std;
+using namespace et;
+
+TEST(RenderProfilerTest, Render)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    string source = "{% for _, v in ipairs({1,2,3}) %}\n"
+        "{% if v > 1 %}\n"
+        "{% v %}\n"
+        "{% end %}\n"
+        "{% end %}";
+    Template tpl(source.c_str(), source.length(), "test");
+
+    RenderProfiler profiler;
+    RenderOptions options;
+    options.Profiler = &profiler;
+
+    string out;
+    tpl.Render(out, L, 0, &options);
+    EXPECT_EQ("\n2\n3", out);
+
+    auto entries = profiler.GetEntries();
+    ASSERT_EQ(3u, entries.size());
+
+    map<uint32_t, RenderProfiler::Entry> byLine;
+    for (const auto& entry : entries)
+    {
+        EXPECT_EQ("test", entry.Source);
+        EXPECT_LE(entry.ExclusiveTime, entry.InclusiveTime);
+        byLine[entry.Line] = entry;
+    }
+    EXPECT_EQ(1u, byLine[1].Calls);
+    EXPECT_EQ(4u, byLine[1].Bytes);
+    EXPECT_EQ(3u, byLine[2].Calls);
+    EXPECT_EQ(4u, byLine[2].Bytes);
+    EXPECT_EQ(2u, byLine[3].Calls);
+    EXPECT_EQ(2u, byLine[3].Bytes);
+
+    string folded;
+    profiler.DumpFoldedStacks(folded);
+    EXPECT_NE(string::npos, folded.find("test:1;test:2;test:3 "));
+
+    string report;
+    profiler.DumpReport(report);
+    EXPECT_NE(string::npos, report.find("test:1"));
+
+    // 未设置分析器时不统计
+    profiler.Reset();
+    tpl.Render(out, L);
+    EXPECT_TRUE(profiler.GetEntries().empty());
+
+    EXPECT_EQ(0, lua_gettop(L));
+    lua_close(L);
+}
@@ -0,0 +1,94 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/2/1
+ */
+#include <gtest/gtest.h>
+
+#include <et.hpp>
+#include <et/TemplateAnalyzer.hpp>
+#include <et/TemplateCache.hpp>
+
+#include <fstream>
+
+using namespace std;
+using namespace et;
+
+namespace
+{
+    vector<string> Analyze(lua_State* L, const char* source, TemplateAnalyzer* out=nullptr)
+    {
+        Template tpl(source, strlen(source), "test");
+        TemplateAnalyzer analyzer(L);
+        analyzer.Analyze(tpl.GetRoot());
+        if (out)
+            *out = analyzer;
+        return vector<string>(analyzer.GetDependencies().begin(), analyzer.GetDependencies().end());
+    }
+}
+
+TEST(TemplateAnalyzerTest, Dependencies)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+
+    EXPECT_EQ(vector<string>(), Analyze(L, "text only"));
+    EXPECT_EQ(vector<string>({ "a", "b" }), Analyze(L, "{% a %}{% b.c.d %}{% a:e() %}"));
+
+    // 局部变量、函数参数、表构造的键以及只赋值的名称不是依赖
+    EXPECT_EQ(vector<string>({ "list", "x" }),
+        Analyze(L, "{% local n = #list for i = 1, n do y = i end %}{% (function(p) return p + x end)(1) %}"
+            "{% { key = 1 } %}"));
+
+    // 迭代变量只在循环体内排除
+    EXPECT_EQ(vector<string>({ "i", "ipairs", "items", "title" }),
+        Analyze(L, "{% for i, v in ipairs(items) %}{% v.name %}{% i %}{% title %}{% end %}{% i %}"));
+
+    // 宏名称和宏参数
+    EXPECT_EQ(vector<string>({ "list", "suffix" }),
+        Analyze(L, "{% macro item(x) %}{% x %}{% suffix %}{% end %}{% item(list) %}"));
+
+    // 各类语句的表达式
+    EXPECT_EQ(vector<string>({ "a", "b", "c", "d", "e" }),
+        Analyze(L, "{% if a %}{% elseif b %}{% else %}{% c %}{% end %}{% while d %}{% end %}"
+            "{% cache e %}{% end %}"));
+
+    // 各类常量
+    EXPECT_EQ(vector<string>({ "f", "flag" }),
+        Analyze(L, "{% (flag and 1.5 or 2 or true) .. f('0123456789012345678901234567890123456789-long') %}"));
+
+    EXPECT_THROW(Analyze(L, "{% if a b %}{% end %}"), LuaRuntimeException);
+    lua_close(L);
+}
+
+TEST(TemplateAnalyzerTest, Include)
+{
+    string dir = ::testing::TempDir();
+    {
+        ofstream f(dir + "/et_deps_item.tpl", ios::binary);
+        f << "<{% v %}{% sep %}{% include 'et_deps_item.tpl' %}>";
+    }
+
+    auto& cache = TemplateCache::GetInstance();
+    cache.Clear();
+    cache.SetSearchPaths({ dir });
+
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+
+    TemplateAnalyzer analyzer(L);
+    EXPECT_EQ(vector<string>({ "ipairs", "list", "sep" }),
+        Analyze(L, "{% for _, v in ipairs(list) %}{% include 'et_deps_item.tpl' %}{% end %}", &analyzer));
+    EXPECT_EQ(set<string>({ "et_deps_item.tpl" }), analyzer.GetIncludes());
+    EXPECT_FALSE(analyzer.HasDynamicInclude());
+
+    Analyze(L, "{% include name .. '.tpl' %}", &analyzer);
+    EXPECT_TRUE(analyzer.HasDynamicInclude());
+    EXPECT_EQ(set<string>({ "name" }), analyzer.GetDependencies());
+
+    EXPECT_THROW(Analyze(L, "{% include 'et_deps_missing.tpl' %}"), IOException);
+
+    cache.Clear();
+    cache.SetSearchPaths({});
+    lua_close(L);
+}
@@ -0,0 +1,199 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/25
+ */
+#include <gtest/gtest.h>
+
+#include <et.hpp>
+#include <et/TemplateCache.hpp>
+
+#include <fstream>
+
+#include <sys/stat.h>
+
+using namespace std;
+using namespace et;
+
+namespace
+{
+    void WriteTestFile(const string& dir, const char* name, const char* content)
+    {
+        ofstream f(dir + "/" + name, ios::binary);
+        f << content;
+    }
+}
+
+TEST(TemplateCacheTest, Include)
+{
+    string dir = ::testing::TempDir();
+    WriteTestFile(dir, "et_item.tpl", "<{% v %}>");
+    WriteTestFile(dir, "et_loop.tpl", "{% include 'et_loop.tpl' %}");
+
+    auto& cache = TemplateCache::GetInstance();
+    cache.Clear();
+    cache.SetSearchPaths({ dir });
+
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    // 逐节点渲染
+    string result;
+    RenderString(result, L, "{% for _, v in ipairs({1, 2, 3}) %}{% include \"et_item.tpl\" %}{% end %}", "test");
+    EXPECT_EQ("<1><2><3>", result);
+    EXPECT_EQ(1u, cache.GetSize());
+
+    RenderString(result, L, "{% name = 'et_item.tpl' v = 4 %}{% include name %}", "test");
+    EXPECT_EQ("<4>", result);
+    EXPECT_EQ(1u, cache.GetSize());
+
+    EXPECT_THROW(RenderString(result, L, "{% include 'et_loop.tpl' %}", "test"), RenderException);
+    EXPECT_THROW(RenderString(result, L, "{% include 'et_missing.tpl' %}", "test"), IOException);
+
+    // 编译产物
+    CompileString(L, "{% for _, v in ipairs({5, 6}) %}{% include 'et_item.tpl' %}{% end %}", "test");
+    ASSERT_EQ(LUA_OK, lua_pcall(L, 0, 1, 0)) << lua_tostring(L, -1);
+    EXPECT_STREQ("<5><6>", lua_tostring(L, -1));
+    lua_pop(L, 1);
+
+    CompileString(L, "{% include 'et_loop.tpl' %}", "test");
+    ASSERT_NE(LUA_OK, lua_pcall(L, 0, 1, 0));
+    EXPECT_NE(nullptr, strstr(lua_tostring(L, -1), "Include depth limit exceeded"));
+    lua_pop(L, 1);
+
+    CompileString(L, "{% include 'et_missing.tpl' %}", "test");
+    ASSERT_NE(LUA_OK, lua_pcall(L, 0, 1, 0));
+    EXPECT_EQ(0, strncmp("test:1:", lua_tostring(L, -1), 7));
+    lua_pop(L, 1);
+
+    // 流式渲染时被include的模板同样分块输出
+    RegisterLibrary(L);
+    const char* script = "local parts = {} "
+        "for chunk in et.render_iter(\"{% for _, v in ipairs({1, 2, 3}) %}{% include 'et_item.tpl' %}{% end %}\", "
+        "  nil, 1) do parts[#parts + 1] = chunk end "
+        "assert(#parts == 9 and table.concat(parts) == '<1><2><3>', table.concat(parts, ','))";
+    EXPECT_EQ(LUA_OK, luaL_dostring(L, script)) << lua_tostring(L, -1);
+
+    EXPECT_EQ(0, lua_gettop(L));
+    lua_close(L);
+
+    cache.SetSearchPaths({});
+    cache.Clear();
+}
+
+TEST(TemplateCacheTest, Extends)
+{
+    string dir = ::testing::TempDir();
+    WriteTestFile(dir, "et_base.tpl", "<title>{% block title %}Default{% end %}</title>"
+        "<body>{% block body %}[{% block inner %}base{% end %}]{% end %}</body>");
+    WriteTestFile(dir, "et_layout.tpl", "{% extends 'et_base.tpl' %}"
+        "{% block body %}<div>{% block inner %}layout{% end %}</div>{% end %}");
+    WriteTestFile(dir, "et_cycle.tpl", "{% extends 'et_cycle.tpl' %}");
+
+    auto& cache = TemplateCache::GetInstance();
+    cache.Clear();
+    cache.SetSearchPaths({ dir });
+
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    string result;
+    RenderString(result, L, "{% extends 'et_base.tpl' %}ignored{% block title %}{% 'Page' %}{% end %}", "test");
+    EXPECT_EQ("<title>Page</title><body>[base]</body>", result);
+
+    RenderString(result, L, "{% extends \"et_layout.tpl\" %}{% block inner %}page{% end %}", "test");
+    EXPECT_EQ("<title>Default</title><body><div>page</div></body>", result);
+
+    CompileString(L, "{% extends 'et_layout.tpl' %}{% block title %}T{% end %}", "test");
+    ASSERT_EQ(LUA_OK, lua_pcall(L, 0, 1, 0)) << lua_tostring(L, -1);
+    EXPECT_STREQ("<title>T</title><body><div>layout</div></body>", lua_tostring(L, -1));
+    lua_pop(L, 1);
+
+    EXPECT_THROW(RenderString(result, L, "{% extends 'et_cycle.tpl' %}", "test"), ParseErrorException);
+    EXPECT_THROW(RenderString(result, L, "{% if true %}{% extends 'et_base.tpl' %}{% end %}", "test"),
+        ParseErrorException);
+    EXPECT_THROW(RenderString(result, L, "{% extends name %}", "test"), ParseErrorException);
+    EXPECT_THROW(RenderString(result, L, "{% extends 'et_base.tpl' %}{% block a %}{% end %}{% block a %}{% end %}",
+        "test"), ParseErrorException);
+    EXPECT_THROW(RenderString(result, L, "{% block a %}{% end %}{% block a %}{% end %}", "test"), ParseErrorException);
+
+    // 被继承的模板相对于子模板所在的目录查找
+    ::mkdir((dir + "/et_sub").c_str(), 0755);
+    WriteTestFile(dir, "et_sub/et_base.tpl", "sub[{% block body %}{% end %}]");
+    WriteTestFile(dir, "et_sub/et_page.tpl", "{% extends 'et_base.tpl' %}{% block body %}page{% end %}");
+    WriteTestFile(dir, "et_sub/et_dup.tpl", "{% block a %}{% end %}{% block a %}{% end %}");
+    WriteTestFile(dir, "et_dup.tpl", "{% extends 'et_sub/et_dup.tpl' %}");
+
+    cache.Load("et_sub/et_page.tpl")->Render(result, L);
+    EXPECT_EQ("sub[page]", result);
+    LoadTemplateFile((dir + "/et_sub/et_page.tpl").c_str())->Render(result, L);
+    EXPECT_EQ("sub[page]", result);
+    EXPECT_THROW(cache.Load("et_dup.tpl"), ParseErrorException);
+
+    // 源文本被缓存，不再读取文件
+    ::remove((dir + "/et_sub/et_base.tpl").c_str());
+    RenderString(result, L, "{% extends 'et_sub/et_base.tpl' %}{% block body %}cached{% end %}", "test");
+    EXPECT_EQ("sub[cached]", result);
+
+    EXPECT_EQ(0, lua_gettop(L));
+    lua_close(L);
+
+    cache.SetSearchPaths({});
+    cache.Clear();
+}
+
+TEST(TemplateCacheTest, Preload)
+{
+    string dir = ::testing::TempDir() + "/et_preload";
+    ::mkdir(dir.c_str(), 0755);
+    ::mkdir((dir + "/sub").c_str(), 0755);
+    for (int i = 0; i < 20; ++i)
+        WriteTestFile(dir, Format("page%d.html", i).c_str(), "{% extends 'sub/base.html' %}{% block body %}page{% end %}");
+    WriteTestFile(dir, "sub/base.html", "[{% block body %}base{% end %}]");
+    WriteTestFile(dir, "sub/bad.html", "{% if %}");
+    WriteTestFile(dir, "readme.txt", "{% if %}");
+    WriteTestFile(dir, ".hidden.html", "{% if %}");
+
+    auto& cache = TemplateCache::GetInstance();
+    cache.Clear();
+    cache.SetSearchPaths({ dir });
+
+    PreloadStatistics stats;
+    PreloadTemplates(stats, dir.c_str(), "*.html", 4);
+    ASSERT_EQ(21u, stats.Names.size());
+    EXPECT_EQ("page0.html", stats.Names.front());
+    EXPECT_EQ("sub/base.html", stats.Names.back());
+    ASSERT_EQ(1u, stats.Errors.size());
+    EXPECT_NE(string::npos, stats.Errors[0].find("sub/bad.html"));
+    EXPECT_LT(0u, stats.SourceSize);
+    EXPECT_EQ(21u, cache.GetSize());
+
+    // 通配符
+    PreloadTemplates(stats, dir.c_str(), "sub/?ase.*", 0);
+    ASSERT_EQ(1u, stats.Names.size());
+    EXPECT_EQ("sub/base.html", stats.Names[0]);
+    EXPECT_EQ(0u, stats.SourceSize);  // 已经缓存
+    EXPECT_TRUE(stats.Errors.empty());
+
+    EXPECT_THROW(PreloadTemplates(stats, (dir + "/missing").c_str()), IOException);
+
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+    RegisterLibrary(L);
+
+    const char* script = "local report = et.preload(...) "
+        "assert(report.count == 21 and report.failed == 1 and #report.errors == 1) "
+        "assert(report.parse_time >= 0 and report.compile_time >= 0 and report.memory_delta > 0) "
+        "assert(et.compile_string('{% include \\'page3.html\\' %}')() == '[page]')";
+    ASSERT_EQ(LUA_OK, luaL_loadstring(L, script));
+    lua_pushstring(L, dir.c_str());
+    lua_pushstring(L, "*.html");
+    EXPECT_EQ(LUA_OK, lua_pcall(L, 2, 0, 0)) << lua_tostring(L, -1);
+    lua_close(L);
+
+    cache.SetSearchPaths({});
+    cache.Clear();
+}
@@ -0,0 +1,159 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/20
+ */
+#include <gtest/gtest.h>
+
+#include <et.hpp>
+#include <et/TemplateCompiler.hpp>
+
+using namespace std;
+using namespace et;
+
+#define DO_COMPILE_AND_RUN(code) \
+    string result; \
+    { \
+        CompileString(L, code, "test"); \
+        ASSERT_EQ(LUA_OK, lua_pcall(L, 0, 1, 0)); \
+        result = lua_tostring(L, -1); \
+        lua_pop(L, 1); \
+    }
+
+TEST(TemplateCompilerTest, Compile)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    {
+        DO_COMPILE_AND_RUN("");
+        EXPECT_EQ("", result);
+    }
+
+    {
+        DO_COMPILE_AND_RUN("\"hello\"\n\t{% 1 + 1 %}\\");
+        EXPECT_EQ("\"hello\"\n\t2\\", result);
+    }
+
+    {
+        DO_COMPILE_AND_RUN("{% nil %}{% true, false %}{% 1, \"+\", 2 %}");
+        EXPECT_EQ("truefalse1+2", result);
+    }
+
+    {
+        DO_COMPILE_AND_RUN("{% 1 -- comment %}{% a = 2 -- comment %}{% a %}");
+        EXPECT_EQ("12", result);
+    }
+
+    {
+        DO_COMPILE_AND_RUN("{%if nil%}a{%elseif 1%}b{%if true%}c{%else%}d{%end%}e{%elseif true%}f{%else%}g{%end%}");
+        EXPECT_EQ("bce", result);
+    }
+
+    {
+        DO_COMPILE_AND_RUN("{% i = 0 %}{% while i < 3 %}_{% i = i + 1 %}{% end %}");
+        EXPECT_EQ("___", result);
+    }
+
+    {
+        DO_COMPILE_AND_RUN("{% a={1,2}; v=10 %}{%v%}{% for _,v in ipairs(a) %}{%v%}{% end %}{% v %}");
+        EXPECT_EQ("101210", result);
+    }
+
+    {
+        DO_COMPILE_AND_RUN("{% a={2,3}; v=10 %}{%v%}{% for _ in ipairs(a) %}{%_%}{% end %}{% v %}");
+        EXPECT_EQ("101210", result);
+    }
+
+    {
+        DO_COMPILE_AND_RUN("{% macro li(x) %}<{% x %}>{% end %}{% for _,v in ipairs({1,2}) %}{% li(v) %}{% end %}");
+        EXPECT_EQ("<1><2>", result);
+    }
+
+    {
+        DO_COMPILE_AND_RUN("{% macro f(n) %}{% if n > 0 %}{% n %}{% f(n - 1) %}{% end %}{% end %}{% f(3) %}");
+        EXPECT_EQ("321", result);
+    }
+
+    EXPECT_THROW(CompileString(L, "{% if ) %}123{% end %}"), LuaRuntimeException);
+    EXPECT_THROW(CompileString(L, "{% ) %}"), LuaRuntimeException);
+    EXPECT_THROW(CompileString(L, "{% if true %}"), ParseErrorException);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    lua_close(L);
+}
+
+TEST(TemplateCompilerTest, Env)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    CompileString(L, "{% a %} {% b %}", "test");
+    lua_newtable(L);
+    lua_pushstring(L, "hello");
+    lua_setfield(L, -2, "a");
+    lua_pushstring(L, "world");
+    lua_setfield(L, -2, "b");
+    ASSERT_EQ(LUA_OK, lua_pcall(L, 1, 1, 0));
+    EXPECT_STREQ("hello world", lua_tostring(L, -1));
+    lua_pop(L, 1);
+
+    lua_close(L);
+}
+
+TEST(TemplateCompilerTest, Error)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    CompileString(L, "line1\nline2 {% {} %}", "test");
+    ASSERT_NE(LUA_OK, lua_pcall(L, 0, 1, 0));
+    EXPECT_STREQ("test:2: Unexpected expression return type table", lua_tostring(L, -1));
+    lua_pop(L, 1);
+
+    CompileString(L, "\n\n{% for i in ipairs({1}) %}\n{% non_exists() %}{% end %}", "test");
+    ASSERT_NE(LUA_OK, lua_pcall(L, 0, 1, 0));
+    EXPECT_EQ(0, strncmp("test:4:", lua_tostring(L, -1), 7));
+    lua_pop(L, 1);
+
+    lua_close(L);
+}
+
+TEST(TemplateCompilerTest, Yield)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    lua_State* co = lua_newthread(L);
+    CompileString(co, "<{% fetch('a') %}|{% for i in ipairs({1, 2}) %}{% fetch(i) %}{% end %}>", "test");
+
+    ASSERT_EQ(LUA_OK, luaL_dostring(L, "function fetch(k) return coroutine.yield(k) end"));
+
+    int ret = lua_resume(co, L, 0);
+    ASSERT_EQ(LUA_YIELD, ret);
+    EXPECT_STREQ("a", lua_tostring(co, -1));
+    lua_pop(co, 1);
+
+    lua_pushstring(co, "A");
+    ret = lua_resume(co, L, 1);
+    ASSERT_EQ(LUA_YIELD, ret);
+    EXPECT_EQ(1, lua_tointeger(co, -1));
+    lua_pop(co, 1);
+
+    lua_pushstring(co, "B");
+    ret = lua_resume(co, L, 1);
+    ASSERT_EQ(LUA_YIELD, ret);
+    EXPECT_EQ(2, lua_tointeger(co, -1));
+    lua_pop(co, 1);
+
+    lua_pushstring(co, "C");
+    ret = lua_resume(co, L, 1);
+    ASSERT_EQ(LUA_OK, ret);
+    EXPECT_STREQ("<A|BC>", lua_tostring(co, -1));
+
+    lua_close(L);
+}
@@ -190,6 +190,21 @@ TEST(TemplateNodeTest, BuildRootNotde)
         EXPECT_EQ("101210", result);
     }
 
+    {
+        DO_PARSE_AND_BUILD("{% macro li(x) %}<{% x %}>{% end %}{% for _,i in ipairs({1,2}) %}{% li(i) %}{% end %}{% li('a') %}");
+        EXPECT_EQ("<1><2><a>", result);
+    }
+
+    {
+        DO_PARSE_AND_BUILD("{% macro f(n) %}{% if n > 0 %}{% n %}{% f(n - 1) %}{% end %}{% end %}{% f(3) %}");
+        EXPECT_EQ("321", result);
+    }
+
+    {
+        EXPECT_THROW(DO_PARSE_AND_BUILD("{% macro f() %}{% non_exists() %}{% end %}{% f() %}"),
+            LuaRuntimeException);
+    }
+
     {
         EXPECT_THROW(DO_PARSE_AND_BUILD("{% while true %}{% non_exists() %}{% end %}"), LuaRuntimeException);
     }
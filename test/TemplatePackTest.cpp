@@ -0,0 +1,148 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/30
+ */
+#include <gtest/gtest.h>
+
+#include <et.hpp>
+#include <et/TemplateCache.hpp>
+#include <et/TemplateCompiler.hpp>
+
+#include <fstream>
+#include <limits>
+
+using namespace std;
+using namespace et;
+
+namespace
+{
+    void WriteTestFile(const string& path, const string& content)
+    {
+        ofstream f(path, ios::binary);
+        f << content;
+    }
+
+    void AddTemplate(TemplatePackBuilder& builder, const char* name, const char* source)
+    {
+        builder.Add(name, source, strlen(source));
+    }
+}
+
+TEST(TemplatePackTest, BuildAndLoad)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    auto& cache = TemplateCache::GetInstance();
+    cache.Clear();
+    cache.ClearPacks();
+    cache.SetSearchPaths({});
+
+    TemplatePackBuilder builder(L);
+    AddTemplate(builder, "pack_list.tpl", "{% for _, v in ipairs(list) %}{% include 'pack_item.tpl' %}{% end %}");
+    AddTemplate(builder, "pack_item.tpl", "<{% v %}>");
+    AddTemplate(builder, "pack_error.tpl", "\n{% error('x') %}");
+    EXPECT_THROW(AddTemplate(builder, "pack_item.tpl", ""), InvalidArgumentException);
+    EXPECT_THROW(AddTemplate(builder, "pack_bad.tpl", "{% if %}"), Exception);
+    EXPECT_EQ(3u, builder.GetCount());
+
+    string data;
+    builder.Save(data);
+    string path = ::testing::TempDir() + "/et_test.etpack";
+    WriteTestFile(path, data);
+
+    auto pack = make_shared<TemplatePack>(path.c_str());
+    ASSERT_EQ(3u, pack->GetCount());
+    EXPECT_STREQ("pack_error.tpl", pack->GetEntry(0).Name);
+    EXPECT_STREQ("pack_item.tpl", pack->GetEntry(1).Name);
+    EXPECT_STREQ("pack_list.tpl", pack->GetEntry(2).Name);
+
+    TemplatePack::Entry entry;
+    EXPECT_FALSE(pack->Find("pack_missing.tpl", entry));
+    EXPECT_FALSE(pack->Find("pack_item.tp", entry));
+    ASSERT_TRUE(pack->Find("pack_item.tpl", entry));
+    EXPECT_EQ("<{% v %}>", string(entry.Source, entry.SourceLength));
+
+    // 挂载后include从包中加载，已经缓存的同名模板被移除
+    cache.Put("pack_item.tpl", make_shared<Template>("old", 3, "pack_item.tpl"));
+    cache.AddPack(pack);
+    EXPECT_EQ(nullptr, cache.Find("pack_item.tpl"));
+    auto tpl = cache.Load("pack_list.tpl");
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushinteger(L, 1);
+    lua_rawseti(L, -2, 1);
+    lua_pushinteger(L, 2);
+    lua_rawseti(L, -2, 2);
+    lua_setfield(L, -2, "list");
+    lua_newtable(L);
+    lua_getglobal(L, "_G");
+    lua_setfield(L, -2, "__index");
+    lua_setmetatable(L, -2);
+    int env = lua_gettop(L);
+
+    string result;
+    tpl->Render(result, L, env);
+    EXPECT_EQ("<1><2>", result);
+
+    // 编译产物直接加载字节码
+    TemplateCompiler::LoadTemplate(L, "pack_list.tpl");
+    lua_pushvalue(L, env);
+    ASSERT_EQ(LUA_OK, lua_pcall(L, 1, 1, 0)) << lua_tostring(L, -1);
+    EXPECT_STREQ("<1><2>", lua_tostring(L, -1));
+    lua_pop(L, 1);
+
+    // 错误信息带有源名称和行号
+    TemplateCompiler::LoadTemplate(L, "pack_error.tpl");
+    ASSERT_NE(LUA_OK, lua_pcall(L, 0, 1, 0));
+    EXPECT_EQ(0, strncmp("pack_error.tpl:2:", lua_tostring(L, -1), 17)) << lua_tostring(L, -1);
+    lua_pop(L, 2);
+
+    cache.Clear();
+    cache.ClearPacks();
+    EXPECT_THROW(cache.Load("pack_list.tpl"), IOException);
+    lua_close(L);
+}
+
+TEST(TemplatePackTest, BadFormat)
+{
+    string path = ::testing::TempDir() + "/et_test_bad.etpack";
+
+    WriteTestFile(path, "");
+    EXPECT_THROW(TemplatePack pack(path.c_str()), IOException);
+
+    WriteTestFile(path, "not a template pack");
+    EXPECT_THROW(TemplatePack pack(path.c_str()), IOException);
+
+    // 索引超出文件范围
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    TemplatePackBuilder builder(L);
+    AddTemplate(builder, "a.tpl", "a");
+    string data;
+    builder.Save(data);
+    data.resize(data.size() - 1);
+    WriteTestFile(path, data);
+    EXPECT_THROW(TemplatePack pack(path.c_str()), IOException);
+
+    // 名称长度溢出
+    AddTemplate(builder, "b.tpl", "b");
+    builder.Save(data);
+    string bad = data;
+    uint64_t length = numeric_limits<uint64_t>::max();
+    memcpy(&bad[16 + 8], &length, sizeof(length));
+    WriteTestFile(path, bad);
+    EXPECT_THROW(TemplatePack pack(path.c_str()), IOException);
+
+    // 索引未排序
+    bad = data;
+    std::swap_ranges(bad.begin() + 16, bad.begin() + 16 + 48, bad.begin() + 16 + 48);
+    WriteTestFile(path, bad);
+    EXPECT_THROW(TemplatePack pack(path.c_str()), IOException);
+
+    WriteTestFile(path, data);
+    EXPECT_EQ(2u, TemplatePack(path.c_str()).GetCount());
+    lua_close(L);
+}
@@ -6,6 +6,9 @@
 #include <gtest/gtest.h>
 
 #include <et/TemplateParser.hpp>
+#include <et/TemplateNode.hpp>
+
+#include <random>
 
 using namespace std;
 using namespace et;
@@ -215,6 +218,49 @@ TEST(TemplateParserTest, ParseInner)
         EXPECT_EQ("c", parser.GetTokenByIndex(0).Content);
     }
 
+    {
+        DO_PARSE("{% macro card(a, b) %}");
+        EXPECT_EQ(1ull, parser.GetTokenCount());
+        EXPECT_EQ(TemplateParser::TokenTypes::Macro, parser.GetTokenByIndex(0).Type);
+        EXPECT_EQ(3ull, parser.GetTokenByIndex(0).Args.size());
+        EXPECT_EQ("card", parser.GetTokenByIndex(0).Args[0]);
+        EXPECT_EQ("a", parser.GetTokenByIndex(0).Args[1]);
+        EXPECT_EQ("b", parser.GetTokenByIndex(0).Args[2]);
+        EXPECT_EQ("", parser.GetTokenByIndex(0).Content);
+    }
+
+    {
+        DO_PARSE("{% macro hr() %}");
+        EXPECT_EQ(1ull, parser.GetTokenCount());
+        EXPECT_EQ(TemplateParser::TokenTypes::Macro, parser.GetTokenByIndex(0).Type);
+        EXPECT_EQ(1ull, parser.GetTokenByIndex(0).Args.size());
+        EXPECT_EQ("hr", parser.GetTokenByIndex(0).Args[0]);
+    }
+
+    {
+        // 语句名称之后是运算符时作为表达式
+        DO_PARSE("{% raw .. x %}{% cache = {} %}{% include or x %}{% raw [[<b>]] %}");
+        EXPECT_EQ(4ull, parser.GetTokenCount());
+        EXPECT_EQ(TemplateParser::TokenTypes::Expression, parser.GetTokenByIndex(0).Type);
+        EXPECT_EQ("raw .. x", parser.GetTokenByIndex(0).Content);
+        EXPECT_EQ(TemplateParser::TokenTypes::Expression, parser.GetTokenByIndex(1).Type);
+        EXPECT_EQ(TemplateParser::TokenTypes::Expression, parser.GetTokenByIndex(2).Type);
+        EXPECT_EQ(TemplateParser::TokenTypes::RawExpression, parser.GetTokenByIndex(3).Type);
+        EXPECT_EQ("[[<b>]]", parser.GetTokenByIndex(3).Content);
+    }
+
+    {
+        EXPECT_THROW(DO_PARSE("{% macro card %}"), ParseErrorException);
+    }
+
+    {
+        EXPECT_THROW(DO_PARSE("{% macro card(a,) %}"), ParseErrorException);
+    }
+
+    {
+        EXPECT_THROW(DO_PARSE("{% macro card(a) b %}"), ParseErrorException);
+    }
+
     {
         EXPECT_THROW(DO_PARSE("{% end %"), ParseErrorException);
     }
@@ -316,3 +362,139 @@ TEST(TemplateParserTest, Mixed)
         EXPECT_THROW(DO_PARSE("1{% {% % }"), ParseErrorException);
     }
 }
+
+namespace
+{
+    void ExpectSameTokens(const TemplateParser& expected, const TemplateParser& actual)
+    {
+        ASSERT_EQ(expected.GetTokenCount(), actual.GetTokenCount());
+        for (size_t i = 0; i < expected.GetTokenCount(); ++i)
+        {
+            const auto& lhs = expected.GetTokenByIndex(i);
+            const auto& rhs = actual.GetTokenByIndex(i);
+            EXPECT_EQ(lhs.Type, rhs.Type) << i;
+            EXPECT_EQ(lhs.Content, rhs.Content) << i;
+            EXPECT_EQ(lhs.Args, rhs.Args) << i;
+            EXPECT_EQ(lhs.Anchor.Position, rhs.Anchor.Position) << i;
+            EXPECT_EQ(lhs.Anchor.Line, rhs.Anchor.Line) << i;
+            EXPECT_EQ(lhs.Anchor.Column, rhs.Anchor.Column) << i;
+        }
+    }
+}
+
+TEST(TemplateParserTest, Incremental)
+{
+    {
+        string source = "line1\n{% for i in list %}\n  <{% i %}>\n{% end %}\nline5";
+        TextReader reader(source.c_str(), source.length());
+        TemplateParser parser;
+        EXPECT_THROW(parser.Update(reader, 0, 0, 0), InvalidCallException);
+
+        parser.SetIncrementalEnable(true);
+        parser.Run(reader);
+        EXPECT_EQ(7u, parser.GetLastParsedTokenCount());
+
+        // 只修改表达式，只有附近的Token被重新解析
+        source.replace(source.find("i %}>"), 1, "item");
+        TextReader updated(source.c_str(), source.length());
+        parser.Update(updated, source.find("item"), 1, 4);
+        EXPECT_GE(3u, parser.GetLastParsedTokenCount());
+
+        TextReader full(source.c_str(), source.length());
+        TemplateParser expected;
+        expected.Run(full);
+        ExpectSameTokens(expected, parser);
+
+        // 构造语法树只复制增量解析的输出，之后的编辑仍然只替换受影响的Token
+        EXPECT_NE(nullptr, BuildRootNode(parser));
+        ExpectSameTokens(expected, parser);
+
+        // 解析失败后需要重新Run
+        source.insert(source.find("{% end"), "{% for %}");
+        TextReader broken(source.c_str(), source.length());
+        EXPECT_THROW(parser.Update(broken, source.find("{% for %}"), 0, 9), ParseErrorException);
+        EXPECT_THROW(parser.Update(broken, 0, 0, 0), InvalidCallException);
+    }
+
+    {
+        // 随机编辑，结果应当与完整解析一致
+        static const char* kFragments[] = {
+            "a", "\n", "\r\n", "\r", "{", "%", "}", "{%", "%}", "{% x %}", "{% if x %}", "{% end %}", "  ",
+            "{% for k, v in pairs(t) %}", "\n{% y = 1 %}\n", "'", "{% raw x %}", "\n  {% else %}  \n", " \n ",
+        };
+
+        mt19937 random(12345);
+        string source = "head\n{% if a %}\n  {% b %}\n{% else %}\nc\n{% end %}\n{% x = 1 %}\ntail";
+        TemplateParser parser;
+        parser.SetIncrementalEnable(true);
+        bool valid = true;
+        {
+            TextReader reader(source.c_str(), source.length());
+            parser.Run(reader);
+        }
+
+        for (int i = 0; i < 2000; ++i)
+        {
+            size_t start = random() % (source.length() + 1);
+            size_t removed = std::min<size_t>(random() % 4, source.length() - start);
+            string inserted = kFragments[random() % (sizeof(kFragments) / sizeof(kFragments[0]))];
+            if (random() % 4 == 0)
+                inserted.clear();
+            if (removed == 0 && inserted.empty())
+                continue;
+            source.replace(start, removed, inserted);
+
+            TextReader full(source.c_str(), source.length());
+            TemplateParser expected;
+            bool expectedValid = true;
+            try
+            {
+                expected.Run(full);
+            }
+            catch (const ParseErrorException&)
+            {
+                expectedValid = false;
+            }
+
+            TextReader reader(source.c_str(), source.length());
+            bool actualValid = true;
+            try
+            {
+                if (valid)
+                    parser.Update(reader, start, removed, inserted.length());
+                else
+                    parser.Run(reader);
+            }
+            catch (const ParseErrorException&)
+            {
+                actualValid = false;
+            }
+
+            ASSERT_EQ(expectedValid, actualValid) << source;
+            valid = actualValid;
+            if (valid)
+            {
+                ExpectSameTokens(expected, parser);
+                EXPECT_EQ(full.GetPosition(), reader.GetPosition());
+                EXPECT_EQ(full.GetLine(), reader.GetLine());
+                EXPECT_EQ(full.GetColumn(), reader.GetColumn());
+            }
+
+            // 避免文本无限增长
+            if (source.length() > 400)
+            {
+                source.resize(200);
+                TextReader truncated(source.c_str(), source.length());
+                try
+                {
+                    parser.Run(truncated);
+                    valid = true;
+                }
+                catch (const ParseErrorException&)
+                {
+                    valid = false;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,364 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/22
+ */
+#include <gtest/gtest.h>
+
+#include <et/Template.hpp>
+
+#include <cstdio>
+#include <fstream>
+
+using namespace std;
+using namespace et;
+
+TEST(TemplateTest, SmoothOutputSize)
+{
+    EXPECT_EQ(0u, Template::SmoothOutputSize(0, 0));
+    EXPECT_EQ(100u, Template::SmoothOutputSize(0, 100));
+    EXPECT_EQ(125u, Template::SmoothOutputSize(100, 200));
+    EXPECT_EQ(75u, Template::SmoothOutputSize(100, 0));
+    EXPECT_EQ(100u, Template::SmoothOutputSize(100, 100));
+}
+
+TEST(TemplateTest, Render)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    string source = "{% for i in ipairs({1,2,3,4,5,6,7,8,9,10}) %}0123456789{% end %}";
+    Template tpl(source.c_str(), source.length(), "test");
+    EXPECT_EQ(tpl.GetSourceSize(), tpl.GetPredictedOutputSize());
+
+    string buffer;
+    tpl.Render(buffer, L);
+    EXPECT_EQ(100u, buffer.length());
+    EXPECT_LE(100u, tpl.GetPredictedOutputSize());
+
+    // 复用缓冲区时不发生重新分配
+    const char* data = buffer.data();
+    tpl.Render(buffer, L);
+    EXPECT_EQ(100u, buffer.length());
+    EXPECT_EQ(data, buffer.data());
+
+    EXPECT_EQ(0, lua_gettop(L));
+    lua_close(L);
+}
+
+TEST(TemplateTest, ChunkCache)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    // 循环中的节点共享同一个ENV，迭代变量和赋值在各节点之间可见
+    string source = "{% n = 0 %}{% for _, v in ipairs(list) %}{% n = n + v %}[{% n %}]{% end %}"
+        "{% while n > 0 %}{% n = n - 2 %}.{% end %}";
+    Template tpl(source.c_str(), source.length(), "test");
+
+    lua_newtable(L);
+    luaL_dostring(L, "return {1, 2, 3}");
+    lua_setfield(L, -2, "list");
+    lua_newtable(L);
+    lua_getglobal(L, "_G");
+    lua_setfield(L, -2, "__index");
+    lua_setmetatable(L, -2);
+    int env = lua_gettop(L);
+
+    string buffer;
+    tpl.Render(buffer, L, env);
+    EXPECT_EQ("[1][3][6]...", buffer);
+    EXPECT_EQ(1, lua_gettop(L));
+
+    // 每次渲染重新绑定ENV
+    lua_newtable(L);
+    luaL_dostring(L, "return {10}");
+    lua_setfield(L, -2, "list");
+    lua_newtable(L);
+    lua_pushvalue(L, env);
+    lua_setfield(L, -2, "__index");
+    lua_setmetatable(L, -2);
+    tpl.Render(buffer, L, lua_gettop(L));
+    EXPECT_EQ("[10].....", buffer);
+    EXPECT_EQ(2, lua_gettop(L));
+
+    // 对_ENV的赋值作用于其后的节点，与编译产物一致，传入的env不受影响
+    source = "{% y = 1 %}{% _ENV = setmetatable({ y = 2 }, { __index = _ENV }) %}{% y %}"
+        "{% for _, v in ipairs(list) %}{% y + v %}{% end %}";
+    Template rebind(source.c_str(), source.length(), "test");
+    rebind.Render(buffer, L, env);
+    EXPECT_EQ("2345", buffer);
+    string compiled;
+    RenderError error;
+    ASSERT_EQ(RenderErrorCodes::Ok, rebind.TryRender(compiled, L, env, error)) << error.Message;
+    EXPECT_EQ(buffer, compiled);
+    rebind.ReleaseCompiled(L);
+    lua_getfield(L, env, "y");
+    EXPECT_EQ(1, lua_tointeger(L, -1));
+    lua_pop(L, 1);
+
+    // 出错时缓存同样被移除
+    source = "{% x = 1 %}{% for _, v in ipairs(list) %}{% error('x') %}{% end %}";
+    Template bad(source.c_str(), source.length(), "test");
+    EXPECT_THROW(bad.Render(buffer, L, env), LuaRuntimeException);
+    EXPECT_EQ(2, lua_gettop(L));
+
+    lua_close(L);
+}
+
+TEST(TemplateTest, TryRender)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    // 输出与逐节点渲染一致
+    string source = "{% for _, v in ipairs({1, 2, 3}) %}[{% v %}]{% end %}{% if x %}x{% else %}y{% end %}";
+    Template tpl(source.c_str(), source.length(), "test");
+
+    string expected;
+    tpl.Render(expected, L);
+
+    string buffer;
+    RenderError error;
+    EXPECT_EQ(RenderErrorCodes::Ok, tpl.TryRender(buffer, L, 0, error));
+    EXPECT_EQ(expected, buffer);
+    EXPECT_EQ(RenderErrorCodes::Ok, tpl.TryRender(buffer, L, 0, error));
+    EXPECT_EQ(expected, buffer);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    // 错误以错误码返回，并给出节点的位置
+    source = "a\n{% for _, i in ipairs({1, 2, 3}) %}\n{% assert(i ~= 2, 'boom') %}{% end %}";
+    Template bad(source.c_str(), source.length(), "bad");
+    EXPECT_EQ(RenderErrorCodes::RuntimeError, bad.TryRender(buffer, L, 0, error));
+    EXPECT_EQ(RenderErrorCodes::RuntimeError, error.Code);
+    EXPECT_EQ("bad", error.Source);
+    EXPECT_EQ(3u, error.Line);
+    EXPECT_NE(string::npos, error.Message.find("boom"));
+    EXPECT_TRUE(buffer.empty());
+    EXPECT_EQ(0, lua_gettop(L));
+
+    source = "{% a + %}";
+    Template invalid(source.c_str(), source.length(), "invalid");
+    EXPECT_EQ(RenderErrorCodes::CompileError, invalid.TryRender(buffer, L, 0, error));
+    EXPECT_EQ("invalid", error.Source);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    // 渲染选项中的限制
+    source = "{% while true %}x{% end %}";
+    Template loop(source.c_str(), source.length(), "loop");
+    RenderOptions options;
+    options.MaxInstructions = 10000;
+    EXPECT_EQ(RenderErrorCodes::LimitExceeded, loop.TryRender(buffer, L, 0, error, &options));
+    EXPECT_EQ(1u, error.Line);
+
+    options.MaxInstructions = 0;
+    options.MaxOutputSize = 100;
+    EXPECT_EQ(RenderErrorCodes::LimitExceeded, loop.TryRender(buffer, L, 0, error, &options));
+    EXPECT_NE(string::npos, error.Message.find("Output size limit exceeded"));
+    EXPECT_EQ(0, lua_gettop(L));
+
+    tpl.ReleaseCompiled(L);
+    bad.ReleaseCompiled(L);
+    loop.ReleaseCompiled(L);
+
+    // 未释放就销毁的模板，其编译产物之后会被清理
+    auto renderTemporaries = [&](int count) {
+        for (int i = 0; i < count; ++i)
+        {
+            string temp = Format("{%% %d %%}", i);
+            Template tmp(temp.c_str(), temp.length(), "temp");
+            EXPECT_EQ(RenderErrorCodes::Ok, tmp.TryRender(buffer, L, 0, error));
+        }
+        lua_gc(L, LUA_GCCOLLECT, 0);
+        return lua_gc(L, LUA_GCCOUNT, 0);
+    };
+    int memory = renderTemporaries(200);
+    EXPECT_GT(memory * 2, renderTemporaries(2000));
+    lua_close(L);
+
+    // 任意一次分配失败都只返回错误码，并且卸载守卫
+    struct FailingAllocator
+    {
+        int Countdown = -1;
+
+        static void* Alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+        {
+            auto self = static_cast<FailingAllocator*>(ud);
+            if (nsize == 0)
+            {
+                free(ptr);
+                return nullptr;
+            }
+            if (nsize > osize && self->Countdown >= 0)
+            {
+                // 失败后一直失败，否则Lua在完整回收之后的重试会成功
+                if (self->Countdown == 0)
+                    return nullptr;
+                --self->Countdown;
+            }
+            return realloc(ptr, nsize);
+        }
+    };
+    FailingAllocator allocator;
+    L = lua_newstate(FailingAllocator::Alloc, &allocator);
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    source = "{% for _, i in ipairs({1, 2, 3}) %}{% i %}{% end %}";
+    Template limited(source.c_str(), source.length(), "limited");
+    options.MaxInstructions = 10000;
+    options.MaxOutputSize = 0;
+    RenderErrorCodes code = RenderErrorCodes::OutOfMemory;
+    for (int i = 0; code == RenderErrorCodes::OutOfMemory && i < 1000; ++i)
+    {
+        allocator.Countdown = i;
+        code = limited.TryRender(buffer, L, 0, error, &options);
+        allocator.Countdown = -1;
+
+        EXPECT_TRUE(code == RenderErrorCodes::Ok || code == RenderErrorCodes::OutOfMemory) << error.Message;
+        EXPECT_EQ(nullptr, lua_gethook(L));
+        EXPECT_EQ(0, lua_gettop(L));
+    }
+    EXPECT_EQ(RenderErrorCodes::Ok, code);
+    EXPECT_EQ("123", buffer);
+    limited.ReleaseCompiled(L);
+    lua_close(L);
+}
+
+TEST(TemplateTest, ErrorLocation)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    // 渲染错误带有节点的源位置，描述在what()中拼接
+    string source = "a\n{% error('boom', 0) %}";
+    Template tpl(source.c_str(), source.length(), "test");
+
+    string buffer;
+    try
+    {
+        tpl.Render(buffer, L);
+        FAIL();
+    }
+    catch (const LuaRuntimeException& ex)
+    {
+        EXPECT_STREQ("LuaRuntimeException", ex.GetKind());
+        EXPECT_STREQ("test", ex.GetSource());
+        EXPECT_EQ(2u, ex.GetSourceLine());
+        EXPECT_EQ(0u, ex.GetSourceColumn());
+        EXPECT_STREQ("boom", ex.GetErrorMessage());
+        EXPECT_STREQ("test:2: boom", ex.what());
+
+        // 拷贝共享同一份描述
+        LuaRuntimeException copy(ex);
+        EXPECT_EQ(ex.what(), copy.what());
+    }
+
+    // 解析错误带有列号
+    source = "{% if true %}";
+    try
+    {
+        Template bad(source.c_str(), source.length(), "bad");
+        FAIL();
+    }
+    catch (const ParseErrorException& ex)
+    {
+        EXPECT_STREQ("ParseErrorException", ex.GetKind());
+        EXPECT_STREQ("bad", ex.GetSource());
+        EXPECT_EQ(1u, ex.GetSourceLine());
+        EXPECT_NE(0u, ex.GetSourceColumn());
+        EXPECT_EQ(Format("bad:1:%u: Unclosed block", ex.GetSourceColumn()), ex.what());
+    }
+
+    // 宏定义执行失败时同样带有宏节点的位置
+    source = "\n{% macro m() %}x{% end %}{% m() %}";
+    Template macro(source.c_str(), source.length(), "macro");
+    ASSERT_EQ(LUA_OK, luaL_dostring(L, "return setmetatable({}, { __newindex = function() error('ro', 0) end })"));
+    try
+    {
+        macro.Render(buffer, L, -1);
+        FAIL();
+    }
+    catch (const LuaRuntimeException& ex)
+    {
+        EXPECT_STREQ("macro", ex.GetSource());
+        EXPECT_EQ(2u, ex.GetSourceLine());
+    }
+    lua_pop(L, 1);
+    macro.Render(buffer, L);
+    EXPECT_EQ("\nx", buffer);
+
+    // 不带源位置的异常与之前一致
+    try
+    {
+        ET_THROW(RenderException, "Output size limit exceeded (%d bytes)", 10);
+    }
+    catch (const RenderException& ex)
+    {
+        EXPECT_STREQ("", ex.GetSource());
+        EXPECT_STREQ("Output size limit exceeded (10 bytes)", ex.what());
+    }
+
+    lua_close(L);
+}
+
+TEST(TemplateTest, Check)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+
+    // 不会被执行的分支同样被检查，表达式可以是语句
+    string source = "{% x = 1 %}{% if false %}{% while false %}{% a.b( %}{% end %}{% end %}";
+    Template bad(source.c_str(), source.length(), "bad");
+    try
+    {
+        bad.Check(L);
+        FAIL();
+    }
+    catch (const LuaRuntimeException& ex)
+    {
+        EXPECT_STREQ("bad", ex.GetSource());
+        EXPECT_EQ(1u, ex.GetSourceLine());
+    }
+    EXPECT_EQ(0, lua_gettop(L));
+
+    source = "{% if x %}\n{% for _, v in ipairs(list) %}{% v %}{% end %}\n{% elseif error('x') %}{% end %}\n"
+        "{% cache 'k' %}{% include name %}{% end %}{% macro m(a) %}{% a %}{% end %}";
+    Template good(source.c_str(), source.length(), "good");
+    EXPECT_NO_THROW(good.Check(L));
+    EXPECT_EQ(0, lua_gettop(L));
+
+    source = "{% macro m(a) %}\n{% a + %}{% end %}";
+    Template macro(source.c_str(), source.length(), "macro");
+    EXPECT_THROW(macro.Check(L), LuaRuntimeException);
+    EXPECT_EQ(0, lua_gettop(L));
+
+    lua_close(L);
+
+    // 并行检查文件，错误与路径的顺序一致
+    string dir = ::testing::TempDir();
+    vector<string> paths;
+    for (int i = 0; i < 8; ++i)
+    {
+        paths.push_back(dir + "/et_check_" + to_string(i) + ".tpl");
+        ofstream f(paths.back(), ios::binary);
+        f << ((i % 3 == 0) ? "{% for %}" : "{% for _, v in ipairs(list) %}{% v %}{% end %}");
+    }
+    paths.push_back(dir + "/et_check_missing.tpl");
+
+    CheckStatistics stats;
+    CheckTemplateFiles(stats, paths, 4);
+    EXPECT_EQ(9u, stats.Count);
+    ASSERT_EQ(4u, stats.Errors.size());
+    EXPECT_EQ(0u, stats.Errors[0].find(paths[0]));
+    EXPECT_EQ(0u, stats.Errors[1].find(paths[3]));
+    EXPECT_EQ(0u, stats.Errors[2].find(paths[6]));
+    EXPECT_NE(string::npos, stats.Errors[3].find("et_check_missing.tpl"));
+
+    for (size_t i = 0; i + 1 < paths.size(); ++i)
+        remove(paths[i].c_str());
+}
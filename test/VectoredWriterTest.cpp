@@ -0,0 +1,83 @@
+/**
+ * @file
+ * @author chu
+ * @date 2018/1/28
+ */
+#include <gtest/gtest.h>
+
+#include <et/Template.hpp>
+#include <et/VectoredWriter.hpp>
+
+#include <cstdio>
+
+using namespace std;
+using namespace et;
+
+namespace
+{
+    string ReadAll(FILE* fp)
+    {
+        string ret;
+        char buf[4096];
+        fflush(fp);
+        rewind(fp);
+        size_t count;
+        while ((count = fread(buf, 1, sizeof(buf), fp)) > 0)
+            ret.append(buf, count);
+        return ret;
+    }
+}
+
+TEST(VectoredWriterTest, Write)
+{
+    FILE* fp = tmpfile();
+    ASSERT_NE(nullptr, fp);
+
+    string expected;
+    {
+        VectoredWriter writer(fileno(fp));
+
+        // 超过单批片段数和暂存区大小
+        static const char kStatic[] = "<static>";
+        for (int i = 0; i < 1000; ++i)
+        {
+            string dynamic = to_string(i);
+            writer.WriteReference(kStatic, sizeof(kStatic) - 1);
+            writer.Write(dynamic.c_str(), dynamic.length());
+            expected.append(kStatic);
+            expected.append(dynamic);
+        }
+
+        string large(VectoredWriter::kArenaSize, 'x');
+        writer.Write(large.c_str(), large.length());
+        expected.append(large);
+
+        writer.Flush();
+        EXPECT_EQ(expected.length(), writer.GetSize());
+    }
+    EXPECT_EQ(expected, ReadAll(fp));
+    fclose(fp);
+}
+
+TEST(VectoredWriterTest, Render)
+{
+    lua_State* L = luaL_newstate();
+    ASSERT_NE(nullptr, L);
+    luaL_openlibs(L);
+
+    string source = "{% for _, v in ipairs({1,2,3}) %}<{% v %}>{% cache 'vw' %}[{% v %}]{% end %}{% end %}";
+    Template tpl(source.c_str(), source.length(), "test");
+
+    string expected;
+    tpl.Render(expected, L);
+
+    FILE* fp = tmpfile();
+    ASSERT_NE(nullptr, fp);
+    VectoredWriter writer(fileno(fp));
+    tpl.Render(writer, L);
+    EXPECT_EQ(expected, ReadAll(fp));
+    fclose(fp);
+
+    EXPECT_EQ(0, lua_gettop(L));
+    lua_close(L);
+}